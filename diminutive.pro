@@ -212,6 +212,7 @@ HEADERS += src/qt/diminutivevaultcoingui.h \
     src/chainparams.h \
     src/chainparamsseeds.h \
     src/checkpoints.h \
+    src/checkqueue.h \
     src/compat.h \
     src/coincontrol.h \
     src/sync.h \
@@ -227,11 +228,18 @@ HEADERS += src/qt/diminutivevaultcoingui.h \
     src/miner.h \
     src/net.h \
     src/key.h \
+    src/secp256k1.h \
+    src/sha256d.h \
+    src/coins.h \
+    src/blockindexmap.h \
+    src/mappedfile.h \
+    src/blockencodings.h \
     src/db.h \
     src/txdb.h \
     src/txmempool.h \
     src/walletdb.h \
     src/script.h \
+    src/sigcache.h \
     src/init.h \
     src/mruset.h \
     src/json/json_spirit_writer_template.h \
@@ -321,9 +329,18 @@ SOURCES += src/qt/diminutivevaultcoin.cpp src/qt/diminutivevaultcoingui.cpp \
     src/txmempool.cpp \
     src/util.cpp \
     src/hash.cpp \
+    src/hashblock.cpp \
+    src/hashblock_aes.cpp \
     src/netbase.cpp \
     src/key.cpp \
+    src/secp256k1.cpp \
+    src/sha256d.cpp \
+    src/coins.cpp \
+    src/blockindexmap.cpp \
+    src/mappedfile.cpp \
+    src/blockencodings.cpp \
     src/script.cpp \
+    src/sigcache.cpp \
     src/core.cpp \
     src/main.cpp \
     src/miner.cpp \
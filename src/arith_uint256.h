@@ -1,4 +1,3 @@
-
 // Copyright (c) 2009-2010 Satoshi Nakamoto
 // Copyright (c) 2009-2012 The Bitcoin developers
 // Distributed under the MIT/X11 software license, see the accompanying
@@ -6,19 +5,220 @@
 #ifndef DIMINUTIVEVAULT_ARITH_UINT256_H
 #define DIMINUTIVEVAULT_ARITH_UINT256_H
 
-// Temporary for migration to opaque uint160/256
 #include "uint256.h"
 
-class arith_uint256 : public uint256 {
+#include <stdexcept>
+
+class uint_error : public std::runtime_error {
+public:
+    explicit uint_error(const std::string& str) : std::runtime_error(str) {}
+};
+
+/** Fixed width unsigned arithmetic on the stack: multiplication, division and
+ * the compact "nBits" encoding on top of base_uint. Results are reduced
+ * modulo 2^BITS, so callers size the type for the largest intermediate.
+ * Used instead of CBigNum in consensus code.
+ */
+template<unsigned int BITS>
+class base_arith_uint : public base_uint<BITS>
+{
+protected:
+    using base_uint<BITS>::pn;
+    enum { WIDTH = BITS / 32 };
+
+public:
+    base_arith_uint()
+    {
+        for (int i = 0; i < WIDTH; i++)
+            pn[i] = 0;
+    }
+
+    base_arith_uint(uint64 b)
+    {
+        pn[0] = (uint32_t)b;
+        pn[1] = (uint32_t)(b >> 32);
+        for (int i = 2; i < WIDTH; i++)
+            pn[i] = 0;
+    }
+
+    base_arith_uint(const base_uint<BITS>& b)
+    {
+        memcpy(pn, b.begin(), sizeof(pn));
+    }
+
+    base_arith_uint& operator*=(uint32_t b32)
+    {
+        uint64 carry = 0;
+        for (int i = 0; i < WIDTH; i++)
+        {
+            uint64 n = carry + (uint64)b32 * pn[i];
+            pn[i] = n & 0xffffffff;
+            carry = n >> 32;
+        }
+        return *this;
+    }
+
+    base_arith_uint& operator*=(const base_arith_uint& b)
+    {
+        base_arith_uint a;
+        for (int j = 0; j < WIDTH; j++)
+        {
+            uint64 carry = 0;
+            for (int i = 0; i + j < WIDTH; i++)
+            {
+                uint64 n = carry + a.pn[i + j] + (uint64)pn[j] * b.pn[i];
+                a.pn[i + j] = n & 0xffffffff;
+                carry = n >> 32;
+            }
+        }
+        *this = a;
+        return *this;
+    }
+
+    base_arith_uint& operator/=(const base_arith_uint& b)
+    {
+        base_arith_uint div = b;     // make a copy, so we can shift.
+        base_arith_uint num = *this; // make a copy, so we can subtract.
+        *this = 0;                   // the quotient.
+        int num_bits = num.bits();
+        int div_bits = div.bits();
+        if (div_bits == 0)
+            throw uint_error("Division by zero");
+        if (div_bits > num_bits) // the result is certainly 0.
+            return *this;
+        int shift = num_bits - div_bits;
+        div <<= shift; // shift so that div and num align.
+        while (shift >= 0)
+        {
+            if (num >= div)
+            {
+                num -= div;
+                pn[shift / 32] |= (1U << (shift & 31)); // set a bit of the result.
+            }
+            div >>= 1; // shift back.
+            shift--;
+        }
+        // num now contains the remainder of the division.
+        return *this;
+    }
+
+    /** Position of the highest set bit plus one, or zero for zero */
+    unsigned int bits() const
+    {
+        for (int pos = WIDTH - 1; pos >= 0; pos--)
+        {
+            if (pn[pos])
+            {
+                for (int nbits = 31; nbits > 0; nbits--)
+                    if (pn[pos] & (1U << nbits))
+                        return 32 * pos + nbits + 1;
+                return 32 * pos + 1;
+            }
+        }
+        return 0;
+    }
+
+    /**
+     * The "compact" format is a representation of a whole number N using an
+     * unsigned 32bit number similar to a floating point format. The most
+     * significant 8 bits are the unsigned exponent of base 256. This exponent
+     * can be thought of as "number of bytes of N". The lower 23 bits are the
+     * mantissa. Bit number 24 (0x800000) represents the sign of N.
+     * N = (-1^sign) * mantissa * 256^(exponent-3)
+     *
+     * This matches the MPI based encoding CBigNum used: pfNegative is set for
+     * a nonzero negative number (only its magnitude is stored), pfOverflow
+     * when N does not fit in BITS bits.
+     */
+    base_arith_uint& SetCompact(uint32_t nCompact, bool* pfNegative = NULL, bool* pfOverflow = NULL)
+    {
+        int nSize = nCompact >> 24;
+        uint32_t nWord = nCompact & 0x007fffff;
+        if (nSize <= 3)
+        {
+            nWord >>= 8 * (3 - nSize);
+            *this = nWord;
+        }
+        else
+        {
+            *this = nWord;
+            *this <<= 8 * (nSize - 3);
+        }
+        if (pfNegative)
+            *pfNegative = nWord != 0 && (nCompact & 0x00800000) != 0;
+        if (pfOverflow)
+        {
+            unsigned int nWordBits = base_arith_uint(nWord).bits();
+            *pfOverflow = nWord != 0 && nSize > 3 && nWordBits + 8 * (nSize - 3) > BITS;
+        }
+        return *this;
+    }
+
+    uint32_t GetCompact(bool fNegative = false) const
+    {
+        int nSize = (bits() + 7) / 8;
+        uint32_t nCompact = 0;
+        if (nSize <= 3)
+            nCompact = this->GetLow64() << 8 * (3 - nSize);
+        else
+        {
+            base_arith_uint bn = *this;
+            bn >>= 8 * (nSize - 3);
+            nCompact = bn.GetLow64();
+        }
+        // The 0x00800000 bit denotes the sign.
+        // Thus, if it is already set, divide the mantissa by 256 and increase the exponent.
+        if (nCompact & 0x00800000)
+        {
+            nCompact >>= 8;
+            nSize++;
+        }
+        assert((nCompact & ~0x007fffff) == 0);
+        assert(nSize < 256);
+        nCompact |= nSize << 24;
+        nCompact |= (fNegative && (nCompact & 0x007fffff) ? 0x00800000 : 0);
+        return nCompact;
+    }
+};
+
+/** 256-bit unsigned big integer with arithmetic. */
+class arith_uint256 : public base_arith_uint<256> {
 public:
     arith_uint256() {}
-    arith_uint256(const base_uint<256>& b) : uint256(b) {}
-    arith_uint256(uint64_t b) : uint256(b) {}
-    explicit arith_uint256(const std::string& str) : uint256(str) {}
-    explicit arith_uint256(const std::vector<unsigned char>& vch) : uint256(vch) {}
+    arith_uint256(const base_uint<256>& b) : base_arith_uint<256>(b) {}
+    arith_uint256(uint64 b) : base_arith_uint<256>(b) {}
+    explicit arith_uint256(const std::string& str) : base_arith_uint<256>(uint256(str)) {}
+    explicit arith_uint256(const std::vector<unsigned char>& vch) : base_arith_uint<256>(uint256(vch)) {}
 };
 
-#define ArithToUint256(x) (x)
-#define UintToArith256(x) (x)
+/** 512-bit unsigned big integer with arithmetic, for products of 256-bit values. */
+class arith_uint512 : public base_arith_uint<512> {
+public:
+    arith_uint512() {}
+    arith_uint512(const base_uint<512>& b) : base_arith_uint<512>(b) {}
+    arith_uint512(uint64 b) : base_arith_uint<512>(b) {}
+
+    /** Zero-extend a 256-bit value */
+    explicit arith_uint512(const base_uint<256>& b)
+    {
+        memcpy(pn, b.begin(), b.size());
+    }
+
+    /** The low 256 bits */
+    uint256 trim256() const
+    {
+        uint256 ret;
+        memcpy(ret.begin(), pn, ret.size());
+        return ret;
+    }
+};
+
+inline const arith_uint256 operator*(const arith_uint256& a, const arith_uint256& b) { return arith_uint256(a) *= b; }
+inline const arith_uint256 operator/(const arith_uint256& a, const arith_uint256& b) { return arith_uint256(a) /= b; }
+inline const arith_uint512 operator*(const arith_uint512& a, const arith_uint512& b) { return arith_uint512(a) *= b; }
+inline const arith_uint512 operator/(const arith_uint512& a, const arith_uint512& b) { return arith_uint512(a) /= b; }
+
+inline uint256 ArithToUint256(const arith_uint256& a) { uint256 b; memcpy(b.begin(), a.begin(), b.size()); return b; }
+inline arith_uint256 UintToArith256(const uint256& a) { return arith_uint256(a); }
 
-#endif // DIMINUTIVEVAULT_UINT256_H
+#endif // DIMINUTIVEVAULT_ARITH_UINT256_H
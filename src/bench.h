@@ -0,0 +1,89 @@
+// Copyright (c) 2009-2012 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef DIMINUTIVEVAULT_BENCH_H
+#define DIMINUTIVEVAULT_BENCH_H
+
+// Helpers shared by the standalone benchmarks, bench_hmq1725 and bench_stake
+
+#include "uint256.h"
+
+#include <chrono>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+enum BenchOutputFormat
+{
+    FORMAT_CSV,
+    FORMAT_JSON,
+};
+
+/** Deterministic xorshift so runs are comparable across builds */
+class BenchRand
+{
+public:
+    BenchRand() : n(0x2545f4914f6cdd1dULL) {}
+    uint64_t Next()
+    {
+        n ^= n << 13;
+        n ^= n >> 7;
+        n ^= n << 17;
+        return n;
+    }
+    // Uniform in [0, 1)
+    double NextDouble()
+    {
+        return (Next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+    void Fill(unsigned char* p, size_t nLen)
+    {
+        for (size_t i = 0; i < nLen; i++)
+            p[i] = Next() >> 56;
+    }
+    uint256 NextHash()
+    {
+        uint256 hash;
+        Fill(hash.begin(), hash.size());
+        return hash;
+    }
+private:
+    uint64_t n;
+};
+
+inline int64_t GetBenchNanos()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/** Handle -csv and -json; false for any other argument */
+inline bool ParseBenchOutputFormat(const std::string& strArg, BenchOutputFormat& format)
+{
+    if (strArg == "-csv")
+        format = FORMAT_CSV;
+    else if (strArg == "-json")
+        format = FORMAT_JSON;
+    else
+        return false;
+    return true;
+}
+
+/** Handle a positive integer argument of the form <pszName><n> */
+inline bool ParseBenchUInt(const std::string& strArg, const char* pszName, unsigned int& n)
+{
+    size_t nLen = strlen(pszName);
+    if (strArg.compare(0, nLen, pszName) != 0 || atoi(strArg.c_str() + nLen) <= 0)
+        return false;
+    n = atoi(strArg.c_str() + nLen);
+    return true;
+}
+
+/** A JSON array separator: a comma after every element but the last */
+inline const char* JSONSeparator(size_t i, size_t nSize)
+{
+    return i + 1 < nSize ? "," : "";
+}
+
+#endif // DIMINUTIVEVAULT_BENCH_H
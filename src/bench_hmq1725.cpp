@@ -0,0 +1,357 @@
+// Copyright (c) 2009-2012 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Per-stage HMQ1725 profiler: times every primitive of the chain on 64-byte
+// inputs, one at a time and through the multi-lane kernels of the batch
+// path, the full chain on 80-byte headers, and records how often each
+// branching stage takes its first primitive. Build with
+// "make -f makefile.unix bench_hmq1725" and run with -csv (default) or -json.
+
+#include "bench.h"
+#include "hashblock.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+struct PrimitiveResult
+{
+    string strName;
+    int nIterations;
+    double dNanos;
+    double dCallsPerHash;
+};
+
+struct LaneResult
+{
+    string strName;
+    int nLanes;
+    int nIterations;
+    double dNanos;
+    double dSpeedup;
+};
+
+struct ChainResult
+{
+    string strName;
+    int nIterations;
+    double dNanos;
+    int nInputSize;
+};
+
+struct StageResult
+{
+    int nStage;
+    string strTrue;
+    string strFalse;
+    int nSamples;
+    int nTaken;
+};
+
+/** Walk the chain one primitive at a time, counting the branches taken and
+ *  the number of calls to each primitive. Returns false if the result does
+ *  not match HMQ1725(), which would make the rest of the report meaningless. */
+bool TraceChain(const unsigned char* pheader, int nBMW, vector<int>& vTaken, vector<int>& vCalls)
+{
+    unsigned char vch[2][64];
+    sph_bmw512_context ctx;
+    sph_bmw512_init(&ctx);
+    sph_bmw512(&ctx, pheader, 80);
+    sph_bmw512_close(&ctx, vch[0]);
+    vCalls[nBMW]++;
+
+    int nCur = 0;
+    for (int s = 0; s < HMQ1725StageCount(); s++)
+    {
+        int nTrue, nFalse;
+        HMQ1725StagePrimitives(s, nTrue, nFalse);
+        uint32_t nLow;
+        memcpy(&nLow, vch[nCur], sizeof(nLow));
+        bool fTaken = (nLow & 24) != 0;
+        if (fTaken)
+            vTaken[s]++;
+        int nPrimitive = fTaken ? nTrue : nFalse;
+        vCalls[nPrimitive]++;
+        HMQ1725Primitive(nPrimitive, vch[nCur], vch[nCur ^ 1]);
+        nCur ^= 1;
+    }
+
+    uint256 hash;
+    memcpy(hash.begin(), vch[nCur], 32);
+    return hash == HMQ1725(pheader, pheader + 80);
+}
+
+double TimePrimitive(int nPrimitive, int nIterations, BenchRand& rand)
+{
+    unsigned char vch[2][64];
+    rand.Fill(vch[0], 64);
+    for (int i = 0; i < 16; i++)
+        HMQ1725Primitive(nPrimitive, vch[0], vch[1]);
+
+    // Feed each output back in, as the chain does, so no call can be elided
+    int64_t nStart = GetBenchNanos();
+    for (int i = 0; i < nIterations; i++)
+        HMQ1725Primitive(nPrimitive, vch[i & 1], vch[(i & 1) ^ 1]);
+    return (double)(GetBenchNanos() - nStart) / nIterations;
+}
+
+/** Time per input of a primitive run over groups of inputs, as HMQ1725Batch()
+ *  runs it at each stage */
+double TimePrimitiveLanes(int nPrimitive, int nIterations, BenchRand& rand)
+{
+    const unsigned int nGroup = 64;
+    vector<unsigned char> vch(2 * 64 * nGroup);
+    unsigned char* pin = &vch[0];
+    unsigned char* pout = &vch[64 * nGroup];
+    rand.Fill(pin, 64 * nGroup);
+    HMQ1725PrimitiveBatch(nPrimitive, pin, pout, nGroup);
+
+    int nRounds = max(1, nIterations / (int)nGroup);
+    int64_t nStart = GetBenchNanos();
+    for (int i = 0; i < nRounds; i++)
+    {
+        HMQ1725PrimitiveBatch(nPrimitive, pin, pout, nGroup);
+        swap(pin, pout);
+    }
+    return (double)(GetBenchNanos() - nStart) / (nRounds * nGroup);
+}
+
+double TimeChain(int nIterations, BenchRand& rand)
+{
+    unsigned char header[80];
+    rand.Fill(header, sizeof(header));
+    uint256 hash = 0;
+    int64_t nStart = GetBenchNanos();
+    for (int i = 0; i < nIterations; i++)
+    {
+        memcpy(&header[76], &i, 4);
+        hash ^= HMQ1725(header, header + sizeof(header));
+    }
+    int64_t nElapsed = GetBenchNanos() - nStart;
+    if (hash == 0)
+        fprintf(stderr, "warning: unexpected zero hash accumulator\n");
+    return (double)nElapsed / nIterations;
+}
+
+double TimeBatch(int nIterations, BenchRand& rand)
+{
+    vector<unsigned char> vHeaders(80 * nIterations);
+    rand.Fill(&vHeaders[0], vHeaders.size());
+    vector<HMQ1725Input> vInputs;
+    for (int i = 0; i < nIterations; i++)
+        vInputs.push_back(HMQ1725Input(&vHeaders[80 * i], 80));
+
+    vector<uint256> vHash;
+    int64_t nStart = GetBenchNanos();
+    HMQ1725Batch(vInputs, vHash);
+    return (double)(GetBenchNanos() - nStart) / nIterations;
+}
+
+double MegabytesPerSecond(int nBytes, double dNanos)
+{
+    return dNanos > 0 ? nBytes * 1000.0 / dNanos : 0;
+}
+
+void PrintCSV(const vector<PrimitiveResult>& vPrimitives, const vector<LaneResult>& vLanes,
+              const vector<ChainResult>& vChains, const vector<StageResult>& vStages)
+{
+    double dTotal = 0;
+    for (unsigned int i = 0; i < vPrimitives.size(); i++)
+        dTotal += vPrimitives[i].dNanos * vPrimitives[i].dCallsPerHash;
+
+    printf("section,name,iterations,ns_per_op,mb_per_s,calls_per_hash,share,taken_fraction\n");
+    for (unsigned int i = 0; i < vPrimitives.size(); i++)
+    {
+        const PrimitiveResult& r = vPrimitives[i];
+        printf("primitive,%s,%d,%.1f,%.2f,%.4f,%.4f,\n", r.strName.c_str(), r.nIterations, r.dNanos,
+               MegabytesPerSecond(64, r.dNanos), r.dCallsPerHash,
+               dTotal > 0 ? r.dNanos * r.dCallsPerHash / dTotal : 0);
+    }
+    for (unsigned int i = 0; i < vLanes.size(); i++)
+    {
+        const LaneResult& r = vLanes[i];
+        printf("lanes,%s_x%d,%d,%.1f,%.2f,,,\n", r.strName.c_str(), r.nLanes, r.nIterations, r.dNanos,
+               MegabytesPerSecond(64, r.dNanos));
+    }
+    for (unsigned int i = 0; i < vChains.size(); i++)
+    {
+        const ChainResult& r = vChains[i];
+        printf("chain,%s,%d,%.1f,%.2f,,,\n", r.strName.c_str(), r.nIterations, r.dNanos,
+               MegabytesPerSecond(r.nInputSize, r.dNanos));
+    }
+    for (unsigned int i = 0; i < vStages.size(); i++)
+    {
+        const StageResult& r = vStages[i];
+        printf("branch,stage%02d:%s|%s,%d,,,,,%.4f\n", r.nStage + 1, r.strTrue.c_str(), r.strFalse.c_str(),
+               r.nSamples, r.nSamples ? (double)r.nTaken / r.nSamples : 0);
+    }
+}
+
+void PrintJSON(const vector<PrimitiveResult>& vPrimitives, const vector<LaneResult>& vLanes,
+               const vector<ChainResult>& vChains, const vector<StageResult>& vStages)
+{
+    double dTotal = 0;
+    for (unsigned int i = 0; i < vPrimitives.size(); i++)
+        dTotal += vPrimitives[i].dNanos * vPrimitives[i].dCallsPerHash;
+
+    printf("{\n");
+    printf("  \"implementation\": {\"batch\": \"%s\", \"aes\": \"%s\"},\n",
+           HMQ1725BatchImplementation(), HMQ1725AESImplementation());
+    printf("  \"primitives\": [\n");
+    for (unsigned int i = 0; i < vPrimitives.size(); i++)
+    {
+        const PrimitiveResult& r = vPrimitives[i];
+        printf("    {\"name\": \"%s\", \"iterations\": %d, \"ns_per_op\": %.1f, \"mb_per_s\": %.2f, "
+               "\"calls_per_hash\": %.4f, \"share\": %.4f}%s\n",
+               r.strName.c_str(), r.nIterations, r.dNanos, MegabytesPerSecond(64, r.dNanos), r.dCallsPerHash,
+               dTotal > 0 ? r.dNanos * r.dCallsPerHash / dTotal : 0, JSONSeparator(i, vPrimitives.size()));
+    }
+    printf("  ],\n");
+    printf("  \"lanes\": [\n");
+    for (unsigned int i = 0; i < vLanes.size(); i++)
+    {
+        const LaneResult& r = vLanes[i];
+        printf("    {\"name\": \"%s\", \"lanes\": %d, \"iterations\": %d, \"ns_per_op\": %.1f, "
+               "\"mb_per_s\": %.2f, \"speedup\": %.2f}%s\n",
+               r.strName.c_str(), r.nLanes, r.nIterations, r.dNanos, MegabytesPerSecond(64, r.dNanos),
+               r.dSpeedup, JSONSeparator(i, vLanes.size()));
+    }
+    printf("  ],\n");
+    printf("  \"chain\": [\n");
+    for (unsigned int i = 0; i < vChains.size(); i++)
+    {
+        const ChainResult& r = vChains[i];
+        printf("    {\"name\": \"%s\", \"iterations\": %d, \"ns_per_op\": %.1f, \"mb_per_s\": %.2f}%s\n",
+               r.strName.c_str(), r.nIterations, r.dNanos, MegabytesPerSecond(r.nInputSize, r.dNanos),
+               JSONSeparator(i, vChains.size()));
+    }
+    printf("  ],\n");
+    printf("  \"branches\": [\n");
+    for (unsigned int i = 0; i < vStages.size(); i++)
+    {
+        const StageResult& r = vStages[i];
+        printf("    {\"stage\": %d, \"true\": \"%s\", \"false\": \"%s\", \"samples\": %d, \"taken_fraction\": %.4f}%s\n",
+               r.nStage + 1, r.strTrue.c_str(), r.strFalse.c_str(), r.nSamples,
+               r.nSamples ? (double)r.nTaken / r.nSamples : 0, JSONSeparator(i, vStages.size()));
+    }
+    printf("  ]\n");
+    printf("}\n");
+}
+
+void Usage()
+{
+    fprintf(stderr,
+            "Usage: bench_hmq1725 [-csv|-json] [-iterations=<n>]\n"
+            "  -csv             CSV output (default)\n"
+            "  -json            JSON output\n"
+            "  -iterations=<n>  Calls per primitive; the chain and branch\n"
+            "                   sample use a quarter of this (default: 20000)\n");
+}
+
+} // anon namespace
+
+int main(int argc, char* argv[])
+{
+    BenchOutputFormat format = FORMAT_CSV;
+    int nIterations = 20000;
+    for (int i = 1; i < argc; i++)
+    {
+        string strArg = argv[i];
+        unsigned int n;
+        if (ParseBenchOutputFormat(strArg, format))
+            ;
+        else if (ParseBenchUInt(strArg, "-iterations=", n))
+            nIterations = n;
+        else
+        {
+            Usage();
+            return 1;
+        }
+    }
+    int nChainIterations = max(1, nIterations / 4);
+    BenchRand rand;
+
+    // Branch distribution and how often each primitive runs per hash
+    const int nPrimitives = HMQ1725PrimitiveCount();
+    const int nStages = HMQ1725StageCount();
+    vector<int> vTaken(nStages, 0), vCalls(nPrimitives, 0);
+    int nBMW = 0;
+    while (strcmp(HMQ1725PrimitiveName(nBMW), "bmw") != 0)
+        nBMW++;
+    unsigned char header[80];
+    for (int i = 0; i < nChainIterations; i++)
+    {
+        rand.Fill(header, sizeof(header));
+        if (!TraceChain(header, nBMW, vTaken, vCalls))
+        {
+            fprintf(stderr, "error: traced chain does not match HMQ1725()\n");
+            return 1;
+        }
+    }
+
+    vector<StageResult> vStageResults;
+    for (int s = 0; s < nStages; s++)
+    {
+        int nTrue, nFalse;
+        HMQ1725StagePrimitives(s, nTrue, nFalse);
+        if (nTrue == nFalse)
+            continue;
+        StageResult r;
+        r.nStage = s;
+        r.strTrue = HMQ1725PrimitiveName(nTrue);
+        r.strFalse = HMQ1725PrimitiveName(nFalse);
+        r.nSamples = nChainIterations;
+        r.nTaken = vTaken[s];
+        vStageResults.push_back(r);
+    }
+
+    vector<PrimitiveResult> vPrimitiveResults;
+    for (int n = 0; n < nPrimitives; n++)
+    {
+        PrimitiveResult r;
+        r.strName = HMQ1725PrimitiveName(n);
+        r.nIterations = nIterations;
+        r.dNanos = TimePrimitive(n, nIterations, rand);
+        r.dCallsPerHash = (double)vCalls[n] / nChainIterations;
+        vPrimitiveResults.push_back(r);
+    }
+
+    // Primitives the batch path hashes several inputs at a time
+    vector<LaneResult> vLaneResults;
+    for (int n = 0; n < nPrimitives; n++)
+    {
+        if (HMQ1725PrimitiveLanes(n) <= 1)
+            continue;
+        LaneResult r;
+        r.strName = HMQ1725PrimitiveName(n);
+        r.nLanes = HMQ1725PrimitiveLanes(n);
+        r.nIterations = nIterations;
+        r.dNanos = TimePrimitiveLanes(n, nIterations, rand);
+        r.dSpeedup = r.dNanos > 0 ? vPrimitiveResults[n].dNanos / r.dNanos : 0;
+        vLaneResults.push_back(r);
+    }
+
+    vector<ChainResult> vChainResults;
+    ChainResult r;
+    r.strName = "hmq1725";
+    r.nIterations = nChainIterations;
+    r.dNanos = TimeChain(nChainIterations, rand);
+    r.nInputSize = 80;
+    vChainResults.push_back(r);
+    r.strName = string("hmq1725_batch_") + HMQ1725BatchImplementation();
+    r.dNanos = TimeBatch(nChainIterations, rand);
+    vChainResults.push_back(r);
+
+    if (format == FORMAT_JSON)
+        PrintJSON(vPrimitiveResults, vLaneResults, vChainResults, vStageResults);
+    else
+        PrintCSV(vPrimitiveResults, vLaneResults, vChainResults, vStageResults);
+    return 0;
+}
@@ -0,0 +1,373 @@
+// Copyright (c) 2009-2012 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Staking throughput benchmark: builds an in-memory chain and a synthetic
+// set of stake inputs, then runs the same kernel search CreateCoinStake()
+// uses over a series of search intervals, with no network, wallet or disk.
+// Reports kernels evaluated per second, time per search interval and heap
+// allocations. Build with "make -f makefile.unix bench_stake".
+
+#include "bench.h"
+#include "kernel.h"
+
+#include <atomic>
+#include <deque>
+#include <math.h>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Heap allocations made while fCountAllocs is set
+static atomic<bool> fCountAllocs(false);
+static atomic<uint64_t> nAllocs(0);
+static atomic<uint64_t> nAllocBytes(0);
+
+static void* CountedAlloc(size_t nSize)
+{
+    if (fCountAllocs.load(memory_order_relaxed))
+    {
+        nAllocs.fetch_add(1, memory_order_relaxed);
+        nAllocBytes.fetch_add(nSize, memory_order_relaxed);
+    }
+    void* p = malloc(nSize ? nSize : 1);
+    if (!p)
+        throw bad_alloc();
+    return p;
+}
+
+void* operator new(size_t nSize) { return CountedAlloc(nSize); }
+void* operator new[](size_t nSize) { return CountedAlloc(nSize); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+
+namespace {
+
+enum Distribution
+{
+    DIST_FIXED,
+    DIST_UNIFORM,
+    DIST_EXP,
+};
+
+// An input age in [nMin, nMax]; DIST_EXP favours young inputs, with
+// mean nMin + (nMax - nMin) / 4 before clamping
+int64_t SampleAge(BenchRand& rand, Distribution dist, int64_t nMin, int64_t nMax)
+{
+    switch (dist)
+    {
+        case DIST_FIXED:
+            return nMax;
+        case DIST_UNIFORM:
+            return nMin + (int64_t)(rand.NextDouble() * (nMax - nMin + 1));
+        case DIST_EXP:
+        default:
+            return min(nMax, nMin + (int64_t)(-log(1.0 - rand.NextDouble()) * (nMax - nMin) / 4));
+    }
+}
+
+// An input value with mean nMean
+int64_t SampleValue(BenchRand& rand, Distribution dist, int64_t nMean)
+{
+    switch (dist)
+    {
+        case DIST_FIXED:
+            return nMean;
+        case DIST_UNIFORM:
+            return 1 + (int64_t)(rand.NextDouble() * (2 * nMean - 1));
+        case DIST_EXP:
+        default:
+            return max((int64_t)1, (int64_t)(-log(1.0 - rand.NextDouble()) * nMean));
+    }
+}
+
+bool ParseDistribution(const string& str, Distribution& dist)
+{
+    if (str == "fixed")
+        dist = DIST_FIXED;
+    else if (str == "uniform")
+        dist = DIST_UNIFORM;
+    else if (str == "exp")
+        dist = DIST_EXP;
+    else
+        return false;
+    return true;
+}
+
+struct BenchOptions
+{
+    BenchOutputFormat format;
+    unsigned int nUtxos;
+    int nMinAge;
+    int nMaxAge;
+    Distribution ageDist;
+    int64_t nValue;
+    Distribution valueDist;
+    unsigned int nIntervals;
+    unsigned int nSearchSpan;
+    unsigned int nThreads;
+    unsigned int nBits;
+};
+
+/** An in-memory best chain whose blocks carry only what the kernel check
+ *  reads: height, time and stake modifier */
+class BenchChain
+{
+public:
+    BenchChain(BenchRand& randIn) : rand(randIn) {}
+
+    ~BenchChain()
+    {
+        mapBlockIndex.clear();
+        pindexBest = pindexGenesisBlock = NULL;
+    }
+
+    CBlockIndex* Append(unsigned int nTime)
+    {
+        deqIndex.push_back(CBlockIndex());
+        CBlockIndex* pindex = &deqIndex.back();
+        pindex->pprev = pindexBest;
+        if (pindexBest)
+        {
+            pindexBest->pnext = pindex;
+            pindex->nHeight = pindexBest->nHeight + 1;
+        }
+        pindex->nTime = nTime;
+        pindex->SetProofOfStake();
+        pindex->bnStakeModifierV2 = ComputeStakeModifierV2(pindexBest, rand.NextHash());
+        pindex->phashBlock = &mapBlockIndex.insert(make_pair(rand.NextHash(), pindex)).first->first;
+
+        if (!pindexGenesisBlock)
+            pindexGenesisBlock = pindex;
+        pindexBest = pindex;
+        nBestHeight = pindex->nHeight;
+        hashBestChain = pindex->GetBlockHash();
+        return pindex;
+    }
+
+    CBlockIndex* operator[](int nHeight) { return &deqIndex[nHeight]; }
+
+private:
+    BenchRand& rand;
+    deque<CBlockIndex> deqIndex;
+};
+
+struct IntervalStats
+{
+    uint64_t nKernels;
+    int64_t nNanos;
+    uint64_t nAllocs;
+    uint64_t nAllocBytes;
+    bool fFound;
+};
+
+struct BenchResult
+{
+    unsigned int nEligible;
+    uint64_t nKernels;
+    int64_t nNanos;
+    int64_t nMaxIntervalNanos;
+    uint64_t nAllocs;
+    uint64_t nAllocBytes;
+    unsigned int nFound;
+};
+
+BenchResult RunBench(const BenchOptions& opt)
+{
+    BenchRand rand;
+    BenchChain chain(rand);
+
+    // Enough history for the oldest input, then the inputs themselves
+    const int nSpacing = GetTargetSpacing(0);
+    const unsigned int nStartTime = 1517516135;
+    for (int nHeight = 0; nHeight <= opt.nMaxAge; nHeight++)
+        chain.Append(nStartTime + nHeight * nSpacing);
+
+    vector<COutPoint> vPrevouts;
+    vector<CStakeCandidate> vCandidates;
+    for (unsigned int i = 0; i < opt.nUtxos; i++)
+    {
+        int nAge = SampleAge(rand, opt.ageDist, opt.nMinAge, opt.nMaxAge);
+        CBlockIndex* pindexFrom = chain[pindexBest->nHeight - nAge];
+        CStakeCandidate candidate;
+        candidate.hashBlock = pindexFrom->GetBlockHash();
+        candidate.nHeight = pindexFrom->nHeight;
+        candidate.nBlockTime = pindexFrom->GetBlockTime();
+        candidate.nTxPrevTime = pindexFrom->nTime;
+        candidate.nValue = SampleValue(rand, opt.valueDist, opt.nValue * COIN);
+        vPrevouts.push_back(COutPoint(rand.NextHash(), 0));
+        vCandidates.push_back(candidate);
+    }
+
+    BenchResult result;
+    result.nEligible = 0;
+    for (unsigned int i = 0; i < vCandidates.size(); i++)
+        if (pindexBest->nHeight - vCandidates[i].nHeight >= nStakeMinConfirmations - 1)
+            result.nEligible++;
+    result.nKernels = result.nNanos = result.nMaxIntervalNanos = 0;
+    result.nAllocs = result.nAllocBytes = 0;
+    result.nFound = 0;
+
+    // Each interval searches the nSearchSpan seconds since the last one, as
+    // the staking thread does; a kernel found becomes the next block and its
+    // input starts maturing again
+    vector<bool> vExcluded(vPrevouts.size(), false);
+    int64_t nClock = pindexBest->GetBlockTime();
+    for (unsigned int k = 0; k < opt.nIntervals; k++)
+    {
+        nClock += opt.nSearchSpan;
+        int64_t nSearchTime = nClock & ~STAKE_TIMESTAMP_MASK;
+
+        IntervalStats stats;
+        uint64_t nAllocsStart = nAllocs, nAllocBytesStart = nAllocBytes;
+        fCountAllocs = true;
+        int64_t nStart = GetBenchNanos();
+        unsigned int nCoin, nOffset;
+        CStakeKernelSearch search(pindexBest, nBestChainUpdates, opt.nBits, nSearchTime, opt.nSearchSpan, vPrevouts, vCandidates, vExcluded);
+        stats.fFound = FindStakeKernel(search, opt.nThreads, nCoin, nOffset);
+        stats.nNanos = GetBenchNanos() - nStart;
+        fCountAllocs = false;
+        stats.nKernels = search.GetKernelsChecked();
+        stats.nAllocs = nAllocs - nAllocsStart;
+        stats.nAllocBytes = nAllocBytes - nAllocBytesStart;
+
+        result.nKernels += stats.nKernels;
+        result.nNanos += stats.nNanos;
+        result.nMaxIntervalNanos = max(result.nMaxIntervalNanos, stats.nNanos);
+        result.nAllocs += stats.nAllocs;
+        result.nAllocBytes += stats.nAllocBytes;
+
+        if (stats.fFound)
+        {
+            result.nFound++;
+            unsigned int nTime = max((int64_t)pindexBest->nTime + 1, nSearchTime - nOffset);
+            CBlockIndex* pindexNew = chain.Append(nTime);
+            CStakeCandidate& candidate = vCandidates[nCoin];
+            candidate.hashBlock = pindexNew->GetBlockHash();
+            candidate.nHeight = pindexNew->nHeight;
+            candidate.nBlockTime = pindexNew->GetBlockTime();
+            candidate.nTxPrevTime = pindexNew->nTime;
+            nClock = max(nClock, (int64_t)nTime);
+        }
+    }
+    return result;
+}
+
+void PrintCSV(const BenchOptions& opt, const BenchResult& r)
+{
+    double dSeconds = r.nNanos / 1e9;
+    printf("utxos,eligible,threads,intervals,span,bits,kernels,kernels_per_s,us_per_interval,max_us_per_interval,allocs_per_interval,alloc_bytes_per_interval,allocs_per_kernel,kernels_found\n");
+    printf("%u,%u,%u,%u,%u,%08x,%llu,%.0f,%.1f,%.1f,%.1f,%.0f,%.4f,%u\n",
+           opt.nUtxos, r.nEligible, opt.nThreads, opt.nIntervals, opt.nSearchSpan, opt.nBits,
+           (unsigned long long)r.nKernels, dSeconds > 0 ? r.nKernels / dSeconds : 0.0,
+           r.nNanos / 1e3 / opt.nIntervals, r.nMaxIntervalNanos / 1e3,
+           (double)r.nAllocs / opt.nIntervals, (double)r.nAllocBytes / opt.nIntervals,
+           r.nKernels ? (double)r.nAllocs / r.nKernels : 0.0, r.nFound);
+}
+
+void PrintJSON(const BenchOptions& opt, const BenchResult& r)
+{
+    double dSeconds = r.nNanos / 1e9;
+    printf("{\n");
+    printf("  \"utxos\": %u, \"eligible\": %u, \"threads\": %u, \"intervals\": %u, \"span\": %u, \"bits\": \"%08x\",\n",
+           opt.nUtxos, r.nEligible, opt.nThreads, opt.nIntervals, opt.nSearchSpan, opt.nBits);
+    printf("  \"kernels\": %llu, \"kernels_per_s\": %.0f,\n",
+           (unsigned long long)r.nKernels, dSeconds > 0 ? r.nKernels / dSeconds : 0.0);
+    printf("  \"us_per_interval\": %.1f, \"max_us_per_interval\": %.1f,\n",
+           r.nNanos / 1e3 / opt.nIntervals, r.nMaxIntervalNanos / 1e3);
+    printf("  \"allocs_per_interval\": %.1f, \"alloc_bytes_per_interval\": %.0f, \"allocs_per_kernel\": %.4f,\n",
+           (double)r.nAllocs / opt.nIntervals, (double)r.nAllocBytes / opt.nIntervals,
+           r.nKernels ? (double)r.nAllocs / r.nKernels : 0.0);
+    printf("  \"kernels_found\": %u\n", r.nFound);
+    printf("}\n");
+}
+
+void Usage()
+{
+    fprintf(stderr,
+            "Usage: bench_stake [options]\n"
+            "  -csv                 CSV output (default)\n"
+            "  -json                JSON output\n"
+            "  -utxos=<n>           Number of stake inputs (default: 1000)\n"
+            "  -minage=<n>          Youngest input age in blocks (default: %d)\n"
+            "  -maxage=<n>          Oldest input age in blocks (default: 20000)\n"
+            "  -agedist=<dist>      Input age distribution: fixed, uniform or exp (default: uniform)\n"
+            "  -value=<n>           Mean input value in coins (default: 1000)\n"
+            "  -valuedist=<dist>    Input value distribution: fixed, uniform or exp (default: exp)\n"
+            "  -intervals=<n>       Search intervals to run (default: 100)\n"
+            "  -span=<n>            Seconds searched per interval (default: 60)\n"
+            "  -threads=<n>         Kernel search threads, as -stakethreads (default: 1)\n"
+            "  -bits=<hex>          Compact stake target (default: 1a00ffff)\n",
+            nStakeMinConfirmations);
+}
+
+} // anon namespace
+
+int main(int argc, char* argv[])
+{
+    BenchOptions opt;
+    opt.format = FORMAT_CSV;
+    opt.nUtxos = 1000;
+    opt.nMinAge = nStakeMinConfirmations;
+    opt.nMaxAge = 20000;
+    opt.ageDist = DIST_UNIFORM;
+    opt.nValue = 1000;
+    opt.valueDist = DIST_EXP;
+    opt.nIntervals = 100;
+    opt.nSearchSpan = 60;
+    opt.nThreads = 1;
+    opt.nBits = 0x1a00ffff;
+    for (int i = 1; i < argc; i++)
+    {
+        string strArg = argv[i];
+        unsigned int n;
+        if (ParseBenchOutputFormat(strArg, opt.format))
+            ;
+        else if (ParseBenchUInt(strArg, "-utxos=", n))
+            opt.nUtxos = n;
+        else if (ParseBenchUInt(strArg, "-minage=", n))
+            opt.nMinAge = n;
+        else if (ParseBenchUInt(strArg, "-maxage=", n))
+            opt.nMaxAge = n;
+        else if (strArg.compare(0, 9, "-agedist=") == 0 && ParseDistribution(strArg.substr(9), opt.ageDist))
+            ;
+        else if (ParseBenchUInt(strArg, "-value=", n))
+            opt.nValue = n;
+        else if (strArg.compare(0, 11, "-valuedist=") == 0 && ParseDistribution(strArg.substr(11), opt.valueDist))
+            ;
+        else if (ParseBenchUInt(strArg, "-intervals=", n))
+            opt.nIntervals = n;
+        else if (ParseBenchUInt(strArg, "-span=", n))
+            opt.nSearchSpan = n;
+        else if (ParseBenchUInt(strArg, "-threads=", n))
+            opt.nThreads = n;
+        else if (strArg.compare(0, 6, "-bits=") == 0 && strArg.size() > 6)
+            opt.nBits = strtoul(strArg.c_str() + 6, NULL, 16);
+        else
+        {
+            Usage();
+            return 1;
+        }
+    }
+    if (opt.nMinAge > opt.nMaxAge)
+    {
+        fprintf(stderr, "error: -minage is above -maxage\n");
+        return 1;
+    }
+
+    // Kernel checks only log on failure paths; keep that off disk
+    fPrintToDebugLog = false;
+    SelectParams(CChainParams::MAIN);
+
+    BenchResult result = RunBench(opt);
+    if (opt.format == FORMAT_JSON)
+        PrintJSON(opt, result);
+    else
+        PrintCSV(opt, result);
+    return 0;
+}
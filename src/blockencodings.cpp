@@ -0,0 +1,147 @@
+// Copyright (c) 2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockencodings.h"
+
+#include "hash.h"
+#include "txmempool.h"
+#include "util.h"
+
+#include <limits>
+
+#include <boost/unordered_map.hpp>
+
+using namespace std;
+
+CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock& block) :
+    nonce(GetRand(numeric_limits<uint64_t>::max())), header(block)
+{
+    header.vtx.clear();
+    FillShortTxIDSelector();
+
+    // Nobody has the coinbase or the coinstake yet
+    unsigned int nPrefilled = block.IsProofOfStake() ? 2 : 1;
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
+    {
+        if (i < nPrefilled)
+        {
+            CPrefilledTransaction prefilled;
+            prefilled.index = i;
+            prefilled.tx = block.vtx[i];
+            prefilledtxn.push_back(prefilled);
+        }
+        else
+            shorttxids.push_back(GetShortID(block.vtx[i].GetHash()));
+    }
+}
+
+void CBlockHeaderAndShortTxIDs::FillShortTxIDSelector() const
+{
+    // Salted by the sender's nonce, so that nobody can make transactions
+    // whose ids collide in every compact block
+    uint256 hash = Hash(BEGIN(header.nVersion), END(header.nNonce), BEGIN(nonce), END(nonce));
+    shorttxidk0 = hash.Get64(0);
+    shorttxidk1 = hash.Get64(1);
+}
+
+uint64_t CBlockHeaderAndShortTxIDs::GetShortID(const uint256& txhash) const
+{
+    return SipHashUint256(shorttxidk0, shorttxidk1, txhash) & 0xffffffffffffULL;
+}
+
+ReadStatus CPartialBlock::InitData(const CBlockHeaderAndShortTxIDs& cmpctblock, const CTxMemPool& pool)
+{
+    size_t nTxCount = cmpctblock.BlockTxCount();
+    if (cmpctblock.header.IsNull() || nTxCount == 0 || nTxCount > MAX_BLOCK_SIZE / 60)
+        return READ_STATUS_INVALID;
+
+    header = cmpctblock.header;
+    vtx.assign(nTxCount, CTransaction());
+    vHave.assign(nTxCount, false);
+
+    // Prefilled transactions come in index order
+    int nLastIndex = -1;
+    BOOST_FOREACH(const CPrefilledTransaction& prefilled, cmpctblock.prefilledtxn)
+    {
+        if ((int)prefilled.index <= nLastIndex || prefilled.index >= nTxCount)
+            return READ_STATUS_INVALID;
+        nLastIndex = prefilled.index;
+        vtx[prefilled.index] = prefilled.tx;
+        vtx[prefilled.index].CacheHash();
+        vHave[prefilled.index] = true;
+    }
+
+    // Short ids take the places the prefilled transactions leave
+    boost::unordered_map<uint64_t, unsigned short> mapShortIDs;
+    mapShortIDs.rehash(cmpctblock.shorttxids.size());
+    unsigned int nIndex = 0;
+    BOOST_FOREACH(uint64_t shortid, cmpctblock.shorttxids)
+    {
+        while (vHave[nIndex])
+            nIndex++;
+        if (!mapShortIDs.insert(make_pair(shortid, nIndex)).second)
+            return READ_STATUS_FAILED;
+        nIndex++;
+    }
+
+    vector<bool> vCollided(nTxCount, false);
+    {
+        LOCK(pool.cs);
+        for (map<uint256, CTransaction>::const_iterator it = pool.mapTx.begin(); it != pool.mapTx.end(); ++it)
+        {
+            boost::unordered_map<uint64_t, unsigned short>::iterator mi = mapShortIDs.find(cmpctblock.GetShortID(it->first));
+            if (mi == mapShortIDs.end())
+                continue;
+            unsigned short index = mi->second;
+            if (vHave[index] || vCollided[index])
+            {
+                // Two pool transactions match: ask for the right one
+                vHave[index] = false;
+                vCollided[index] = true;
+                continue;
+            }
+            vtx[index] = it->second;
+            vHave[index] = true;
+        }
+    }
+
+    LogPrint("net", "compact block %s: %u transactions, %u prefilled, %u from the memory pool\n",
+        header.GetHash().ToString(), nTxCount, cmpctblock.prefilledtxn.size(),
+        count(vHave.begin(), vHave.end(), true) - cmpctblock.prefilledtxn.size());
+    return READ_STATUS_OK;
+}
+
+vector<unsigned short> CPartialBlock::GetMissing() const
+{
+    vector<unsigned short> vMissing;
+    for (unsigned int i = 0; i < vHave.size(); i++)
+        if (!vHave[i])
+            vMissing.push_back(i);
+    return vMissing;
+}
+
+ReadStatus CPartialBlock::FillBlock(CBlock& block, const vector<CTransaction>& vtxMissing) const
+{
+    if (header.IsNull())
+        return READ_STATUS_INVALID;
+
+    block = header;
+    block.vtx = vtx;
+    unsigned int nMissing = 0;
+    for (unsigned int i = 0; i < vHave.size(); i++)
+    {
+        if (vHave[i])
+            continue;
+        if (nMissing >= vtxMissing.size())
+            return READ_STATUS_INVALID;
+        block.vtx[i] = vtxMissing[nMissing++];
+        block.vtx[i].CacheHash();
+    }
+    if (nMissing != vtxMissing.size())
+        return READ_STATUS_INVALID;
+
+    if (block.BuildMerkleTree() != block.hashMerkleRoot)
+        return READ_STATUS_FAILED;
+    return READ_STATUS_OK;
+}
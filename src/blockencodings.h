@@ -0,0 +1,174 @@
+// Copyright (c) 2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef DIMINUTIVEVAULT_BLOCKENCODINGS_H
+#define DIMINUTIVEVAULT_BLOCKENCODINGS_H
+
+#include "main.h"
+
+class CTxMemPool;
+
+/** Bytes of a short transaction id on the wire */
+static const unsigned int SHORTTXIDS_LENGTH = 6;
+/** Compact blocks are only served for blocks this close to the tip */
+static const int MAX_CMPCTBLOCK_DEPTH = 10;
+
+/** Wire form of a list of short transaction ids: a length, then
+ *  SHORTTXIDS_LENGTH bytes of each id, least significant first */
+class CShortTxIDs
+{
+private:
+    std::vector<uint64_t>* pv;
+
+public:
+    explicit CShortTxIDs(std::vector<uint64_t>& vIn) : pv(&vIn) { }
+
+    unsigned int GetSerializeSize(int, int=0) const
+    {
+        return GetSizeOfCompactSize(pv->size()) + pv->size() * SHORTTXIDS_LENGTH;
+    }
+
+    template<typename Stream>
+    void Serialize(Stream& s, int, int=0) const
+    {
+        WriteCompactSize(s, pv->size());
+        for (unsigned int i = 0; i < pv->size(); i++)
+        {
+            unsigned char pch[SHORTTXIDS_LENGTH];
+            for (unsigned int j = 0; j < SHORTTXIDS_LENGTH; j++)
+                pch[j] = (*pv)[i] >> (8 * j);
+            s.write((char*)pch, SHORTTXIDS_LENGTH);
+        }
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s, int, int=0)
+    {
+        uint64_t nSize = ReadCompactSize(s);
+        pv->clear();
+        // Grow as the ids arrive instead of trusting the length up front
+        for (uint64_t i = 0; i < nSize; i++)
+        {
+            unsigned char pch[SHORTTXIDS_LENGTH];
+            s.read((char*)pch, SHORTTXIDS_LENGTH);
+            uint64_t n = 0;
+            for (unsigned int j = 0; j < SHORTTXIDS_LENGTH; j++)
+                n |= (uint64_t)pch[j] << (8 * j);
+            pv->push_back(n);
+        }
+    }
+};
+
+/** A transaction sent in full with a compact block, and its index in the block */
+class CPrefilledTransaction
+{
+public:
+    unsigned short index;
+    CTransaction tx;
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(index);
+        READWRITE(tx);
+    )
+};
+
+/** "cmpctblock" message: a block's header and signature, salted short ids
+ *  of the transactions the receiver probably has in its memory pool, and
+ *  the ones it can't have in full: the coinbase and the coinstake. */
+class CBlockHeaderAndShortTxIDs
+{
+private:
+    uint64_t nonce;
+    mutable uint64_t shorttxidk0, shorttxidk1;
+
+    void FillShortTxIDSelector() const;
+
+public:
+    CBlock header;  // without transactions
+    std::vector<uint64_t> shorttxids;
+    std::vector<CPrefilledTransaction> prefilledtxn;
+
+    CBlockHeaderAndShortTxIDs() : nonce(0), shorttxidk0(0), shorttxidk1(0) { }
+    explicit CBlockHeaderAndShortTxIDs(const CBlock& block);
+
+    uint64_t GetShortID(const uint256& txhash) const;
+    size_t BlockTxCount() const { return shorttxids.size() + prefilledtxn.size(); }
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(header.nVersion);
+        READWRITE(header.hashPrevBlock);
+        READWRITE(header.hashMerkleRoot);
+        READWRITE(header.nTime);
+        READWRITE(header.nBits);
+        READWRITE(header.nNonce);
+        READWRITE(header.vchBlockSig);
+        READWRITE(nonce);
+        READWRITE(REF(CShortTxIDs(REF(shorttxids))));
+        READWRITE(prefilledtxn);
+        if (fRead)
+            FillShortTxIDSelector();
+    )
+};
+
+/** "getblocktxn" message: the transactions of a block, by index, that
+ *  could not be found for a compact block */
+class CBlockTransactionsRequest
+{
+public:
+    uint256 blockhash;
+    std::vector<unsigned short> indexes;
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(blockhash);
+        READWRITE(indexes);
+    )
+};
+
+/** "blocktxn" message: the transactions asked for by a getblocktxn */
+class CBlockTransactions
+{
+public:
+    uint256 blockhash;
+    std::vector<CTransaction> txn;
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(blockhash);
+        READWRITE(txn);
+    )
+};
+
+enum ReadStatus
+{
+    READ_STATUS_OK,
+    READ_STATUS_INVALID,    // the peer sent something no valid block gives
+    READ_STATUS_FAILED,     // short id collisions, get the whole block instead
+};
+
+/** A block being rebuilt from a compact block and the memory pool */
+class CPartialBlock
+{
+private:
+    std::vector<CTransaction> vtx;
+    std::vector<bool> vHave;
+
+public:
+    CBlock header;
+
+    /** Place the prefilled transactions and the ones of the pool whose short
+     *  ids match. Ids that more than one pool transaction match are left
+     *  missing. */
+    ReadStatus InitData(const CBlockHeaderAndShortTxIDs& cmpctblock, const CTxMemPool& pool);
+    bool IsTxAvailable(size_t index) const { return index < vHave.size() && vHave[index]; }
+    std::vector<unsigned short> GetMissing() const;
+
+    /** Complete the block with the missing transactions, in index order.
+     *  Transactions that don't add up to the header's merkle root mean a
+     *  short id matched the wrong pool transaction. */
+    ReadStatus FillBlock(CBlock& block, const std::vector<CTransaction>& vtxMissing) const;
+};
+
+#endif
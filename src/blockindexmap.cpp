@@ -0,0 +1,141 @@
+// Copyright (c) 2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockindexmap.h"
+
+#include "hash.h"
+#include "main.h"
+
+#include <new>
+
+#include <openssl/rand.h>
+
+using namespace std;
+
+void* CChunkArena::Allocate()
+{
+    if (nUsed == nChunkObjects) {
+        vChunks.push_back(static_cast<char*>(::operator new(nObjectSize * nChunkObjects)));
+        nUsed = 0;
+    }
+    return vChunks.back() + nObjectSize * nUsed++;
+}
+
+void CChunkArena::Clear()
+{
+    for (unsigned int i = 0; i < vChunks.size(); i++)
+        ::operator delete(vChunks[i]);
+    vChunks.clear();
+    nUsed = nChunkObjects;
+}
+
+CBlockIndexMap::CBlockIndexMap() :
+    nSize(0), k0(0), k1(0),
+    entryArena(sizeof(value_type), 4096), indexArena(sizeof(CBlockIndex), 4096)
+{
+    // Not knowing the salt, nobody can pick block hashes that land in
+    // the same buckets. OpenSSL seeds itself, so this is safe during
+    // static initialization.
+    if (RAND_bytes((unsigned char*)&k0, sizeof(k0)) != 1 ||
+        RAND_bytes((unsigned char*)&k1, sizeof(k1)) != 1)
+    {
+        // GetRand() can't help here, it reads the same source unchecked.
+        // The clock and this object's address are a poor salt, but not
+        // one an outsider knows in advance.
+        uint64_t nSeed[2] = { (uint64_t)GetTimeMicros(), (uint64_t)(size_t)this };
+        uint256 hash = ::Hash(BEGIN(nSeed), END(nSeed));
+        k0 = hash.Get64(0);
+        k1 = hash.Get64(1);
+    }
+}
+
+uint64_t CBlockIndexMap::Hash(const uint256& hash) const
+{
+    // Block hashes are already uniform; the salt and multiplications only
+    // have to keep an outsider from predicting the bucket
+    uint64_t h = (hash.Get64(0) ^ k0) * 0x9E3779B97F4A7C15ULL;
+    h ^= (hash.Get64(1) ^ k1) * 0xC2B2AE3D27D4EB4FULL;
+    h ^= hash.Get64(2) + (h >> 29);
+    h *= 0x165667B19E3779F9ULL;
+    h ^= hash.Get64(3) + (h >> 32);
+    return h;
+}
+
+size_t CBlockIndexMap::FindSlot(const uint256& hash, uint64_t nHash) const
+{
+    size_t nMask = vSlots.size() - 1;
+    size_t i = (size_t)(nHash >> 16) & nMask;
+    while (vSlots[i].pentry && (vSlots[i].nHash != nHash || vSlots[i].pentry->first != hash))
+        i = (i + 1) & nMask;
+    return i;
+}
+
+CBlockIndexMap::iterator CBlockIndexMap::find(const uint256& hash)
+{
+    if (nSize == 0)
+        return end();
+    size_t i = FindSlot(hash, Hash(hash));
+    return vSlots[i].pentry ? MakeIterator(i) : end();
+}
+
+CBlockIndexMap::const_iterator CBlockIndexMap::find(const uint256& hash) const
+{
+    if (nSize == 0)
+        return end();
+    size_t i = FindSlot(hash, Hash(hash));
+    return vSlots[i].pentry ? MakeIterator(i) : end();
+}
+
+pair<CBlockIndexMap::iterator, bool> CBlockIndexMap::insert(const value_type& value)
+{
+    // Keep the table at most 3/4 full
+    if ((nSize + 1) * 4 > vSlots.size() * 3)
+        Rehash(max((size_t)64, vSlots.size() * 2));
+
+    uint64_t nHash = Hash(value.first);
+    size_t i = FindSlot(value.first, nHash);
+    if (vSlots[i].pentry)
+        return make_pair(MakeIterator(i), false);
+
+    vSlots[i].nHash = nHash;
+    vSlots[i].pentry = new (entryArena.Allocate()) value_type(value);
+    nSize++;
+    return make_pair(MakeIterator(i), true);
+}
+
+void CBlockIndexMap::Rehash(size_t nSlots)
+{
+    vector<CSlot> vOld;
+    vOld.swap(vSlots);
+    CSlot empty = { 0, NULL };
+    vSlots.assign(nSlots, empty);
+    for (unsigned int i = 0; i < vOld.size(); i++) {
+        if (!vOld[i].pentry)
+            continue;
+        size_t j = FindSlot(vOld[i].pentry->first, vOld[i].nHash);
+        vSlots[j] = vOld[i];
+    }
+}
+
+void CBlockIndexMap::reserve(size_type nEntries)
+{
+    size_t nSlots = 64;
+    while (nEntries * 4 > nSlots * 3)
+        nSlots *= 2;
+    if (nSlots > vSlots.size())
+        Rehash(nSlots);
+}
+
+void CBlockIndexMap::clear()
+{
+    vector<CSlot>().swap(vSlots);
+    nSize = 0;
+    entryArena.Clear();
+    indexArena.Clear();
+}
+
+size_t CBlockIndexMap::DynamicUsage() const
+{
+    return vSlots.capacity() * sizeof(CSlot) + entryArena.DynamicUsage() + indexArena.DynamicUsage();
+}
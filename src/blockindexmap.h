@@ -0,0 +1,145 @@
+// Copyright (c) 2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef DIMINUTIVEVAULT_BLOCKINDEXMAP_H
+#define DIMINUTIVEVAULT_BLOCKINDEXMAP_H
+
+#include "uint256.h"
+
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+class CBlockIndex;
+
+/** Objects of one size carved out of large chunks. Nothing is freed until
+ *  the arena is cleared or destroyed, and then no destructors run. */
+class CChunkArena : private boost::noncopyable
+{
+public:
+    CChunkArena(size_t nObjectSizeIn, size_t nChunkObjectsIn) :
+        nObjectSize(nObjectSizeIn), nChunkObjects(nChunkObjectsIn), nUsed(nChunkObjectsIn) { }
+    ~CChunkArena() { Clear(); }
+
+    // Uninitialized storage for one object
+    void* Allocate();
+    void Clear();
+
+    size_t DynamicUsage() const { return vChunks.size() * nObjectSize * nChunkObjects; }
+
+private:
+    const size_t nObjectSize;
+    const size_t nChunkObjects;
+    size_t nUsed;   // objects handed out from the last chunk
+    std::vector<char*> vChunks;
+};
+
+/** Hash table from block hash to CBlockIndex*, the type of mapBlockIndex.
+ *
+ *  It offers the parts of the std::map interface the code uses. Lookups
+ *  probe a power-of-two table linearly, comparing a stored 64-bit hash
+ *  before the key. The entries themselves are allocated from an arena and
+ *  never move, so CBlockIndex::phashBlock can point at their keys. Buckets
+ *  come from the block hash mixed with a random per-process salt, so block
+ *  hashes chosen to collide don't turn lookups into long probes.
+ *
+ *  Entries can't be erased one by one. Iteration order is unspecified.
+ *
+ *  CBlockIndex objects for the map are also allocated from a chunked arena
+ *  by AllocateIndex(), so DynamicUsage() covers all memory the block index
+ *  takes.
+ */
+class CBlockIndexMap : private boost::noncopyable
+{
+public:
+    typedef uint256 key_type;
+    typedef CBlockIndex* mapped_type;
+    typedef std::pair<const uint256, CBlockIndex*> value_type;
+    typedef size_t size_type;
+
+private:
+    struct CSlot
+    {
+        uint64_t nHash;
+        value_type* pentry;   // NULL if the slot is free
+    };
+
+    template<typename Value>
+    class iterator_base : public std::iterator<std::forward_iterator_tag, Value>
+    {
+    public:
+        iterator_base() : pslot(NULL), pend(NULL) { }
+        iterator_base(const CSlot* pslotIn, const CSlot* pendIn) : pslot(pslotIn), pend(pendIn) { Skip(); }
+        // iterator converts to const_iterator
+        template<typename Other>
+        iterator_base(const iterator_base<Other>& it) : pslot(it.pslot), pend(it.pend) { }
+
+        Value& operator*() const { return *pslot->pentry; }
+        Value* operator->() const { return pslot->pentry; }
+        iterator_base& operator++() { ++pslot; Skip(); return *this; }
+        iterator_base operator++(int) { iterator_base ret = *this; ++*this; return ret; }
+        template<typename Other>
+        bool operator==(const iterator_base<Other>& it) const { return pslot == it.pslot; }
+        template<typename Other>
+        bool operator!=(const iterator_base<Other>& it) const { return pslot != it.pslot; }
+
+    private:
+        template<typename Other> friend class iterator_base;
+
+        void Skip() { while (pslot != pend && !pslot->pentry) ++pslot; }
+
+        const CSlot* pslot;
+        const CSlot* pend;
+    };
+
+public:
+    typedef iterator_base<value_type> iterator;
+    typedef iterator_base<const value_type> const_iterator;
+
+    CBlockIndexMap();
+
+    iterator begin() { return MakeIterator(0); }
+    iterator end() { return MakeIterator(vSlots.size()); }
+    const_iterator begin() const { return MakeIterator(0); }
+    const_iterator end() const { return MakeIterator(vSlots.size()); }
+
+    size_type size() const { return nSize; }
+    bool empty() const { return nSize == 0; }
+
+    iterator find(const uint256& hash);
+    const_iterator find(const uint256& hash) const;
+    size_type count(const uint256& hash) const { return find(hash) != end() ? 1 : 0; }
+
+    std::pair<iterator, bool> insert(const value_type& value);
+    CBlockIndex*& operator[](const uint256& hash) { return insert(value_type(hash, NULL)).first->second; }
+
+    // Drop all entries and free the CBlockIndex objects from AllocateIndex(),
+    // so no pointer to one may be used afterwards
+    void clear();
+    // Make room for nEntries without growing the table again
+    void reserve(size_type nEntries);
+
+    // Uninitialized storage for a CBlockIndex, which lives until shutdown
+    void* AllocateIndex() { return indexArena.Allocate(); }
+
+    // Heap used by the table, its entries and the CBlockIndex objects
+    size_t DynamicUsage() const;
+
+private:
+    std::vector<CSlot> vSlots;   // size is zero or a power of two
+    size_type nSize;
+    uint64_t k0, k1;             // salt
+    CChunkArena entryArena;
+    CChunkArena indexArena;
+
+    uint64_t Hash(const uint256& hash) const;
+    size_t FindSlot(const uint256& hash, uint64_t nHash) const;
+    void Rehash(size_t nSlots);
+
+    iterator MakeIterator(size_t nSlot) { return iterator(vSlots.empty() ? NULL : &vSlots[0] + nSlot, vSlots.empty() ? NULL : &vSlots[0] + vSlots.size()); }
+    const_iterator MakeIterator(size_t nSlot) const { return const_iterator(vSlots.empty() ? NULL : &vSlots[0] + nSlot, vSlots.empty() ? NULL : &vSlots[0] + vSlots.size()); }
+};
+
+#endif
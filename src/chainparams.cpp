@@ -57,7 +57,7 @@ public:
         //nDefaultPort = 16000;
        // nRPCPort = 16001;	    
 	    
-        bnProofOfWorkLimit = CBigNum(~uint256(0) >> 20);
+        bnProofOfWorkLimit = ~uint256(0) >> 20;
 	const char* pszTimestamp = "Diminitivevault needs a new chain sha256 failed 20200121"; //
         std::vector<CTxIn> vin;
         vin.resize(1);
@@ -125,7 +125,7 @@ public:
         pchMessageStart[1] = 0x5a;
         pchMessageStart[2] = 0xd5;
         pchMessageStart[3] = 0x21;
-        bnProofOfWorkLimit = CBigNum(~uint256(0) >> 8);
+        bnProofOfWorkLimit = ~uint256(0) >> 8;
         nDefaultPort = 4913;
         nRPCPort = 4912;
 	//nDefaultPort = 1600;
@@ -6,6 +6,7 @@
 #ifndef DIMINUTIVEVAULT_CHAIN_PARAMS_H
 #define DIMINUTIVEVAULT_CHAIN_PARAMS_H
 
+#include "arith_uint256.h"
 #include "bignum.h"
 #include "uint256.h"
 #include "util.h"
@@ -56,7 +57,7 @@ public:
     const MessageStartChars& MessageStart() const { return pchMessageStart; }
     int GetDefaultPort() const { return nDefaultPort; }
 
-    const CBigNum& ProofOfWorkLimit() const { return bnProofOfWorkLimit; }
+    const arith_uint256& ProofOfWorkLimit() const { return bnProofOfWorkLimit; }
     int SubsidyHalvingInterval() const { return nSubsidyHalvingInterval; }
     virtual const CBlock& GenesisBlock() const = 0;
     virtual bool RequireRPCPassword() const { return true; }
@@ -74,7 +75,7 @@ protected:
     MessageStartChars pchMessageStart;
     int nDefaultPort;
     int nRPCPort;
-    CBigNum bnProofOfWorkLimit;
+    arith_uint256 bnProofOfWorkLimit;
     int nSubsidyHalvingInterval;
     string strDataDir;
     vector<CDNSSeedData> vSeeds;
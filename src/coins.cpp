@@ -0,0 +1,47 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coins.h"
+
+using namespace std;
+
+void CCoins::Spend(const vector<CDiskTxPos>& vSpent)
+{
+    for (unsigned int i = 0; i < vout.size() && i < vSpent.size(); i++)
+        if (!vSpent[i].IsNull())
+            vout[i].SetNull();
+}
+
+bool CCoins::IsPruned() const
+{
+    BOOST_FOREACH(const CTxOut& out, vout)
+        if (!out.IsNull())
+            return false;
+    return true;
+}
+
+void CCoins::GetTransaction(const uint256& hash, CTransaction& tx) const
+{
+    tx.SetNull();
+    tx.nTime = nTime;
+    tx.vin.resize(1);
+    // A coinbase has a single input with a null prevout, anything else needs
+    // a non-null one for IsCoinBase() and IsCoinStake() to come out the same
+    if (!fCoinBase)
+        tx.vin[0].prevout = COutPoint(0, 0);
+    tx.vout = vout;
+    // The coinstake marker output is never spent, but keep it empty anyway
+    if (fCoinStake && !tx.vout.empty())
+        tx.vout[0].SetEmpty();
+    tx.SetCachedHash(hash);
+}
+
+size_t CCoins::DynamicUsage() const
+{
+    size_t nUsage = sizeof(CCoins) + vout.capacity() * sizeof(CTxOut);
+    BOOST_FOREACH(const CTxOut& out, vout)
+        nUsage += out.scriptPubKey.capacity();
+    return nUsage;
+}
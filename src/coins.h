@@ -0,0 +1,108 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef DIMINUTIVEVAULT_COINS_H
+#define DIMINUTIVEVAULT_COINS_H
+
+#include "main.h"
+
+#include <vector>
+
+/** The unspent outputs of one transaction, plus what validation needs to
+ *  know about the transaction itself. This lets FetchInputs() hand
+ *  ConnectInputs() the outputs being spent without reading the whole
+ *  previous transaction back from the block files.
+ *
+ *  vout has one entry per output of the transaction; spent outputs are
+ *  null. Only the unspent ones are serialized:
+ *
+ *  - VARINT(code): bit 0 coinbase, bit 1 coinstake
+ *  - nTime
+ *  - VARINT(number of outputs)
+ *  - a bitmask of the unspent outputs, one bit per output
+ *  - each unspent output through CTxOutCompressor
+ *
+ *  The spent flags of CTxIndex remain authoritative; records are kept in
+ *  step with them by ConnectBlock() and DisconnectInputs().
+ */
+class CCoins
+{
+public:
+    bool fCoinBase;
+    bool fCoinStake;
+    unsigned int nTime;
+    std::vector<CTxOut> vout;
+
+    CCoins() : fCoinBase(false), fCoinStake(false), nTime(0) { }
+
+    explicit CCoins(const CTransaction& tx) :
+        fCoinBase(tx.IsCoinBase()), fCoinStake(tx.IsCoinStake()), nTime(tx.nTime), vout(tx.vout) { }
+
+    // Null the outputs marked spent in vSpent
+    void Spend(const std::vector<CDiskTxPos>& vSpent);
+
+    bool IsAvailable(unsigned int n) const
+    {
+        return n < vout.size() && !vout[n].IsNull();
+    }
+
+    // Whether every output is spent
+    bool IsPruned() const;
+
+    // Rebuild a transaction that is equivalent for ConnectInputs(): same
+    // txid, time, coinbase/coinstake status and unspent outputs. Spent
+    // outputs are null and the inputs are placeholders.
+    void GetTransaction(const uint256& hash, CTransaction& tx) const;
+
+    // Approximate heap usage, for the coins cache
+    size_t DynamicUsage() const;
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        CSizeComputer s(nType, nVersion);
+        Serialize(s, nType, nVersion);
+        return s.size();
+    }
+
+    template<typename Stream>
+    void Serialize(Stream &s, int nType, int nVersion) const
+    {
+        unsigned int nCode = (fCoinBase ? 1 : 0) | (fCoinStake ? 2 : 0);
+        unsigned int nOutputs = vout.size();
+        s << VARINT(nCode);
+        s << nTime;
+        s << VARINT(nOutputs);
+        std::vector<unsigned char> vMask((nOutputs + 7) / 8, 0);
+        for (unsigned int i = 0; i < nOutputs; i++)
+            if (!vout[i].IsNull())
+                vMask[i / 8] |= 1 << (i % 8);
+        if (!vMask.empty())
+            s << CFlatData(&vMask[0], &vMask[vMask.size()]);
+        for (unsigned int i = 0; i < nOutputs; i++)
+            if (!vout[i].IsNull())
+                s << CTxOutCompressor(REF(vout[i]));
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream &s, int nType, int nVersion)
+    {
+        unsigned int nCode = 0, nOutputs = 0;
+        s >> VARINT(nCode);
+        s >> nTime;
+        s >> VARINT(nOutputs);
+        fCoinBase = nCode & 1;
+        fCoinStake = (nCode & 2) != 0;
+        if (nOutputs > MAX_BLOCK_SIZE)
+            throw std::ios_base::failure("CCoins : too many outputs");
+        std::vector<unsigned char> vMask((nOutputs + 7) / 8, 0);
+        if (!vMask.empty())
+            s >> REF(CFlatData(&vMask[0], &vMask[vMask.size()]));
+        vout.assign(nOutputs, CTxOut());
+        for (unsigned int i = 0; i < nOutputs; i++)
+            if (vMask[i / 8] & (1 << (i % 8)))
+                s >> REF(CTxOutCompressor(vout[i]));
+    }
+};
+
+#endif
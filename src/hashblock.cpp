@@ -0,0 +1,1032 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2012 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#include "hashblock.h"
+
+#include <assert.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HMQ1725_X86_DISPATCH
+#endif
+
+namespace {
+
+/** The sph primitives used by HMQ1725, in the order of their sph headers */
+enum HMQ1725Func
+{
+    HMQ_BLAKE,
+    HMQ_BMW,
+    HMQ_GROESTL,
+    HMQ_JH,
+    HMQ_KECCAK,
+    HMQ_SKEIN,
+    HMQ_LUFFA,
+    HMQ_CUBEHASH,
+    HMQ_SHAVITE,
+    HMQ_SIMD,
+    HMQ_ECHO,
+    HMQ_HAMSI,
+    HMQ_FUGUE,
+    HMQ_SHABAL,
+    HMQ_WHIRLPOOL,
+    HMQ_SHA512,
+    HMQ_HAVAL,
+    HMQ_FUNC_COUNT
+};
+
+/** One link of the chain after the initial BMW: hash[i] = f(hash[i-1]),
+ *  where f is fnTrue when (hash[i-1] & 24) != 0 and fnFalse otherwise. */
+struct HMQ1725Stage
+{
+    HMQ1725Func fnTrue;
+    HMQ1725Func fnFalse;
+};
+
+const HMQ1725Stage vStages[] =
+{
+    { HMQ_WHIRLPOOL, HMQ_WHIRLPOOL },   // hash[1]
+    { HMQ_GROESTL,   HMQ_SKEIN     },
+    { HMQ_JH,        HMQ_JH        },
+    { HMQ_KECCAK,    HMQ_KECCAK    },
+    { HMQ_BLAKE,     HMQ_BMW       },   // hash[5]
+    { HMQ_LUFFA,     HMQ_LUFFA     },
+    { HMQ_CUBEHASH,  HMQ_CUBEHASH  },
+    { HMQ_KECCAK,    HMQ_JH        },
+    { HMQ_SHAVITE,   HMQ_SHAVITE   },
+    { HMQ_SIMD,      HMQ_SIMD      },   // hash[10]
+    { HMQ_WHIRLPOOL, HMQ_HAVAL     },
+    { HMQ_ECHO,      HMQ_ECHO      },
+    { HMQ_BLAKE,     HMQ_BLAKE     },
+    { HMQ_SHAVITE,   HMQ_LUFFA     },
+    { HMQ_HAMSI,     HMQ_HAMSI     },   // hash[15]
+    { HMQ_FUGUE,     HMQ_FUGUE     },
+    { HMQ_ECHO,      HMQ_SIMD      },
+    { HMQ_SHABAL,    HMQ_SHABAL    },
+    { HMQ_WHIRLPOOL, HMQ_WHIRLPOOL },
+    { HMQ_FUGUE,     HMQ_SHA512    },   // hash[20]
+    { HMQ_GROESTL,   HMQ_GROESTL   },
+    { HMQ_SHA512,    HMQ_SHA512    },
+    { HMQ_HAVAL,     HMQ_WHIRLPOOL },
+    { HMQ_BMW,       HMQ_BMW       },   // hash[24]
+};
+
+#define HMQ1725_SCALAR(name, member, ctxtype, fn) \
+void Hash64_##name(const unsigned char* pin, unsigned char* pout) \
+{ \
+    ctxtype ctx = HMQ1725InitialContexts().member; \
+    fn(&ctx, pin, 64); \
+    fn##_close(&ctx, pout); \
+}
+
+HMQ1725_SCALAR(blake,     blake,     sph_blake512_context,    sph_blake512)
+HMQ1725_SCALAR(bmw,       bmw,       sph_bmw512_context,      sph_bmw512)
+HMQ1725_SCALAR(jh,        jh,        sph_jh512_context,       sph_jh512)
+HMQ1725_SCALAR(keccak,    keccak,    sph_keccak512_context,   sph_keccak512)
+HMQ1725_SCALAR(skein,     skein,     sph_skein512_context,    sph_skein512)
+HMQ1725_SCALAR(luffa,     luffa,     sph_luffa512_context,    sph_luffa512)
+HMQ1725_SCALAR(cubehash,  cubehash,  sph_cubehash512_context, sph_cubehash512)
+HMQ1725_SCALAR(simd,      simd,      sph_simd512_context,     sph_simd512)
+HMQ1725_SCALAR(hamsi,     hamsi,     sph_hamsi512_context,    sph_hamsi512)
+HMQ1725_SCALAR(fugue,     fugue,     sph_fugue512_context,    sph_fugue512)
+HMQ1725_SCALAR(shabal,    shabal,    sph_shabal512_context,   sph_shabal512)
+HMQ1725_SCALAR(whirlpool, whirlpool, sph_whirlpool_context,   sph_whirlpool)
+HMQ1725_SCALAR(sha512,    sha2,      sph_sha512_context,      sph_sha512)
+
+// The AES based stages dispatch to AES-NI kernels when available
+void Hash64_groestl(const unsigned char* pin, unsigned char* pout) { HMQ1725Groestl512(pin, pout); }
+void Hash64_shavite(const unsigned char* pin, unsigned char* pout) { HMQ1725Shavite512(pin, pout); }
+void Hash64_echo(const unsigned char* pin, unsigned char* pout) { HMQ1725Echo512(pin, pout); }
+
+// HAVAL-256 only produces 32 bytes; the upper half of the 512-bit chaining
+// value stays zero, exactly as in the uint512 array of HMQ1725().
+void Hash64_haval(const unsigned char* pin, unsigned char* pout)
+{
+    sph_haval256_5_context ctx = HMQ1725InitialContexts().haval;
+    memset(pout + 32, 0, 32);
+    sph_haval256_5(&ctx, pin, 64);
+    sph_haval256_5_close(&ctx, pout);
+}
+
+typedef void (*Hash64Fn)(const unsigned char* pin, unsigned char* pout);
+
+const Hash64Fn vScalar[HMQ_FUNC_COUNT] =
+{
+    Hash64_blake, Hash64_bmw, Hash64_groestl, Hash64_jh, Hash64_keccak,
+    Hash64_skein, Hash64_luffa, Hash64_cubehash, Hash64_shavite, Hash64_simd,
+    Hash64_echo, Hash64_hamsi, Hash64_fugue, Hash64_shabal, Hash64_whirlpool,
+    Hash64_sha512, Hash64_haval,
+};
+
+const char* const vNames[HMQ_FUNC_COUNT] =
+{
+    "blake", "bmw", "groestl", "jh", "keccak",
+    "skein", "luffa", "cubehash", "shavite", "simd",
+    "echo", "hamsi", "fugue", "shabal", "whirlpool",
+    "sha512", "haval",
+};
+
+/** Multi-lane kernel: hash a fixed number of independent 64-byte inputs per
+ *  call, pin[l] and pout[l] being the input and output of lane l */
+typedef void (*Hash64xNFn)(const unsigned char* const* pin, unsigned char* const* pout);
+static const unsigned int HMQ1725_MAX_LANES = 8;
+
+#ifdef HMQ1725_X86_DISPATCH
+
+// The lane kernels are written once against GCC vector types, each element
+// holding one word of a different input, and are compiled for every
+// instruction set by the target specific wrappers at the end, which inline
+// them. The 16-byte types give the SSE4.1 kernels, the 32-byte types AVX2.
+typedef uint32_t u32x4 __attribute__((vector_size(16)));
+typedef uint32_t u32x8 __attribute__((vector_size(32)));
+typedef uint64_t u64x2 __attribute__((vector_size(16)));
+typedef uint64_t u64x4 __attribute__((vector_size(32)));
+
+#define LANES_INLINE inline __attribute__((always_inline))
+#define ROTL32V(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+#define ROTL64V(v, n) (((v) << (n)) | ((v) >> (64 - (n))))
+
+/** Gather the little-endian word at nOffset of every lane into v */
+template<typename W, typename V>
+LANES_INLINE void LoadLanes(V& v, const unsigned char* const* pin, size_t nOffset)
+{
+    W w[sizeof(V) / sizeof(W)];
+    for (size_t l = 0; l < sizeof(V) / sizeof(W); l++)
+        memcpy(&w[l], pin[l] + nOffset, sizeof(W));
+    memcpy(&v, w, sizeof(V));
+}
+
+/** Scatter v to the little-endian word at nOffset of every lane */
+template<typename W, typename V>
+LANES_INLINE void StoreLanes(const V& v, unsigned char* const* pout, size_t nOffset)
+{
+    W w[sizeof(V) / sizeof(W)];
+    memcpy(w, &v, sizeof(V));
+    for (size_t l = 0; l < sizeof(V) / sizeof(W); l++)
+        memcpy(pout[l] + nOffset, &w[l], sizeof(W));
+}
+
+template<typename V>
+LANES_INLINE void LoadLanesBE32(V& v, const unsigned char* const* pin, size_t nOffset)
+{
+    LoadLanes<uint32_t>(v, pin, nOffset);
+    uint32_t w[sizeof(V) / 4];
+    memcpy(w, &v, sizeof(V));
+    for (size_t l = 0; l < sizeof(V) / 4; l++)
+        w[l] = __builtin_bswap32(w[l]);
+    memcpy(&v, w, sizeof(V));
+}
+
+template<typename V>
+LANES_INLINE void StoreLanesBE32(const V& v, unsigned char* const* pout, size_t nOffset)
+{
+    uint32_t w[sizeof(V) / 4];
+    memcpy(w, &v, sizeof(V));
+    for (size_t l = 0; l < sizeof(V) / 4; l++)
+        w[l] = __builtin_bswap32(w[l]);
+    V vSwapped;
+    memcpy(&vSwapped, w, sizeof(V));
+    StoreLanes<uint32_t>(vSwapped, pout, nOffset);
+}
+
+/** A vector of type V with every element set to w */
+#define SPLATV(V, w) (V() + (w))
+
+// CubeHash-512 (16 rounds per 32-byte block, 160 final rounds)
+
+/** Two CubeHash rounds. Rather than swapping words as the specification
+ *  does, a round leaves the state permuted: word i of the lower half ends up
+ *  in x[i ^ 12] and word i of the upper half in x[16 + (i ^ 3)], and the
+ *  second round restores the original layout. The loops are unrolled so
+ *  that every index is a constant. */
+template<typename V>
+LANES_INLINE void CubeHashRoundPair(V x[32])
+{
+#pragma GCC unroll 2
+    for (int r = 0; r < 2; r++)
+    {
+        const int a = r ? 12 : 0, b = r ? 3 : 0;
+#pragma GCC unroll 16
+        for (int i = 0; i < 16; i++)
+        {
+            x[16 + (i ^ b)] += x[i ^ a];
+            x[i ^ a] = ROTL32V(x[i ^ a], 7);
+        }
+#pragma GCC unroll 16
+        for (int i = 0; i < 16; i++)
+            x[i ^ a ^ 8] ^= x[16 + (i ^ b)];
+#pragma GCC unroll 16
+        for (int i = 0; i < 16; i++)
+        {
+            x[16 + (i ^ b ^ 2)] += x[i ^ a ^ 8];
+            x[i ^ a ^ 8] = ROTL32V(x[i ^ a ^ 8], 11);
+        }
+#pragma GCC unroll 16
+        for (int i = 0; i < 16; i++)
+            x[i ^ a ^ 12] ^= x[16 + (i ^ b ^ 2)];
+    }
+}
+
+template<typename V>
+LANES_INLINE void CubeHashRounds(V x[32], int nRounds)
+{
+    for (int r = 0; r < nRounds; r += 2)
+        CubeHashRoundPair(x);
+}
+
+template<typename V>
+LANES_INLINE void Hash64xN_cubehash(const unsigned char* const* pin, unsigned char* const* pout)
+{
+    const uint32_t* pIV = HMQ1725InitialContexts().cubehash.state;
+    V x[32];
+    for (int i = 0; i < 32; i++)
+        x[i] = SPLATV(V, pIV[i]);
+
+    for (int nBlock = 0; nBlock < 2; nBlock++)
+    {
+        for (int i = 0; i < 8; i++)
+        {
+            V m;
+            LoadLanes<uint32_t>(m, pin, 32 * nBlock + 4 * i);
+            x[i] ^= m;
+        }
+        CubeHashRounds(x, 16);
+    }
+
+    // Padding block, then finalization
+    x[0] ^= SPLATV(V, 0x80U);
+    CubeHashRounds(x, 16);
+    x[31] ^= SPLATV(V, 1U);
+    CubeHashRounds(x, 160);
+
+    for (int i = 0; i < 16; i++)
+        StoreLanes<uint32_t>(x[i], pout, 4 * i);
+}
+
+// JH-512 (42 rounds of E8 per 64-byte block). As in sph, the bitsliced state
+// is kept little-endian with byte-swapped round constants.
+
+#define JH_C(x) __builtin_bswap64(x##ULL)
+
+const uint64_t JHRoundConstants[168] =
+{
+    JH_C(0x72d5dea2df15f867), JH_C(0x7b84150ab7231557),
+    JH_C(0x81abd6904d5a87f6), JH_C(0x4e9f4fc5c3d12b40),
+    JH_C(0xea983ae05c45fa9c), JH_C(0x03c5d29966b2999a),
+    JH_C(0x660296b4f2bb538a), JH_C(0xb556141a88dba231),
+    JH_C(0x03a35a5c9a190edb), JH_C(0x403fb20a87c14410),
+    JH_C(0x1c051980849e951d), JH_C(0x6f33ebad5ee7cddc),
+    JH_C(0x10ba139202bf6b41), JH_C(0xdc786515f7bb27d0),
+    JH_C(0x0a2c813937aa7850), JH_C(0x3f1abfd2410091d3),
+    JH_C(0x422d5a0df6cc7e90), JH_C(0xdd629f9c92c097ce),
+    JH_C(0x185ca70bc72b44ac), JH_C(0xd1df65d663c6fc23),
+    JH_C(0x976e6c039ee0b81a), JH_C(0x2105457e446ceca8),
+    JH_C(0xeef103bb5d8e61fa), JH_C(0xfd9697b294838197),
+    JH_C(0x4a8e8537db03302f), JH_C(0x2a678d2dfb9f6a95),
+    JH_C(0x8afe7381f8b8696c), JH_C(0x8ac77246c07f4214),
+    JH_C(0xc5f4158fbdc75ec4), JH_C(0x75446fa78f11bb80),
+    JH_C(0x52de75b7aee488bc), JH_C(0x82b8001e98a6a3f4),
+    JH_C(0x8ef48f33a9a36315), JH_C(0xaa5f5624d5b7f989),
+    JH_C(0xb6f1ed207c5ae0fd), JH_C(0x36cae95a06422c36),
+    JH_C(0xce2935434efe983d), JH_C(0x533af974739a4ba7),
+    JH_C(0xd0f51f596f4e8186), JH_C(0x0e9dad81afd85a9f),
+    JH_C(0xa7050667ee34626a), JH_C(0x8b0b28be6eb91727),
+    JH_C(0x47740726c680103f), JH_C(0xe0a07e6fc67e487b),
+    JH_C(0x0d550aa54af8a4c0), JH_C(0x91e3e79f978ef19e),
+    JH_C(0x8676728150608dd4), JH_C(0x7e9e5a41f3e5b062),
+    JH_C(0xfc9f1fec4054207a), JH_C(0xe3e41a00cef4c984),
+    JH_C(0x4fd794f59dfa95d8), JH_C(0x552e7e1124c354a5),
+    JH_C(0x5bdf7228bdfe6e28), JH_C(0x78f57fe20fa5c4b2),
+    JH_C(0x05897cefee49d32e), JH_C(0x447e9385eb28597f),
+    JH_C(0x705f6937b324314a), JH_C(0x5e8628f11dd6e465),
+    JH_C(0xc71b770451b920e7), JH_C(0x74fe43e823d4878a),
+    JH_C(0x7d29e8a3927694f2), JH_C(0xddcb7a099b30d9c1),
+    JH_C(0x1d1b30fb5bdc1be0), JH_C(0xda24494ff29c82bf),
+    JH_C(0xa4e7ba31b470bfff), JH_C(0x0d324405def8bc48),
+    JH_C(0x3baefc3253bbd339), JH_C(0x459fc3c1e0298ba0),
+    JH_C(0xe5c905fdf7ae090f), JH_C(0x947034124290f134),
+    JH_C(0xa271b701e344ed95), JH_C(0xe93b8e364f2f984a),
+    JH_C(0x88401d63a06cf615), JH_C(0x47c1444b8752afff),
+    JH_C(0x7ebb4af1e20ac630), JH_C(0x4670b6c5cc6e8ce6),
+    JH_C(0xa4d5a456bd4fca00), JH_C(0xda9d844bc83e18ae),
+    JH_C(0x7357ce453064d1ad), JH_C(0xe8a6ce68145c2567),
+    JH_C(0xa3da8cf2cb0ee116), JH_C(0x33e906589a94999a),
+    JH_C(0x1f60b220c26f847b), JH_C(0xd1ceac7fa0d18518),
+    JH_C(0x32595ba18ddd19d3), JH_C(0x509a1cc0aaa5b446),
+    JH_C(0x9f3d6367e4046bba), JH_C(0xf6ca19ab0b56ee7e),
+    JH_C(0x1fb179eaa9282174), JH_C(0xe9bdf7353b3651ee),
+    JH_C(0x1d57ac5a7550d376), JH_C(0x3a46c2fea37d7001),
+    JH_C(0xf735c1af98a4d842), JH_C(0x78edec209e6b6779),
+    JH_C(0x41836315ea3adba8), JH_C(0xfac33b4d32832c83),
+    JH_C(0xa7403b1f1c2747f3), JH_C(0x5940f034b72d769a),
+    JH_C(0xe73e4e6cd2214ffd), JH_C(0xb8fd8d39dc5759ef),
+    JH_C(0x8d9b0c492b49ebda), JH_C(0x5ba2d74968f3700d),
+    JH_C(0x7d3baed07a8d5584), JH_C(0xf5a5e9f0e4f88e65),
+    JH_C(0xa0b8a2f436103b53), JH_C(0x0ca8079e753eec5a),
+    JH_C(0x9168949256e8884f), JH_C(0x5bb05c55f8babc4c),
+    JH_C(0xe3bb3b99f387947b), JH_C(0x75daf4d6726b1c5d),
+    JH_C(0x64aeac28dc34b36d), JH_C(0x6c34a550b828db71),
+    JH_C(0xf861e2f2108d512a), JH_C(0xe3db643359dd75fc),
+    JH_C(0x1cacbcf143ce3fa2), JH_C(0x67bbd13c02e843b0),
+    JH_C(0x330a5bca8829a175), JH_C(0x7f34194db416535c),
+    JH_C(0x923b94c30e794d1e), JH_C(0x797475d7b6eeaf3f),
+    JH_C(0xeaa8d4f7be1a3921), JH_C(0x5cf47e094c232751),
+    JH_C(0x26a32453ba323cd2), JH_C(0x44a3174a6da6d5ad),
+    JH_C(0xb51d3ea6aff2c908), JH_C(0x83593d98916b3c56),
+    JH_C(0x4cf87ca17286604d), JH_C(0x46e23ecc086ec7f6),
+    JH_C(0x2f9833b3b1bc765e), JH_C(0x2bd666a5efc4e62a),
+    JH_C(0x06f4b6e8bec1d436), JH_C(0x74ee8215bcef2163),
+    JH_C(0xfdc14e0df453c969), JH_C(0xa77d5ac406585826),
+    JH_C(0x7ec1141606e0fa16), JH_C(0x7e90af3d28639d3f),
+    JH_C(0xd2c9f2e3009bd20c), JH_C(0x5faace30b7d40c30),
+    JH_C(0x742a5116f2e03298), JH_C(0x0deb30d8e3cef89a),
+    JH_C(0x4bc59e7bb5f17992), JH_C(0xff51e66e048668d3),
+    JH_C(0x9b234d57e6966731), JH_C(0xcce6a6f3170a7505),
+    JH_C(0xb17681d913326cce), JH_C(0x3c175284f805a262),
+    JH_C(0xf42bcbb378471547), JH_C(0xff46548223936a48),
+    JH_C(0x38df58074e5e6565), JH_C(0xf2fc7c89fc86508e),
+    JH_C(0x31702e44d00bca86), JH_C(0xf04009a23078474e),
+    JH_C(0x65a0ee39d1f73883), JH_C(0xf75ee937e42c3abd),
+    JH_C(0x2197b2260113f86f), JH_C(0xa344edd1ef9fdee7),
+    JH_C(0x8ba0df15762592d9), JH_C(0x3c85f7f612dc42be),
+    JH_C(0xd8a7ec7cab27b07e), JH_C(0x538d7ddaaa3ea8de),
+    JH_C(0xaa25ce93bd0269d8), JH_C(0x5af643fd1a7308f9),
+    JH_C(0xc05fefda174a19a5), JH_C(0x974d66334cfd216a),
+    JH_C(0x35b49831db411570), JH_C(0xea1e0fbbedcd549b),
+    JH_C(0x9ad063a151974072), JH_C(0xf6759dbf91476fe2)
+};
+
+#undef JH_C
+
+template<typename V>
+LANES_INLINE void JHSbox(V& x0, V& x1, V& x2, V& x3, const V& c)
+{
+    V tmp;
+    x3 = ~x3;
+    x0 ^= c & ~x2;
+    tmp = c ^ (x0 & x1);
+    x0 ^= x2 & x3;
+    x3 ^= ~x1 & x2;
+    x1 ^= x0 & x2;
+    x2 ^= x0 & ~x3;
+    x0 ^= x1 | x3;
+    x3 ^= x1 & x2;
+    x1 ^= tmp & x0;
+    x2 ^= tmp;
+}
+
+template<typename V>
+LANES_INLINE void JHLinear(V& x0, V& x1, V& x2, V& x3, V& x4, V& x5, V& x6, V& x7)
+{
+    x4 ^= x1;
+    x5 ^= x2;
+    x6 ^= x3 ^ x0;
+    x7 ^= x0;
+    x0 ^= x5;
+    x1 ^= x6;
+    x2 ^= x7 ^ x4;
+    x3 ^= x4;
+}
+
+/** Swap adjacent groups of 2^nGroup bits within each 64-bit half of a word;
+ *  the sixth swap exchanges the halves themselves */
+template<typename V>
+LANES_INLINE void JHSwap(V& xh, V& xl, int nGroup)
+{
+    static const uint64_t vMasks[6] =
+    {
+        0x5555555555555555ULL, 0x3333333333333333ULL, 0x0F0F0F0F0F0F0F0FULL,
+        0x00FF00FF00FF00FFULL, 0x0000FFFF0000FFFFULL, 0x00000000FFFFFFFFULL,
+    };
+    if (nGroup == 6)
+    {
+        V t = xh;
+        xh = xl;
+        xl = t;
+        return;
+    }
+    const V c = SPLATV(V, vMasks[nGroup]);
+    const int n = 1 << nGroup;
+    xh = ((xh >> n) & c) | ((xh & c) << n);
+    xl = ((xl >> n) & c) | ((xl & c) << n);
+}
+
+/** h[2 * i] and h[2 * i + 1] are the high and low halves of JH word i */
+template<typename V>
+LANES_INLINE void JHRound(V h[16], int r, int nGroup)
+{
+    const uint64_t* pC = JHRoundConstants + 4 * r;
+    JHSbox(h[0], h[4], h[8], h[12], SPLATV(V, pC[0]));
+    JHSbox(h[1], h[5], h[9], h[13], SPLATV(V, pC[1]));
+    JHSbox(h[2], h[6], h[10], h[14], SPLATV(V, pC[2]));
+    JHSbox(h[3], h[7], h[11], h[15], SPLATV(V, pC[3]));
+    JHLinear(h[0], h[4], h[8], h[12], h[2], h[6], h[10], h[14]);
+    JHLinear(h[1], h[5], h[9], h[13], h[3], h[7], h[11], h[15]);
+    for (int i = 2; i < 16; i += 4)
+        JHSwap(h[i], h[i + 1], nGroup);
+}
+
+template<typename V>
+LANES_INLINE void Hash64xN_jh(const unsigned char* const* pin, unsigned char* const* pout)
+{
+    uint64_t vIV[16];
+    memcpy(vIV, &HMQ1725InitialContexts().jh.H, sizeof(vIV));
+    V h[16], m[8];
+    for (int i = 0; i < 16; i++)
+        h[i] = SPLATV(V, vIV[i]);
+
+    // The message block, then the padding block: 0x80, zeros and the
+    // 128-bit big-endian bit length
+    for (int i = 0; i < 8; i++)
+        LoadLanes<uint64_t>(m[i], pin, 8 * i);
+    for (int nBlock = 0; nBlock < 2; nBlock++)
+    {
+        if (nBlock == 1)
+        {
+            for (int i = 0; i < 8; i++)
+                m[i] = SPLATV(V, 0ULL);
+            m[0] = SPLATV(V, 0x80ULL);
+            m[7] = SPLATV(V, __builtin_bswap64(512ULL));
+        }
+        for (int i = 0; i < 8; i++)
+            h[i] ^= m[i];
+        for (int r = 0; r < 42; r += 7)
+        {
+#pragma GCC unroll 7
+            for (int nGroup = 0; nGroup < 7; nGroup++)
+                JHRound(h, r + nGroup, nGroup);
+        }
+        for (int i = 0; i < 8; i++)
+            h[8 + i] ^= m[i];
+    }
+
+    for (int i = 0; i < 8; i++)
+        StoreLanes<uint64_t>(h[8 + i], pout, 8 * i);
+}
+
+// Keccak-512 (sph variant: 0x01 ... 0x80 padding)
+
+const uint64_t KeccakRoundConstants[24] =
+{
+    0x0000000000000001ULL, 0x0000000000008082ULL, 0x800000000000808AULL,
+    0x8000000080008000ULL, 0x000000000000808BULL, 0x0000000080000001ULL,
+    0x8000000080008081ULL, 0x8000000000008009ULL, 0x000000000000008AULL,
+    0x0000000000000088ULL, 0x0000000080008009ULL, 0x000000008000000AULL,
+    0x000000008000808BULL, 0x800000000000008BULL, 0x8000000000008089ULL,
+    0x8000000000008003ULL, 0x8000000000008002ULL, 0x8000000000000080ULL,
+    0x000000000000800AULL, 0x800000008000000AULL, 0x8000000080008081ULL,
+    0x8000000000008080ULL, 0x0000000080000001ULL, 0x8000000080008008ULL,
+};
+
+#define CHIV(a, b, c) ((a) ^ (~(b) & (c)))
+
+template<typename V>
+LANES_INLINE void Hash64xN_keccak(const unsigned char* const* pin, unsigned char* const* pout)
+{
+    V A[25], B[25], C[5], D[5];
+
+    // Absorb: the whole message plus padding fits in one 72-byte block
+    for (int i = 0; i < 8; i++)
+        LoadLanes<uint64_t>(A[i], pin, 8 * i);
+    A[8] = SPLATV(V, 0x8000000000000001ULL);
+    for (int i = 9; i < 25; i++)
+        A[i] = SPLATV(V, 0ULL);
+
+    for (int round = 0; round < 24; round++)
+    {
+        // theta
+#pragma GCC unroll 5
+        for (int x = 0; x < 5; x++)
+            C[x] = A[x] ^ A[x + 5] ^ A[x + 10] ^ A[x + 15] ^ A[x + 20];
+#pragma GCC unroll 5
+        for (int x = 0; x < 5; x++)
+            D[x] = C[(x + 4) % 5] ^ ROTL64V(C[(x + 1) % 5], 1);
+#pragma GCC unroll 25
+        for (int i = 0; i < 25; i++)
+            A[i] ^= D[i % 5];
+
+        // rho and pi
+        B[ 0] = A[0];
+        B[ 1] = ROTL64V(A[ 6], 44);
+        B[ 2] = ROTL64V(A[12], 43);
+        B[ 3] = ROTL64V(A[18], 21);
+        B[ 4] = ROTL64V(A[24], 14);
+        B[ 5] = ROTL64V(A[ 3], 28);
+        B[ 6] = ROTL64V(A[ 9], 20);
+        B[ 7] = ROTL64V(A[10],  3);
+        B[ 8] = ROTL64V(A[16], 45);
+        B[ 9] = ROTL64V(A[22], 61);
+        B[10] = ROTL64V(A[ 1],  1);
+        B[11] = ROTL64V(A[ 7],  6);
+        B[12] = ROTL64V(A[13], 25);
+        B[13] = ROTL64V(A[19],  8);
+        B[14] = ROTL64V(A[20], 18);
+        B[15] = ROTL64V(A[ 4], 27);
+        B[16] = ROTL64V(A[ 5], 36);
+        B[17] = ROTL64V(A[11], 10);
+        B[18] = ROTL64V(A[17], 15);
+        B[19] = ROTL64V(A[23], 56);
+        B[20] = ROTL64V(A[ 2], 62);
+        B[21] = ROTL64V(A[ 8], 55);
+        B[22] = ROTL64V(A[14], 39);
+        B[23] = ROTL64V(A[15], 41);
+        B[24] = ROTL64V(A[21],  2);
+
+        // chi
+#pragma GCC unroll 5
+        for (int y = 0; y < 25; y += 5)
+        {
+            A[y + 0] = CHIV(B[y + 0], B[y + 1], B[y + 2]);
+            A[y + 1] = CHIV(B[y + 1], B[y + 2], B[y + 3]);
+            A[y + 2] = CHIV(B[y + 2], B[y + 3], B[y + 4]);
+            A[y + 3] = CHIV(B[y + 3], B[y + 4], B[y + 0]);
+            A[y + 4] = CHIV(B[y + 4], B[y + 0], B[y + 1]);
+        }
+
+        // iota
+        A[0] ^= SPLATV(V, KeccakRoundConstants[round]);
+    }
+
+    for (int i = 0; i < 8; i++)
+        StoreLanes<uint64_t>(A[i], pout, 8 * i);
+}
+
+#undef CHIV
+
+// Luffa-512 (five 256-bit sub-permutations of 8 steps per 32-byte block)
+
+const uint32_t LuffaRoundConstants[5][2][8] =
+{
+    {
+        { 0x303994a6, 0xc0e65299, 0x6cc33a12, 0xdc56983e, 0x1e00108f, 0x7800423d, 0x8f5b7882, 0x96e1db12 },
+        { 0xe0337818, 0x441ba90d, 0x7f34d442, 0x9389217f, 0xe5a8bce6, 0x5274baf4, 0x26889ba7, 0x9a226e9d },
+    },
+    {
+        { 0xb6de10ed, 0x70f47aae, 0x0707a3d4, 0x1c1e8f51, 0x707a3d45, 0xaeb28562, 0xbaca1589, 0x40a46f3e },
+        { 0x01685f3d, 0x05a17cf4, 0xbd09caca, 0xf4272b28, 0x144ae5cc, 0xfaa7ae2b, 0x2e48f1c1, 0xb923c704 },
+    },
+    {
+        { 0xfc20d9d2, 0x34552e25, 0x7ad8818f, 0x8438764a, 0xbb6de032, 0xedb780c8, 0xd9847356, 0xa2c78434 },
+        { 0xe25e72c1, 0xe623bb72, 0x5c58a4a4, 0x1e38e2e7, 0x78e38b9d, 0x27586719, 0x36eda57f, 0x703aace7 },
+    },
+    {
+        { 0xb213afa5, 0xc84ebe95, 0x4e608a22, 0x56d858fe, 0x343b138f, 0xd0ec4e3d, 0x2ceb4882, 0xb3ad2208 },
+        { 0xe028c9bf, 0x44756f91, 0x7e8fce32, 0x956548be, 0xfe191be2, 0x3cb226e5, 0x5944a28e, 0xa1c4c355 },
+    },
+    {
+        { 0xf0d2e9e3, 0xac11d7fa, 0x1bcb66f2, 0x6f2d9bc9, 0x78602649, 0x8edae952, 0x3b6ba548, 0xedae9520 },
+        { 0x5090d577, 0x2d1925ab, 0xb46496ac, 0xd1925ab0, 0x29131ab6, 0x0fc053c3, 0x3f014f0c, 0xfc053c31 },
+    },
+};
+
+/** Multiplication by 2 in the Luffa field; d may be s */
+template<typename V>
+LANES_INLINE void LuffaMul2(V d[8], const V s[8])
+{
+    V tmp = s[7];
+    d[7] = s[6];
+    d[6] = s[5];
+    d[5] = s[4];
+    d[4] = s[3] ^ tmp;
+    d[3] = s[2] ^ tmp;
+    d[2] = s[1];
+    d[1] = s[0] ^ tmp;
+    d[0] = tmp;
+}
+
+template<typename V>
+LANES_INLINE void LuffaXor(V d[8], const V s[8])
+{
+    for (int i = 0; i < 8; i++)
+        d[i] ^= s[i];
+}
+
+template<typename V>
+LANES_INLINE void LuffaSubCrumb(V& a0, V& a1, V& a2, V& a3)
+{
+    V tmp = a0;
+    a0 |= a1;
+    a2 ^= a3;
+    a1 = ~a1;
+    a0 ^= a3;
+    a3 &= tmp;
+    a1 ^= a3;
+    a3 ^= a2;
+    a2 &= a0;
+    a0 = ~a0;
+    a2 ^= a1;
+    a1 |= a3;
+    tmp ^= a1;
+    a3 ^= a2;
+    a2 &= a1;
+    a1 ^= a0;
+    a0 = tmp;
+}
+
+template<typename V>
+LANES_INLINE void LuffaMixWord(V& u, V& v)
+{
+    v ^= u;
+    u = ROTL32V(u, 2) ^ v;
+    v = ROTL32V(v, 14) ^ u;
+    u = ROTL32V(u, 10) ^ v;
+    v = ROTL32V(v, 1);
+}
+
+/** Message injection of block M, then the five tweaked sub-permutations */
+template<typename V>
+LANES_INLINE void LuffaBlock(V S[5][8], V M[8])
+{
+    V a[8], b[8];
+
+    for (int i = 0; i < 8; i++)
+        a[i] = S[0][i] ^ S[1][i] ^ S[2][i] ^ S[3][i] ^ S[4][i];
+    LuffaMul2(a, a);
+    for (int j = 0; j < 5; j++)
+        LuffaXor(S[j], a);
+    LuffaMul2(b, S[0]);
+    LuffaXor(b, S[1]);
+    for (int j = 1; j < 5; j++)
+    {
+        LuffaMul2(S[j], S[j]);
+        LuffaXor(S[j], S[(j + 1) % 5]);
+    }
+    LuffaMul2(S[0], b);
+    LuffaXor(S[0], S[4]);
+    for (int j = 4; j > 0; j--)
+    {
+        LuffaMul2(S[j], S[j]);
+        LuffaXor(S[j], j > 1 ? S[j - 1] : b);
+    }
+    for (int j = 0; j < 5; j++)
+    {
+        if (j > 0)
+            LuffaMul2(M, M);
+        LuffaXor(S[j], M);
+    }
+
+    for (int j = 1; j < 5; j++)
+        for (int i = 4; i < 8; i++)
+            S[j][i] = (S[j][i] << j) | (S[j][i] >> (32 - j));
+    for (int j = 0; j < 5; j++)
+    {
+        V* v = S[j];
+        for (int r = 0; r < 8; r++)
+        {
+            LuffaSubCrumb(v[0], v[1], v[2], v[3]);
+            LuffaSubCrumb(v[5], v[6], v[7], v[4]);
+            LuffaMixWord(v[0], v[4]);
+            LuffaMixWord(v[1], v[5]);
+            LuffaMixWord(v[2], v[6]);
+            LuffaMixWord(v[3], v[7]);
+            v[0] ^= SPLATV(V, LuffaRoundConstants[j][0][r]);
+            v[4] ^= SPLATV(V, LuffaRoundConstants[j][1][r]);
+        }
+    }
+}
+
+template<typename V>
+LANES_INLINE void Hash64xN_luffa(const unsigned char* const* pin, unsigned char* const* pout)
+{
+    const HMQ1725Contexts& contexts = HMQ1725InitialContexts();
+    V S[5][8], M[8];
+    for (int j = 0; j < 5; j++)
+        for (int i = 0; i < 8; i++)
+            S[j][i] = SPLATV(V, contexts.luffa.V[j][i]);
+
+    // Two message blocks, the padding block, then two blank rounds that
+    // each produce half of the output
+    for (int nBlock = 0; nBlock < 5; nBlock++)
+    {
+        for (int i = 0; i < 8; i++)
+        {
+            if (nBlock < 2)
+                LoadLanesBE32(M[i], pin, 32 * nBlock + 4 * i);
+            else
+                M[i] = SPLATV(V, nBlock == 2 && i == 0 ? 0x80000000U : 0U);
+        }
+        LuffaBlock(S, M);
+        if (nBlock >= 3)
+            for (int i = 0; i < 8; i++)
+                StoreLanesBE32(S[0][i] ^ S[1][i] ^ S[2][i] ^ S[3][i] ^ S[4][i], pout, 32 * (nBlock - 3) + 4 * i);
+    }
+}
+
+#define HMQ1725_LANE_KERNEL(name, isa, suffix, vectype) \
+__attribute__((target(isa))) \
+void Hash64xN_##name##_##suffix(const unsigned char* const* pin, unsigned char* const* pout) \
+{ \
+    Hash64xN_##name<vectype>(pin, pout); \
+}
+
+HMQ1725_LANE_KERNEL(cubehash, "sse4.1", sse41, u32x4)
+HMQ1725_LANE_KERNEL(jh,       "sse4.1", sse41, u64x2)
+HMQ1725_LANE_KERNEL(keccak,   "sse4.1", sse41, u64x2)
+HMQ1725_LANE_KERNEL(luffa,    "sse4.1", sse41, u32x4)
+HMQ1725_LANE_KERNEL(cubehash, "avx2",   avx2,  u32x8)
+HMQ1725_LANE_KERNEL(jh,       "avx2",   avx2,  u64x4)
+HMQ1725_LANE_KERNEL(keccak,   "avx2",   avx2,  u64x4)
+HMQ1725_LANE_KERNEL(luffa,    "avx2",   avx2,  u32x8)
+
+#undef HMQ1725_LANE_KERNEL
+#undef LANES_INLINE
+#undef ROTL32V
+#undef ROTL64V
+#undef SPLATV
+
+#endif // HMQ1725_X86_DISPATCH
+
+struct HMQ1725LaneKernel
+{
+    HMQ1725Func fn;
+    Hash64xNFn fnLanes;
+    unsigned int nLanes;
+};
+
+#ifdef HMQ1725_X86_DISPATCH
+
+const HMQ1725LaneKernel vKernelsSSE41[] =
+{
+    { HMQ_CUBEHASH, Hash64xN_cubehash_sse41, 4 },
+    { HMQ_JH,       Hash64xN_jh_sse41,       2 },
+    { HMQ_KECCAK,   Hash64xN_keccak_sse41,   2 },
+    { HMQ_LUFFA,    Hash64xN_luffa_sse41,    4 },
+};
+
+const HMQ1725LaneKernel vKernelsAVX2[] =
+{
+    { HMQ_CUBEHASH, Hash64xN_cubehash_avx2, 8 },
+    { HMQ_JH,       Hash64xN_jh_avx2,       4 },
+    { HMQ_KECCAK,   Hash64xN_keccak_avx2,   4 },
+    { HMQ_LUFFA,    Hash64xN_luffa_avx2,    8 },
+};
+
+#endif // HMQ1725_X86_DISPATCH
+
+struct HMQ1725Dispatch
+{
+    Hash64xNFn vLanes[HMQ_FUNC_COUNT];
+    unsigned int vLaneCount[HMQ_FUNC_COUNT];
+    const char* pszName;
+    bool fSelfTestPassed;
+
+    HMQ1725Dispatch()
+    {
+        for (int i = 0; i < HMQ_FUNC_COUNT; i++)
+        {
+            vLanes[i] = NULL;
+            vLaneCount[i] = 1;
+        }
+        pszName = "generic";
+        fSelfTestPassed = true;
+#ifdef HMQ1725_X86_DISPATCH
+        // Every kernel set this CPU supports is checked, narrowest first,
+        // and the widest one that passes is used
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("sse4.1"))
+            Select("sse4.1", vKernelsSSE41, sizeof(vKernelsSSE41) / sizeof(vKernelsSSE41[0]));
+        if (__builtin_cpu_supports("avx2"))
+            Select("avx2", vKernelsAVX2, sizeof(vKernelsAVX2) / sizeof(vKernelsAVX2[0]));
+#endif
+    }
+
+    void Select(const char* pszSet, const HMQ1725LaneKernel* pKernels, size_t nKernels)
+    {
+        for (size_t i = 0; i < nKernels; i++)
+        {
+            if (!SelfTest(pKernels[i]))
+            {
+                fSelfTestPassed = false;
+                return;
+            }
+        }
+        for (size_t i = 0; i < nKernels; i++)
+        {
+            vLanes[pKernels[i].fn] = pKernels[i].fnLanes;
+            vLaneCount[pKernels[i].fn] = pKernels[i].nLanes;
+        }
+        pszName = pszSet;
+    }
+
+    /** Compare a lane kernel against the sph code on distinct inputs in
+     *  every lane, each one fed the previous output as the chain does */
+    static bool SelfTest(const HMQ1725LaneKernel& kernel)
+    {
+        unsigned char vch[HMQ1725_MAX_LANES][64], vchTest[HMQ1725_MAX_LANES][64], vchRef[64];
+        const unsigned char* vpin[HMQ1725_MAX_LANES];
+        unsigned char* vpout[HMQ1725_MAX_LANES];
+        for (unsigned int l = 0; l < kernel.nLanes; l++)
+        {
+            for (int i = 0; i < 64; i++)
+                vch[l][i] = i * (l + 1);
+            vpin[l] = vch[l];
+            vpout[l] = vchTest[l];
+        }
+        for (int n = 0; n < 16; n++)
+        {
+            kernel.fnLanes(vpin, vpout);
+            for (unsigned int l = 0; l < kernel.nLanes; l++)
+            {
+                vScalar[kernel.fn](vch[l], vchRef);
+                if (memcmp(vchTest[l], vchRef, 64) != 0)
+                    return false;
+                memcpy(vch[l], vchRef, 64);
+            }
+        }
+        return true;
+    }
+};
+
+const HMQ1725Dispatch& GetDispatch()
+{
+    static const HMQ1725Dispatch dispatch;
+    return dispatch;
+}
+
+/** Run one primitive over the inputs listed in vGroup, reading 64-byte
+ *  chaining values from pin and writing them to pout. */
+void HashGroup(const HMQ1725Dispatch& dispatch, HMQ1725Func fn, const std::vector<unsigned int>& vGroup,
+               const unsigned char* pin, unsigned char* pout)
+{
+    size_t i = 0;
+    if (dispatch.vLanes[fn])
+    {
+        const unsigned int nLanes = dispatch.vLaneCount[fn];
+        const unsigned char* vpin[HMQ1725_MAX_LANES];
+        unsigned char* vpout[HMQ1725_MAX_LANES];
+        for (; i + nLanes <= vGroup.size(); i += nLanes)
+        {
+            for (unsigned int l = 0; l < nLanes; l++)
+            {
+                vpin[l] = pin + 64 * vGroup[i + l];
+                vpout[l] = pout + 64 * vGroup[i + l];
+            }
+            dispatch.vLanes[fn](vpin, vpout);
+        }
+    }
+    for (; i < vGroup.size(); i++)
+        vScalar[fn](pin + 64 * vGroup[i], pout + 64 * vGroup[i]);
+}
+
+} // anon namespace
+
+HMQ1725Contexts::HMQ1725Contexts()
+{
+    sph_blake512_init(&blake);
+    sph_bmw512_init(&bmw);
+    sph_groestl512_init(&groestl);
+    sph_jh512_init(&jh);
+    sph_keccak512_init(&keccak);
+    sph_skein512_init(&skein);
+    sph_luffa512_init(&luffa);
+    sph_cubehash512_init(&cubehash);
+    sph_shavite512_init(&shavite);
+    sph_simd512_init(&simd);
+    sph_echo512_init(&echo);
+    sph_hamsi512_init(&hamsi);
+    sph_fugue512_init(&fugue);
+    sph_shabal512_init(&shabal);
+    sph_whirlpool_init(&whirlpool);
+    sph_sha512_init(&sha2);
+    sph_haval256_5_init(&haval);
+}
+
+const HMQ1725Contexts& HMQ1725InitialContexts()
+{
+    // Function-local so that hashes computed during static initialization
+    // (the genesis block in chainparams.cpp) see constructed contexts
+    static const HMQ1725Contexts contexts;
+    return contexts;
+}
+
+CHMQ1725::CHMQ1725() : ctx(HMQ1725InitialContexts().bmw)
+{
+}
+
+CHMQ1725& CHMQ1725::Write(const unsigned char* data, size_t len)
+{
+    sph_bmw512(&ctx, data, len);
+    return *this;
+}
+
+void CHMQ1725::Finalize(unsigned char hash[OUTPUT_SIZE])
+{
+    unsigned char vch[2][64];
+    sph_bmw512_close(&ctx, vch[0]);
+
+    int nCur = 0;
+    for (unsigned int s = 0; s < sizeof(vStages) / sizeof(vStages[0]); s++)
+    {
+        uint32_t nLow;
+        memcpy(&nLow, vch[nCur], sizeof(nLow));
+        vScalar[(nLow & 24) != 0 ? vStages[s].fnTrue : vStages[s].fnFalse](vch[nCur], vch[nCur ^ 1]);
+        nCur ^= 1;
+    }
+    memcpy(hash, vch[nCur], OUTPUT_SIZE);
+}
+
+CHMQ1725& CHMQ1725::Reset()
+{
+    ctx = HMQ1725InitialContexts().bmw;
+    return *this;
+}
+
+void HMQ1725Batch(const std::vector<HMQ1725Input>& vInputs, std::vector<uint256>& vHashRet)
+{
+    const HMQ1725Dispatch& dispatch = GetDispatch();
+    const unsigned int nCount = vInputs.size();
+    static unsigned char pblank[1];
+
+    vHashRet.resize(nCount);
+    if (nCount == 0)
+        return;
+
+    std::vector<unsigned char> vA(64 * nCount), vB(64 * nCount);
+    unsigned char* pin = &vA[0];
+    unsigned char* pout = &vB[0];
+
+    // hash[0]: BMW over the variable length input
+    for (unsigned int i = 0; i < nCount; i++)
+    {
+        sph_bmw512_context ctx = HMQ1725InitialContexts().bmw;
+        sph_bmw512(&ctx, vInputs[i].second ? vInputs[i].first : pblank, vInputs[i].second);
+        sph_bmw512_close(&ctx, pin + 64 * i);
+    }
+
+    std::vector<unsigned int> vGroup[2];
+    vGroup[0].reserve(nCount);
+    vGroup[1].reserve(nCount);
+    for (unsigned int s = 0; s < sizeof(vStages) / sizeof(vStages[0]); s++)
+    {
+        const HMQ1725Stage& stage = vStages[s];
+        vGroup[0].clear();
+        vGroup[1].clear();
+        for (unsigned int i = 0; i < nCount; i++)
+        {
+            uint32_t nLow;
+            memcpy(&nLow, pin + 64 * i, sizeof(nLow));
+            vGroup[stage.fnTrue == stage.fnFalse || (nLow & 24) != 0 ? 0 : 1].push_back(i);
+        }
+        HashGroup(dispatch, stage.fnTrue, vGroup[0], pin, pout);
+        HashGroup(dispatch, stage.fnFalse, vGroup[1], pin, pout);
+        std::swap(pin, pout);
+    }
+
+    for (unsigned int i = 0; i < nCount; i++)
+        memcpy(vHashRet[i].begin(), pin + 64 * i, 32);
+}
+
+const char* HMQ1725BatchImplementation()
+{
+    return GetDispatch().pszName;
+}
+
+bool HMQ1725BatchSelfTest()
+{
+    return GetDispatch().fSelfTestPassed;
+}
+
+int HMQ1725PrimitiveCount()
+{
+    return HMQ_FUNC_COUNT;
+}
+
+const char* HMQ1725PrimitiveName(int nPrimitive)
+{
+    assert(nPrimitive >= 0 && nPrimitive < HMQ_FUNC_COUNT);
+    return vNames[nPrimitive];
+}
+
+void HMQ1725Primitive(int nPrimitive, const void* pin, void* pout)
+{
+    assert(nPrimitive >= 0 && nPrimitive < HMQ_FUNC_COUNT);
+    vScalar[nPrimitive]((const unsigned char*)pin, (unsigned char*)pout);
+}
+
+int HMQ1725PrimitiveLanes(int nPrimitive)
+{
+    assert(nPrimitive >= 0 && nPrimitive < HMQ_FUNC_COUNT);
+    return GetDispatch().vLaneCount[nPrimitive];
+}
+
+void HMQ1725PrimitiveBatch(int nPrimitive, const void* pin, void* pout, unsigned int nCount)
+{
+    assert(nPrimitive >= 0 && nPrimitive < HMQ_FUNC_COUNT);
+    std::vector<unsigned int> vGroup(nCount);
+    for (unsigned int i = 0; i < nCount; i++)
+        vGroup[i] = i;
+    HashGroup(GetDispatch(), (HMQ1725Func)nPrimitive, vGroup, (const unsigned char*)pin, (unsigned char*)pout);
+}
+
+int HMQ1725StageCount()
+{
+    return sizeof(vStages) / sizeof(vStages[0]);
+}
+
+void HMQ1725StagePrimitives(int nStage, int& nTrueRet, int& nFalseRet)
+{
+    assert(nStage >= 0 && nStage < HMQ1725StageCount());
+    nTrueRet = vStages[nStage].fnTrue;
+    nFalseRet = vStages[nStage].fnFalse;
+}
@@ -25,279 +25,119 @@
 #include "sph_sha2.h"
 #include "sph_haval.h"
 
-#ifndef QT_NO_DEBUG
-#include <string>
+#include <utility>
+#include <vector>
 
-#endif
-
-#ifdef GLOBALDEFINED
-#define GLOBAL
-#else
-#define GLOBAL extern
-#endif
-
-GLOBAL sph_blake512_context     z_blake;
-GLOBAL sph_bmw512_context       z_bmw;
-GLOBAL sph_groestl512_context   z_groestl;
-GLOBAL sph_jh512_context        z_jh;
-GLOBAL sph_keccak512_context    z_keccak;
-GLOBAL sph_skein512_context     z_skein;
-/** ADDED FOR HMQ1725 */
-GLOBAL sph_luffa512_context     z_luffa;
-GLOBAL sph_cubehash512_context  z_cubehash;
-GLOBAL sph_shavite512_context   z_shavite;
-GLOBAL sph_simd512_context      z_simd;
-GLOBAL sph_echo512_context      z_echo;
-GLOBAL sph_hamsi512_context     z_hamsi;
-GLOBAL sph_fugue512_context     z_fugue;
-GLOBAL sph_shabal512_context    z_shabal;
-GLOBAL sph_whirlpool_context    z_whirlpool;
-GLOBAL sph_sha512_context       z_sha2;
-GLOBAL sph_haval256_5_context   z_haval;
+/** sph contexts in their initial state. Built once on first use and copied
+ * wherever a fresh context is needed, instead of running the sph init
+ * functions on every hash. */
+struct HMQ1725Contexts
+{
+    sph_blake512_context     blake;
+    sph_bmw512_context       bmw;
+    sph_groestl512_context   groestl;
+    sph_jh512_context        jh;
+    sph_keccak512_context    keccak;
+    sph_skein512_context     skein;
+    sph_luffa512_context     luffa;
+    sph_cubehash512_context  cubehash;
+    sph_shavite512_context   shavite;
+    sph_simd512_context      simd;
+    sph_echo512_context      echo;
+    sph_hamsi512_context     hamsi;
+    sph_fugue512_context     fugue;
+    sph_shabal512_context    shabal;
+    sph_whirlpool_context    whirlpool;
+    sph_sha512_context       sha2;
+    sph_haval256_5_context   haval;
+
+    HMQ1725Contexts();
+};
+
+/** The shared initial contexts; safe to call from any thread, including
+ * during static initialization */
+const HMQ1725Contexts& HMQ1725InitialContexts();
+
+/** Groestl-512, ECHO-512 and SHAvite-3-512 of one 64-byte chaining value.
+ * These use AES-NI when the CPU has it and the sph code otherwise; the
+ * AES-NI kernels are checked against the sph code before first use.
+ */
+void HMQ1725Groestl512(const void* pin, void* pout);
+void HMQ1725Echo512(const void* pin, void* pout);
+void HMQ1725Shavite512(const void* pin, void* pout);
+
+/** Name of the kernels selected for the AES based stages ("aesni" or "sph") */
+const char* HMQ1725AESImplementation();
+
+/** False if this CPU has AES-NI but the AES-NI kernels disagreed with the
+ * sph code, in which case the sph code is used */
+bool HMQ1725AESSelfTest();
+
+/** Incremental HMQ1725. The message is absorbed by the initial BMW stage as
+ * it is written; the remaining 24 stages run on Finalize(). Instances hold no
+ * shared state, so separate instances can be used from different threads.
+ */
+class CHMQ1725
+{
+public:
+    static const size_t OUTPUT_SIZE = 32;
 
-#define fillz() do { \
-    sph_blake512_init(&z_blake); \
-    sph_bmw512_init(&z_bmw); \
-    sph_groestl512_init(&z_groestl); \
-    sph_jh512_init(&z_jh); \
-    sph_keccak512_init(&z_keccak); \
-    sph_skein512_init(&z_skein); \
-    sph_luffa512_init(&z_luffa); \
-    sph_cubehash512_init(&z_cubehash); \
-    sph_shavite512_init(&z_shavite); \
-    sph_simd512_init(&z_simd); \
-    sph_echo512_init(&z_echo); \
-    sph_hamsi512_init(&z_hamsi); \
-    sph_fugue512_init(&z_fugue); \
-    sph_shabal512_init(&z_shabal); \
-    sph_whirlpool_init(&z_whirlpool); \
-    sph_sha512_init(&z_sha2); \
-    sph_haval256_5_init(&z_haval); \
-    } while (0) 
+    CHMQ1725();
+    CHMQ1725& Write(const unsigned char* data, size_t len);
+    void Finalize(unsigned char hash[OUTPUT_SIZE]);
+    CHMQ1725& Reset();
 
-#define ZBLAKE (memcpy(&ctx_blake, &z_blake, sizeof(z_blake)))
-#define ZBMW (memcpy(&ctx_bmw, &z_bmw, sizeof(z_bmw)))
-#define ZGROESTL (memcpy(&ctx_groestl, &z_groestl, sizeof(z_groestl)))
-#define ZJH (memcpy(&ctx_jh, &z_jh, sizeof(z_jh)))
-#define ZKECCAK (memcpy(&ctx_keccak, &z_keccak, sizeof(z_keccak)))
-#define ZSKEIN (memcpy(&ctx_skein, &z_skein, sizeof(z_skein)))
-/** ADDED FOR HMQ1725 */
-#define ZWHIRLPOOL (memcpy(&ctx_whirlpool, &z_whirlpool, sizeof(z_whirlpool)))
-#define ZFUGUE (memcpy(&ctx_fugue, &z_fugue, sizeof(z_fugue)))
-#define ZHAMSI (memcpy(&ctx_hamsi, &z_hamsi, sizeof(z_hamsi)))
-#define ZSHABAL (memcpy(&ctx_shabal, &z_shabal, sizeof(z_shabal))
-#define ZSHA2 (memcpy(&ctx_sha2, &z_sha2, sizeof(z_sha2)))
-#define ZHAVAL (memcpy(&ctx_haval, &z_haval, sizeof(z_haval)))
+private:
+    sph_bmw512_context ctx;
+};
 
 template<typename T1>
 inline uint256 HMQ1725(const T1 pbegin, const T1 pend)
-
 {
-    sph_blake512_context     ctx_blake;
-    sph_bmw512_context       ctx_bmw;
-    sph_groestl512_context   ctx_groestl;
-    sph_jh512_context        ctx_jh;
-    sph_keccak512_context    ctx_keccak;
-    sph_skein512_context     ctx_skein;
-        /** added for HMQ1725 */
-    sph_luffa512_context      ctx_luffa;
-    sph_cubehash512_context   ctx_cubehash;
-    sph_shavite512_context    ctx_shavite;
-    sph_simd512_context       ctx_simd;
-    sph_echo512_context       ctx_echo;
-    sph_hamsi512_context      ctx_hamsi;
-    sph_fugue512_context      ctx_fugue;
-    sph_shabal512_context     ctx_shabal;
-    sph_whirlpool_context     ctx_whirlpool;
-    sph_sha512_context        ctx_sha2;
-    sph_haval256_5_context    ctx_haval;
-    
-    static unsigned char pblank[1];
-
-#ifndef QT_NO_DEBUG
-    //std::string strhash;
-    //strhash = "";
-#endif
-//------------------initial integration of HMQ1725
-    uint512 mask = 24;
-    uint512 zero = 0;
-    
-    uint512 hash[25];
-    
-    sph_bmw512_init(&ctx_bmw);
-    sph_bmw512 (&ctx_bmw, (pbegin == pend ? pblank : static_cast<const void*>(&pbegin[0])), (pend - pbegin) * sizeof(pbegin[0]));
-    sph_bmw512_close(&ctx_bmw, static_cast<void*>(&hash[0]));
-
-    sph_whirlpool_init(&ctx_whirlpool);
-    sph_whirlpool (&ctx_whirlpool, static_cast<const void*>(&hash[0]), 64);
-    sph_whirlpool_close(&ctx_whirlpool, static_cast<void*>(&hash[1]));
-
-    if ((hash[1] & mask) != zero)
-    {
-        sph_groestl512_init(&ctx_groestl);
-        sph_groestl512 (&ctx_groestl, static_cast<const void*>(&hash[1]), 64);
-        sph_groestl512_close(&ctx_groestl, static_cast<void*>(&hash[2]));
-    }
-    else
-    {
-        sph_skein512_init(&ctx_skein);
-        sph_skein512 (&ctx_skein, static_cast<const void*>(&hash[1]), 64);
-        sph_skein512_close(&ctx_skein, static_cast<void*>(&hash[2]));
-    }
-
-
-    sph_jh512_init(&ctx_jh);
-    sph_jh512 (&ctx_jh, static_cast<const void*>(&hash[2]), 64);
-    sph_jh512_close(&ctx_jh, static_cast<void*>(&hash[3]));
-    
-    sph_keccak512_init(&ctx_keccak);
-    sph_keccak512 (&ctx_keccak, static_cast<const void*>(&hash[3]), 64);
-    sph_keccak512_close(&ctx_keccak, static_cast<void*>(&hash[4]));
-
-if ((hash[4] & mask) != zero)
-    {
-        sph_blake512_init(&ctx_blake);
-        sph_blake512 (&ctx_blake, static_cast<const void*>(&hash[4]), 64);
-        sph_blake512_close(&ctx_blake, static_cast<void*>(&hash[5]));
-    }
-    else
-    {
-        sph_bmw512_init(&ctx_bmw);
-        sph_bmw512 (&ctx_bmw, static_cast<const void*>(&hash[4]), 64);
-        sph_bmw512_close(&ctx_bmw, static_cast<void*>(&hash[5]));
-    }
-
-    sph_luffa512_init(&ctx_luffa);
-    sph_luffa512 (&ctx_luffa, static_cast<void*>(&hash[5]), 64);
-    sph_luffa512_close(&ctx_luffa, static_cast<void*>(&hash[6]));
-    
-    sph_cubehash512_init(&ctx_cubehash);
-    sph_cubehash512 (&ctx_cubehash, static_cast<const void*>(&hash[6]), 64);
-    sph_cubehash512_close(&ctx_cubehash, static_cast<void*>(&hash[7]));
- 
-if ((hash[7] & mask) != zero)
-    {
-        sph_keccak512_init(&ctx_keccak);
-        sph_keccak512 (&ctx_keccak, static_cast<const void*>(&hash[7]), 64);
-        sph_keccak512_close(&ctx_keccak, static_cast<void*>(&hash[8]));
-    }
-    else
-    {
-        sph_jh512_init(&ctx_jh);
-        sph_jh512 (&ctx_jh, static_cast<const void*>(&hash[7]), 64);
-        sph_jh512_close(&ctx_jh, static_cast<void*>(&hash[8]));
-    }
-
-    sph_shavite512_init(&ctx_shavite);
-    sph_shavite512(&ctx_shavite, static_cast<const void*>(&hash[8]), 64);
-    sph_shavite512_close(&ctx_shavite, static_cast<void*>(&hash[9]));
-        
-    sph_simd512_init(&ctx_simd);
-    sph_simd512 (&ctx_simd, static_cast<const void*>(&hash[9]), 64);
-    sph_simd512_close(&ctx_simd, static_cast<void*>(&hash[10]));
-
-if ((hash[10] & mask) != zero)
-    {
-    sph_whirlpool_init(&ctx_whirlpool);
-    sph_whirlpool (&ctx_whirlpool, static_cast<const void*>(&hash[10]), 64);
-    sph_whirlpool_close(&ctx_whirlpool, static_cast<void*>(&hash[11]));
-    }
-    else
-    {
-    sph_haval256_5_init(&ctx_haval);
-    sph_haval256_5 (&ctx_haval, static_cast<const void*>(&hash[10]), 64);
-    sph_haval256_5_close(&ctx_haval, static_cast<void*>(&hash[11]));
-    }
-
-    sph_echo512_init(&ctx_echo);
-    sph_echo512 (&ctx_echo, static_cast<const void*>(&hash[11]), 64);
-    sph_echo512_close(&ctx_echo, static_cast<void*>(&hash[12]));
-
-    sph_blake512_init(&ctx_blake);
-    sph_blake512 (&ctx_blake, static_cast<const void*>(&hash[12]), 64);
-    sph_blake512_close(&ctx_blake, static_cast<void*>(&hash[13]));
-
-if ((hash[13] & mask) != zero)
-    {
-    sph_shavite512_init(&ctx_shavite);
-    sph_shavite512(&ctx_shavite, static_cast<const void*>(&hash[13]), 64);
-    sph_shavite512_close(&ctx_shavite, static_cast<void*>(&hash[14]));
-    }
-    else
-    {
-    sph_luffa512_init(&ctx_luffa);
-    sph_luffa512 (&ctx_luffa, static_cast<void*>(&hash[13]), 64);
-    sph_luffa512_close(&ctx_luffa, static_cast<void*>(&hash[14]));
-    }
-
-    sph_hamsi512_init(&ctx_hamsi);
-    sph_hamsi512 (&ctx_hamsi, static_cast<const void*>(&hash[14]), 64);
-    sph_hamsi512_close(&ctx_hamsi, static_cast<void*>(&hash[15]));
-
-    sph_fugue512_init(&ctx_fugue);
-    sph_fugue512 (&ctx_fugue, static_cast<const void*>(&hash[15]), 64);
-    sph_fugue512_close(&ctx_fugue, static_cast<void*>(&hash[16]));
-
-if ((hash[16] & mask) != zero)
-    {
-    sph_echo512_init(&ctx_echo);
-    sph_echo512 (&ctx_echo, static_cast<const void*>(&hash[16]), 64);
-    sph_echo512_close(&ctx_echo, static_cast<void*>(&hash[17]));
-    }
-    else
-    {
-    sph_simd512_init(&ctx_simd);
-    sph_simd512 (&ctx_simd, static_cast<const void*>(&hash[16]), 64);
-    sph_simd512_close(&ctx_simd, static_cast<void*>(&hash[17]));
-    }
-
-    sph_shabal512_init(&ctx_shabal);
-    sph_shabal512 (&ctx_shabal, static_cast<const void*>(&hash[17]), 64);
-    sph_shabal512_close(&ctx_shabal, static_cast<void*>(&hash[18]));
-
-    sph_whirlpool_init(&ctx_whirlpool);
-    sph_whirlpool (&ctx_whirlpool, static_cast<const void*>(&hash[18]), 64);
-    sph_whirlpool_close(&ctx_whirlpool, static_cast<void*>(&hash[19]));
-
-if ((hash[19] & mask) != zero)
-    {
-    sph_fugue512_init(&ctx_fugue);
-    sph_fugue512 (&ctx_fugue, static_cast<const void*>(&hash[19]), 64);
-    sph_fugue512_close(&ctx_fugue, static_cast<void*>(&hash[20]));
-    }
-    else
-    {
-    sph_sha512_init(&ctx_sha2);
-    sph_sha512 (&ctx_sha2, static_cast<const void*>(&hash[19]), 64);
-    sph_sha512_close(&ctx_sha2, static_cast<void*>(&hash[20]));
-    }
-
-    sph_groestl512_init(&ctx_groestl);
-    sph_groestl512 (&ctx_groestl, static_cast<const void*>(&hash[20]), 64);
-    sph_groestl512_close(&ctx_groestl, static_cast<void*>(&hash[21]));
-
-    sph_sha512_init(&ctx_sha2);
-    sph_sha512 (&ctx_sha2, static_cast<const void*>(&hash[21]), 64);
-    sph_sha512_close(&ctx_sha2, static_cast<void*>(&hash[22]));
-
-if ((hash[22] & mask) != zero)
-    {
-    sph_haval256_5_init(&ctx_haval);
-    sph_haval256_5 (&ctx_haval, static_cast<const void*>(&hash[22]), 64);
-    sph_haval256_5_close(&ctx_haval, static_cast<void*>(&hash[23]));
-    }
-    else
-    {
-    sph_whirlpool_init(&ctx_whirlpool);
-    sph_whirlpool (&ctx_whirlpool, static_cast<const void*>(&hash[22]), 64);
-    sph_whirlpool_close(&ctx_whirlpool, static_cast<void*>(&hash[23]));
-    }
-
-    sph_bmw512_init(&ctx_bmw);
-    sph_bmw512 (&ctx_bmw, static_cast<const void*>(&hash[23]), 64);
-    sph_bmw512_close(&ctx_bmw, static_cast<void*>(&hash[24]));
-
-    return hash[24].trim256();
+    static const unsigned char pblank[1] = {0};
+    uint256 hash;
+    CHMQ1725().Write(pbegin == pend ? pblank : (const unsigned char*)&pbegin[0], (pend - pbegin) * sizeof(pbegin[0]))
+              .Finalize(hash.begin());
+    return hash;
 }
 
+/** A message to be hashed by HMQ1725Batch(): start pointer and length in bytes */
+typedef std::pair<const unsigned char*, size_t> HMQ1725Input;
+
+/** Compute HMQ1725 of many independent messages, giving the same results as
+ * calling HMQ1725() on each. The chain is run one stage at a time across the
+ * whole batch: inputs are regrouped by the branch they take at every
+ * data-dependent stage, so each primitive runs over a group of inputs at
+ * once. CubeHash, JH, Keccak and Luffa then hash several inputs per call
+ * with multi-lane SIMD kernels (AVX2, or SSE4.1, selected at runtime); the
+ * other primitives run one input at a time.
+ */
+void HMQ1725Batch(const std::vector<HMQ1725Input>& vInputs, std::vector<uint256>& vHashRet);
+
+/** Name of the multi-lane kernel set selected for this CPU ("avx2",
+ * "sse4.1", or "generic" if none) */
+const char* HMQ1725BatchImplementation();
+
+/** False if a multi-lane kernel set this CPU supports disagreed with the sph
+ * code, in which case the next narrower set (or none) is used */
+bool HMQ1725BatchSelfTest();
+
+/** Introspection for profiling tools such as bench_hmq1725. Primitives are
+ * the 17 hash functions used by the chain, each applied to a 64-byte
+ * chaining value through the same code paths as HMQ1725Batch(). Stages are
+ * the 24 links after the initial BMW over the message; stage n computes
+ * hash[n + 1] with the first primitive when (hash[n] & 24) != 0 and with
+ * the second otherwise.
+ */
+int HMQ1725PrimitiveCount();
+const char* HMQ1725PrimitiveName(int nPrimitive);
+void HMQ1725Primitive(int nPrimitive, const void* pin, void* pout);
+/** Inputs hashed per call by HMQ1725Batch() for a primitive (1 if scalar) */
+int HMQ1725PrimitiveLanes(int nPrimitive);
+/** Apply a primitive to nCount consecutive 64-byte values, as HMQ1725Batch()
+ * does for a group */
+void HMQ1725PrimitiveBatch(int nPrimitive, const void* pin, void* pout, unsigned int nCount);
+int HMQ1725StageCount();
+void HMQ1725StagePrimitives(int nStage, int& nTrueRet, int& nFalseRet);
+
 #endif // HASHBLOCK_H
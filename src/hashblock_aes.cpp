@@ -0,0 +1,430 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2012 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// Groestl-512, ECHO-512 and SHAvite-3-512 of a single 64-byte chaining value,
+// the only way HMQ1725 uses them. All three are built from AES rounds, so on
+// CPUs with AES-NI they are computed with aesenc/aesenclast instead of the
+// table driven aes_helper.c code. The sph implementations remain the
+// reference and the fallback.
+
+#include "hashblock.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#include <immintrin.h>
+#define HMQ1725_AESNI
+#endif
+
+namespace {
+
+void Groestl512_sph(const unsigned char* pin, unsigned char* pout)
+{
+    sph_groestl512_context ctx = HMQ1725InitialContexts().groestl;
+    sph_groestl512(&ctx, pin, 64);
+    sph_groestl512_close(&ctx, pout);
+}
+
+void Echo512_sph(const unsigned char* pin, unsigned char* pout)
+{
+    sph_echo512_context ctx = HMQ1725InitialContexts().echo;
+    sph_echo512(&ctx, pin, 64);
+    sph_echo512_close(&ctx, pout);
+}
+
+void Shavite512_sph(const unsigned char* pin, unsigned char* pout)
+{
+    sph_shavite512_context ctx = HMQ1725InitialContexts().shavite;
+    sph_shavite512(&ctx, pin, 64);
+    sph_shavite512_close(&ctx, pout);
+}
+
+#ifdef HMQ1725_AESNI
+
+#define AESNI_TARGET __attribute__((target("aes,ssse3")))
+
+/** Multiply every byte by x in GF(2^8) modulo the AES polynomial */
+AESNI_TARGET inline __m128i XTime(__m128i x)
+{
+    __m128i hi = _mm_cmplt_epi8(x, _mm_setzero_si128());
+    return _mm_xor_si128(_mm_add_epi8(x, x), _mm_and_si128(hi, _mm_set1_epi8(0x1b)));
+}
+
+//
+// Groestl-512: the 8x16 byte state is kept as one register per row, so
+// MixBytes becomes whole-register GF(2^8) arithmetic and SubBytes plus
+// ShiftBytes is one pshufb followed by aesenclast with a zero key.
+//
+
+// pshufb pattern that undoes the ShiftRows step of aesenclast
+const unsigned char GroestlInvShiftRows[16] = { 0, 13, 10, 7, 4, 1, 14, 11, 8, 5, 2, 15, 12, 9, 6, 3 };
+const int GroestlShiftP[8] = { 0, 1, 2, 3, 4, 5, 6, 11 };
+const int GroestlShiftQ[8] = { 1, 3, 5, 11, 0, 2, 4, 6 };
+
+// MixBytes output row: 2a[i] ^ 2a[i+1] ^ 3a[i+2] ^ 4a[i+3] ^ 5a[i+4] ^ 3a[i+5] ^ 5a[i+6] ^ 7a[i+7]
+#define GROESTL_MIXROW(i, i1, i2, i3, i4, i5, i6, i7) \
+    b[i] = _mm_xor_si128( \
+        _mm_xor_si128(_mm_xor_si128(x2[i], x2[i1]), _mm_xor_si128(x2[i2], a[i2])), \
+        _mm_xor_si128( \
+            _mm_xor_si128(x4[i3], _mm_xor_si128(x4[i4], a[i4])), \
+            _mm_xor_si128(_mm_xor_si128(_mm_xor_si128(x2[i5], a[i5]), _mm_xor_si128(x4[i6], a[i6])), \
+                          _mm_xor_si128(_mm_xor_si128(x4[i7], x2[i7]), a[i7]))))
+
+template<bool fQ>
+AESNI_TARGET void GroestlPermute(__m128i a[8])
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi8((char)0xff);
+    const __m128i columns = _mm_set_epi8((char)0xf0, (char)0xe0, (char)0xd0, (char)0xc0, (char)0xb0, (char)0xa0, (char)0x90, (char)0x80,
+                                         0x70, 0x60, 0x50, 0x40, 0x30, 0x20, 0x10, 0x00);
+    const __m128i base = _mm_loadu_si128((const __m128i*)GroestlInvShiftRows);
+    const int* pshift = fQ ? GroestlShiftQ : GroestlShiftP;
+    __m128i shuffle[8], x2[8], x4[8], b[8];
+    for (int i = 0; i < 8; i++)
+        shuffle[i] = _mm_and_si128(_mm_add_epi8(base, _mm_set1_epi8(pshift[i])), _mm_set1_epi8(0x0f));
+
+    for (int r = 0; r < 14; r++)
+    {
+        // AddRoundConstant
+        if (fQ)
+        {
+            for (int i = 0; i < 7; i++)
+                a[i] = _mm_xor_si128(a[i], ones);
+            a[7] = _mm_xor_si128(a[7], _mm_xor_si128(columns, _mm_set1_epi8((char)(0xff ^ r))));
+        }
+        else
+            a[0] = _mm_xor_si128(a[0], _mm_xor_si128(columns, _mm_set1_epi8(r)));
+
+        // SubBytes and ShiftBytes
+        for (int i = 0; i < 8; i++)
+        {
+            a[i] = _mm_aesenclast_si128(_mm_shuffle_epi8(a[i], shuffle[i]), zero);
+            x2[i] = XTime(a[i]);
+            x4[i] = XTime(x2[i]);
+        }
+
+        // MixBytes
+        GROESTL_MIXROW(0, 1, 2, 3, 4, 5, 6, 7);
+        GROESTL_MIXROW(1, 2, 3, 4, 5, 6, 7, 0);
+        GROESTL_MIXROW(2, 3, 4, 5, 6, 7, 0, 1);
+        GROESTL_MIXROW(3, 4, 5, 6, 7, 0, 1, 2);
+        GROESTL_MIXROW(4, 5, 6, 7, 0, 1, 2, 3);
+        GROESTL_MIXROW(5, 6, 7, 0, 1, 2, 3, 4);
+        GROESTL_MIXROW(6, 7, 0, 1, 2, 3, 4, 5);
+        GROESTL_MIXROW(7, 0, 1, 2, 3, 4, 5, 6);
+        for (int i = 0; i < 8; i++)
+            a[i] = b[i];
+    }
+}
+
+#undef GROESTL_MIXROW
+
+// The byte string fills the state column by column
+AESNI_TARGET void GroestlLoadRows(const unsigned char* p, __m128i a[8])
+{
+    unsigned char row[16];
+    for (int i = 0; i < 8; i++)
+    {
+        for (int j = 0; j < 16; j++)
+            row[j] = p[8 * j + i];
+        a[i] = _mm_loadu_si128((const __m128i*)row);
+    }
+}
+
+AESNI_TARGET void Groestl512_aesni(const unsigned char* pin, unsigned char* pout)
+{
+    unsigned char buf[128];
+    __m128i h[8], m[8], p[8], q[8];
+
+    // Padding of a 64-byte message: 0x80, zeros, 64-bit big endian block count
+    memcpy(buf, pin, 64);
+    memset(buf + 64, 0, 64);
+    buf[64] = 0x80;
+    buf[127] = 1;
+    GroestlLoadRows(buf, m);
+
+    // IV: the output length in bits, as a big endian integer
+    for (int i = 0; i < 8; i++)
+        h[i] = _mm_setzero_si128();
+    h[6] = _mm_insert_epi16(h[6], 0x0200, 7);
+
+    // h = P(h ^ m) ^ Q(m) ^ h
+    for (int i = 0; i < 8; i++)
+    {
+        p[i] = _mm_xor_si128(h[i], m[i]);
+        q[i] = m[i];
+    }
+    GroestlPermute<false>(p);
+    GroestlPermute<true>(q);
+    for (int i = 0; i < 8; i++)
+        h[i] = _mm_xor_si128(h[i], _mm_xor_si128(p[i], q[i]));
+
+    // Output transformation: last 512 bits of P(h) ^ h
+    for (int i = 0; i < 8; i++)
+        p[i] = h[i];
+    GroestlPermute<false>(p);
+    unsigned char row[16];
+    for (int i = 0; i < 8; i++)
+    {
+        _mm_storeu_si128((__m128i*)row, _mm_xor_si128(p[i], h[i]));
+        for (int j = 8; j < 16; j++)
+            pout[8 * (j - 8) + i] = row[j];
+    }
+}
+
+//
+// ECHO-512: 16 128-bit words, each going through two AES rounds per round
+//
+
+AESNI_TARGET void Echo512_aesni(const unsigned char* pin, unsigned char* pout)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set_epi32(0, 0, 0, 1);
+    __m128i V[8], M[8], W[16];
+    unsigned char buf[128];
+
+    // Padding of a 64-byte message: 0x80, zeros, 16-bit output length,
+    // 128-bit message bit counter (all little endian)
+    memcpy(buf, pin, 64);
+    memset(buf + 64, 0, 64);
+    buf[64] = 0x80;
+    buf[111] = 0x02;
+    buf[113] = 0x02;
+
+    for (int i = 0; i < 8; i++)
+    {
+        V[i] = _mm_set_epi32(0, 0, 0, 512);
+        M[i] = _mm_loadu_si128((const __m128i*)(buf + 16 * i));
+        W[i] = V[i];
+        W[i + 8] = M[i];
+    }
+
+    __m128i K = _mm_set_epi32(0, 0, 0, 512);
+    for (int r = 0; r < 10; r++)
+    {
+        // BigSubWords; the counter never carries out of its low word here
+        for (int n = 0; n < 16; n++)
+        {
+            W[n] = _mm_aesenc_si128(_mm_aesenc_si128(W[n], K), zero);
+            K = _mm_add_epi32(K, one);
+        }
+
+        // BigShiftRows
+        __m128i t = W[1];
+        W[1] = W[5]; W[5] = W[9]; W[9] = W[13]; W[13] = t;
+        t = W[2]; W[2] = W[10]; W[10] = t;
+        t = W[6]; W[6] = W[14]; W[14] = t;
+        t = W[15];
+        W[15] = W[11]; W[11] = W[7]; W[7] = W[3]; W[3] = t;
+
+        // BigMixColumns
+        for (int c = 0; c < 16; c += 4)
+        {
+            __m128i a = W[c], b = W[c + 1], cc = W[c + 2], d = W[c + 3];
+            __m128i ab = _mm_xor_si128(a, b);
+            __m128i bc = _mm_xor_si128(b, cc);
+            __m128i cd = _mm_xor_si128(cc, d);
+            __m128i abx = XTime(ab);
+            __m128i bcx = XTime(bc);
+            __m128i cdx = XTime(cd);
+            W[c]     = _mm_xor_si128(abx, _mm_xor_si128(bc, d));
+            W[c + 1] = _mm_xor_si128(bcx, _mm_xor_si128(a, cd));
+            W[c + 2] = _mm_xor_si128(cdx, _mm_xor_si128(ab, d));
+            W[c + 3] = _mm_xor_si128(_mm_xor_si128(abx, bcx), _mm_xor_si128(_mm_xor_si128(cdx, ab), cc));
+        }
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+        V[i] = _mm_xor_si128(V[i], _mm_xor_si128(M[i], _mm_xor_si128(W[i], W[i + 8])));
+        _mm_storeu_si128((__m128i*)(pout + 16 * i), V[i]);
+    }
+}
+
+//
+// SHAvite-3-512: the message expansion and the round function are AES
+// rounds with all-zero keys, so the subkeys fold into aesenc.
+//
+
+const uint32_t ShaviteIV512[16] =
+{
+    0x72FCCDD8, 0x79CA4727, 0x128A077B, 0x40D55AEC,
+    0xD1901A06, 0x430AE307, 0xB29F5CD1, 0xDF07FBFC,
+    0x8E45D73D, 0x681AB538, 0xBDE86578, 0xDD577E47,
+    0xE275EADE, 0x502D9FCD, 0xB9357178, 0x022A4B9A,
+};
+
+AESNI_TARGET void Shavite512_aesni(const unsigned char* pin, unsigned char* pout)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const uint32_t c0 = 512, c1 = 0, c2 = 0, c3 = 0;
+    __m128i rk[112], P[4];
+    unsigned char buf[128];
+
+    // Padding of a 64-byte message: 0x80, zeros, 128-bit message bit
+    // counter and 16-bit output length (all little endian)
+    memcpy(buf, pin, 64);
+    memset(buf + 64, 0, 64);
+    buf[64] = 0x80;
+    buf[111] = 0x02;
+    buf[127] = 0x02;
+
+    for (int k = 0; k < 8; k++)
+        rk[k] = _mm_loadu_si128((const __m128i*)(buf + 16 * k));
+
+    // Message expansion: blocks of 8 nonlinear words alternating with
+    // blocks of 8 linear words; the counter is mixed into four subkeys
+    int k = 8;
+    for (;;)
+    {
+        for (int s = 0; s < 8; s++, k++)
+        {
+            __m128i x = _mm_aesenc_si128(_mm_shuffle_epi32(rk[k - 8], 0x39), zero);
+            rk[k] = _mm_xor_si128(x, rk[k - 1]);
+            if (k == 8)
+                rk[k] = _mm_xor_si128(rk[k], _mm_set_epi32(~c3, c2, c1, c0));
+            else if (k == 41)
+                rk[k] = _mm_xor_si128(rk[k], _mm_set_epi32(~c0, c1, c2, c3));
+            else if (k == 79)
+                rk[k] = _mm_xor_si128(rk[k], _mm_set_epi32(~c1, c0, c3, c2));
+            else if (k == 110)
+                rk[k] = _mm_xor_si128(rk[k], _mm_set_epi32(~c2, c3, c0, c1));
+        }
+        if (k == 112)
+            break;
+        for (int s = 0; s < 8; s++, k++)
+            rk[k] = _mm_xor_si128(rk[k - 8], _mm_alignr_epi8(rk[k - 1], rk[k - 2], 4));
+    }
+
+    for (int i = 0; i < 4; i++)
+        P[i] = _mm_loadu_si128((const __m128i*)(ShaviteIV512 + 4 * i));
+
+    const __m128i* prk = rk;
+    for (int r = 0; r < 14; r++)
+    {
+        __m128i x = _mm_xor_si128(P[1], prk[0]);
+        x = _mm_aesenc_si128(x, prk[1]);
+        x = _mm_aesenc_si128(x, prk[2]);
+        x = _mm_aesenc_si128(x, prk[3]);
+        P[0] = _mm_xor_si128(P[0], _mm_aesenc_si128(x, zero));
+
+        x = _mm_xor_si128(P[3], prk[4]);
+        x = _mm_aesenc_si128(x, prk[5]);
+        x = _mm_aesenc_si128(x, prk[6]);
+        x = _mm_aesenc_si128(x, prk[7]);
+        P[2] = _mm_xor_si128(P[2], _mm_aesenc_si128(x, zero));
+        prk += 8;
+
+        __m128i t = P[3];
+        P[3] = P[2];
+        P[2] = P[1];
+        P[1] = P[0];
+        P[0] = t;
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+        __m128i h = _mm_loadu_si128((const __m128i*)(ShaviteIV512 + 4 * i));
+        _mm_storeu_si128((__m128i*)(pout + 16 * i), _mm_xor_si128(h, P[i]));
+    }
+}
+
+bool HaveAESNI()
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return false;
+    return (ecx & bit_AES) && (ecx & bit_SSSE3);
+}
+
+#endif // HMQ1725_AESNI
+
+typedef void (*Hash64Fn)(const unsigned char* pin, unsigned char* pout);
+
+struct HMQ1725AESDispatch
+{
+    Hash64Fn groestl;
+    Hash64Fn echo;
+    Hash64Fn shavite;
+    const char* pszName;
+    bool fSelfTestPassed;
+
+    HMQ1725AESDispatch()
+    {
+        groestl = Groestl512_sph;
+        echo = Echo512_sph;
+        shavite = Shavite512_sph;
+        pszName = "sph";
+        fSelfTestPassed = true;
+#ifdef HMQ1725_AESNI
+        if (HaveAESNI())
+        {
+            if (SelfTest(Groestl512_aesni, Groestl512_sph) &&
+                SelfTest(Echo512_aesni, Echo512_sph) &&
+                SelfTest(Shavite512_aesni, Shavite512_sph))
+            {
+                groestl = Groestl512_aesni;
+                echo = Echo512_aesni;
+                shavite = Shavite512_aesni;
+                pszName = "aesni";
+            }
+            else
+                fSelfTestPassed = false;
+        }
+#endif
+    }
+
+    /** Compare an accelerated kernel against the sph code on a fixed set
+     *  of inputs, each one fed the previous output as the chain does */
+    static bool SelfTest(Hash64Fn fnTest, Hash64Fn fnRef)
+    {
+        unsigned char vch[64], vchTest[64], vchRef[64];
+        for (int i = 0; i < 64; i++)
+            vch[i] = i;
+        for (int n = 0; n < 16; n++)
+        {
+            fnTest(vch, vchTest);
+            fnRef(vch, vchRef);
+            if (memcmp(vchTest, vchRef, 64) != 0)
+                return false;
+            memcpy(vch, vchRef, 64);
+        }
+        return true;
+    }
+};
+
+const HMQ1725AESDispatch& GetAESDispatch()
+{
+    static const HMQ1725AESDispatch dispatch;
+    return dispatch;
+}
+
+} // anon namespace
+
+void HMQ1725Groestl512(const void* pin, void* pout)
+{
+    GetAESDispatch().groestl((const unsigned char*)pin, (unsigned char*)pout);
+}
+
+void HMQ1725Echo512(const void* pin, void* pout)
+{
+    GetAESDispatch().echo((const unsigned char*)pin, (unsigned char*)pout);
+}
+
+void HMQ1725Shavite512(const void* pin, void* pout)
+{
+    GetAESDispatch().shavite((const unsigned char*)pin, (unsigned char*)pout);
+}
+
+const char* HMQ1725AESImplementation()
+{
+    return GetAESDispatch().pszName;
+}
+
+bool HMQ1725AESSelfTest()
+{
+    return GetAESDispatch().fSelfTestPassed;
+}
@@ -7,6 +7,8 @@
 #include "main.h"
 #include "chainparams.h"
 #include "script.h"
+#include "sha256d.h"
+#include "sigcache.h"
 #include "txdb.h"
 #include "rpcserver.h"
 #include "net.h"
@@ -101,6 +103,7 @@ void Shutdown()
     StopNode();
     {
         LOCK(cs_main);
+        CTxDB::Flush();
 #ifdef ENABLE_WALLET
         if (pwalletMain)
             pwalletMain->SetBestChain(CBlockLocator(pindexBest));
@@ -166,6 +169,10 @@ std::string HelpMessage()
     strUsage += "  -datadir=<dir>         " + _("Specify data directory") + "\n";
     strUsage += "  -wallet=<dir>          " + _("Specify wallet file (within data directory)") + "\n";
     strUsage += "  -dbcache=<n>           " + _("Set database cache size in megabytes (default: 25)") + "\n";
+    strUsage += "  -blockfilemaps=<n>     " + _("Keep up to <n> block files memory-mapped for reading blocks (default: 8)") + "\n";
+    strUsage += "  -maxsigcachesize=<n>   " + strprintf(_("Limit the signature cache to <n> megabytes (up to %u, default: %u, larger values are read as an entry count)"), MAX_MAX_SIG_CACHE_SIZE, DEFAULT_MAX_SIG_CACHE_SIZE) + "\n";
+    strUsage += "  -par=<n>               " + strprintf(_("Set the number of script verification threads (up to %d, 0 = auto, <0 = leave that many cores free, default: %d)"), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS) + "\n";
+    strUsage += "  -msgthreads=<n>        " + strprintf(_("Set the number of threads checking received blocks and transactions before they are processed (up to %d, 0 = none, default: %d)"), MAX_MESSAGEPREPARE_THREADS, DEFAULT_MESSAGEPREPARE_THREADS) + "\n";
     strUsage += "  -dblogsize=<n>         " + _("Set database disk log size in megabytes (default: 100)") + "\n";
     strUsage += "  -timeout=<n>           " + _("Specify connection timeout in milliseconds (default: 5000)") + "\n";
     strUsage += "  -proxy=<ip:port>       " + _("Connect through SOCKS5 proxy") + "\n";
@@ -188,6 +195,9 @@ std::string HelpMessage()
     strUsage += "  -bantime=<n>           " + _("Number of seconds to keep misbehaving peers from reconnecting (default: 86400)") + "\n";
     strUsage += "  -maxreceivebuffer=<n>  " + _("Maximum per-connection receive buffer, <n>*1000 bytes (default: 5000)") + "\n";
     strUsage += "  -maxsendbuffer=<n>     " + _("Maximum per-connection send buffer, <n>*1000 bytes (default: 1000)") + "\n";
+#ifdef __linux__
+    strUsage += "  -epoll                 " + _("Wait for socket events with epoll rather than select (default: 1)") + "\n";
+#endif
 #ifdef USE_UPNP
 #if USE_UPNP
     strUsage += "  -upnp                  " + _("Use UPnP to map the listening port (default: 1 when listening)") + "\n";
@@ -197,6 +207,7 @@ std::string HelpMessage()
 #endif
     strUsage += "  -paytxfee=<amt>        " + _("Fee per KB to add to transactions you send") + "\n";
     strUsage += "  -mininput=<amt>        " + _("When creating transactions, ignore inputs with value less than this (default: 0.01)") + "\n";
+    strUsage += "  -stakethreads=<n>      " + _("Number of threads searching for stake kernels (up to 16, 0 = one per core, <0 = leave that many cores free, default: 1)") + "\n";
     if (fHaveGUI)
         strUsage += "  -server                " + _("Accept command line and JSON-RPC commands") + "\n";
 #if !defined(WIN32)
@@ -242,6 +253,7 @@ std::string HelpMessage()
     strUsage += "  -checkblocks=<n>       " + _("How many blocks to check at startup (default: 500, 0 = all)") + "\n";
     strUsage += "  -checklevel=<n>        " + _("How thorough the block verification is (0-6, default: 1)") + "\n";
     strUsage += "  -loadblock=<file>      " + _("Imports blocks from external blk000?.dat file") + "\n";
+    strUsage += "  -headersfirst          " + _("Download the block header chain first, then blocks from all peers in parallel (default: 1)") + "\n";
     strUsage += "  -maxorphanblocksmib=<n> " + strprintf(_("Keep at most <n> MiB of unconnectable blocks in memory (default: %u)"), DEFAULT_MAX_ORPHAN_BLOCKS) + "\n";
 
     strUsage += "  -datacarriersize       " + strprintf(_("Maximum size of data in data carrier transactions we relay and mine (default: %u)"), MAX_OP_RETURN_RELAY) + "\n";
@@ -281,6 +293,8 @@ bool InitSanityCheck(void)
  */
 bool AppInit2(boost::thread_group& threadGroup)
 {
+    int64_t nInitStart = GetTimeMillis();
+
     // ********************************************************* Step 1: setup
 #ifdef _MSC_VER
     // Turn off Microsoft heap dump noise
@@ -435,12 +449,29 @@ bool AppInit2(boost::thread_group& threadGroup)
 
     fConfChange = GetBoolArg("-confchange", false);
 
+    // -par=0 means autodetect, but nScriptCheckThreads==0 means no concurrency
+    nScriptCheckThreads = GetArg("-par", DEFAULT_SCRIPTCHECK_THREADS);
+    if (nScriptCheckThreads <= 0)
+        nScriptCheckThreads += boost::thread::hardware_concurrency();
+    if (nScriptCheckThreads <= 1)
+        nScriptCheckThreads = 0;
+    else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
+        nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
+
+    nMessagePrepareThreads = max(0, min((int)GetArg("-msgthreads", DEFAULT_MESSAGEPREPARE_THREADS), MAX_MESSAGEPREPARE_THREADS));
+    fHeadersFirst = GetBoolArg("-headersfirst", true);
+
 #ifdef ENABLE_WALLET
     if (mapArgs.count("-mininput"))
     {
         if (!ParseMoney(mapArgs["-mininput"], nMinimumInputValue))
             return InitError(strprintf(_("Invalid amount for -mininput=<amount>: '%s'"), mapArgs["-mininput"]));
     }
+
+    nStakeThreads = GetArg("-stakethreads", 1);
+    if (nStakeThreads <= 0)
+        nStakeThreads += boost::thread::hardware_concurrency();
+    nStakeThreads = std::max(1, std::min(nStakeThreads, MAX_STAKE_THREADS));
 #endif
 
     nMaxDatacarrierBytes = GetArg("-datacarriersize", nMaxDatacarrierBytes);
@@ -472,6 +503,15 @@ bool AppInit2(boost::thread_group& threadGroup)
     LogPrintf("\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n");
     LogPrintf("DiminutiveVaultCoin version %s (%s)\n", FormatFullVersion(), CLIENT_DATE);
     LogPrintf("Using OpenSSL version %s\n", SSLeay_version(SSLEAY_VERSION));
+    if (!HMQ1725BatchSelfTest())
+        LogPrintf("HMQ1725 batch kernels failed the self-test, falling back to narrower ones\n");
+    LogPrintf("Using HMQ1725 batch kernels: %s\n", HMQ1725BatchImplementation());
+    if (!HMQ1725AESSelfTest())
+        LogPrintf("HMQ1725 AES-NI kernels failed the self-test, falling back to sph code\n");
+    LogPrintf("Using HMQ1725 AES kernels: %s\n", HMQ1725AESImplementation());
+    if (!SHA256D64SelfTest())
+        LogPrintf("SHA256D64 kernels failed the self-test, falling back to slower ones\n");
+    LogPrintf("Using SHA256D64 kernels: %s\n", SHA256D64Implementation());
     if (!fLogTimestamps)
         LogPrintf("Startup time: %s\n", DateTimeStrFormat("%x %H:%M:%S", GetTime()));
     LogPrintf("Default data directory %s\n", GetDefaultDataDir().string());
@@ -481,6 +521,22 @@ bool AppInit2(boost::thread_group& threadGroup)
     if (fDaemon)
         fprintf(stdout, "DiminutiveVaultCoin server starting\n");
 
+    CSignatureCacheStats sigcachestats;
+    GetSignatureCache().GetStats(sigcachestats);
+    LogPrintf("Using %u MiB for the signature cache, able to store %u entries\n", sigcachestats.nBytes >> 20, sigcachestats.nCapacity);
+
+    if (nScriptCheckThreads) {
+        LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadScriptCheck);
+    }
+
+    if (nMessagePrepareThreads) {
+        LogPrintf("Using %u threads to check received blocks and transactions\n", nMessagePrepareThreads);
+        for (int i=0; i<nMessagePrepareThreads; i++)
+            threadGroup.create_thread(&ThreadMessagePrepare);
+    }
+
     int64_t nStart;
 
     // ********************************************************* Step 5: verify database integrity
@@ -667,7 +723,7 @@ bool AppInit2(boost::thread_group& threadGroup)
     {
         string strMatch = mapArgs["-printblock"];
         int nFound = 0;
-        for (map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
+        for (CBlockIndexMap::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
         {
             uint256 hash = (*mi).first;
             if (strncmp(hash.ToString().c_str(), strMatch.c_str(), strMatch.size()) == 0)
@@ -817,7 +873,8 @@ bool AppInit2(boost::thread_group& threadGroup)
     RandAddSeedPerfmon();
 
     //// debug print
-    LogPrintf("mapBlockIndex.size() = %u\n",   mapBlockIndex.size());
+    LogPrintf("mapBlockIndex.size() = %u (%u kB, %u bytes per entry)\n", mapBlockIndex.size(),
+              mapBlockIndex.DynamicUsage() / 1024, mapBlockIndex.DynamicUsage() / max((size_t)1, mapBlockIndex.size()));
     LogPrintf("nBestHeight = %d\n",                   nBestHeight);
 #ifdef ENABLE_WALLET
     LogPrintf("setKeyPool.size() = %u\n",      pwalletMain ? pwalletMain->setKeyPool.size() : 0);
@@ -844,6 +901,7 @@ bool AppInit2(boost::thread_group& threadGroup)
     // ********************************************************* Step 12: finished
 
     uiInterface.InitMessage(_("Done loading"));
+    LogPrintf("Startup took %dms\n", GetTimeMillis() - nInitStart);
 
 #ifdef ENABLE_WALLET
     if (pwalletMain) {
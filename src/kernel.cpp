@@ -4,6 +4,8 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include <boost/assign/list_of.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
 
 #include "kernel.h"
 #include "txdb.h"
@@ -203,6 +205,39 @@ uint256 ComputeStakeModifierV2(const CBlockIndex* pindexPrev, const uint256& ker
     return HMQ1725(ss.begin(), ss.end());
 }
 
+bool CheckStakeKernelTarget(unsigned int nBits, int64_t nValueIn, const uint256& hashProofOfStake, uint256& targetProofOfStake)
+{
+    // The weighted target mantissa * 256^(exponent-3) * nValueIn can be far
+    // wider than 256 bits, so keep it as (mantissa * nValueIn) << nShift:
+    // the product fits in 87 bits and the shift is applied only as needed.
+    unsigned int nSize = nBits >> 24;
+    arith_uint512 bnMantissa = (nBits & 0x007fffff) >> (nSize < 3 ? 8 * (3 - nSize) : 0);
+    bool fNegative = (nBits & 0x00800000) != 0 && bnMantissa != 0;
+    unsigned int nShift = nSize > 3 ? 8 * (nSize - 3) : 0;
+
+    uint64_t nWeight = nValueIn;
+    if (nValueIn < 0)
+    {
+        fNegative = !fNegative;
+        nWeight = -nWeight;
+    }
+    bnMantissa *= arith_uint512(nWeight);
+
+    // Low 256 bits of the target (of its magnitude if negative)
+    arith_uint512 bnTarget = bnMantissa;
+    if (nShift < 256)
+        bnTarget <<= nShift;
+    else
+        bnTarget = 0;
+    targetProofOfStake = bnTarget.trim256();
+
+    if (fNegative && bnMantissa != 0)
+        return false;
+    if (bnMantissa != 0 && bnMantissa.bits() + nShift > 256) // at least 2^256, so above any hash
+        return true;
+    return arith_uint512(hashProofOfStake) <= bnTarget;
+}
+
 // DiminutiveVaultCoin kernel protocol
 // coinstake must meet hash target according to the protocol:
 // kernel (input 0) must meet the formula
@@ -225,22 +260,11 @@ uint256 ComputeStakeModifierV2(const CBlockIndex* pindexPrev, const uint256& ker
 //   quantities so as to generate blocks faster, degrading the system back into
 //   a proof-of-work situation.
 //
-static bool CheckStakeKernelHashV2(CBlockIndex* pindexPrev, unsigned int nBits, unsigned int nTimeBlockFrom, const CTransaction& txPrev, const COutPoint& prevout, unsigned int nTimeTx, uint256& hashProofOfStake, uint256& targetProofOfStake, bool fPrintProofOfStake)
+static bool CheckStakeKernelHashV2(CBlockIndex* pindexPrev, unsigned int nBits, unsigned int nTimeBlockFrom, unsigned int nTimeTxPrev, int64_t nValueIn, const COutPoint& prevout, unsigned int nTimeTx, uint256& hashProofOfStake, uint256& targetProofOfStake, bool fPrintProofOfStake)
 {
-    if (nTimeTx < txPrev.nTime)  // Transaction timestamp violation
+    if (nTimeTx < nTimeTxPrev)  // Transaction timestamp violation
         return error("CheckStakeKernelHash() : nTime violation");
 
-    // Base target
-    CBigNum bnTarget;
-    bnTarget.SetCompact(nBits);
-
-    // Weighted target
-    int64_t nValueIn = txPrev.vout[prevout.n].nValue;
-    CBigNum bnWeight = CBigNum(nValueIn);
-    bnTarget *= bnWeight;
-
-    targetProofOfStake = bnTarget.getuint256();
-
     uint64_t nStakeModifier = pindexPrev->nStakeModifier;
     uint256 bnStakeModifierV2 = pindexPrev->bnStakeModifierV2;
     int nStakeModifierHeight = pindexPrev->nHeight;
@@ -249,7 +273,7 @@ static bool CheckStakeKernelHashV2(CBlockIndex* pindexPrev, unsigned int nBits,
     // Calculate hash
     CDataStream ss(SER_GETHASH, 0);
     ss << bnStakeModifierV2;
-    ss << txPrev.nTime << prevout.hash << prevout.n << nTimeTx;
+    ss << nTimeTxPrev << prevout.hash << prevout.n << nTimeTx;
     hashProofOfStake = HMQ1725(ss.begin(), ss.end());
 
     if (fPrintProofOfStake)
@@ -260,12 +284,12 @@ static bool CheckStakeKernelHashV2(CBlockIndex* pindexPrev, unsigned int nBits,
             DateTimeStrFormat(nTimeBlockFrom));
         LogPrintf("CheckStakeKernelHash() : check modifier=0x%016x nTimeBlockFrom=%u nTimeTxPrev=%u nPrevout=%u nTimeTx=%u hashProof=%s\n",
             nStakeModifier,
-            nTimeBlockFrom, txPrev.nTime, prevout.n, nTimeTx,
+            nTimeBlockFrom, nTimeTxPrev, prevout.n, nTimeTx,
             hashProofOfStake.ToString());
     }
 
     // Now check if proof-of-stake hash meets target protocol
-    if (CBigNum(hashProofOfStake) > bnTarget)
+    if (!CheckStakeKernelTarget(nBits, nValueIn, hashProofOfStake, targetProofOfStake))
         return false;
 
     if (fDebug && !fPrintProofOfStake)
@@ -276,7 +300,7 @@ static bool CheckStakeKernelHashV2(CBlockIndex* pindexPrev, unsigned int nBits,
             DateTimeStrFormat(nTimeBlockFrom));
         LogPrintf("CheckStakeKernelHash() : pass modifier=0x%016x nTimeBlockFrom=%u nTimeTxPrev=%u nPrevout=%u nTimeTx=%u hashProof=%s\n",
             nStakeModifier,
-            nTimeBlockFrom, txPrev.nTime, prevout.n, nTimeTx,
+            nTimeBlockFrom, nTimeTxPrev, prevout.n, nTimeTx,
             hashProofOfStake.ToString());
     }
 
@@ -285,7 +309,7 @@ static bool CheckStakeKernelHashV2(CBlockIndex* pindexPrev, unsigned int nBits,
 
 bool CheckStakeKernelHash(CBlockIndex* pindexPrev, unsigned int nBits, const CBlock& blockFrom, unsigned int nTxPrevOffset, const CTransaction& txPrev, const COutPoint& prevout, unsigned int nTimeTx, uint256& hashProofOfStake, uint256& targetProofOfStake, bool fPrintProofOfStake)
 {
-    return CheckStakeKernelHashV2(pindexPrev, nBits, blockFrom.GetBlockTime(), txPrev, prevout, nTimeTx, hashProofOfStake, targetProofOfStake, fPrintProofOfStake);
+    return CheckStakeKernelHashV2(pindexPrev, nBits, blockFrom.GetBlockTime(), txPrev.nTime, txPrev.vout[prevout.n].nValue, prevout, nTimeTx, hashProofOfStake, targetProofOfStake, fPrintProofOfStake);
 }
 
 // Check kernel hash target and coinstake signature
@@ -330,27 +354,133 @@ bool CheckCoinStakeTimestamp(int nHeight, int64_t nTimeBlock, int64_t nTimeTx)
     return (nTimeBlock == nTimeTx) && ((nTimeTx & STAKE_TIMESTAMP_MASK) == 0);
 }
 
-bool CheckKernel(CBlockIndex* pindexPrev, unsigned int nBits, int64_t nTime, const COutPoint& prevout, int64_t* pBlockTime)
+bool ReadStakeCandidate(CTxDB& txdb, const COutPoint& prevout, CStakeCandidate& candidate)
 {
-    uint256 hashProofOfStake, targetProofOfStake;
-
-    CTxDB txdb("r");
     CTransaction txPrev;
     CTxIndex txindex;
     if (!txPrev.ReadFromDisk(txdb, prevout, txindex))
         return false;
+    if (prevout.n >= txPrev.vout.size())
+        return false;
 
     // Read block header
     CBlock block;
     if (!block.ReadFromDisk(txindex.pos.nFile, txindex.pos.nBlockPos, false))
         return false;
 
-    int nDepth;
-    if (IsConfirmedInNPrevBlocks(txindex, pindexPrev, nStakeMinConfirmations - 1, nDepth))
+    uint256 hashBlock = block.GetHash();
+    CBlockIndexMap::iterator mi = mapBlockIndex.find(hashBlock);
+    if (mi == mapBlockIndex.end() || !mi->second->IsInMainChain())
+        return false;
+
+    candidate.hashBlock = hashBlock;
+    candidate.nHeight = mi->second->nHeight;
+    candidate.nBlockTime = block.GetBlockTime();
+    candidate.nTxPrevTime = txPrev.nTime;
+    candidate.nValue = txPrev.vout[prevout.n].nValue;
+    return true;
+}
+
+bool CheckKernel(CBlockIndex* pindexPrev, unsigned int nBits, int64_t nTime, const COutPoint& prevout, int64_t* pBlockTime)
+{
+    CTxDB txdb("r");
+    CStakeCandidate candidate;
+    if (!ReadStakeCandidate(txdb, prevout, candidate))
         return false;
 
     if (pBlockTime)
-        *pBlockTime = block.GetBlockTime();
+        *pBlockTime = candidate.nBlockTime;
 
-    return CheckStakeKernelHash(pindexPrev, nBits, block, txindex.pos.nTxPos - txindex.pos.nBlockPos, txPrev, prevout, nTime, hashProofOfStake, targetProofOfStake);
+    return CheckKernel(pindexPrev, nBits, nTime, prevout, candidate);
+}
+
+bool CheckKernel(CBlockIndex* pindexPrev, unsigned int nBits, int64_t nTime, const COutPoint& prevout, const CStakeCandidate& candidate)
+{
+    uint256 hashProofOfStake, targetProofOfStake;
+
+    // Min age requirement; same as IsConfirmedInNPrevBlocks() for a block
+    // in the main chain
+    if (pindexPrev->nHeight - candidate.nHeight < nStakeMinConfirmations - 1)
+        return false;
+
+    return CheckStakeKernelHashV2(pindexPrev, nBits, candidate.nBlockTime, candidate.nTxPrevTime, candidate.nValue, prevout, nTime, hashProofOfStake, targetProofOfStake, false);
+}
+
+void CStakeKernelSearch::Run()
+{
+    // Counted locally and published once, to keep the threads off a shared
+    // cache line
+    uint64_t nCheckedLocal = 0;
+    while (!fDone)
+    {
+        if (boost::this_thread::interruption_requested())
+        {
+            fDone = true;
+            break;
+        }
+        // Coins are handed out in order, so none from here on can beat a
+        // kernel already found
+        unsigned int i = nNext++;
+        if (i >= vPrevouts.size() || i > nFirstFound)
+            break;
+        if (vExcluded[i])
+            continue;
+        for (unsigned int n = 0; n < nSearchSpan; n++)
+        {
+            if (fDone || i > nFirstFound)
+                break;
+            if (nBestChainUpdates != nChainUpdates)
+            {
+                fDone = true;
+                break;
+            }
+            nCheckedLocal++;
+            if (CheckKernel(pindexPrev, nBits, nTime - n, vPrevouts[i], vCandidates[i]))
+            {
+                // Threads still on earlier coins finish them, so the
+                // earliest coin wins, as in a single threaded search
+                LOCK(cs);
+                if (!fFound || i < nCoin)
+                {
+                    fFound = true;
+                    nCoin = i;
+                    nOffset = n;
+                    nFirstFound = i;
+                }
+                break;
+            }
+        }
+    }
+    nChecked += nCheckedLocal;
+}
+
+void CStakeKernelSearch::RunWorker()
+{
+    SetThreadPriority(THREAD_PRIORITY_LOWEST);
+    RenameThread("diminutivevaultcoin-stake");
+    Run();
+}
+
+bool CStakeKernelSearch::GetResult(unsigned int& nCoinRet, unsigned int& nOffsetRet)
+{
+    LOCK(cs);
+    nCoinRet = nCoin;
+    nOffsetRet = nOffset;
+    return fFound;
+}
+
+bool FindStakeKernel(CStakeKernelSearch& search, unsigned int nThreads, unsigned int& nCoinRet, unsigned int& nOffsetRet)
+{
+    unsigned int nWorkers = min(nThreads, (unsigned int)search.GetCoinCount());
+    boost::thread_group workers;
+    for (unsigned int i = 1; i < nWorkers; i++)
+        workers.create_thread(boost::bind(&CStakeKernelSearch::RunWorker, &search));
+
+    // Run our share, stopping early rather than throwing on shutdown so the
+    // workers are always joined before the search goes out of scope
+    search.Run();
+    workers.join_all();
+    boost::this_thread::interruption_point();
+
+    return search.GetResult(nCoinRet, nOffsetRet);
 }
@@ -6,6 +6,11 @@
 
 #include "main.h"
 
+#include <atomic>
+#include <limits>
+
+class CTxDB;
+
 // To decrease granularity of timestamp
 // Supposed to be 2^n-1
 static const int STAKE_TIMESTAMP_MASK = 15;
@@ -21,6 +26,10 @@ static const int MODIFIER_INTERVAL_RATIO = 3;
 bool ComputeNextStakeModifier(const CBlockIndex* pindexPrev, uint64_t& nStakeModifier, bool& fGeneratedStakeModifier);
 uint256 ComputeStakeModifierV2(const CBlockIndex* pindexPrev, const uint256& kernel);
 
+// Check hashProofOfStake against the target for nBits weighted by nValueIn
+// Sets targetProofOfStake to the low 256 bits of the weighted target
+bool CheckStakeKernelTarget(unsigned int nBits, int64_t nValueIn, const uint256& hashProofOfStake, uint256& targetProofOfStake);
+
 // Check whether stake kernel meets hash target
 // Sets hashProofOfStake on success return
 bool CheckStakeKernelHash(CBlockIndex* pindexPrev, unsigned int nBits, const CBlock& blockFrom, unsigned int nTxPrevOffset, const CTransaction& txPrev, const COutPoint& prevout, unsigned int nTimeTx, uint256& hashProofOfStake, uint256& targetProofOfStake, bool fPrintProofOfStake=false);
@@ -35,9 +44,83 @@ bool CheckCoinStakeTimestamp(int nHeight, int64_t nTimeBlock, int64_t nTimeTx);
 // Get time weight using supplied timestamps
 int64_t GetWeight(int64_t nIntervalBeginning, int64_t nIntervalEnd);
 
+// What the kernel check needs to know about a stake input, so that a
+// kernel search can run without reading txPrev or its block from disk
+struct CStakeCandidate
+{
+    uint256 hashBlock;          // block containing txPrev
+    int nHeight;                // height of that block
+    int64_t nBlockTime;         // time of that block
+    unsigned int nTxPrevTime;   // txPrev.nTime
+    int64_t nValue;             // value of the staked output
+
+    CStakeCandidate() : nHeight(0), nBlockTime(0), nTxPrevTime(0), nValue(0) {}
+};
+
+// Look up a stake input in the transaction database
+// Fails if it does not exist or is not in the main chain
+bool ReadStakeCandidate(CTxDB& txdb, const COutPoint& prevout, CStakeCandidate& candidate);
+
 // Wrapper around CheckStakeKernelHash()
 // Also checks existence of kernel input and min age
 // Convenient for searching a kernel
 bool CheckKernel(CBlockIndex* pindexPrev, unsigned int nBits, int64_t nTime, const COutPoint& prevout, int64_t* pBlockTime = NULL);
 
+// Same as above for an input already looked up with ReadStakeCandidate(),
+// whose block must still be in the main chain; does not touch the database
+bool CheckKernel(CBlockIndex* pindexPrev, unsigned int nBits, int64_t nTime, const COutPoint& prevout, const CStakeCandidate& candidate);
+
+/** A kernel search over (coin x timestamp) pairs. Coins are handed out one
+ *  at a time to however many threads call Run(), each trying the timestamps
+ *  nTime, nTime - 1, ... for its coin. Coins after the first one found with
+ *  a kernel are skipped, but the ones before it are still searched to the
+ *  end, so the result is the one a single thread would find. Every thread
+ *  stops once nBestChainUpdates no longer matches the count the caller read
+ *  along with pindexPrev. */
+class CStakeKernelSearch
+{
+public:
+    CStakeKernelSearch(CBlockIndex* pindexPrevIn, unsigned int nChainUpdatesIn, unsigned int nBitsIn, int64_t nTimeIn,
+                       unsigned int nSearchSpanIn, const std::vector<COutPoint>& vPrevoutsIn,
+                       const std::vector<CStakeCandidate>& vCandidatesIn, const std::vector<bool>& vExcludedIn) :
+        pindexPrev(pindexPrevIn), nChainUpdates(nChainUpdatesIn), nBits(nBitsIn), nTime(nTimeIn), nSearchSpan(nSearchSpanIn),
+        vPrevouts(vPrevoutsIn), vCandidates(vCandidatesIn), vExcluded(vExcludedIn),
+        nNext(0), fDone(false), nChecked(0), nFirstFound(std::numeric_limits<unsigned int>::max()),
+        fFound(false), nCoin(0), nOffset(0) {}
+
+    void Run();
+    void RunWorker();
+    void Stop() { fDone = true; }
+
+    bool GetResult(unsigned int& nCoinRet, unsigned int& nOffsetRet);
+
+    unsigned int GetCoinCount() const { return vPrevouts.size(); }
+
+    // Number of CheckKernel() calls made so far
+    uint64_t GetKernelsChecked() const { return nChecked; }
+
+private:
+    CBlockIndex* pindexPrev;
+    unsigned int nChainUpdates;
+    unsigned int nBits;
+    int64_t nTime;
+    unsigned int nSearchSpan;
+    const std::vector<COutPoint>& vPrevouts;
+    const std::vector<CStakeCandidate>& vCandidates;
+    const std::vector<bool>& vExcluded;
+
+    std::atomic<unsigned int> nNext;
+    std::atomic<bool> fDone;
+    std::atomic<uint64_t> nChecked;
+    std::atomic<unsigned int> nFirstFound;  // lowest coin with a kernel so far
+
+    CCriticalSection cs;
+    bool fFound;
+    unsigned int nCoin;
+    unsigned int nOffset;
+};
+
+// Run a kernel search on up to nThreads threads, the calling one included
+bool FindStakeKernel(CStakeKernelSearch& search, unsigned int nThreads, unsigned int& nCoinRet, unsigned int& nOffsetRet);
+
 #endif // PPCOIN_KERNEL_H
@@ -8,6 +8,7 @@
 #include <openssl/obj_mac.h>
 
 #include "key.h"
+#include "secp256k1.h"
 
 
 // anonymous namespace with local implementation code (OpenSSL interaction)
@@ -227,13 +228,6 @@ public:
         return true;
     }
 
-    bool Verify(const uint256 &hash, const std::vector<unsigned char>& vchSig) {
-        // -1 = error, 0 = bad sig, 1 = good
-        if (ECDSA_verify(0, (unsigned char*)&hash, sizeof(hash), &vchSig[0], vchSig.size(), pkey) != 1)
-            return false;
-        return true;
-    }
-
     bool SignCompact(const uint256 &hash, unsigned char *p64, int &rec) {
         bool fOk = false;
         ECDSA_SIG *sig = ECDSA_do_sign((unsigned char*)&hash, sizeof(hash), pkey);
@@ -521,14 +515,9 @@ bool CKey::Load(CPrivKey &privkey, CPubKey &vchPubKey, bool fSkipCheck=false) {
 }
 
 bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchSig) const {
-    if (!IsValid())
-        return false;
-    CECKey key;
-    if (!key.SetPubKey(*this))
+    if (!IsValid() || vchSig.empty())
         return false;
-    if (!key.Verify(hash, vchSig))
-        return false;
-    return true;
+    return Secp256k1Verify(hash.begin(), &vchSig[0], vchSig.size(), begin(), size());
 }
 
 bool CPubKey::RecoverCompact(const uint256 &hash, const std::vector<unsigned char>& vchSig) {
@@ -559,10 +548,7 @@ bool CPubKey::VerifyCompact(const uint256 &hash, const std::vector<unsigned char
 bool CPubKey::IsFullyValid() const {
     if (!IsValid())
         return false;
-    CECKey key;
-    if (!key.SetPubKey(*this))
-        return false;
-    return true;
+    return Secp256k1PubKeyIsValid(begin(), size());
 }
 
 bool CPubKey::Decompress() {
@@ -709,6 +695,10 @@ bool ECC_InitSanityCheck() {
         return false;
     EC_KEY_free(pkey);
 
+    // Verification does not go through OpenSSL; make sure it works too
+    if (!Secp256k1SelfTest())
+        return false;
+
     // TODO Is there more EC functionality that could be missing?
     return true;
 }
@@ -7,8 +7,11 @@
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 
+#include "blockencodings.h"
 #include "chainparams.h"
 #include "checkpoints.h"
+#include "checkqueue.h"
+#include "coins.h"
 #include "db.h"
 #include "init.h"
 #include "kernel.h"
@@ -35,10 +38,10 @@ CCriticalSection cs_main;
 
 CTxMemPool mempool;
 
-map<uint256, CBlockIndex*> mapBlockIndex;
+CBlockIndexMap mapBlockIndex;
 set<pair<COutPoint, unsigned int> > setStakeSeen;
 
-CBigNum bnProofOfStakeLimit(~uint256(0) >> 20);
+arith_uint256 bnProofOfStakeLimit(~uint256(0) >> 20);
 
 int nCoinbaseMaturity = 75;// Blocks to confirm if mining pow pos
 int nStakeMinConfirmations =  150; // 150 Minimum Block confirms 
@@ -52,10 +55,16 @@ uint256 nBestChainTrust = 0;
 uint256 nBestInvalidTrust = 0;
 uint256 hashBestChain = 0;
 CBlockIndex* pindexBest = NULL;
+std::atomic<unsigned int> nBestChainUpdates(0);
 int64_t nTimeBestReceived = 0;
 bool fImporting = false;
 bool fReindex = false;
 bool fHaveGUI = false;
+int nScriptCheckThreads = 0;
+int nMessagePrepareThreads = 0;
+bool fHeadersFirst = true;
+std::atomic<uint64_t> nBlockHashCacheHits(0);
+std::atomic<uint64_t> nBlockHashCacheMisses(0);
 
 struct COrphanBlock {
     uint256 hashBlock;
@@ -68,6 +77,14 @@ multimap<uint256, COrphanBlock*> mapOrphanBlocksByPrev;
 set<pair<COutPoint, unsigned int> > setStakeSeenOrphan;
 size_t nOrphanBlocksSize = 0;
 
+// Compact blocks waiting for the transactions asked for with getblocktxn,
+// by the node they came from
+struct CPartialBlockInFlight {
+    CPartialBlock partial;
+    int64_t nTime;
+};
+map<CNode*, CPartialBlockInFlight> mapPartialBlocks;
+
 map<uint256, CTransaction> mapOrphanTransactions;
 map<uint256, set<uint256> > mapOrphanTransactionsByPrev;
 
@@ -145,12 +162,14 @@ void RegisterNodeSignals(CNodeSignals& nodeSignals)
 {
     nodeSignals.ProcessMessages.connect(&ProcessMessages);
     nodeSignals.SendMessages.connect(&SendMessages);
+    nodeSignals.FinalizeNode.connect(&FinalizeNode);
 }
 
 void UnregisterNodeSignals(CNodeSignals& nodeSignals)
 {
     nodeSignals.ProcessMessages.disconnect(&ProcessMessages);
     nodeSignals.SendMessages.disconnect(&SendMessages);
+    nodeSignals.FinalizeNode.disconnect(&FinalizeNode);
 }
 
 
@@ -509,7 +528,7 @@ int CMerkleTx::SetMerkleBranch(const CBlock* pblock)
     vMerkleBranch = pblock->GetMerkleBranch(nIndex);
 
     // Is the tx in a block that's in the main chain
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+    CBlockIndexMap::iterator mi = mapBlockIndex.find(hashBlock);
     if (mi == mapBlockIndex.end())
         return 0;
     CBlockIndex* pindex = (*mi).second;
@@ -599,13 +618,13 @@ int64_t GetMinFee(const CTransaction& tx, unsigned int nBlockSize, enum GetMinFe
 
 
 bool AcceptToMemoryPool(CTxMemPool& pool, CTransaction &tx, bool fLimitFree,
-                        bool* pfMissingInputs)
+                        bool* pfMissingInputs, bool fChecked)
 {
     AssertLockHeld(cs_main);
     if (pfMissingInputs)
         *pfMissingInputs = false;
 
-    if (!tx.CheckTransaction())
+    if (!fChecked && !tx.CheckTransaction())
         return error("AcceptToMemoryPool : CheckTransaction failed");
 
     // Coinbase is only valid in a block, not as a loose transaction
@@ -752,7 +771,7 @@ int CMerkleTx::GetDepthInMainChainINTERNAL(CBlockIndex* &pindexRet) const
     AssertLockHeld(cs_main);
 
     // Find the block it claims to be in
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+    CBlockIndexMap::iterator mi = mapBlockIndex.find(hashBlock);
     if (mi == mapBlockIndex.end())
         return 0;
     CBlockIndex* pindex = (*mi).second;
@@ -828,7 +847,7 @@ int CTxIndex::GetDepthInMainChain() const
     if (!block.ReadFromDisk(pos.nFile, pos.nBlockPos, false))
         return 0;
     // Find the block in the index
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(block.GetHash());
+    CBlockIndexMap::iterator mi = mapBlockIndex.find(block.GetHash());
     if (mi == mapBlockIndex.end())
         return 0;
     CBlockIndex* pindex = (*mi).second;
@@ -1053,7 +1072,7 @@ unsigned int GetNextTargetRequired(const CBlockIndex* pindexLast, bool fProofOfS
 {
     // DarkGravityWave v3.1, written by Evan Duffield - evan@dashpay.io
     // Modified & revised by bitbandi for PoW support [implementation (fork) cleanup done by CryptoCoderz]
-    const CBigNum nProofOfWorkLimit = fProofOfStake ? bnProofOfStakeLimit : Params().ProofOfWorkLimit();
+    const arith_uint256 nProofOfWorkLimit = fProofOfStake ? bnProofOfStakeLimit : Params().ProofOfWorkLimit();
     const CBlockIndex *BlockLastSolved = GetLastBlockIndex(pindexLast, fProofOfStake);
     const CBlockIndex *BlockReading = BlockLastSolved;
     int64_t nActualTimespan = 0;
@@ -1062,8 +1081,10 @@ unsigned int GetNextTargetRequired(const CBlockIndex* pindexLast, bool fProofOfS
     int64_t PastBlocksMax = 24;
     int64_t CountBlocks = 0;
     int64_t nTargetSpacing = GetTargetSpacing(pindexLast->nHeight);
-    CBigNum PastDifficultyAverage;
-    CBigNum PastDifficultyAveragePrev;
+    // 512 bits holds every intermediate value below exactly: targets are at
+    // most 256 bits and the factors they are multiplied by are small
+    arith_uint512 PastDifficultyAverage;
+    arith_uint512 PastDifficultyAveragePrev;
 
             if (BlockLastSolved == NULL || BlockLastSolved->nHeight == 0 || BlockLastSolved->nHeight < PastBlocksMax) {
                 return nProofOfWorkLimit.GetCompact();
@@ -1075,7 +1096,13 @@ unsigned int GetNextTargetRequired(const CBlockIndex* pindexLast, bool fProofOfS
 
                 if(CountBlocks <= PastBlocksMin) {
                     if (CountBlocks == 1) { PastDifficultyAverage.SetCompact(BlockReading->nBits); }
-                    else { PastDifficultyAverage = ((PastDifficultyAveragePrev * CountBlocks) + (CBigNum().SetCompact(BlockReading->nBits))) / (CountBlocks + 1); }
+                    else {
+                        arith_uint512 bnTarget;
+                        bnTarget.SetCompact(BlockReading->nBits);
+                        PastDifficultyAverage = PastDifficultyAveragePrev * arith_uint512(CountBlocks);
+                        PastDifficultyAverage += bnTarget;
+                        PastDifficultyAverage /= arith_uint512(CountBlocks + 1);
+                    }
                     PastDifficultyAveragePrev = PastDifficultyAverage;
                 }
 
@@ -1087,7 +1114,7 @@ unsigned int GetNextTargetRequired(const CBlockIndex* pindexLast, bool fProofOfS
                 BlockReading = GetLastBlockIndex(BlockReading->pprev, fProofOfStake);
             }
 
-            CBigNum bnNew(PastDifficultyAverage);
+            arith_uint512 bnNew(PastDifficultyAverage);
 
             int64_t _nTargetTimespan = CountBlocks * nTargetSpacing;
 
@@ -1097,11 +1124,11 @@ unsigned int GetNextTargetRequired(const CBlockIndex* pindexLast, bool fProofOfS
                 nActualTimespan = _nTargetTimespan*3;
 
             // Retarget
-            bnNew *= nActualTimespan;
-            bnNew /= _nTargetTimespan;
+            bnNew *= arith_uint512(nActualTimespan);
+            bnNew /= arith_uint512(_nTargetTimespan);
 
-            if (bnNew > nProofOfWorkLimit){
-                bnNew = nProofOfWorkLimit;
+            if (bnNew > arith_uint512(nProofOfWorkLimit)){
+                bnNew = arith_uint512(nProofOfWorkLimit);
             }
 
             return bnNew.GetCompact();
@@ -1109,15 +1136,17 @@ unsigned int GetNextTargetRequired(const CBlockIndex* pindexLast, bool fProofOfS
 
 bool CheckProofOfWork(uint256 hash, unsigned int nBits)
 {
-    CBigNum bnTarget;
-    bnTarget.SetCompact(nBits);
+    bool fNegative;
+    bool fOverflow;
+    arith_uint256 bnTarget;
+    bnTarget.SetCompact(nBits, &fNegative, &fOverflow);
 
     // Check range
-    if (bnTarget <= 0 || bnTarget > Params().ProofOfWorkLimit())
+    if (fNegative || bnTarget == 0 || fOverflow || bnTarget > Params().ProofOfWorkLimit())
         return error("CheckProofOfWork() : nBits below minimum work");
 
     // Check proof of work matches claimed amount
-    if (hash > bnTarget.getuint256())
+    if (UintToArith256(hash) > bnTarget)
         return error("CheckProofOfWork() : hash doesn't match nBits");
 
     return true;
@@ -1203,6 +1232,20 @@ bool CTransaction::DisconnectInputs(CTxDB& txdb)
             // Write back
             if (!txdb.UpdateTxIndex(prevout.hash, txindex))
                 return error("DisconnectInputs() : UpdateTxIndex failed");
+
+            // Put the output back in the coins record; drop the record if
+            // the transaction can't be read, FetchInputs() then reads it
+            // from disk
+            CTransaction txPrev;
+            if (txPrev.ReadFromDisk(txindex.pos))
+            {
+                CCoins coins(txPrev);
+                coins.Spend(txindex.vSpent);
+                if (!txdb.WriteCoins(prevout.hash, coins))
+                    return error("DisconnectInputs() : WriteCoins failed");
+            }
+            else
+                txdb.EraseCoins(prevout.hash);
         }
     }
 
@@ -1262,8 +1305,16 @@ bool CTransaction::FetchInputs(CTxDB& txdb, const map<uint256, CTxIndex>& mapTes
         }
         else
         {
-            // Get prev tx from disk
-            if (!txPrev.ReadFromDisk(txindex.pos))
+            // Rebuild prev tx from its unspent outputs if they cover
+            // everything spent from it here, else get it from disk
+            CCoins coins;
+            bool fCoins = txdb.ReadCoins(prevout.hash, coins) && coins.vout.size() == txindex.vSpent.size();
+            for (unsigned int j = i; fCoins && j < vin.size(); j++)
+                if (vin[j].prevout.hash == prevout.hash && vin[j].prevout.n < coins.vout.size() && !coins.IsAvailable(vin[j].prevout.n))
+                    fCoins = false;
+            if (fCoins)
+                coins.GetTransaction(prevout.hash, txPrev);
+            else if (!txPrev.ReadFromDisk(txindex.pos))
                 return error("FetchInputs() : %s ReadFromDisk prev tx %s failed", GetHash().ToString(),  prevout.hash.ToString());
         }
     }
@@ -1287,6 +1338,20 @@ bool CTransaction::FetchInputs(CTxDB& txdb, const map<uint256, CTxIndex>& mapTes
     return true;
 }
 
+static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+
+void ThreadScriptCheck() {
+    RenameThread("diminutivevaultcoin-scriptch");
+    scriptcheckqueue.Thread();
+}
+
+bool CScriptCheck::operator()() const {
+    const CScript& scriptSig = ptxTo->vin[nIn].scriptSig;
+    if (!VerifyScript(scriptSig, scriptPubKey, *ptxTo, nIn, nFlags, nHashType, phasher.get()))
+        return error("CScriptCheck() : %s VerifySignature failed", ptxTo->GetHash().ToString());
+    return true;
+}
+
 const CTxOut& CTransaction::GetOutputFor(const CTxIn& input, const MapPrevTx& inputs) const
 {
     MapPrevTx::const_iterator mi = inputs.find(input.prevout.hash);
@@ -1315,7 +1380,7 @@ int64_t CTransaction::GetValueIn(const MapPrevTx& inputs) const
 }
 
 bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, map<uint256, CTxIndex>& mapTestPool, const CDiskTxPos& posThisTx,
-    const CBlockIndex* pindexBlock, bool fBlock, bool fMiner, unsigned int flags)
+    const CBlockIndex* pindexBlock, bool fBlock, bool fMiner, unsigned int flags, vector<CScriptCheck>* pvChecks)
 {
     // Take over previous transactions' spent pointers
     // fBlock is true when this is called from AcceptBlock when a new best-block is added to the blockchain
@@ -1325,6 +1390,7 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, map<uint256, CTx
     {
         int64_t nValueIn = 0;
         int64_t nFees = 0;
+        boost::shared_ptr<CSignatureHasher> phasher; // built on first use, for all inputs
         for (unsigned int i = 0; i < vin.size(); i++)
         {
             COutPoint prevout = vin[i].prevout;
@@ -1377,8 +1443,14 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, map<uint256, CTx
             // still computed and checked, and any change will be caught at the next checkpoint.
             if (!(fBlock && (nBestHeight < Checkpoints::GetTotalBlocksEstimate())))
             {
-                // Verify signature
-                if (!VerifySignature(txPrev, *this, i, flags, 0))
+                // Verify signature, or leave it to the caller's script
+                // check queue; txPrev was found by prevout.hash and
+                // prevout.n is in range, as VerifySignature() requires
+                if (!phasher)
+                    phasher.reset(new CSignatureHasher(*this));
+                if (pvChecks)
+                    pvChecks->push_back(CScriptCheck(txPrev, *this, i, flags, 0, phasher));
+                else if (!VerifySignature(txPrev, *this, i, flags, 0, phasher.get()))
                 {
                     if (flags & STANDARD_NOT_MANDATORY_VERIFY_FLAGS) {
                         // Check whether the failure was caused by a
@@ -1387,7 +1459,7 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs, map<uint256, CTx
                         // if so, don't trigger DoS protection to
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
-                        if (VerifySignature(txPrev, *this, i, flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, 0))
+                        if (VerifySignature(txPrev, *this, i, flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, 0, phasher.get()))
                             return error("ConnectInputs() : %s non-mandatory VerifySignature failed", GetHash().ToString());
                     }
                     // Failures of other flags indicate a transaction that is
@@ -1482,7 +1554,12 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
     else
         nTxPos = pindex->nBlockPos + ::GetSerializeSize(CBlock(), SER_DISK, CLIENT_VERSION) - (2 * GetSizeOfCompactSize(0)) + GetSizeOfCompactSize(vtx.size());
 
+    // Script checks run on the -par worker threads while this one carries
+    // on with the rest of the block
+    CCheckQueueControl<CScriptCheck> control(nScriptCheckThreads ? &scriptcheckqueue : NULL);
+
     map<uint256, CTxIndex> mapQueuedChanges;
+    map<uint256, CCoins> mapCoins;
     int64_t nFees = 0;
     int64_t nValueIn = 0;
     int64_t nValueOut = 0;
@@ -1544,11 +1621,19 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
             if (tx.IsCoinStake())
                 nStakeReward = nTxValueOut - nTxValueIn;
 
-            if (!tx.ConnectInputs(txdb, mapInputs, mapQueuedChanges, posThisTx, pindex, true, false, flags))
+            vector<CScriptCheck> vChecks;
+            if (!tx.ConnectInputs(txdb, mapInputs, mapQueuedChanges, posThisTx, pindex, true, false, flags, nScriptCheckThreads ? &vChecks : NULL))
                 return false;
+            control.Add(vChecks);
+
+            if (!fJustCheck)
+                for (MapPrevTx::const_iterator mi = mapInputs.begin(); mi != mapInputs.end(); ++mi)
+                    mapCoins.insert(make_pair(mi->first, CCoins(mi->second.second)));
         }
 
         mapQueuedChanges[hashTx] = CTxIndex(posThisTx, tx.vout.size());
+        if (!fJustCheck)
+            mapCoins[hashTx] = CCoins(tx);
     }
 
     if (IsProofOfWork())
@@ -1573,6 +1658,9 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
             return DoS(100, error("ConnectBlock() : coinstake pays too much(actual=%d vs calculated=%d)", nStakeReward, nCalculatedStakeReward));
     }
 
+    if (!control.Wait())
+        return DoS(100, error("ConnectBlock() : script verification failed"));
+
     // ppcoin: track money supply and mint amount info
     pindex->nMint = nValueOut - nValueIn + nFees;
     pindex->nMoneySupply = (pindex->pprev? pindex->pprev->nMoneySupply : 0) + nValueOut - nValueIn;
@@ -1587,6 +1675,15 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
     {
         if (!txdb.UpdateTxIndex((*mi).first, (*mi).second))
             return error("ConnectBlock() : UpdateTxIndex failed");
+
+        // Keep the coins record in step with the spent flags just written
+        map<uint256, CCoins>::iterator it = mapCoins.find((*mi).first);
+        if (it != mapCoins.end())
+            it->second.Spend((*mi).second.vSpent);
+        if (it == mapCoins.end() || it->second.IsPruned())
+            txdb.EraseCoins((*mi).first);
+        else if (!txdb.WriteCoins((*mi).first, it->second))
+            return error("ConnectBlock() : WriteCoins failed");
     }
 
     // Update block index on disk without changing it in memory.
@@ -1808,6 +1905,7 @@ bool CBlock::SetBestChain(CTxDB& txdb, CBlockIndex* pindexNew)
     // New best block
     hashBestChain = hash;
     pindexBest = pindexNew;
+    nBestChainUpdates++;
     pblockindexFBBHLast = NULL;
     nBestHeight = pindexBest->nHeight;
     nBestChainTrust = pindexNew->nChainTrust;
@@ -1905,11 +2003,9 @@ bool CBlock::AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos, const u
         return error("AddToBlockIndex() : %s already exists", hash.ToString());
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(nFile, nBlockPos, *this);
-    if (!pindexNew)
-        return error("AddToBlockIndex() : new CBlockIndex failed");
+    CBlockIndex* pindexNew = new (mapBlockIndex.AllocateIndex()) CBlockIndex(nFile, nBlockPos, *this);
     pindexNew->phashBlock = &hash;
-    map<uint256, CBlockIndex*>::iterator miPrev = mapBlockIndex.find(hashPrevBlock);
+    CBlockIndexMap::iterator miPrev = mapBlockIndex.find(hashPrevBlock);
     if (miPrev != mapBlockIndex.end())
     {
         pindexNew->pprev = (*miPrev).second;
@@ -1935,7 +2031,7 @@ bool CBlock::AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos, const u
     pindexNew->bnStakeModifierV2 = ComputeStakeModifierV2(pindexNew->pprev, IsProofOfWork() ? hash : vtx[1].vin[0].prevout.hash);
 
     // Add to mapBlockIndex
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
+    CBlockIndexMap::iterator mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
     if (pindexNew->IsProofOfStake())
         setStakeSeen.insert(make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
     pindexNew->phashBlock = &((*mi).first);
@@ -2059,7 +2155,7 @@ bool CBlock::AcceptBlock()
         return error("AcceptBlock() : block already in mapBlockIndex");
 
     // Get prev block index
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashPrevBlock);
+    CBlockIndexMap::iterator mi = mapBlockIndex.find(hashPrevBlock);
     if (mi == mapBlockIndex.end())
         return DoS(10, error("AcceptBlock() : prev block not found"));
     CBlockIndex* pindexPrev = (*mi).second;
@@ -2149,13 +2245,25 @@ bool CBlock::AcceptBlock()
 
 uint256 CBlockIndex::GetBlockTrust() const
 {
-    CBigNum bnTarget;
-    bnTarget.SetCompact(nBits);
+    bool fNegative;
+    bool fOverflow;
+    arith_uint256 bnTarget;
+    bnTarget.SetCompact(nBits, &fNegative, &fOverflow);
 
-    if (bnTarget <= 0)
+    // A target of 2**256 or more leaves no trust
+    if (fNegative || fOverflow || bnTarget == 0)
         return 0;
 
-    return ((CBigNum(1)<<256) / (bnTarget+1)).getuint256();
+    // We need to compute 2**256 / (bnTarget+1), but we can't represent 2**256
+    // as it's too large for an arith_uint256. However, as 2**256 is at least as large
+    // as bnTarget+1, it is equal to ((2**256 - bnTarget - 1) / (bnTarget+1)) + 1,
+    // or ~bnTarget / (bnTarget+1) + 1.
+    arith_uint256 bnDivisor = bnTarget;
+    bnDivisor += 1;
+    arith_uint256 bnTrust = ~bnTarget;
+    bnTrust /= bnDivisor;
+    bnTrust += 1;
+    return ArithToUint256(bnTrust);
 }
 
 bool CBlockIndex::IsSuperMajority(int minVersion, const CBlockIndex* pstart, unsigned int nRequired, unsigned int nToCheck)
@@ -2181,6 +2289,608 @@ void PushGetBlocks(CNode* pnode, CBlockIndex* pindexBegin, uint256 hashEnd)
     pnode->PushMessage("getblocks", CBlockLocator(pindexBegin), hashEnd);
 }
 
+
+
+//////////////////////////////////////////////////////////////////////////////
+//
+// Headers-first sync
+//
+// The header chain is fetched from the sync node ahead of the blocks, so
+// that the blocks on it can be downloaded from every node that has them,
+// a window at a time. All of this is guarded by cs_main.
+//
+
+struct CHeaderEntry
+{
+    uint256 hashPrev;
+    int nHeight;
+    uint256 nChainTrust;    // as nChainTrust of CBlockIndex, from the targets
+    CNode* pnodeFrom;       // node that sent the header, NULL once it is gone
+};
+
+struct CBlockInFlight
+{
+    CNode* pnode;
+    int64_t nTime;
+};
+
+enum
+{
+    HEADER_ACCEPTED,
+    HEADER_UNCONNECTED,
+    HEADER_TOO_FAR,
+    HEADER_INVALID,
+};
+
+// Headers whose blocks are not in mapBlockIndex yet
+static map<uint256, CHeaderEntry> mapHeaders;
+// The one with the most chain trust, and the headers from the block index
+// up to it
+static uint256 hashBestHeader = 0;
+static int nBestHeaderHeight = -1;
+static uint256 nBestHeaderTrust = 0;
+static deque<uint256> dequeHeaderChain;
+static map<uint256, CBlockInFlight> mapBlocksInFlight;
+// Compact blocks asked for with MSG_CMPCT_BLOCK, the only ones processed
+static map<uint256, CBlockInFlight> mapCmpctBlocksInFlight;
+// Blocks of the header chain, and the nodes that answered notfound or
+// stalled when asked for them
+static map<uint256, set<CNode*> > mapBlocksUnavailable;
+// Node the header chain is being fetched from, when the outstanding
+// getheaders was sent to it (0 if none) and whether it has more to send
+static CNode* pnodeHeaders = NULL;
+static int64_t nHeadersRequestTime = 0;
+static bool fHeadersMore = false;
+
+// Locator for the tip of the header chain, for getheaders to carry on from
+static CBlockLocator GetHeadersLocator()
+{
+    vector<uint256> vHave;
+    int nStep = 1;
+    uint256 hash = hashBestHeader;
+    map<uint256, CHeaderEntry>::iterator it;
+    while ((it = mapHeaders.find(hash)) != mapHeaders.end())
+    {
+        vHave.push_back(hash);
+        for (int i = 0; i < nStep && (it = mapHeaders.find(hash)) != mapHeaders.end(); i++)
+            hash = it->second.hashPrev;
+        if (vHave.size() > 10)
+            nStep *= 2;
+    }
+
+    CBlockIndexMap::iterator mi = mapBlockIndex.find(hash);
+    for (CBlockIndex* pindex = mi != mapBlockIndex.end() ? mi->second : pindexBest; pindex; )
+    {
+        vHave.push_back(pindex->GetBlockHash());
+        for (int i = 0; pindex && i < nStep; i++)
+            pindex = pindex->pprev;
+        if (vHave.size() > 10)
+            nStep *= 2;
+    }
+    vHave.push_back(Params().HashGenesisBlock());
+    return CBlockLocator(vHave);
+}
+
+static void PushGetHeaders(CNode* pnode)
+{
+    pnode->PushMessage("getheaders", GetHeadersLocator(), uint256(0));
+}
+
+// Ask the headers node for its next batch, unless one is on the way or the
+// header chain is already as far ahead of the block chain as we allow
+static void RequestHeaders()
+{
+    if (!pnodeHeaders || !fHeadersMore || nHeadersRequestTime != 0)
+        return;
+    if (nBestHeaderHeight >= nBestHeight + MAX_HEADERS_AHEAD)
+        return;
+    nHeadersRequestTime = GetTime();
+    PushGetHeaders(pnodeHeaders);
+}
+
+static void SetBestHeader(const uint256& hash, int nHeight)
+{
+    uint256 hashOld = hashBestHeader;
+    hashBestHeader = hash;
+    nBestHeaderHeight = nHeight;
+    nBestHeaderTrust = mapHeaders.count(hash) ? mapHeaders[hash].nChainTrust : 0;
+    dequeHeaderChain.clear();
+    map<uint256, CHeaderEntry>::iterator it;
+    for (uint256 h = hash; (it = mapHeaders.find(h)) != mapHeaders.end(); h = it->second.hashPrev)
+        dequeHeaderChain.push_front(h);
+
+    // On another branch, what the nodes are known to have is known again
+    // only once they announce a block of it
+    if (hashOld != 0 && find(dequeHeaderChain.begin(), dequeHeaderChain.end(), hashOld) == dequeHeaderChain.end())
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vNodes)
+            pnode->nSyncHeight = -1;
+    }
+}
+
+// Forget the headers of blocks that have been indexed, and headers off the
+// best chain once there are too many of them
+static void TrimHeaders()
+{
+    while (!dequeHeaderChain.empty() && mapBlockIndex.count(dequeHeaderChain.front()))
+    {
+        mapHeaders.erase(dequeHeaderChain.front());
+        mapBlocksUnavailable.erase(dequeHeaderChain.front());
+        dequeHeaderChain.pop_front();
+    }
+    if (dequeHeaderChain.empty())
+    {
+        hashBestHeader = 0;
+        nBestHeaderHeight = -1;
+        nBestHeaderTrust = 0;
+    }
+
+    if (mapHeaders.size() > dequeHeaderChain.size() + MAX_HEADERS_AHEAD)
+    {
+        map<uint256, CHeaderEntry> mapChain;
+        BOOST_FOREACH(const uint256& hash, dequeHeaderChain)
+            mapChain.insert(*mapHeaders.find(hash));
+        mapHeaders.swap(mapChain);
+        for (map<uint256, set<CNode*> >::iterator it = mapBlocksUnavailable.begin(); it != mapBlocksUnavailable.end(); )
+        {
+            if (mapHeaders.count(it->first))
+                ++it;
+            else
+                mapBlocksUnavailable.erase(it++);
+        }
+    }
+}
+
+// Height of hash if it is on the best header chain, -1 otherwise
+static int GetHeaderChainHeight(const uint256& hash)
+{
+    map<uint256, CHeaderEntry>::iterator it = mapHeaders.find(hash);
+    if (it == mapHeaders.end())
+        return -1;
+    int nPos = it->second.nHeight - (nBestHeaderHeight - (int)dequeHeaderChain.size() + 1);
+    if (nPos < 0 || nPos >= (int)dequeHeaderChain.size() || dequeHeaderChain[nPos] != hash)
+        return -1;
+    return it->second.nHeight;
+}
+
+// Trust a block with this header adds to its chain, as GetBlockTrust()
+static uint256 GetHeaderTrust(const CBlock& header)
+{
+    CBlockIndex index;
+    index.nBits = header.nBits;
+    return index.GetBlockTrust();
+}
+
+// Checks of a header that don't need its block. Proof-of-stake can't be
+// told apart from proof-of-work without the coinstake, so only the target
+// is range checked here and the kernel or hash is checked with the block.
+static int AcceptHeader(CNode* pfrom, const CBlock& header, int& nHeightRet)
+{
+    uint256 hash = header.GetHash();
+    CBlockIndexMap::iterator mi = mapBlockIndex.find(hash);
+    if (mi != mapBlockIndex.end())
+    {
+        nHeightRet = mi->second->nHeight;
+        return HEADER_ACCEPTED;
+    }
+    map<uint256, CHeaderEntry>::iterator it = mapHeaders.find(hash);
+    if (it != mapHeaders.end())
+    {
+        nHeightRet = it->second.nHeight;
+        return HEADER_ACCEPTED;
+    }
+
+    int nHeight;
+    uint256 nPrevTrust;
+    if ((mi = mapBlockIndex.find(header.hashPrevBlock)) != mapBlockIndex.end())
+    {
+        nHeight = mi->second->nHeight + 1;
+        nPrevTrust = mi->second->nChainTrust;
+    }
+    else if ((it = mapHeaders.find(header.hashPrevBlock)) != mapHeaders.end())
+    {
+        nHeight = it->second.nHeight + 1;
+        nPrevTrust = it->second.nChainTrust;
+    }
+    else
+        return HEADER_UNCONNECTED;
+
+    if (nHeight > nBestHeight + MAX_HEADERS_AHEAD)
+        return HEADER_TOO_FAR;
+
+    if (!Checkpoints::CheckHardened(nHeight, hash))
+    {
+        header.DoS(100, false);
+        LogPrintf("AcceptHeader() : rejected by hardened checkpoint lock-in at %d\n", nHeight);
+        return HEADER_INVALID;
+    }
+
+    if (nHeight <= Checkpoints::AutoSelectSyncCheckpoint()->nHeight)
+    {
+        header.DoS(1, false);
+        LogPrintf("AcceptHeader() : forked chain older than last checkpoint (height %d)\n", nHeight);
+        return HEADER_INVALID;
+    }
+
+    bool fNegative;
+    bool fOverflow;
+    arith_uint256 bnTarget;
+    bnTarget.SetCompact(header.nBits, &fNegative, &fOverflow);
+    arith_uint256 bnLimit = Params().ProofOfWorkLimit();
+    if (bnProofOfStakeLimit > bnLimit)
+        bnLimit = bnProofOfStakeLimit;
+    if (fNegative || bnTarget == 0 || fOverflow || bnTarget > bnLimit)
+    {
+        header.DoS(100, false);
+        LogPrintf("AcceptHeader() : nBits below minimum work\n");
+        return HEADER_INVALID;
+    }
+
+    if (header.GetBlockTime() > FutureDrift(GetAdjustedTime()))
+    {
+        LogPrintf("AcceptHeader() : block timestamp too far in the future\n");
+        return HEADER_INVALID;
+    }
+
+    CHeaderEntry entry;
+    entry.hashPrev = header.hashPrevBlock;
+    entry.nHeight = nHeight;
+    entry.nChainTrust = nPrevTrust + GetHeaderTrust(header);
+    entry.pnodeFrom = pfrom;
+    mapHeaders.insert(make_pair(hash, entry));
+    nHeightRet = nHeight;
+    return HEADER_ACCEPTED;
+}
+
+static void ProcessHeaders(CNode* pfrom, const vector<CBlock>& vHeaders)
+{
+    // Only the headers node is asked for headers. Taking them from anyone
+    // else would let any node steer the download.
+    if (pfrom != pnodeHeaders)
+    {
+        LogPrint("net", "ignoring unrequested headers from peer=%s\n", pfrom->addr.ToString());
+        return;
+    }
+
+    // Hash the whole batch at once
+    vector<HMQ1725Input> vInputs;
+    vector<uint256> vHash;
+    vInputs.reserve(vHeaders.size());
+    BOOST_FOREACH(const CBlock& header, vHeaders)
+        vInputs.push_back(HMQ1725Input((const unsigned char*)&header.nVersion, CBlock::HEADER_SIZE));
+    HMQ1725Batch(vInputs, vHash);
+    for (unsigned int i = 0; i < vHeaders.size(); i++)
+        vHeaders[i].SetCachedHash(vHash[i]);
+
+    nHeadersRequestTime = 0;
+
+    // A header chain is only worth downloading if it has more trust than
+    // the block chain, however long it is
+    uint256 hashBest = hashBestHeader;
+    int nBest = nBestHeaderHeight;
+    uint256 nBestTrust = nBestHeaderTrust > nBestChainTrust ? nBestHeaderTrust : nBestChainTrust;
+    uint256 hashLast = 0;
+    int nResult = HEADER_ACCEPTED;
+    for (unsigned int i = 0; i < vHeaders.size(); i++)
+    {
+        int nHeight;
+        nResult = AcceptHeader(pfrom, vHeaders[i], nHeight);
+        if (nResult != HEADER_ACCEPTED)
+        {
+            if (vHeaders[i].nDoS)
+                pfrom->Misbehaving(vHeaders[i].nDoS);
+            break;
+        }
+        hashLast = vHash[i];
+        map<uint256, CHeaderEntry>::iterator it = mapHeaders.find(hashLast);
+        if (it != mapHeaders.end() && it->second.nChainTrust > nBestTrust)
+        {
+            hashBest = hashLast;
+            nBest = nHeight;
+            nBestTrust = it->second.nChainTrust;
+        }
+    }
+    if (nResult == HEADER_UNCONNECTED)
+        LogPrint("net", "headers from peer=%s don't connect\n", pfrom->addr.ToString());
+
+    if (hashBest != hashBestHeader)
+        SetBestHeader(hashBest, nBest);
+    TrimHeaders();
+
+    // The node has the blocks of the header chain up to the last one it sent
+    pfrom->hashSyncAnnounced = hashLast;
+    int nSyncHeight = GetHeaderChainHeight(hashLast);
+    if (nSyncHeight > pfrom->nSyncHeight)
+        pfrom->nSyncHeight = nSyncHeight;
+
+    // A full batch means the node has more
+    fHeadersMore = vHeaders.size() == MAX_HEADERS_RESULTS && (nResult == HEADER_ACCEPTED || nResult == HEADER_TOO_FAR);
+    RequestHeaders();
+}
+
+// Forget a header whose block turned out to be invalid, and the ones built on it
+static void InvalidateHeader(const uint256& hash)
+{
+    if (!mapHeaders.count(hash))
+        return;
+
+    vector<pair<int, uint256> > vSorted;
+    vSorted.reserve(mapHeaders.size());
+    for (map<uint256, CHeaderEntry>::iterator it = mapHeaders.begin(); it != mapHeaders.end(); ++it)
+        vSorted.push_back(make_pair(it->second.nHeight, it->first));
+    sort(vSorted.begin(), vSorted.end());
+
+    set<uint256> setInvalid;
+    setInvalid.insert(hash);
+    for (unsigned int i = 0; i < vSorted.size(); i++)
+        if (setInvalid.count(mapHeaders[vSorted[i].second].hashPrev))
+            setInvalid.insert(vSorted[i].second);
+    BOOST_FOREACH(const uint256& hashInvalid, setInvalid)
+    {
+        mapHeaders.erase(hashInvalid);
+        mapBlocksUnavailable.erase(hashInvalid);
+        map<uint256, CBlockInFlight>::iterator mi = mapBlocksInFlight.find(hashInvalid);
+        if (mi != mapBlocksInFlight.end())
+        {
+            mi->second.pnode->nBlocksInFlight--;
+            mapBlocksInFlight.erase(mi);
+        }
+    }
+    LogPrintf("InvalidateHeader() : dropped %u headers from %s\n", setInvalid.size(), hash.ToString());
+
+    if (setInvalid.count(hashBestHeader))
+    {
+        uint256 hashBest = 0;
+        int nBest = -1;
+        uint256 nBestTrust = nBestChainTrust;
+        for (map<uint256, CHeaderEntry>::iterator it = mapHeaders.begin(); it != mapHeaders.end(); ++it)
+        {
+            if (it->second.nChainTrust > nBestTrust)
+            {
+                hashBest = it->first;
+                nBest = it->second.nHeight;
+                nBestTrust = it->second.nChainTrust;
+            }
+        }
+        SetBestHeader(hashBest, nBest);
+    }
+}
+
+// Give up on a block of the header chain that no node serves, and on the
+// headers built on it, and fall back to getblocks from another node
+static void DropUnavailableBlock(const uint256& hash)
+{
+    map<uint256, CHeaderEntry>::iterator it = mapHeaders.find(hash);
+    if (it == mapHeaders.end())
+        return;
+    CNode* pnodeFrom = it->second.pnodeFrom;
+    LogPrintf("no peer serves block %s of the header chain, falling back to getblocks\n", hash.ToString());
+    InvalidateHeader(hash);
+    if (pnodeFrom && pnodeFrom == pnodeHeaders)
+    {
+        pnodeHeaders = NULL;
+        nHeadersRequestTime = 0;
+        fHeadersMore = false;
+    }
+
+    LOCK(cs_vNodes);
+    CNode* pnodeSync = NULL;
+    BOOST_FOREACH(CNode* pnode, vNodes)
+    {
+        if (pnode == pnodeFrom || pnode->fClient || pnode->fDisconnect || !pnode->fSuccessfullyConnected)
+            continue;
+        if (!pnodeSync || pnode->nStartingHeight > pnodeSync->nStartingHeight)
+            pnodeSync = pnode;
+    }
+    if (pnodeSync)
+        PushGetBlocks(pnodeSync, pindexBest, uint256(0));
+}
+
+// The node answered notfound or stalled on a block of the header chain.
+// Once every node has, the block is dropped.
+static void MarkBlockUnavailable(CNode* pnode, const uint256& hash)
+{
+    if (!mapHeaders.count(hash))
+        return;
+    set<CNode*>& setFailed = mapBlocksUnavailable[hash];
+    setFailed.insert(pnode);
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnodeOther, vNodes)
+            if (!pnodeOther->fClient && !pnodeOther->fDisconnect && pnodeOther->fSuccessfullyConnected && !setFailed.count(pnodeOther))
+                return;
+    }
+    DropUnavailableBlock(hash);
+}
+
+static void ReleaseBlocksInFlight(CNode* pnode)
+{
+    for (map<uint256, CBlockInFlight>::iterator it = mapBlocksInFlight.begin(); it != mapBlocksInFlight.end(); )
+    {
+        if (it->second.pnode == pnode)
+            mapBlocksInFlight.erase(it++);
+        else
+            ++it;
+    }
+    pnode->nBlocksInFlight = 0;
+}
+
+static void MarkBlockReceived(const uint256& hash)
+{
+    map<uint256, CBlockInFlight>::iterator it = mapBlocksInFlight.find(hash);
+    if (it != mapBlocksInFlight.end())
+    {
+        it->second.pnode->nBlocksInFlight--;
+        mapBlocksInFlight.erase(it);
+    }
+}
+
+// The node doesn't have a block we asked it for, or as a node without
+// notfound for blocks, didn't send it in time: ask someone else, and don't
+// ask it for anything from there on
+static void MarkBlockNotFound(CNode* pnode, const uint256& hash)
+{
+    map<uint256, CBlockInFlight>::iterator it = mapBlocksInFlight.find(hash);
+    if (it == mapBlocksInFlight.end() || it->second.pnode != pnode)
+        return;
+    pnode->nBlocksInFlight--;
+    mapBlocksInFlight.erase(it);
+    int nHeight = GetHeaderChainHeight(hash);
+    if (nHeight >= 0 && nHeight <= pnode->nSyncHeight)
+        pnode->nSyncHeight = nHeight - 1;
+    MarkBlockUnavailable(pnode, hash);
+}
+
+// Drop nodes that leave a block or header request unanswered for too long,
+// and get blocks whole whose compact form is still missing transactions.
+// Older nodes say nothing about blocks they don't have, so a block they
+// don't send is asked of another node instead. A block is given up on once
+// the node that sent its header stalls on it.
+static void CheckDownloadStalls()
+{
+    static int64_t nLastCheck = 0;
+    int64_t nNow = GetTime();
+    if (nNow == nLastCheck)
+        return;
+    nLastCheck = nNow;
+
+    set<CNode*> setStalled;
+    vector<pair<CNode*, uint256> > vStalledBlocks, vNotSent;
+    for (map<uint256, CBlockInFlight>::iterator it = mapBlocksInFlight.begin(); it != mapBlocksInFlight.end(); ++it)
+    {
+        CNode* pnode = it->second.pnode;
+        if (!pnode->fDisconnect && it->second.nTime < nNow - BLOCK_DOWNLOAD_TIMEOUT)
+        {
+            if (pnode->nVersion < BLOCK_NOTFOUND_VERSION)
+            {
+                LogPrint("net", "peer=%s did not send block %s, asking another peer\n", pnode->addr.ToString(), it->first.ToString());
+                vNotSent.push_back(make_pair(pnode, it->first));
+                continue;
+            }
+            LogPrintf("peer=%s stalled on block %s, disconnecting\n", pnode->addr.ToString(), it->first.ToString());
+            pnode->fDisconnect = true;
+            vStalledBlocks.push_back(make_pair(pnode, it->first));
+        }
+        if (pnode->fDisconnect)
+            setStalled.insert(pnode);
+    }
+    for (unsigned int i = 0; i < vNotSent.size(); i++)
+        if (!setStalled.count(vNotSent[i].first))
+            MarkBlockNotFound(vNotSent[i].first, vNotSent[i].second);
+    BOOST_FOREACH(CNode* pnode, setStalled)
+        ReleaseBlocksInFlight(pnode);
+    for (unsigned int i = 0; i < vStalledBlocks.size(); i++)
+    {
+        map<uint256, CHeaderEntry>::iterator it = mapHeaders.find(vStalledBlocks[i].second);
+        if (it != mapHeaders.end() && it->second.pnodeFrom == vStalledBlocks[i].first)
+            DropUnavailableBlock(vStalledBlocks[i].second);
+        else
+            MarkBlockUnavailable(vStalledBlocks[i].first, vStalledBlocks[i].second);
+    }
+
+    if (pnodeHeaders && nHeadersRequestTime != 0 && nHeadersRequestTime < nNow - BLOCK_DOWNLOAD_TIMEOUT)
+    {
+        LogPrintf("peer=%s stalled on headers, disconnecting\n", pnodeHeaders->addr.ToString());
+        pnodeHeaders->fDisconnect = true;
+        pnodeHeaders = NULL;
+        nHeadersRequestTime = 0;
+    }
+
+    for (map<uint256, CBlockInFlight>::iterator it = mapCmpctBlocksInFlight.begin(); it != mapCmpctBlocksInFlight.end(); )
+    {
+        if (it->second.nTime < nNow - BLOCK_DOWNLOAD_TIMEOUT || it->second.pnode->fDisconnect)
+            mapCmpctBlocksInFlight.erase(it++);
+        else
+            ++it;
+    }
+
+    for (map<CNode*, CPartialBlockInFlight>::iterator it = mapPartialBlocks.begin(); it != mapPartialBlocks.end(); )
+    {
+        CNode* pnode = it->first;
+        if (it->second.nTime >= nNow - BLOCKTXN_TIMEOUT && !pnode->fDisconnect)
+        {
+            ++it;
+            continue;
+        }
+        CInv inv(MSG_BLOCK, it->second.partial.header.GetHash());
+        if (!pnode->fDisconnect)
+        {
+            LogPrint("net", "peer=%s did not send the transactions of compact block %s, getting it whole\n", pnode->addr.ToString(), inv.hash.ToString());
+            pnode->PushMessage("getdata", vector<CInv>(1, inv));
+        }
+        mapPartialBlocks.erase(it++);
+    }
+}
+
+// Request blocks on the header chain from pto, up to its share of the
+// download window
+static void RequestBlocks(CNode* pto, vector<CInv>& vGetData)
+{
+    TrimHeaders();
+    RequestHeaders();
+
+    if (dequeHeaderChain.empty() || pto->fClient || pto->fDisconnect)
+        return;
+    if (pto->nBlocksInFlight >= MAX_BLOCKS_IN_FLIGHT_PER_PEER)
+        return;
+
+    // Only blocks the node has shown it has are asked of it: the ones up
+    // to a block it announced, once that block is on the header chain
+    if (pto->hashSyncAnnounced != 0)
+    {
+        int nAnnouncedHeight = GetHeaderChainHeight(pto->hashSyncAnnounced);
+        if (nAnnouncedHeight > pto->nSyncHeight)
+            pto->nSyncHeight = nAnnouncedHeight;
+    }
+
+    // Blocks past the first missing one wait in the orphan pool until it
+    // arrives, so don't run further ahead than the pool can hold
+    size_t nMaxOrphanBlocksSize = GetArg("-maxorphanblocksmib", DEFAULT_MAX_ORPHAN_BLOCKS) * ((size_t) 1 << 20);
+    int nWindow = nOrphanBlocksSize > nMaxOrphanBlocksSize / 2 ? MAX_BLOCKS_IN_FLIGHT_PER_PEER : BLOCK_DOWNLOAD_WINDOW;
+
+    int64_t nNow = GetTime();
+    int nHeight = nBestHeaderHeight - (int)dequeHeaderChain.size() + 1;
+    for (int i = 0; i < (int)dequeHeaderChain.size() && i < nWindow && nHeight <= pto->nSyncHeight; i++, nHeight++)
+    {
+        const uint256& hash = dequeHeaderChain[i];
+        if (mapBlocksInFlight.count(hash) || mapOrphanBlocks.count(hash))
+            continue;
+
+        CBlockInFlight request;
+        request.pnode = pto;
+        request.nTime = nNow;
+        mapBlocksInFlight.insert(make_pair(hash, request));
+        vGetData.push_back(CInv(MSG_BLOCK, hash));
+        if (++pto->nBlocksInFlight >= MAX_BLOCKS_IN_FLIGHT_PER_PEER)
+            break;
+    }
+}
+
+void FinalizeNode(CNode* pnode)
+{
+    LOCK(cs_main);
+    ReleaseBlocksInFlight(pnode);
+    mapPartialBlocks.erase(pnode);
+    for (map<uint256, CBlockInFlight>::iterator it = mapCmpctBlocksInFlight.begin(); it != mapCmpctBlocksInFlight.end(); )
+    {
+        if (it->second.pnode == pnode)
+            mapCmpctBlocksInFlight.erase(it++);
+        else
+            ++it;
+    }
+    for (map<uint256, CHeaderEntry>::iterator it = mapHeaders.begin(); it != mapHeaders.end(); ++it)
+        if (it->second.pnodeFrom == pnode)
+            it->second.pnodeFrom = NULL;
+    for (map<uint256, set<CNode*> >::iterator it = mapBlocksUnavailable.begin(); it != mapBlocksUnavailable.end(); ++it)
+        it->second.erase(pnode);
+    if (pnode == pnodeHeaders)
+    {
+        pnodeHeaders = NULL;
+        nHeadersRequestTime = 0;
+    }
+}
+
 bool static IsCanonicalBlockSignature(CBlock* pblock, bool checkLowS)
 {
     if (pblock->IsProofOfWork()) {
@@ -2190,7 +2900,25 @@ bool static IsCanonicalBlockSignature(CBlock* pblock, bool checkLowS)
     return checkLowS ? IsLowDERSignature(pblock->vchBlockSig, false) : IsDERSignature(pblock->vchBlockSig, false);
 }
 
-bool ProcessBlock(CNode* pfrom, CBlock* pblock)
+// The checks of a compact block's header that are cheap next to matching
+// its short ids against the memory pool: the proof-of-work, or the block
+// signature by the key of the prefilled coinstake
+static bool CheckCompactBlockHeader(const CBlockHeaderAndShortTxIDs& cmpctblock)
+{
+    CBlock block = cmpctblock.header;
+    block.vtx.clear();
+    for (unsigned int i = 0; i < cmpctblock.prefilledtxn.size() && i < 2; i++)
+        if (cmpctblock.prefilledtxn[i].index == i)
+            block.vtx.push_back(cmpctblock.prefilledtxn[i].tx);
+
+    if (!IsCanonicalBlockSignature(&block, false))
+        return false;
+    if (block.IsProofOfWork())
+        return CheckProofOfWork(block.GetHash(), block.nBits);
+    return block.CheckBlockSignature();
+}
+
+bool ProcessBlock(CNode* pfrom, CBlock* pblock, bool fChecked)
 {
     AssertLockHeld(cs_main);
 
@@ -2238,8 +2966,8 @@ bool ProcessBlock(CNode* pfrom, CBlock* pblock)
             return error("ProcessBlock(): EnsureLowS failed");
     }
 
-    // Preliminary checks
-    if (!pblock->CheckBlock())
+    // Preliminary checks, unless already done off the message handler thread
+    if (!fChecked && !pblock->CheckBlock())
         return error("ProcessBlock() : CheckBlock FAILED");
 
     // If we don't already have its previous block, shunt it off to holding area until we get it
@@ -2273,8 +3001,12 @@ bool ProcessBlock(CNode* pfrom, CBlock* pblock)
             if (pblock->IsProofOfStake())
                 setStakeSeenOrphan.insert(pblock->GetProofOfStake());
 
-            // Ask this guy to fill in what we're missing
-            PushGetBlocks(pfrom, pindexBest, GetOrphanRoot(hash));
+            // Ask this guy to fill in what we're missing. With headers-first
+            // sync the headers lead to its parents, once we have them.
+            if (!fHeadersFirst)
+                PushGetBlocks(pfrom, pindexBest, GetOrphanRoot(hash));
+            else if (GetHeaderChainHeight(hash) < 0)
+                PushGetHeaders(pfrom);
             // ppcoin: getblocks may not obtain the ancestor block rejected
             // earlier by duplicate-stake check so we ask for it again directly
             if (!IsInitialBlockDownload())
@@ -2285,7 +3017,11 @@ bool ProcessBlock(CNode* pfrom, CBlock* pblock)
 
     // Store to disk
     if (!pblock->AcceptBlock())
+    {
+        if (pblock->nDoS)
+            InvalidateHeader(hash);
         return error("ProcessBlock() : AcceptBlock FAILED");
+    }
 
     // Recursively process any orphan blocks that depended on this one
     vector<uint256> vWorkQueue;
@@ -2302,9 +3038,12 @@ bool ProcessBlock(CNode* pfrom, CBlock* pblock)
                 CDataStream ss(mi->second->vchBlock, SER_DISK, CLIENT_VERSION);
                 ss >> block;
             }
+            block.CacheTxHashes();
             block.BuildMerkleTree();
             if (block.AcceptBlock())
                 vWorkQueue.push_back(mi->second->hashBlock);
+            else if (block.nDoS)
+                InvalidateHeader(mi->second->hashBlock);
             mapOrphanBlocks.erase(mi->second->hashBlock);
             setStakeSeenOrphan.erase(block.GetProofOfStake());
             nOrphanBlocksSize -= mi->second->vchBlock.size();
@@ -2439,6 +3178,46 @@ static filesystem::path BlockFilePath(unsigned int nFile)
     return GetDataDir() / strBlockFn;
 }
 
+// Blocks and the transactions in them are mostly read from mappings of
+// the block files, which saves opening, seeking and reading the file for
+// every one of them
+static CMappedFileCache& GetBlockFileMappings()
+{
+    static CMappedFileCache mappings(max((int64_t)1, GetArg("-blockfilemaps", 8)));
+    return mappings;
+}
+
+bool CBlockFileSpan::Map(unsigned int nFile, unsigned int nBlockPos, unsigned int nPos)
+{
+    // Each block follows the message start and its size, see WriteToDisk()
+    static const unsigned int nRecordHeader = sizeof(Params().MessageStart()) + sizeof(unsigned int);
+    if ((nFile < 1) || (nFile == (unsigned int) -1) || nBlockPos < nRecordHeader || nPos < nBlockPos)
+        return false;
+    boost::filesystem::path path = BlockFilePath(nFile);
+    pmap = GetBlockFileMappings().Get(nFile, path, nBlockPos);
+    if (!pmap)
+        return false;
+
+    const unsigned char* pchRecord = (const unsigned char*)pmap->data() + nBlockPos - nRecordHeader;
+    if (memcmp(pchRecord, Params().MessageStart(), sizeof(Params().MessageStart())) != 0)
+        return false;
+    const unsigned char* pchSize = pchRecord + sizeof(Params().MessageStart());
+    unsigned int nSize = pchSize[0] | (pchSize[1] << 8) | (pchSize[2] << 16) | ((unsigned int)pchSize[3] << 24);
+    if (nSize > MAX_SIZE || nPos >= nBlockPos + (uint64_t)nSize)
+        return false;
+
+    // A block written after the file was mapped needs a new mapping
+    if (pmap->size() < (uint64_t)nBlockPos + nSize)
+    {
+        pmap = GetBlockFileMappings().Get(nFile, path, (uint64_t)nBlockPos + nSize);
+        if (!pmap)
+            return false;
+    }
+    pbegin = pmap->data() + nPos;
+    pend = pmap->data() + nBlockPos + nSize;
+    return true;
+}
+
 FILE* OpenBlockFile(unsigned int nFile, unsigned int nBlockPos, const char* pszMode)
 {
     if ((nFile < 1) || (nFile == (unsigned int) -1))
@@ -2525,7 +3304,7 @@ void PrintBlockTree()
     AssertLockHeld(cs_main);
     // pre-compute tree structure
     map<CBlockIndex*, vector<CBlockIndex*> > mapNext;
-    for (map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
+    for (CBlockIndexMap::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
     {
         CBlockIndex* pindex = (*mi).second;
         mapNext[pindex->pprev].push_back(pindex);
@@ -2637,6 +3416,7 @@ bool LoadExternalBlockFile(FILE* fileIn)
                 {
                     CBlock block;
                     blkdat >> block;
+                    block.CacheTxHashes();
                     LOCK(cs_main);
                     if (ProcessBlock(NULL,&block))
                     {
@@ -2789,10 +3569,10 @@ void static ProcessGetData(CNode* pfrom)
             boost::this_thread::interruption_point();
             it++;
 
-            if (inv.type == MSG_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_CMPCT_BLOCK)
             {
                 // Send block from disk
-                map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(inv.hash);
+                CBlockIndexMap::iterator mi = mapBlockIndex.find(inv.hash);
                 if (mi != mapBlockIndex.end())
                 {
                     CBlock block;
@@ -2804,7 +3584,12 @@ void static ProcessGetData(CNode* pfrom)
                         assert(ret);
                     }
 
-                    pfrom->PushMessage("block", block);
+                    // Peers only have the transactions of recent blocks in
+                    // their memory pools
+                    if (inv.type == MSG_CMPCT_BLOCK && mi->second->nHeight >= nBestHeight - MAX_CMPCTBLOCK_DEPTH)
+                        pfrom->PushMessage("cmpctblock", CBlockHeaderAndShortTxIDs(block));
+                    else
+                        pfrom->PushMessage("block", block);
 
                     // Trigger them to send a getblocks request for the next batch of inventory
                     if (inv.hash == pfrom->hashContinue)
@@ -2818,6 +3603,8 @@ void static ProcessGetData(CNode* pfrom)
                         pfrom->hashContinue = 0;
                     }
                 }
+                else
+                    vNotFound.push_back(inv);
             }
             else if (inv.IsKnownType())
             {
@@ -2849,7 +3636,7 @@ void static ProcessGetData(CNode* pfrom)
             // Track requests for our stuff.
             g_signals.Inventory(inv.hash);
 
-            if (inv.type == MSG_BLOCK /* || inv.type == MSG_FILTERED_BLOCK */)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_CMPCT_BLOCK)
                 break;
         }
     }
@@ -2868,7 +3655,143 @@ void static ProcessGetData(CNode* pfrom)
     }
 }
 
-bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived)
+// Complete a block rebuilt from a compact block and process it, or get it
+// whole if it didn't come out right
+void static ProcessPartialBlock(CNode* pfrom, const CPartialBlock& partial, const vector<CTransaction>& vtxMissing)
+{
+    CBlock block;
+    CInv inv(MSG_BLOCK, partial.header.GetHash());
+    ReadStatus status = partial.FillBlock(block, vtxMissing);
+    if (status == READ_STATUS_INVALID)
+    {
+        pfrom->Misbehaving(100);
+        LogPrintf("ProcessPartialBlock() : peer=%s sent the wrong transactions for %s\n", pfrom->addr.ToString(), inv.hash.ToString());
+        return;
+    }
+    if (status == READ_STATUS_FAILED)
+    {
+        LogPrint("net", "compact block %s did not match its merkle root, getting it whole\n", inv.hash.ToString());
+        pfrom->PushMessage("getdata", vector<CInv>(1, inv));
+        return;
+    }
+
+    MarkBlockReceived(inv.hash);
+    if (ProcessBlock(pfrom, &block))
+        mapAlreadyAskedFor.erase(inv);
+    if (block.nDoS) pfrom->Misbehaving(block.nDoS);
+}
+
+// A tx or block message checksummed, parsed and checked without chain
+// context by a message preparation thread
+class CPreparedTxOrBlock : public CPreparedMessage
+{
+public:
+    string strCommand;
+    CDataStream vRecv;
+    unsigned int nChecksum;
+    bool fParsed;
+    bool fChecked;
+    CTransaction tx;
+    CBlock block;
+
+    CPreparedTxOrBlock(const string& strCommandIn, CDataStream& vRecvIn) :
+        strCommand(strCommandIn), vRecv(vRecvIn.nType, vRecvIn.nVersion), nChecksum(0), fParsed(false), fChecked(false)
+    {
+        vRecv.swap(vRecvIn);
+    }
+
+    void Prepare()
+    {
+        uint256 hash = Hash(vRecv.begin(), vRecv.end());
+        memcpy(&nChecksum, &hash, sizeof(nChecksum));
+        if (vRecv.empty())
+            return;
+
+        // Parse without consuming vRecv, so that ProcessMessage can still
+        // read it and report the error if this fails
+        try {
+            CSpanReader reader(&vRecv[0], &vRecv[0] + vRecv.size(), vRecv.nType, vRecv.nVersion);
+            if (strCommand == "tx")
+            {
+                reader >> tx;
+                tx.CacheHash();
+                fChecked = tx.CheckTransaction();
+            }
+            else
+            {
+                reader >> block;
+                block.CacheTxHashes();
+                fChecked = block.CheckBlock();
+            }
+            fParsed = true;
+        }
+        catch (std::exception& e) {
+            fChecked = false;
+        }
+
+        // A failed check is repeated under cs_main, which scores the peer
+        tx.nDoS = 0;
+        block.nDoS = 0;
+    }
+};
+
+static boost::mutex csMessagePrepare;
+static boost::condition_variable condMessagePrepare;
+static deque<boost::shared_ptr<CPreparedTxOrBlock> > queueMessagePrepare;
+
+void ThreadMessagePrepare()
+{
+    RenameThread("diminutivevaultcoin-msgprep");
+    while (true)
+    {
+        boost::shared_ptr<CPreparedTxOrBlock> pprepared;
+        {
+            boost::unique_lock<boost::mutex> lock(csMessagePrepare);
+            while (queueMessagePrepare.empty())
+                condMessagePrepare.wait(lock);
+            pprepared = queueMessagePrepare.front();
+            queueMessagePrepare.pop_front();
+        }
+
+        // Dropped along with the node's receive queue; nobody is waiting
+        if (pprepared.unique())
+            continue;
+
+        pprepared->Prepare();
+        pprepared->fReady = true;
+        WakeMessageHandler();
+    }
+}
+
+// Hand pfrom's complete blocks and transactions to the message preparation
+// threads, so that hashing, parsing and context-free checks don't hold up
+// the other peers. requires LOCK(pfrom->cs_vRecvMsg)
+static void PrepareMessages(CNode* pfrom)
+{
+    bool fQueued = false;
+    BOOST_FOREACH(CNetMessage& msg, pfrom->vRecvMsg)
+    {
+        if (!msg.complete())
+            break;
+        if (msg.pprepared)
+            continue;
+        string strCommand = msg.hdr.GetCommand();
+        if (strCommand != "tx" && strCommand != "block")
+            continue;
+
+        boost::shared_ptr<CPreparedTxOrBlock> pprepared(new CPreparedTxOrBlock(strCommand, msg.vRecv));
+        msg.pprepared = pprepared;
+        {
+            boost::lock_guard<boost::mutex> lock(csMessagePrepare);
+            queueMessagePrepare.push_back(pprepared);
+        }
+        fQueued = true;
+    }
+    if (fQueued)
+        condMessagePrepare.notify_all();
+}
+
+bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived, CPreparedTxOrBlock* pprepared)
 {
     RandAddSeedPerfmon();
     LogPrint("net", "received: %s (%u bytes)\n", strCommand, vRecv.size());
@@ -3086,12 +4009,23 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             bool fAlreadyHave = AlreadyHave(txdb, inv);
             LogPrint("net", "  got inventory: %s  %s\n", inv.ToString(), fAlreadyHave ? "have" : "new");
 
+            // Blocks on the header chain are requested by RequestBlocks,
+            // from the nodes that announced them or a block after them
+            int nHeaderHeight = inv.type == MSG_BLOCK && fHeadersFirst ? GetHeaderChainHeight(inv.hash) : -1;
+            if (nHeaderHeight > pfrom->nSyncHeight)
+                pfrom->nSyncHeight = nHeaderHeight;
+            else if (nHeaderHeight < 0 && inv.type == MSG_BLOCK && fHeadersFirst && !fAlreadyHave)
+                pfrom->hashSyncAnnounced = inv.hash;
+
             if (!fAlreadyHave) {
-                if (!fImporting)
+                if (!fImporting && nHeaderHeight < 0)
                     pfrom->AskFor(inv);
             } else if (inv.type == MSG_BLOCK && mapOrphanBlocks.count(inv.hash)) {
-                PushGetBlocks(pfrom, pindexBest, GetOrphanRoot(inv.hash));
-            } else if (nInv == nLastBlock) {
+                if (!fHeadersFirst)
+                    PushGetBlocks(pfrom, pindexBest, GetOrphanRoot(inv.hash));
+                else if (GetHeaderChainHeight(inv.hash) < 0)
+                    PushGetHeaders(pfrom);
+            } else if (nInv == nLastBlock && !fHeadersFirst) {
                 // In case we are on a very long side-chain, it is possible that we already have
                 // the last block in an inv bundle sent in response to getblocks. Try to detect
                 // this situation and push another getblocks to continue.
@@ -3173,7 +4107,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         if (locator.IsNull())
         {
             // If locator is null, return the hashStop block
-            map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashStop);
+            CBlockIndexMap::iterator mi = mapBlockIndex.find(hashStop);
             if (mi == mapBlockIndex.end())
                 return true;
             pindex = (*mi).second;
@@ -3187,7 +4121,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         }
 
         vector<CBlock> vHeaders;
-        int nLimit = 2000;
+        int nLimit = MAX_HEADERS_RESULTS;
         LogPrint("net", "getheaders %d to %s\n", (pindex ? pindex->nHeight : -1), hashStop.ToString());
         for (; pindex; pindex = pindex->pnext)
         {
@@ -3198,13 +4132,54 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         pfrom->PushMessage("headers", vHeaders);
     }
 
+    else if (strCommand == "headers" && !fImporting && !fReindex)
+    {
+        vector<CBlock> vHeaders;
+        vRecv >> vHeaders;
+        if (vHeaders.size() > MAX_HEADERS_RESULTS)
+        {
+            pfrom->Misbehaving(20);
+            return error("message headers size() = %u", vHeaders.size());
+        }
+
+        LOCK(cs_main);
+        ProcessHeaders(pfrom, vHeaders);
+    }
+
+    else if (strCommand == "notfound")
+    {
+        vector<CInv> vInv;
+        vRecv >> vInv;
+        if (vInv.size() > MAX_INV_SZ)
+        {
+            pfrom->Misbehaving(20);
+            return error("message notfound size() = %u", vInv.size());
+        }
+
+        LOCK(cs_main);
+        BOOST_FOREACH(const CInv& inv, vInv)
+        {
+            if (inv.type != MSG_BLOCK)
+                continue;
+            MarkBlockNotFound(pfrom, inv.hash);
+            map<CNode*, CPartialBlockInFlight>::iterator it = mapPartialBlocks.find(pfrom);
+            if (it != mapPartialBlocks.end() && it->second.partial.header.GetHash() == inv.hash)
+                mapPartialBlocks.erase(it);
+        }
+    }
+
 
     else if (strCommand == "tx")
     {
         vector<uint256> vWorkQueue;
         vector<uint256> vEraseQueue;
-        CTransaction tx;
-        vRecv >> tx;
+        CTransaction txRecv;
+        CTransaction& tx = pprepared ? pprepared->tx : txRecv;
+        if (!pprepared)
+        {
+            vRecv >> tx;
+            tx.CacheHash();
+        }
 
         CInv inv(MSG_TX, tx.GetHash());
         pfrom->AddInventoryKnown(inv);
@@ -3215,7 +4190,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
         mapAlreadyAskedFor.erase(inv);
 
-        if (AcceptToMemoryPool(mempool, tx, true, &fMissingInputs))
+        if (AcceptToMemoryPool(mempool, tx, true, &fMissingInputs, pprepared && pprepared->fChecked))
         {
             RelayTransaction(tx, inv.hash);
             vWorkQueue.push_back(inv.hash);
@@ -3269,8 +4244,13 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
     else if (strCommand == "block" && !fImporting && !fReindex) // Ignore blocks received while importing
     {
-        CBlock block;
-        vRecv >> block;
+        CBlock blockRecv;
+        CBlock& block = pprepared ? pprepared->block : blockRecv;
+        if (!pprepared)
+        {
+            vRecv >> block;
+            block.CacheTxHashes();
+        }
         uint256 hashBlock = block.GetHash();
 
         LogPrint("net", "received block %s\n", hashBlock.ToString());
@@ -3280,12 +4260,145 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
         LOCK(cs_main);
 
-        if (ProcessBlock(pfrom, &block))
+        MarkBlockReceived(hashBlock);
+        map<CNode*, CPartialBlockInFlight>::iterator it = mapPartialBlocks.find(pfrom);
+        if (it != mapPartialBlocks.end() && it->second.partial.header.GetHash() == hashBlock)
+            mapPartialBlocks.erase(it);
+        if (ProcessBlock(pfrom, &block, pprepared && pprepared->fChecked))
             mapAlreadyAskedFor.erase(inv);
         if (block.nDoS) pfrom->Misbehaving(block.nDoS);
     }
 
 
+    else if (strCommand == "cmpctblock" && !fImporting && !fReindex)
+    {
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+        uint256 hashBlock = cmpctblock.header.GetHash();
+
+        LogPrint("net", "received compact block %s\n", hashBlock.ToString());
+
+        CInv inv(MSG_BLOCK, hashBlock);
+        pfrom->AddInventoryKnown(inv);
+
+        LOCK(cs_main);
+
+        // Rebuilding one scans the whole memory pool, so only the ones asked
+        // for are, and only once their header checks out
+        map<uint256, CBlockInFlight>::iterator mi = mapCmpctBlocksInFlight.find(hashBlock);
+        if (mi == mapCmpctBlocksInFlight.end() || mi->second.pnode != pfrom)
+        {
+            LogPrint("net", "unrequested compact block %s from peer=%s\n", hashBlock.ToString(), pfrom->addr.ToString());
+            return true;
+        }
+        mapCmpctBlocksInFlight.erase(mi);
+
+        if (mapBlockIndex.count(hashBlock) || mapOrphanBlocks.count(hashBlock))
+            return true;
+
+        if (!CheckCompactBlockHeader(cmpctblock))
+        {
+            pfrom->Misbehaving(100);
+            return error("compact block %s with bad proof-of-work or signature", hashBlock.ToString());
+        }
+
+        // An orphan has to be kept whole until its parents arrive anyway
+        if (!mapBlockIndex.count(cmpctblock.header.hashPrevBlock))
+        {
+            pfrom->PushMessage("getdata", vector<CInv>(1, inv));
+            return true;
+        }
+
+        CPartialBlock partial;
+        ReadStatus status = partial.InitData(cmpctblock, mempool);
+        if (status == READ_STATUS_INVALID)
+        {
+            pfrom->Misbehaving(100);
+            return error("invalid compact block %s", hashBlock.ToString());
+        }
+        if (status == READ_STATUS_FAILED)
+        {
+            pfrom->PushMessage("getdata", vector<CInv>(1, inv));
+            return true;
+        }
+
+        CBlockTransactionsRequest req;
+        req.blockhash = hashBlock;
+        req.indexes = partial.GetMissing();
+        if (req.indexes.empty())
+            ProcessPartialBlock(pfrom, partial, vector<CTransaction>());
+        else
+        {
+            CPartialBlockInFlight& pending = mapPartialBlocks[pfrom];
+            pending.partial = partial;
+            pending.nTime = GetTime();
+            pfrom->PushMessage("getblocktxn", req);
+        }
+    }
+
+
+    else if (strCommand == "getblocktxn")
+    {
+        CBlockTransactionsRequest req;
+        vRecv >> req;
+
+        LOCK(cs_main);
+
+        // Answer either way, or the peer is left waiting for the transactions
+        CBlockIndexMap::iterator mi = mapBlockIndex.find(req.blockhash);
+        if (mi == mapBlockIndex.end())
+        {
+            LogPrint("net", "getblocktxn for unknown block %s\n", req.blockhash.ToString());
+            pfrom->PushMessage("notfound", vector<CInv>(1, CInv(MSG_BLOCK, req.blockhash)));
+            return true;
+        }
+
+        CBlock block;
+        if (!block.ReadFromDisk(mi->second))
+            return error("getblocktxn : ReadFromDisk failed for %s", req.blockhash.ToString());
+
+        if (mi->second->nHeight < nBestHeight - MAX_CMPCTBLOCK_DEPTH)
+        {
+            LogPrint("net", "getblocktxn for old block %s, sending it whole\n", req.blockhash.ToString());
+            pfrom->PushMessage("block", block);
+            return true;
+        }
+
+        CBlockTransactions resp;
+        resp.blockhash = req.blockhash;
+        resp.txn.reserve(req.indexes.size());
+        BOOST_FOREACH(unsigned short index, req.indexes)
+        {
+            if (index >= block.vtx.size())
+            {
+                pfrom->Misbehaving(100);
+                return error("getblocktxn with out of range index %u", index);
+            }
+            resp.txn.push_back(block.vtx[index]);
+        }
+        pfrom->PushMessage("blocktxn", resp);
+    }
+
+
+    else if (strCommand == "blocktxn" && !fImporting && !fReindex)
+    {
+        CBlockTransactions resp;
+        vRecv >> resp;
+
+        LOCK(cs_main);
+
+        map<CNode*, CPartialBlockInFlight>::iterator it = mapPartialBlocks.find(pfrom);
+        if (it == mapPartialBlocks.end() || it->second.partial.header.GetHash() != resp.blockhash)
+        {
+            LogPrint("net", "unrequested blocktxn for %s\n", resp.blockhash.ToString());
+            return true;
+        }
+        CPartialBlock partial = it->second.partial;
+        mapPartialBlocks.erase(it);
+        ProcessPartialBlock(pfrom, partial, resp.txn);
+    }
+
+
     // This asymmetric behavior for inbound and outbound connections was introduced
     // to prevent a fingerprinting attack: an attacker can send specific fake addresses
     // to users' AddrMan and later request them by sending getaddr messages.
@@ -3436,6 +4549,11 @@ bool ProcessMessages(CNode* pfrom)
     // this maintains the order of responses
     if (!pfrom->vRecvGetData.empty()) return fOk;
 
+    // Before the version message, a node's blocks and transactions are
+    // rejected unparsed
+    if (nMessagePrepareThreads > 0 && pfrom->nVersion != 0)
+        PrepareMessages(pfrom);
+
     std::deque<CNetMessage>::iterator it = pfrom->vRecvMsg.begin();
     while (!pfrom->fDisconnect && it != pfrom->vRecvMsg.end()) {
         // Don't bother if send buffer is too full to respond anyway
@@ -3450,8 +4568,9 @@ bool ProcessMessages(CNode* pfrom)
         //            msg.hdr.nMessageSize, msg.vRecv.size(),
         //            msg.complete() ? "Y" : "N");
 
-        // end, if an incomplete message is found
-        if (!msg.complete())
+        // end, if an incomplete message is found, or one still being
+        // prepared; later messages wait for it to keep them in order
+        if (!msg.ready())
             break;
 
         // at this point, any failure means we can delete the current message
@@ -3477,10 +4596,16 @@ bool ProcessMessages(CNode* pfrom)
         unsigned int nMessageSize = hdr.nMessageSize;
 
         // Checksum
-        CDataStream& vRecv = msg.vRecv;
-        uint256 hash = Hash(vRecv.begin(), vRecv.begin() + nMessageSize);
+        CPreparedTxOrBlock* pprepared = (CPreparedTxOrBlock*)msg.pprepared.get();
+        CDataStream& vRecv = pprepared ? pprepared->vRecv : msg.vRecv;
         unsigned int nChecksum = 0;
-        memcpy(&nChecksum, &hash, sizeof(nChecksum));
+        if (pprepared)
+            nChecksum = pprepared->nChecksum;
+        else
+        {
+            uint256 hash = Hash(vRecv.begin(), vRecv.begin() + nMessageSize);
+            memcpy(&nChecksum, &hash, sizeof(nChecksum));
+        }
         if (nChecksum != hdr.nChecksum)
         {
             LogPrintf("ProcessMessages(%s, %u bytes) : CHECKSUM ERROR nChecksum=%08x hdr.nChecksum=%08x\n",
@@ -3488,11 +4613,14 @@ bool ProcessMessages(CNode* pfrom)
             continue;
         }
 
+        CNode::RecordMessageLatency(GetTimeMicros() - msg.nTime);
+
         // Process message
         bool fRet = false;
         try
         {
-            fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime);
+            // Unparseable messages go the usual way, which reports the error
+            fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime, pprepared && pprepared->fParsed ? pprepared : NULL);
             boost::this_thread::interruption_point();
         }
         catch (std::ios_base::failure& e)
@@ -3575,7 +4703,13 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         // Start block sync
         if (pto->fStartSync && !fImporting && !fReindex) {
             pto->fStartSync = false;
-            PushGetBlocks(pto, pindexBest, uint256(0));
+            if (fHeadersFirst) {
+                pnodeHeaders = pto;
+                fHeadersMore = true;
+                nHeadersRequestTime = 0;
+                RequestHeaders();
+            } else
+                PushGetBlocks(pto, pindexBest, uint256(0));
         }
 
         // Resend wallet transactions that haven't gotten in a block yet
@@ -3693,7 +4827,17 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             {
                 if (fDebug)
                     LogPrint("net", "sending getdata: %s\n", inv.ToString());
-                vGetData.push_back(inv);
+                // New blocks come as compact blocks, filled in from the memory pool
+                if (inv.type == MSG_BLOCK && pto->nVersion >= COMPACT_BLOCKS_VERSION && !IsInitialBlockDownload())
+                {
+                    CBlockInFlight request;
+                    request.pnode = pto;
+                    request.nTime = GetTime();
+                    mapCmpctBlocksInFlight[inv.hash] = request;
+                    vGetData.push_back(CInv(MSG_CMPCT_BLOCK, inv.hash));
+                }
+                else
+                    vGetData.push_back(inv);
                 if (vGetData.size() >= 1000)
                 {
                     pto->PushMessage("getdata", vGetData);
@@ -3703,6 +4847,9 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             }
             pto->mapAskFor.erase(pto->mapAskFor.begin());
         }
+        CheckDownloadStalls();
+        if (fHeadersFirst && !fImporting && !fReindex)
+            RequestBlocks(pto, vGetData);
         if (!vGetData.empty())
             pto->PushMessage("getdata", vGetData);
 
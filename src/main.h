@@ -6,17 +6,24 @@
 #define DIMINUTIVEVAULT_MAIN_H
 
 #include "core.h"
+#include "arith_uint256.h"
+#include "blockindexmap.h"
 #include "bignum.h"
 #include "sync.h"
 #include "txmempool.h"
 #include "net.h"
 #include "hashblock.h"
+#include "mappedfile.h"
+#include "sha256d.h"
 //#include "script.h"
 //#include "scrypt.h"
 
+#include <atomic>
 #include <limits>
 #include <list>
 
+#include <boost/shared_ptr.hpp>
+
 class CBlock;
 class CBlockIndex;
 class CInv;
@@ -43,6 +50,19 @@ static const unsigned int MAX_ORPHAN_TRANSACTIONS = MAX_BLOCK_SIZE/100;
 static const unsigned int DEFAULT_MAX_ORPHAN_BLOCKS = 40;
 /** The maximum number of entries in an 'inv' protocol message */
 static const unsigned int MAX_INV_SZ = 50000;
+/** The maximum number of headers in a 'headers' protocol message */
+static const unsigned int MAX_HEADERS_RESULTS = 2000;
+/** How many blocks past our best block headers-first sync keeps headers for */
+static const int MAX_HEADERS_AHEAD = 20000;
+/** How many blocks past the first missing one are downloaded in parallel */
+static const int BLOCK_DOWNLOAD_WINDOW = 1024;
+/** Number of blocks requested from a single peer at a time */
+static const int MAX_BLOCKS_IN_FLIGHT_PER_PEER = 16;
+/** Seconds a block or header request may go unanswered before the peer is dropped as stalling,
+ *  or for a block from a peer that predates BLOCK_NOTFOUND_VERSION, asked of another peer */
+static const int64_t BLOCK_DOWNLOAD_TIMEOUT = 60;
+/** Seconds to wait for the missing transactions of a compact block before getting it whole */
+static const int64_t BLOCKTXN_TIMEOUT = 10;
 /** Fees smaller than this (in satoshi) are considered zero fee (for transaction creation) */
 static const int64_t MIN_TX_FEE = 0.00000250 * COIN;
 /** Fees smaller than this (in satoshi) are considered zero fee (for relaying) */
@@ -52,6 +72,14 @@ static const int64_t MAX_MONEY = 200000 * COIN; // 15 million
 inline bool MoneyRange(int64_t nValue) { return (nValue >= 0 && nValue <= MAX_MONEY); }
 /** Threshold for nLockTime: below this value it is interpreted as block number, otherwise as UNIX timestamp. */
 static const unsigned int LOCKTIME_THRESHOLD = 500000000; // Tue Nov  5 00:53:20 1985 UTC
+/** Maximum number of script-checking threads allowed */
+static const int MAX_SCRIPTCHECK_THREADS = 16;
+/** -par default (number of script-checking threads, 0 = auto) */
+static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** Maximum number of threads preparing received blocks and transactions */
+static const int MAX_MESSAGEPREPARE_THREADS = 16;
+/** -msgthreads default (number of message preparation threads, 0 = none) */
+static const int DEFAULT_MESSAGEPREPARE_THREADS = 2;
 /** FutureDrift parameters */
 inline int64_t FutureDrift(int64_t nTime) { return nTime + 30 * 60; }
 /** Block target spacing defines */
@@ -62,7 +90,7 @@ inline bool IsVaultPOS(int nHeight) { return TestNet() || nHeight > 40000; }
 extern CScript COINBASE_FLAGS;
 extern CCriticalSection cs_main;
 extern CTxMemPool mempool;
-extern std::map<uint256, CBlockIndex*> mapBlockIndex;
+extern CBlockIndexMap mapBlockIndex;
 extern std::set<std::pair<COutPoint, unsigned int> > setStakeSeen;
 extern CBlockIndex* pindexGenesisBlock;
 extern int nStakeMinConfirmations;
@@ -74,6 +102,9 @@ extern uint256 nBestChainTrust;
 extern uint256 nBestInvalidTrust;
 extern uint256 hashBestChain;
 extern CBlockIndex* pindexBest;
+/** Incremented under cs_main each time the best chain changes, so other
+ *  threads can see that it moved without taking the lock */
+extern std::atomic<unsigned int> nBestChainUpdates;
 extern uint64_t nLastBlockTx;
 extern uint64_t nLastBlockSize;
 extern int64_t nLastCoinStakeSearchInterval;
@@ -84,6 +115,11 @@ extern bool fReindex;
 struct COrphanBlock;
 extern std::map<uint256, COrphanBlock*> mapOrphanBlocks;
 extern bool fHaveGUI;
+extern int nScriptCheckThreads;
+extern int nMessagePrepareThreads;
+extern bool fHeadersFirst;
+extern std::atomic<uint64_t> nBlockHashCacheHits;
+extern std::atomic<uint64_t> nBlockHashCacheMisses;
 
 // Settings
 extern bool fUseFastIndex;
@@ -93,6 +129,7 @@ extern unsigned int nDerivationMethodIndex;
 static const uint64_t nMinDiskSpace = 52428800;
 
 class CReserveKey;
+class CScriptCheck;
 class CTxDB;
 class CTxIndex;
 class CWalletInterface;
@@ -115,7 +152,7 @@ void UnregisterNodeSignals(CNodeSignals& nodeSignals);
 
 void PushGetBlocks(CNode* pnode, CBlockIndex* pindexBegin, uint256 hashEnd);
 
-bool ProcessBlock(CNode* pfrom, CBlock* pblock);
+bool ProcessBlock(CNode* pfrom, CBlock* pblock, bool fChecked=false);
 bool CheckDiskSpace(uint64_t nAdditionalBytes=0);
 FILE* OpenBlockFile(unsigned int nFile, unsigned int nBlockPos, const char* pszMode="rb");
 FILE* AppendBlockFile(unsigned int& nFileRet);
@@ -124,7 +161,13 @@ void PrintBlockTree();
 CBlockIndex* FindBlockByHeight(int nHeight);
 bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
+/** Forget the sync state of a node that is about to be deleted */
+void FinalizeNode(CNode* pnode);
 void ThreadImport(std::vector<boost::filesystem::path> vImportFiles);
+/** Run an instance of the script checking thread */
+void ThreadScriptCheck();
+/** Run an instance of the message preparation thread */
+void ThreadMessagePrepare();
 
 bool CheckProofOfWork(uint256 hash, unsigned int nBits);
 unsigned int GetNextTargetRequired(const CBlockIndex* pindexLast, bool fProofOfStake);
@@ -159,7 +202,7 @@ void ThreadStakeMiner(CWallet *pwallet);
       
 
 /** (try to) add transaction to memory pool **/
-bool AcceptToMemoryPool(CTxMemPool& pool, CTransaction &tx, bool fLimitFree, bool* pfMissingInputs);
+bool AcceptToMemoryPool(CTxMemPool& pool, CTransaction &tx, bool fLimitFree, bool* pfMissingInputs, bool fChecked=false);
 
 /** Position on disk for a particular transaction. */
 class CDiskTxPos
@@ -207,6 +250,25 @@ public:
     }
 };
 
+/** Part of a block in a memory-mapped block file, from nPos to the end of
+ *  the block at nBlockPos. Keeps the mapping alive while it exists. */
+class CBlockFileSpan
+{
+public:
+    CBlockFileSpan() : pbegin(NULL), pend(NULL) { }
+
+    /** False if the block file can't be mapped or has no valid size
+     *  record for the block; read it through OpenBlockFile() then */
+    bool Map(unsigned int nFile, unsigned int nBlockPos, unsigned int nPos);
+
+    CSpanReader GetReader(int nType) const { return CSpanReader(pbegin, pend, nType, CLIENT_VERSION); }
+
+private:
+    boost::shared_ptr<const CMappedFile> pmap;
+    const char* pbegin;
+    const char* pend;
+};
+
 
 
 
@@ -234,6 +296,11 @@ public:
     std::vector<CTxOut> vout;
     unsigned int nLockTime;
 
+    // memory only: txid, set by SetCachedHash() once the transaction is
+    // known not to change any more
+    mutable uint256 hashCached;
+    mutable bool fHashCached;
+
     // Denial-of-service detection:
     mutable int nDoS;
     bool DoS(int nDoSIn, bool fIn) const { nDoS += nDoSIn; return fIn; }
@@ -244,7 +311,7 @@ public:
     }
 
     CTransaction(int nVersion, unsigned int nTime, const std::vector<CTxIn>& vin, const std::vector<CTxOut>& vout, unsigned int nLockTime)
-        : nVersion(nVersion), nTime(nTime), vin(vin), vout(vout), nLockTime(nLockTime), nDoS(0)
+        : nVersion(nVersion), nTime(nTime), vin(vin), vout(vout), nLockTime(nLockTime), fHashCached(false), nDoS(0)
     {
     }
 
@@ -256,6 +323,8 @@ public:
         READWRITE(vin);
         READWRITE(vout);
         READWRITE(nLockTime);
+        if (fRead)
+            const_cast<CTransaction*>(this)->fHashCached = false;
     )
 
     void SetNull()
@@ -265,6 +334,7 @@ public:
         vin.clear();
         vout.clear();
         nLockTime = 0;
+        fHashCached = false;
         nDoS = 0;  // Denial-of-service prevention
     }
 
@@ -275,9 +345,26 @@ public:
 
     uint256 GetHash() const
     {
+        if (fHashCached)
+            return hashCached;
         return SerializeHash(*this);
     }
 
+    // Remember the txid of a transaction that will not be modified again,
+    // such as one read from the network or disk, or held in the memory
+    // pool. Nothing checks this afterwards: changing a field of a
+    // transaction with a cached hash leaves GetHash() returning the old one.
+    void SetCachedHash(const uint256& hash) const
+    {
+        hashCached = hash;
+        fHashCached = true;
+    }
+
+    void CacheHash() const
+    {
+        SetCachedHash(SerializeHash(*this));
+    }
+
     bool IsCoinBase() const
     {
         return (vin.size() == 1 && vin[0].prevout.IsNull() && vout.size() >= 1);
@@ -316,6 +403,18 @@ public:
 
     bool ReadFromDisk(CDiskTxPos pos, FILE** pfileRet=NULL)
     {
+        CBlockFileSpan span;
+        if (!pfileRet && span.Map(pos.nFile, pos.nBlockPos, pos.nTxPos))
+        {
+            try {
+                span.GetReader(SER_DISK) >> *this;
+            }
+            catch (std::exception &e) {
+                return error("%s() : deserialize error", __PRETTY_FUNCTION__);
+            }
+            return true;
+        }
+
         CAutoFile filein = CAutoFile(OpenBlockFile(pos.nFile, 0, pfileRet ? "rb+" : "rb"), SER_DISK, CLIENT_VERSION);
         if (!filein)
             return error("CTransaction::ReadFromDisk() : OpenBlockFile failed");
@@ -401,17 +500,51 @@ public:
         @param[in] pindexBlock
         @param[in] fBlock	true if called from ConnectBlock
         @param[in] fMiner	true if called from CreateNewBlock
+        @param[out] pvChecks	If not NULL, script checks are appended here instead of being run
         @return Returns true if all checks succeed
      */
     bool ConnectInputs(CTxDB& txdb, MapPrevTx inputs,
                        std::map<uint256, CTxIndex>& mapTestPool, const CDiskTxPos& posThisTx,
-                       const CBlockIndex* pindexBlock, bool fBlock, bool fMiner, unsigned int flags = STANDARD_SCRIPT_VERIFY_FLAGS);
+                       const CBlockIndex* pindexBlock, bool fBlock, bool fMiner, unsigned int flags = STANDARD_SCRIPT_VERIFY_FLAGS,
+                       std::vector<CScriptCheck>* pvChecks = NULL);
     bool CheckTransaction() const;
     bool GetCoinAge(CTxDB& txdb, const CBlockIndex* pindexPrev, uint64_t& nCoinAge) const;
 
     const CTxOut& GetOutputFor(const CTxIn& input, const MapPrevTx& inputs) const;
 };
 
+/** Closure representing one script verification
+ *  Note that this stores references to the spending transaction */
+class CScriptCheck
+{
+private:
+    CScript scriptPubKey;
+    const CTransaction* ptxTo;
+    unsigned int nIn;
+    unsigned int nFlags;
+    int nHashType;
+    boost::shared_ptr<const CSignatureHasher> phasher; // shared by the checks of one transaction
+
+public:
+    CScriptCheck() : ptxTo(0), nIn(0), nFlags(0), nHashType(0) {}
+    CScriptCheck(const CTransaction& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, int nHashTypeIn,
+                 const boost::shared_ptr<const CSignatureHasher>& phasherIn = boost::shared_ptr<const CSignatureHasher>()) :
+        scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey),
+        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), nHashType(nHashTypeIn), phasher(phasherIn) {}
+
+    bool operator()() const;
+
+    void swap(CScriptCheck& check)
+    {
+        scriptPubKey.swap(check.scriptPubKey);
+        std::swap(ptxTo, check.ptxTo);
+        std::swap(nIn, check.nIn);
+        std::swap(nFlags, check.nFlags);
+        std::swap(nHashType, check.nHashType);
+        phasher.swap(check.phasher);
+    }
+};
+
 /** wrapper for CTxOut that provides a more compact serialization */
 class CTxOutCompressor
 {
@@ -604,6 +737,13 @@ public:
     // memory only
     mutable std::vector<uint256> vMerkleTree;
 
+    // memory only: HMQ1725 hash of the header and the header bytes it was
+    // computed from, so that any change to a header field invalidates it
+    enum { HEADER_SIZE = 80 };
+    mutable uint256 hashCached;
+    mutable unsigned char pchHashCachedHeader[HEADER_SIZE];
+    mutable bool fHashCached;
+
     // Denial-of-service detection:
     mutable int nDoS;
     bool DoS(int nDoSIn, bool fIn) const { nDoS += nDoSIn; return fIn; }
@@ -647,6 +787,7 @@ public:
         vtx.clear();
         vchBlockSig.clear();
         vMerkleTree.clear();
+        fHashCached = false;
         nDoS = 0;
     }
 
@@ -657,7 +798,25 @@ public:
 
     uint256 GetHash() const
     {
-        return HMQ1725(BEGIN(nVersion), END(nNonce));
+        if (fHashCached && memcmp(pchHashCachedHeader, BEGIN(nVersion), HEADER_SIZE) == 0)
+        {
+            nBlockHashCacheHits++;
+            return hashCached;
+        }
+        nBlockHashCacheMisses++;
+        memcpy(pchHashCachedHeader, BEGIN(nVersion), HEADER_SIZE);
+        hashCached = HMQ1725(BEGIN(nVersion), END(nNonce));
+        fHashCached = true;
+        return hashCached;
+    }
+
+    // Seed the hash cache with a hash already known to belong to the
+    // current header fields (e.g. the key of a block index entry)
+    void SetCachedHash(const uint256& hash) const
+    {
+        memcpy(pchHashCachedHeader, BEGIN(nVersion), HEADER_SIZE);
+        hashCached = hash;
+        fHashCached = true;
     }
 
     int64_t GetBlockTime() const
@@ -704,22 +863,34 @@ public:
     uint256 BuildMerkleTree() const
     {
         vMerkleTree.clear();
+        vMerkleTree.reserve(vtx.size() * 2 + 16);
         BOOST_FOREACH(const CTransaction& tx, vtx)
             vMerkleTree.push_back(tx.GetHash());
         int j = 0;
         for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
         {
-            for (int i = 0; i < nSize; i += 2)
+            // The pairs of a level lie next to each other, so they are all
+            // hashed in one call; an odd last entry is paired with itself
+            vMerkleTree.resize(j + nSize + (nSize + 1) / 2);
+            SHA256D64(vMerkleTree[j+nSize].begin(), vMerkleTree[j].begin(), nSize / 2);
+            if (nSize & 1)
             {
-                int i2 = std::min(i+1, nSize-1);
-                vMerkleTree.push_back(Hash(BEGIN(vMerkleTree[j+i]),  END(vMerkleTree[j+i]),
-                                           BEGIN(vMerkleTree[j+i2]), END(vMerkleTree[j+i2])));
+                const uint256& last = vMerkleTree[j+nSize-1];
+                vMerkleTree[j+nSize+nSize/2] = Hash(BEGIN(last), END(last), BEGIN(last), END(last));
             }
             j += nSize;
         }
         return (vMerkleTree.empty() ? 0 : vMerkleTree.back());
     }
 
+    // Remember the txids of a block that was read from the network or disk
+    // and will only be checked and stored from here on
+    void CacheTxHashes() const
+    {
+        BOOST_FOREACH(const CTransaction& tx, vtx)
+            tx.CacheHash();
+    }
+
     std::vector<uint256> GetMerkleBranch(int nIndex) const
     {
         if (vMerkleTree.empty())
@@ -781,26 +952,38 @@ public:
     bool ReadFromDisk(unsigned int nFile, unsigned int nBlockPos, bool fReadTransactions=true)
     {
         SetNull();
+        int nType = SER_DISK | (fReadTransactions ? 0 : SER_BLOCKHEADERONLY);
 
-        // Open history file to read
-        CAutoFile filein = CAutoFile(OpenBlockFile(nFile, nBlockPos, "rb"), SER_DISK, CLIENT_VERSION);
-        if (!filein)
-            return error("CBlock::ReadFromDisk() : OpenBlockFile failed");
-        if (!fReadTransactions)
-            filein.nType |= SER_BLOCKHEADERONLY;
-
-        // Read block
-        try {
-            filein >> *this;
+        // Read block from the mapped file if possible, else open it
+        CBlockFileSpan span;
+        if (span.Map(nFile, nBlockPos, nBlockPos))
+        {
+            try {
+                span.GetReader(nType) >> *this;
+            }
+            catch (std::exception &e) {
+                return error("%s() : deserialize error", __PRETTY_FUNCTION__);
+            }
         }
-        catch (std::exception &e) {
-            return error("%s() : deserialize or I/O error", __PRETTY_FUNCTION__);
+        else
+        {
+            CAutoFile filein = CAutoFile(OpenBlockFile(nFile, nBlockPos, "rb"), nType, CLIENT_VERSION);
+            if (!filein)
+                return error("CBlock::ReadFromDisk() : OpenBlockFile failed");
+
+            try {
+                filein >> *this;
+            }
+            catch (std::exception &e) {
+                return error("%s() : deserialize or I/O error", __PRETTY_FUNCTION__);
+            }
         }
 
         // Check the header
         if (fReadTransactions && IsProofOfWork() && !CheckProofOfWork(GetHash(), nBits))
             return error("CBlock::ReadFromDisk() : errors in block header");
 
+        CacheTxHashes();
         return true;
     }
 
@@ -962,6 +1145,8 @@ public:
         block.nTime          = nTime;
         block.nBits          = nBits;
         block.nNonce         = nNonce;
+        if (phashBlock)
+            block.SetCachedHash(*phashBlock);
         return block;
     }
 
@@ -1131,10 +1316,23 @@ public:
         READWRITE(blockHash);
     )
 
-    uint256 GetBlockHash() const
+    // The hash stored with the index, if GetBlockHash() may return it
+    // without hashing the header again
+    bool GetStoredBlockHash(uint256& hash) const
     {
         if (fUseFastIndex && (nTime < GetAdjustedTime() - 24 * 60 * 60) && blockHash != 0)
-            return blockHash;
+        {
+            hash = blockHash;
+            return true;
+        }
+        return false;
+    }
+
+    uint256 GetBlockHash() const
+    {
+        uint256 hash;
+        if (GetStoredBlockHash(hash))
+            return hash;
 
         CBlock block;
         block.nVersion        = nVersion;
@@ -1189,7 +1387,7 @@ public:
 
     explicit CBlockLocator(uint256 hashBlock)
     {
-        std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+        CBlockIndexMap::iterator mi = mapBlockIndex.find(hashBlock);
         if (mi != mapBlockIndex.end())
             Set((*mi).second);
     }
@@ -1240,7 +1438,7 @@ public:
         int nStep = 1;
         BOOST_FOREACH(const uint256& hash, vHave)
         {
-            std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+            CBlockIndexMap::iterator mi = mapBlockIndex.find(hash);
             if (mi != mapBlockIndex.end())
             {
                 CBlockIndex* pindex = (*mi).second;
@@ -1259,7 +1457,7 @@ public:
         // Find the first block the caller has in the main chain
         BOOST_FOREACH(const uint256& hash, vHave)
         {
-            std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+            CBlockIndexMap::iterator mi = mapBlockIndex.find(hash);
             if (mi != mapBlockIndex.end())
             {
                 CBlockIndex* pindex = (*mi).second;
@@ -1275,7 +1473,7 @@ public:
         // Find the first block the caller has in the main chain
         BOOST_FOREACH(const uint256& hash, vHave)
         {
-            std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+            CBlockIndexMap::iterator mi = mapBlockIndex.find(hash);
             if (mi != mapBlockIndex.end())
             {
                 CBlockIndex* pindex = (*mi).second;
@@ -0,0 +1,75 @@
+// Copyright (c) 2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "mappedfile.h"
+
+#include "util.h"
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+CMappedFile::CMappedFile(const boost::filesystem::path& path) : pdata(NULL), nSize(0)
+{
+#ifndef WIN32
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0 && (uint64_t)st.st_size <= (uint64_t)std::numeric_limits<size_t>::max()) {
+        void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED) {
+            pdata = (const char*)p;
+            nSize = st.st_size;
+        }
+    }
+    close(fd);
+#endif
+}
+
+CMappedFile::~CMappedFile()
+{
+#ifndef WIN32
+    if (pdata)
+        munmap((void*)pdata, nSize);
+#endif
+}
+
+boost::shared_ptr<const CMappedFile> CMappedFileCache::Get(unsigned int nKey, const boost::filesystem::path& path, size_t nMinSize)
+{
+    LOCK(cs);
+    map<unsigned int, MappingList::iterator>::iterator mi = mapMappings.find(nKey);
+    if (mi != mapMappings.end()) {
+        MappingList::iterator it = mi->second;
+        listMappings.splice(listMappings.begin(), listMappings, it);
+        if (it->second->size() >= nMinSize)
+            return it->second;
+        listMappings.erase(it);
+        mapMappings.erase(mi);
+    }
+
+    boost::shared_ptr<const CMappedFile> pmap(new CMappedFile(path));
+    if (!pmap->IsValid() || pmap->size() < nMinSize)
+        return boost::shared_ptr<const CMappedFile>();
+    listMappings.push_front(make_pair(nKey, pmap));
+    mapMappings[nKey] = listMappings.begin();
+    while (listMappings.size() > nMaxFiles) {
+        mapMappings.erase(listMappings.back().first);
+        listMappings.pop_back();
+    }
+    LogPrint("db", "CMappedFileCache : mapped %s (%u kB)\n", path.filename().string(), pmap->size() / 1024);
+    return pmap;
+}
+
+void CMappedFileCache::Clear()
+{
+    LOCK(cs);
+    listMappings.clear();
+    mapMappings.clear();
+}
@@ -0,0 +1,98 @@
+// Copyright (c) 2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef DIMINUTIVEVAULT_MAPPEDFILE_H
+#define DIMINUTIVEVAULT_MAPPEDFILE_H
+
+#include "serialize.h"
+#include "sync.h"
+
+#include <list>
+#include <map>
+
+#include <boost/filesystem/path.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+/** Read-only memory mapping of a whole file, as it was when mapped. Later
+ *  appends to the file are not visible through it. Not supported on
+ *  Windows, where IsValid() is always false. */
+class CMappedFile : private boost::noncopyable
+{
+public:
+    explicit CMappedFile(const boost::filesystem::path& path);
+    ~CMappedFile();
+
+    bool IsValid() const { return pdata != NULL; }
+    const char* data() const { return pdata; }
+    size_t size() const { return nSize; }
+
+private:
+    const char* pdata;
+    size_t nSize;
+};
+
+/** A bounded set of file mappings, keyed by number, least recently used
+ *  dropped first. Mappings are shared: one dropped from the cache stays
+ *  valid until its last user lets go of it. Thread safe. */
+class CMappedFileCache : private boost::noncopyable
+{
+public:
+    explicit CMappedFileCache(size_t nMaxFilesIn) : nMaxFiles(nMaxFilesIn) { }
+
+    /** Mapping of path, kept under nKey, covering at least nMinSize bytes.
+     *  A cached mapping that is too short is replaced by a new one, for
+     *  files that have been appended to. NULL if the file can't be mapped
+     *  or is shorter than that. */
+    boost::shared_ptr<const CMappedFile> Get(unsigned int nKey, const boost::filesystem::path& path, size_t nMinSize);
+
+    void Clear();
+
+private:
+    typedef std::list<std::pair<unsigned int, boost::shared_ptr<const CMappedFile> > > MappingList;
+
+    CCriticalSection cs;
+    size_t nMaxFiles;
+    MappingList listMappings;   // most recently used first
+    std::map<unsigned int, MappingList::iterator> mapMappings;
+};
+
+/** Stream that deserializes from a range of memory without copying it,
+ *  such as a block in a CMappedFile. Reading past the end throws, like a
+ *  read past the end of a file. */
+class CSpanReader
+{
+private:
+    const char* pcur;
+    const char* pend;
+
+public:
+    int nType;
+    int nVersion;
+
+    CSpanReader(const char* pbeginIn, const char* pendIn, int nTypeIn, int nVersionIn) :
+        pcur(pbeginIn), pend(pendIn), nType(nTypeIn), nVersion(nVersionIn) { }
+
+    int GetType() const { return nType; }
+    int GetVersion() const { return nVersion; }
+    size_t size() const { return pend - pcur; }
+    bool empty() const { return pcur == pend; }
+
+    CSpanReader& read(char* pch, size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CSpanReader::read : end of data");
+        memcpy(pch, pcur, nSize);
+        pcur += nSize;
+        return (*this);
+    }
+
+    template<typename T>
+    CSpanReader& operator>>(T& obj)
+    {
+        ::Unserialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
+#endif
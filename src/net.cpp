@@ -14,6 +14,13 @@
 #include <string.h>
 #endif
 
+#ifdef __linux__
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#define USE_EPOLL 1
+#endif
+
 #ifdef USE_UPNP
 #include <miniupnpc/miniwget.h>
 #include <miniupnpc/miniupnpc.h>
@@ -74,6 +81,93 @@ static CSemaphore *semOutbound = NULL;
 static CNodeSignals g_signals;
 CNodeSignals& GetNodeSignals() { return g_signals; }
 
+#ifdef USE_EPOLL
+// Edge-triggered set of the listening and peer sockets, -1 when the socket
+// thread uses select(). Only the socket thread adds sockets to it;
+// SocketSendData turns writability watching on and off under cs_vSend.
+static int hEpoll = -1;
+// Registered nodes, and those with data left to read or room left to
+// write from an earlier edge. Socket thread only.
+static set<CNode*> setPollNodes;
+static set<CNode*> setPollRecv;
+static set<CNode*> setPollSend;
+// Wakes ThreadMessageHandler, see WakeMessageHandler
+static int hMessageHandlerEvent = -1;
+
+// requires LOCK(pnode->cs_vSend)
+static bool EpollWatch(CNode* pnode, int op)
+{
+    if (pnode->hSocket == INVALID_SOCKET)
+        return false;
+
+    // Only ask for writability while there is something queued to send,
+    // or every ack would wake the socket thread
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    if (!pnode->vSendMsg.empty())
+        event.events |= EPOLLOUT;
+    event.data.ptr = pnode;
+    if (epoll_ctl(hEpoll, op, pnode->hSocket, &event) == SOCKET_ERROR)
+    {
+        LogPrintf("socket epoll_ctl error %d\n", WSAGetLastError());
+        return false;
+    }
+    pnode->fPollRegistered = true;
+    pnode->fPollSend = !pnode->vSendMsg.empty();
+    return true;
+}
+#endif
+
+// Without an eventfd ThreadMessageHandler waits on a condition variable
+static boost::mutex csMessageHandlerWake;
+static boost::condition_variable condMessageHandlerWake;
+static bool fMessageHandlerWake = false;
+
+// Called when a node has a message ready to process, or room again to send
+// replies, so ThreadMessageHandler doesn't have to poll for them
+void WakeMessageHandler()
+{
+#ifdef USE_EPOLL
+    if (hMessageHandlerEvent != -1)
+    {
+        // Can only fail if the counter would overflow, when it is set anyway
+        uint64_t nOne = 1;
+        if (write(hMessageHandlerEvent, &nOne, sizeof(nOne)) < 0)
+            LogPrint("net", "message handler wakeup failed: %d\n", errno);
+        return;
+    }
+#endif
+    {
+        boost::lock_guard<boost::mutex> lock(csMessageHandlerWake);
+        fMessageHandlerWake = true;
+    }
+    condMessageHandlerWake.notify_one();
+}
+
+// Sleep for up to nMilliseconds, less if WakeMessageHandler is called
+static void WaitForMessages(int64_t nMilliseconds)
+{
+#ifdef USE_EPOLL
+    if (hMessageHandlerEvent != -1)
+    {
+        struct pollfd pfd;
+        pfd.fd = hMessageHandlerEvent;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        poll(&pfd, 1, nMilliseconds);
+        uint64_t nCount;
+        if (read(hMessageHandlerEvent, &nCount, sizeof(nCount)) < 0)
+            nCount = 0;
+        boost::this_thread::interruption_point();
+        return;
+    }
+#endif
+    boost::unique_lock<boost::mutex> lock(csMessageHandlerWake);
+    if (!fMessageHandlerWake)
+        condMessageHandlerWake.timed_wait(lock, boost::posix_time::milliseconds(nMilliseconds));
+    fMessageHandlerWake = false;
+}
+
 void AddOneShot(string strDest)
 {
     LOCK(cs_vOneShots);
@@ -312,6 +406,8 @@ uint64_t CNode::nTotalBytesRecv = 0;
 uint64_t CNode::nTotalBytesSent = 0;
 CCriticalSection CNode::cs_totalBytesRecv;
 CCriticalSection CNode::cs_totalBytesSent;
+CCriticalSection CNode::cs_messageLatency;
+uint64_t CNode::vMessageLatency[MESSAGE_LATENCY_BUCKETS] = {};
 
 CNode* FindNode(const CNetAddr& ip)
 {
@@ -554,8 +650,10 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
         pch += handled;
         nBytes -= handled;
 
-        if (msg.complete())
+        if (msg.complete()) {
             msg.nTime = GetTimeMicros();
+            WakeMessageHandler();
+        }
     }
 
     return true;
@@ -611,6 +709,7 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
 // requires LOCK(cs_vSend)
 void SocketSendData(CNode *pnode)
 {
+    bool fSendBufferFull = pnode->nSendSize >= SendBufferSize();
     std::deque<CSerializeData>::iterator it = pnode->vSendMsg.begin();
 
     while (it != pnode->vSendMsg.end()) {
@@ -650,79 +749,232 @@ void SocketSendData(CNode *pnode)
         assert(pnode->nSendSize == 0);
     }
     pnode->vSendMsg.erase(pnode->vSendMsg.begin(), it);
+
+    // ProcessMessages holds off on nodes with a full send buffer
+    if (fSendBufferFull && pnode->nSendSize < SendBufferSize())
+        WakeMessageHandler();
+
+#ifdef USE_EPOLL
+    if (pnode->fPollRegistered && pnode->fPollSend != !pnode->vSendMsg.empty())
+        EpollWatch(pnode, EPOLL_CTL_MOD);
+#endif
 }
 
 static list<CNode*> vNodesDisconnected;
 
-void ThreadSocketHandler()
+static void DisconnectNodes()
 {
-    unsigned int nPrevNodeCount = 0;
+    static unsigned int nPrevNodeCount = 0;
 
-    while (true)
     {
-        //
-        // Disconnect nodes
-        //
+        LOCK(cs_vNodes);
+        // Disconnect unused nodes
+        vector<CNode*> vNodesCopy = vNodes;
+        BOOST_FOREACH(CNode* pnode, vNodesCopy)
         {
-            LOCK(cs_vNodes);
-            // Disconnect unused nodes
-            vector<CNode*> vNodesCopy = vNodes;
-            BOOST_FOREACH(CNode* pnode, vNodesCopy)
+            if (pnode->fDisconnect ||
+                (pnode->GetRefCount() <= 0 && pnode->vRecvMsg.empty() && pnode->nSendSize == 0 && pnode->ssSend.empty()))
             {
-                if (pnode->fDisconnect ||
-                    (pnode->GetRefCount() <= 0 && pnode->vRecvMsg.empty() && pnode->nSendSize == 0 && pnode->ssSend.empty()))
-                {
-                    // remove from vNodes
-                    vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+                // remove from vNodes
+                vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
 
-                    // release outbound grant (if any)
-                    pnode->grantOutbound.Release();
+#ifdef USE_EPOLL
+                setPollNodes.erase(pnode);
+                setPollRecv.erase(pnode);
+                setPollSend.erase(pnode);
+#endif
 
-                    // close socket and cleanup
-                    pnode->CloseSocketDisconnect();
+                // release outbound grant (if any)
+                pnode->grantOutbound.Release();
 
-                    // hold in disconnected pool until all refs are released
-                    if (pnode->fNetworkNode || pnode->fInbound)
-                        pnode->Release();
-                    vNodesDisconnected.push_back(pnode);
-                }
+                // close socket and cleanup
+                pnode->CloseSocketDisconnect();
+
+                // hold in disconnected pool until all refs are released
+                if (pnode->fNetworkNode || pnode->fInbound)
+                    pnode->Release();
+                vNodesDisconnected.push_back(pnode);
             }
         }
+    }
+    {
+        // Delete disconnected nodes
+        list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
+        BOOST_FOREACH(CNode* pnode, vNodesDisconnectedCopy)
         {
-            // Delete disconnected nodes
-            list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
-            BOOST_FOREACH(CNode* pnode, vNodesDisconnectedCopy)
+            // wait until threads are done using it
+            if (pnode->GetRefCount() <= 0)
             {
-                // wait until threads are done using it
-                if (pnode->GetRefCount() <= 0)
+                bool fDelete = false;
                 {
-                    bool fDelete = false;
+                    TRY_LOCK(pnode->cs_vSend, lockSend);
+                    if (lockSend)
                     {
-                        TRY_LOCK(pnode->cs_vSend, lockSend);
-                        if (lockSend)
+                        TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                        if (lockRecv)
                         {
-                            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                            if (lockRecv)
-                            {
-                                TRY_LOCK(pnode->cs_inventory, lockInv);
-                                if (lockInv)
-                                    fDelete = true;
-                            }
+                            TRY_LOCK(pnode->cs_inventory, lockInv);
+                            if (lockInv)
+                                fDelete = true;
                         }
                     }
-                    if (fDelete)
-                    {
-                        vNodesDisconnected.remove(pnode);
-                        delete pnode;
-                    }
+                }
+                if (fDelete)
+                {
+                    vNodesDisconnected.remove(pnode);
+                    g_signals.FinalizeNode(pnode);
+                    delete pnode;
                 }
             }
         }
-        if(vNodes.size() != nPrevNodeCount) {
-            nPrevNodeCount = vNodes.size();
-            uiInterface.NotifyNumConnectionsChanged(nPrevNodeCount);
+    }
+    if(vNodes.size() != nPrevNodeCount) {
+        nPrevNodeCount = vNodes.size();
+        uiInterface.NotifyNumConnectionsChanged(nPrevNodeCount);
+    }
+}
+
+// Accept one pending connection on hListenSocket. Returns false once there
+// are none left.
+static bool AcceptConnection(SOCKET hListenSocket)
+{
+    struct sockaddr_storage sockaddr;
+    socklen_t len = sizeof(sockaddr);
+    SOCKET hSocket = accept(hListenSocket, (struct sockaddr*)&sockaddr, &len);
+    CAddress addr;
+    int nInbound = 0;
+
+    if (hSocket != INVALID_SOCKET)
+        if (!addr.SetSockAddr((const struct sockaddr*)&sockaddr))
+            LogPrintf("Warning: Unknown socket family\n");
+
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vNodes)
+            if (pnode->fInbound)
+                nInbound++;
+    }
+
+    if (hSocket == INVALID_SOCKET)
+    {
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEWOULDBLOCK)
+            LogPrintf("socket error accept failed: %d\n", nErr);
+        return false;
+    }
+    else if (nInbound >= GetArg("-maxconnections", 125) - MAX_OUTBOUND_CONNECTIONS)
+    {
+        closesocket(hSocket);
+    }
+    else if (CNode::IsBanned(addr))
+    {
+        LogPrintf("connection from %s dropped (banned)\n", addr.ToString());
+        closesocket(hSocket);
+    }
+    else
+    {
+        LogPrint("net", "accepted connection %s\n", addr.ToString());
+        CNode* pnode = new CNode(hSocket, addr, "", true);
+        pnode->AddRef();
+#ifdef USE_EPOLL
+        if (hEpoll != -1)
+        {
+            LOCK(pnode->cs_vSend);
+            if (!EpollWatch(pnode, EPOLL_CTL_ADD))
+                pnode->CloseSocketDisconnect();
+            setPollNodes.insert(pnode);
+        }
+#endif
+        {
+            LOCK(cs_vNodes);
+            vNodes.push_back(pnode);
+        }
+    }
+    return true;
+}
+
+// Read once from pnode's socket into its receive queue. Returns the number
+// of bytes read, 0 if there is nothing to read now or the socket was
+// closed, and -1 if the receive queue is busy.
+static int SocketRecvData(CNode* pnode)
+{
+    TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+    if (!lockRecv)
+        return -1;
+
+    if (pnode->GetTotalRecvSize() > ReceiveFloodSize()) {
+        if (!pnode->fDisconnect)
+            LogPrintf("socket recv flood control disconnect (%u bytes)\n", pnode->GetTotalRecvSize());
+        pnode->CloseSocketDisconnect();
+        return 0;
+    }
+
+    // typical socket buffer is 8K-64K
+    char pchBuf[0x10000];
+    int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+    if (nBytes > 0)
+    {
+        if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
+            pnode->CloseSocketDisconnect();
+        pnode->nLastRecv = GetTime();
+        pnode->nRecvBytes += nBytes;
+        pnode->RecordBytesRecv(nBytes);
+        return nBytes;
+    }
+    else if (nBytes == 0)
+    {
+        // socket closed gracefully
+        if (!pnode->fDisconnect)
+            LogPrint("net", "socket closed\n");
+        pnode->CloseSocketDisconnect();
+    }
+    else if (nBytes < 0)
+    {
+        // error
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
+        {
+            if (!pnode->fDisconnect)
+                LogPrintf("socket recv error %d\n", nErr);
+            pnode->CloseSocketDisconnect();
         }
+    }
+    return 0;
+}
 
+static void InactivityCheck(CNode* pnode)
+{
+    int64_t nTime = GetTime();
+    if (nTime - pnode->nTimeConnected > 60)
+    {
+        if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
+        {
+            LogPrint("net", "socket no message in first 60 seconds, %d %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0);
+            pnode->fDisconnect = true;
+        }
+        else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
+        {
+            LogPrintf("socket sending timeout: %ds\n", nTime - pnode->nLastSend);
+            pnode->fDisconnect = true;
+        }
+        else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
+        {
+            LogPrintf("socket receive timeout: %ds\n", nTime - pnode->nLastRecv);
+            pnode->fDisconnect = true;
+        }
+        else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
+        {
+            LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
+            pnode->fDisconnect = true;
+        }
+    }
+}
+
+static void ThreadSocketHandlerSelect()
+{
+    while (true)
+    {
+        DisconnectNodes();
 
         //
         // Find which sockets have data to receive
@@ -791,50 +1043,7 @@ void ThreadSocketHandler()
         //
         BOOST_FOREACH(SOCKET hListenSocket, vhListenSocket)
         if (hListenSocket != INVALID_SOCKET && FD_ISSET(hListenSocket, &fdsetRecv))
-        {
-            struct sockaddr_storage sockaddr;
-            socklen_t len = sizeof(sockaddr);
-            SOCKET hSocket = accept(hListenSocket, (struct sockaddr*)&sockaddr, &len);
-            CAddress addr;
-            int nInbound = 0;
-
-            if (hSocket != INVALID_SOCKET)
-                if (!addr.SetSockAddr((const struct sockaddr*)&sockaddr))
-                    LogPrintf("Warning: Unknown socket family\n");
-
-            {
-                LOCK(cs_vNodes);
-                BOOST_FOREACH(CNode* pnode, vNodes)
-                    if (pnode->fInbound)
-                        nInbound++;
-            }
-
-            if (hSocket == INVALID_SOCKET)
-            {
-                int nErr = WSAGetLastError();
-                if (nErr != WSAEWOULDBLOCK)
-                    LogPrintf("socket error accept failed: %d\n", nErr);
-            }
-            else if (nInbound >= GetArg("-maxconnections", 125) - MAX_OUTBOUND_CONNECTIONS)
-            {
-                closesocket(hSocket);
-            }
-            else if (CNode::IsBanned(addr))
-            {
-                LogPrintf("connection from %s dropped (banned)\n", addr.ToString());
-                closesocket(hSocket);
-            }
-            else
-            {
-                LogPrint("net", "accepted connection %s\n", addr.ToString());
-                CNode* pnode = new CNode(hSocket, addr, "", true);
-                pnode->AddRef();
-                {
-                    LOCK(cs_vNodes);
-                    vNodes.push_back(pnode);
-                }
-            }
-        }
+            AcceptConnection(hListenSocket);
 
 
         //
@@ -857,48 +1066,7 @@ void ThreadSocketHandler()
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
             if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError))
-            {
-                TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                if (lockRecv)
-                {
-                    if (pnode->GetTotalRecvSize() > ReceiveFloodSize()) {
-                        if (!pnode->fDisconnect)
-                            LogPrintf("socket recv flood control disconnect (%u bytes)\n", pnode->GetTotalRecvSize());
-                        pnode->CloseSocketDisconnect();
-                    }
-                    else {
-                        // typical socket buffer is 8K-64K
-                        char pchBuf[0x10000];
-                        int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
-                        if (nBytes > 0)
-                        {
-                            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
-                                pnode->CloseSocketDisconnect();
-                            pnode->nLastRecv = GetTime();
-                            pnode->nRecvBytes += nBytes;
-                            pnode->RecordBytesRecv(nBytes);
-                        }
-                        else if (nBytes == 0)
-                        {
-                            // socket closed gracefully
-                            if (!pnode->fDisconnect)
-                                LogPrint("net", "socket closed\n");
-                            pnode->CloseSocketDisconnect();
-                        }
-                        else if (nBytes < 0)
-                        {
-                            // error
-                            int nErr = WSAGetLastError();
-                            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
-                            {
-                                if (!pnode->fDisconnect)
-                                    LogPrintf("socket recv error %d\n", nErr);
-                                pnode->CloseSocketDisconnect();
-                            }
-                        }
-                    }
-                }
-            }
+                SocketRecvData(pnode);
 
             //
             // Send
@@ -915,38 +1083,193 @@ void ThreadSocketHandler()
             //
             // Inactivity checking
             //
-            int64_t nTime = GetTime();
-            if (nTime - pnode->nTimeConnected > 60)
+            InactivityCheck(pnode);
+        }
+        {
+            LOCK(cs_vNodes);
+            BOOST_FOREACH(CNode* pnode, vNodesCopy)
+                pnode->Release();
+        }
+    }
+}
+
+#ifdef USE_EPOLL
+// Sockets are registered once and reported only when they become readable
+// or writable, so a wakeup costs time in the number of ready sockets
+// rather than in the number of peers. The per-peer work of the select()
+// loop, disconnecting and timeouts, runs on a timer instead.
+static void ThreadSocketHandlerEpoll()
+{
+    static const int64_t nHousekeepingInterval = 100;
+    // Reads per ready socket per pass, so one busy peer can't starve the rest
+    static const int nMaxRecvPerPass = 4;
+
+    int64_t nNextHousekeeping = 0;
+    bool fMoreToRead = false;
+    struct epoll_event events[256];
+
+    while (true)
+    {
+        int64_t nNow = GetTimeMillis();
+        if (nNow >= nNextHousekeeping)
+        {
+            DisconnectNodes();
+
+            vector<CNode*> vNodesCopy;
             {
-                if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
-                {
-                    LogPrint("net", "socket no message in first 60 seconds, %d %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0);
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
-                {
-                    LogPrintf("socket sending timeout: %ds\n", nTime - pnode->nLastSend);
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
-                {
-                    LogPrintf("socket receive timeout: %ds\n", nTime - pnode->nLastRecv);
-                    pnode->fDisconnect = true;
-                }
-                else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
+                LOCK(cs_vNodes);
+                vNodesCopy = vNodes;
+            }
+            BOOST_FOREACH(CNode* pnode, vNodesCopy)
+            {
+                // Outbound connections are made by other threads; pick them up here
+                if (!setPollNodes.count(pnode))
                 {
-                    LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
-                    pnode->fDisconnect = true;
+                    TRY_LOCK(pnode->cs_vSend, lockSend);
+                    if (lockSend)
+                    {
+                        if (!EpollWatch(pnode, EPOLL_CTL_ADD))
+                            pnode->CloseSocketDisconnect();
+                        setPollNodes.insert(pnode);
+                    }
                 }
+                InactivityCheck(pnode);
             }
+            nNow = GetTimeMillis();
+            nNextHousekeeping = nNow + nHousekeepingInterval;
         }
+
+        // Sockets left over from an earlier edge won't be reported again,
+        // so come back for them right away if they have more data, or soon
+        // if they were busy
+        int64_t nTimeout = nNextHousekeeping - nNow;
+        if (fMoreToRead)
+            nTimeout = 0;
+        else if (!setPollRecv.empty() || !setPollSend.empty())
+            nTimeout = min(nTimeout, (int64_t)50);
+
+        int nEvents = epoll_wait(hEpoll, events, sizeof(events) / sizeof(events[0]), nTimeout);
+        boost::this_thread::interruption_point();
+
+        if (nEvents == SOCKET_ERROR)
         {
-            LOCK(cs_vNodes);
-            BOOST_FOREACH(CNode* pnode, vNodesCopy)
-                pnode->Release();
+            int nErr = WSAGetLastError();
+            if (nErr != WSAEINTR)
+            {
+                LogPrintf("socket epoll_wait error %d\n", nErr);
+                MilliSleep(50);
+            }
+            nEvents = 0;
+        }
+
+        for (int i = 0; i < nEvents; i++)
+        {
+            CNode* pnode = (CNode*)events[i].data.ptr;
+            if (pnode == NULL)
+            {
+                //
+                // Accept new connections
+                //
+                BOOST_FOREACH(SOCKET hListenSocket, vhListenSocket)
+                    while (hListenSocket != INVALID_SOCKET && AcceptConnection(hListenSocket))
+                        boost::this_thread::interruption_point();
+                continue;
+            }
+
+            // Closed sockets can still be reported while a forked child
+            // holds a copy of them
+            if (!setPollNodes.count(pnode) || pnode->hSocket == INVALID_SOCKET)
+                continue;
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                setPollRecv.insert(pnode);
+            if (events[i].events & EPOLLOUT)
+                setPollSend.insert(pnode);
+        }
+
+        //
+        // Send
+        //
+        vector<CNode*> vReady(setPollSend.begin(), setPollSend.end());
+        BOOST_FOREACH(CNode* pnode, vReady)
+        {
+            if (pnode->hSocket != INVALID_SOCKET)
+            {
+                TRY_LOCK(pnode->cs_vSend, lockSend);
+                if (!lockSend)
+                    continue;
+                // If the socket fills up again, EPOLLOUT reports when there is room
+                SocketSendData(pnode);
+            }
+            setPollSend.erase(pnode);
+        }
+
+        //
+        // Receive
+        //
+        fMoreToRead = false;
+        vReady.assign(setPollRecv.begin(), setPollRecv.end());
+        BOOST_FOREACH(CNode* pnode, vReady)
+        {
+            boost::this_thread::interruption_point();
+
+            if (pnode->hSocket == INVALID_SOCKET)
+            {
+                setPollRecv.erase(pnode);
+                continue;
+            }
+            {
+                // do not read, if draining write queue
+                TRY_LOCK(pnode->cs_vSend, lockSend);
+                if (!lockSend || !pnode->vSendMsg.empty())
+                    continue;
+            }
+
+            int nBytes = 0;
+            for (int n = 0; n < nMaxRecvPerPass; n++)
+                if ((nBytes = SocketRecvData(pnode)) <= 0)
+                    break;
+            if (nBytes == 0)
+                setPollRecv.erase(pnode);
+            else if (nBytes > 0)
+                fMoreToRead = true;
         }
     }
 }
+#endif
+
+void ThreadSocketHandler()
+{
+#ifdef USE_EPOLL
+    if (GetBoolArg("-epoll", true))
+    {
+        hEpoll = epoll_create1(EPOLL_CLOEXEC);
+        if (hEpoll == -1)
+            LogPrintf("epoll_create1 failed with error %d, using select()\n", WSAGetLastError());
+    }
+    if (hEpoll != -1)
+    {
+        bool fListening = true;
+        BOOST_FOREACH(SOCKET hListenSocket, vhListenSocket)
+        {
+            struct epoll_event event;
+            event.events = EPOLLIN | EPOLLET;
+            event.data.ptr = NULL;
+            if (epoll_ctl(hEpoll, EPOLL_CTL_ADD, hListenSocket, &event) == SOCKET_ERROR)
+                fListening = false;
+        }
+        if (fListening)
+        {
+            LogPrintf("Using epoll for socket events\n");
+            ThreadSocketHandlerEpoll();
+            return;
+        }
+        LogPrintf("epoll_ctl failed with error %d, using select()\n", WSAGetLastError());
+        close(hEpoll);
+        hEpoll = -1;
+    }
+#endif
+    ThreadSocketHandlerSelect();
+}
 
 
 
@@ -1394,6 +1717,11 @@ void static StartSync(const vector<CNode*> &vNodes) {
 
 void ThreadMessageHandler()
 {
+    // Trickling, pings and getdata retries in SendMessages run on this
+    // tick; everything else wakes the thread through WakeMessageHandler
+    static const int64_t nTickInterval = 100;
+    int64_t nNextTick = 0;
+
     SetThreadPriority(THREAD_PRIORITY_BELOW_NORMAL);
     while (true)
     {
@@ -1415,8 +1743,13 @@ void ThreadMessageHandler()
 
         // Poll the connected nodes for messages
         CNode* pnodeTrickle = NULL;
-        if (!vNodesCopy.empty())
-            pnodeTrickle = vNodesCopy[GetRand(vNodesCopy.size())];
+        int64_t nNow = GetTimeMillis();
+        if (nNow >= nNextTick)
+        {
+            if (!vNodesCopy.empty())
+                pnodeTrickle = vNodesCopy[GetRand(vNodesCopy.size())];
+            nNextTick = nNow + nTickInterval;
+        }
 
         bool fSleep = true;
 
@@ -1435,7 +1768,7 @@ void ThreadMessageHandler()
 
                     if (pnode->nSendSize < SendBufferSize())
                     {
-                        if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete()))
+                        if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].ready()))
                         {
                             fSleep = false;
                         }
@@ -1460,7 +1793,11 @@ void ThreadMessageHandler()
         }
 
         if (fSleep)
-            MilliSleep(100);
+        {
+            nNow = GetTimeMillis();
+            if (nNow < nNextTick)
+                WaitForMessages(nNextTick - nNow);
+        }
     }
 }
 
@@ -1626,6 +1963,11 @@ void StartNode(boost::thread_group& threadGroup)
 
     Discover(threadGroup);
 
+#ifdef USE_EPOLL
+    if (hMessageHandlerEvent == -1)
+        hMessageHandlerEvent = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif
+
     //
     // Start threads
     //
@@ -1745,6 +2087,21 @@ uint64_t CNode::GetTotalBytesSent()
     return nTotalBytesSent;
 }
 
+void CNode::RecordMessageLatency(int64_t nMicros)
+{
+    unsigned int nBucket = 0;
+    while (nBucket < MESSAGE_LATENCY_BUCKETS - 1 && (nMicros >> (nBucket + 1)) > 0)
+        nBucket++;
+    LOCK(cs_messageLatency);
+    vMessageLatency[nBucket]++;
+}
+
+std::vector<uint64_t> CNode::GetMessageLatency()
+{
+    LOCK(cs_messageLatency);
+    return std::vector<uint64_t>(vMessageLatency, vMessageLatency + MESSAGE_LATENCY_BUCKETS);
+}
+
 //
 // CAddrDB
 //
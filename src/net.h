@@ -5,9 +5,11 @@
 #ifndef DIMINUTIVEVAULT_NET_H
 #define DIMINUTIVEVAULT_NET_H
 
+#include <atomic>
 #include <deque>
 #include <boost/array.hpp>
 #include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/signals2/signal.hpp>
 #include <openssl/rand.h>
 
@@ -31,6 +33,9 @@ extern int nBestHeight;
 static const int PING_INTERVAL = 2 * 60;
 /** Time after which to disconnect, after waiting for a ping response (or inactivity). */
 static const int TIMEOUT_INTERVAL = 20 * 60;
+/** Buckets of the receive-to-process latency histogram. Bucket i counts
+ *  latencies below 2^(i+1) microseconds; the last one counts the rest too. */
+static const unsigned int MESSAGE_LATENCY_BUCKETS = 24;
 
 inline unsigned int ReceiveFloodSize() { return 1000*GetArg("-maxreceivebuffer", 5*1000); }
 inline unsigned int SendBufferSize() { return 1000*GetArg("-maxsendbuffer", 1*1000); }
@@ -48,12 +53,15 @@ bool BindListenPort(const CService &bindAddr, std::string& strError=REF(std::str
 void StartNode(boost::thread_group& threadGroup);
 bool StopNode();
 void SocketSendData(CNode *pnode);
+void WakeMessageHandler();
 
 // Signals for message handling
 struct CNodeSignals
 {
     boost::signals2::signal<bool (CNode*)> ProcessMessages;
     boost::signals2::signal<bool (CNode*, bool)> SendMessages;
+    // Called once for each node, just before it is deleted
+    boost::signals2::signal<void (CNode*)> FinalizeNode;
 };
 
 CNodeSignals& GetNodeSignals();
@@ -89,6 +97,8 @@ enum
 {
     MSG_TX = 1,
     MSG_BLOCK,
+    // Only in getdata: the block as a cmpctblock message, if it is recent
+    MSG_CMPCT_BLOCK,
 };
 
 extern bool fDiscover;
@@ -134,6 +144,18 @@ public:
 
 
 
+/** Work on a complete message done by another thread before it is
+ *  processed, such as main.cpp's parsing of blocks and transactions.
+ *  fReady is set once that thread is done with it. */
+class CPreparedMessage
+{
+public:
+    std::atomic<bool> fReady;
+
+    CPreparedMessage() : fReady(false) { }
+    virtual ~CPreparedMessage() { }
+};
+
 class CNetMessage {
 public:
     bool in_data;                   // parsing header (false) or data (true)
@@ -147,6 +169,8 @@ public:
 
     int64_t nTime;                  // time (in microseconds) of message receipt.
 
+    boost::shared_ptr<CPreparedMessage> pprepared; // holds the payload instead of vRecv while set
+
     CNetMessage(int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), vRecv(nTypeIn, nVersionIn) {
         hdrbuf.resize(24);
         in_data = false;
@@ -162,6 +186,12 @@ public:
         return (hdr.nMessageSize == nDataPos);
     }
 
+    // complete, and not waiting on another thread to prepare it
+    bool ready() const
+    {
+        return complete() && (!pprepared || pprepared->fReady);
+    }
+
     void SetVersion(int nVersionIn)
     {
         hdrbuf.SetVersion(nVersionIn);
@@ -189,6 +219,8 @@ public:
     uint64_t nSendBytes;
     std::deque<CSerializeData> vSendMsg;
     CCriticalSection cs_vSend;
+    bool fPollRegistered; // socket is in the epoll set, requires cs_vSend
+    bool fPollSend; // epoll is watching for writability, requires cs_vSend
 
     std::deque<CInv> vRecvGetData;
     std::deque<CNetMessage> vRecvMsg;
@@ -227,6 +259,12 @@ public:
     uint256 hashLastGetBlocksEnd;
     int nStartingHeight;
     bool fStartSync;
+    // headers-first sync, guarded by cs_main: blocks requested from this
+    // node, the height of the best block of the header chain it is known to
+    // have, and the last block it announced that wasn't on the header chain
+    int nBlocksInFlight;
+    int nSyncHeight;
+    uint256 hashSyncAnnounced;
 
     // flood relay
     std::vector<CAddress> vAddrToSend;
@@ -274,11 +312,16 @@ public:
         nRefCount = 0;
         nSendSize = 0;
         nSendOffset = 0;
+        fPollRegistered = false;
+        fPollSend = false;
         hashContinue = 0;
         pindexLastGetBlocksBegin = 0;
         hashLastGetBlocksEnd = 0;
         nStartingHeight = -1;
         fStartSync = false;
+        nBlocksInFlight = 0;
+        nSyncHeight = -1;
+        hashSyncAnnounced = 0;
         fGetAddr = false;
         nMisbehavior = 0;
         setInventoryKnown.max_size(SendBufferSize() / 1000);
@@ -307,6 +350,8 @@ private:
     static CCriticalSection cs_totalBytesSent;
     static uint64_t nTotalBytesRecv;
     static uint64_t nTotalBytesSent;
+    static CCriticalSection cs_messageLatency;
+    static uint64_t vMessageLatency[MESSAGE_LATENCY_BUCKETS];
 
     CNode(const CNode&);
     void operator=(const CNode&);
@@ -325,7 +370,7 @@ public:
     {
         unsigned int total = 0;
         BOOST_FOREACH(const CNetMessage &msg, vRecvMsg)
-            total += msg.vRecv.size() + 24;
+            total += (msg.complete() ? msg.hdr.nMessageSize : msg.vRecv.size()) + 24;
         return total;
     }
 
@@ -653,6 +698,10 @@ public:
 
     static uint64_t GetTotalBytesRecv();
     static uint64_t GetTotalBytesSent();
+
+    // Time from a message's last byte arriving to it being processed
+    static void RecordMessageLatency(int64_t nMicros);
+    static std::vector<uint64_t> GetMessageLatency();
 };
 
 inline void RelayInventory(const CInv& inv)
@@ -7,6 +7,7 @@
 #include "main.h"
 #include "kernel.h"
 #include "checkpoints.h"
+#include "sigcache.h"
 
 using namespace json_spirit;
 using namespace std;
@@ -290,3 +291,31 @@ Value getcheckpoint(const Array& params, bool fHelp)
 
     return result;
 }
+
+Value getcacheinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getcacheinfo\n"
+            "Returns hit/miss statistics of the in-memory validation caches.");
+
+    Object obj, blockhash, sigcache;
+    uint64_t nHits = nBlockHashCacheHits, nMisses = nBlockHashCacheMisses;
+    blockhash.push_back(Pair("hits",    (int64_t)nHits));
+    blockhash.push_back(Pair("misses",  (int64_t)nMisses));
+    blockhash.push_back(Pair("hitrate", (nHits + nMisses) ? (double)nHits / (nHits + nMisses) : 0.0));
+    obj.push_back(Pair("blockhash", blockhash));
+
+    CSignatureCacheStats stats;
+    GetSignatureCache().GetStats(stats);
+    sigcache.push_back(Pair("hits",      (int64_t)stats.nHits));
+    sigcache.push_back(Pair("misses",    (int64_t)stats.nMisses));
+    sigcache.push_back(Pair("hitrate",   (stats.nHits + stats.nMisses) ? (double)stats.nHits / (stats.nHits + stats.nMisses) : 0.0));
+    sigcache.push_back(Pair("inserts",   (int64_t)stats.nInserts));
+    sigcache.push_back(Pair("evictions", (int64_t)stats.nEvictions));
+    sigcache.push_back(Pair("entries",   (int64_t)stats.nEntries));
+    sigcache.push_back(Pair("capacity",  (int64_t)stats.nCapacity));
+    sigcache.push_back(Pair("bytes",     (int64_t)stats.nBytes));
+    obj.push_back(Pair("sigcache", sigcache));
+    return obj;
+}
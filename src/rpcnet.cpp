@@ -241,11 +241,23 @@ Value getnettotals(const Array& params, bool fHelp)
         throw runtime_error(
             "getnettotals\n"
             "Returns information about network traffic, including bytes in, bytes out,\n"
-            "and current time.");
+            "current time, and how long received messages waited to be processed.");
 
     Object obj;
     obj.push_back(Pair("totalbytesrecv", CNode::GetTotalBytesRecv()));
     obj.push_back(Pair("totalbytessent", CNode::GetTotalBytesSent()));
     obj.push_back(Pair("timemillis", GetTimeMillis()));
+
+    Array latency;
+    std::vector<uint64_t> vLatency = CNode::GetMessageLatency();
+    for (unsigned int i = 0; i < vLatency.size(); i++)
+    {
+        Object bucket;
+        if (i + 1 < vLatency.size())
+            bucket.push_back(Pair("belowmicros", (int64_t)1 << (i + 1)));
+        bucket.push_back(Pair("count", vLatency[i]));
+        latency.push_back(bucket);
+    }
+    obj.push_back(Pair("messagelatency", latency));
     return obj;
 }
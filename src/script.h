@@ -691,7 +691,8 @@ public:
         }
         unsigned int nSize = script.size() + nSpecialScripts;
         s << VARINT(nSize);
-        s << CFlatData(&script[0], &script[script.size()]);
+        if (!script.empty())
+            s << CFlatData(&script[0], &script[script.size()]);
     }
 
     template<typename Stream>
@@ -706,15 +707,43 @@ public:
         }
         nSize -= nSpecialScripts;
         script.resize(nSize);
-        s >> REF(CFlatData(&script[0], &script[script.size()]));
+        if (nSize)
+            s >> REF(CFlatData(&script[0], &script[script.size()]));
     }
 };
 
 
+/** Signature hashes for the inputs of one transaction.
+ *
+ *  SignatureHash() copies the whole transaction and serializes it again
+ *  for every input it is asked about, which is quadratic in the number of
+ *  inputs. For the usual SIGHASH_ALL hashes everything except the signed
+ *  input's scriptCode is the same each time, so this keeps the hash state
+ *  after the part before each input, and the rest of the transaction
+ *  serialized once with empty scriptSigs. Hashing an input then covers
+ *  only its own outpoint and scriptCode and the bytes that follow it.
+ *  Other hash types fall back to SignatureHash().
+ */
+class CSignatureHasher
+{
+public:
+    explicit CSignatureHasher(const CTransaction& txToIn);
+
+    uint256 GetHash(CScript scriptCode, unsigned int nIn, int nHashType) const;
+
+private:
+    const CTransaction& txTo;
+    std::vector<CHashWriter> vPrefix;       // state after the part before each input
+    std::vector<unsigned char> vchBlanked;  // inputs with empty scriptSigs, outputs, nLockTime
+    std::vector<unsigned int> vSuffixPos;   // where the bytes after each input start in vchBlanked
+};
+
+uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
 bool IsDERSignature(const valtype &vchSig, bool haveHashType = true);
 bool IsLowDERSignature(const valtype &vchSig, bool haveHashType = true);
 bool IsCompressedOrUncompressedPubKey(const valtype &vchPubKey);
-bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType);
+bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType,
+                const CSignatureHasher* phasher = NULL);
 bool Solver(const CScript& scriptPubKey, txnouttype& typeRet, std::vector<std::vector<unsigned char> >& vSolutionsRet);
 int ScriptSigArgsExpected(txnouttype t, const std::vector<std::vector<unsigned char> >& vSolutions);
 bool IsStandard(const CScript& scriptPubKey, txnouttype& whichType);
@@ -726,8 +755,9 @@ bool ExtractDestinations(const CScript& scriptPubKey, txnouttype& typeRet, std::
 bool SignSignature(const CKeyStore& keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
 bool SignSignature(const CKeyStore& keystore, const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
 bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
-                   unsigned int flags, int nHashType);
-bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType);
+                   unsigned int flags, int nHashType, const CSignatureHasher* phasher = NULL);
+bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType,
+                     const CSignatureHasher* phasher = NULL);
 
 // Given two sets of signatures for scriptPubKey, possibly with OP_0 placeholders,
 // combine them intelligently and return the result.
@@ -0,0 +1,1180 @@
+// Copyright (c) 2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "secp256k1.h"
+
+#include <algorithm>
+#include <stdint.h>
+#include <string.h>
+
+using namespace std;
+
+//
+// secp256k1: y^2 = x^3 + 7 over the field of p = 2^256 - 2^32 - 977, with
+// a group of prime order n. Verification computes u1*G + u2*Q; both
+// scalars are split with the curve's endomorphism (x, y) -> (beta*x, y),
+// which multiplies a point by lambda, into halves of about 128 bits, and
+// the four half-size products are summed with interleaved wNAF chains.
+//
+// Field arithmetic is branch-free. The group and scalar code take
+// shortcuts that depend on their inputs, which is fine here because
+// everything verification sees is public.
+//
+
+namespace {
+
+static const uint64_t FIELD_P[4] = {0xfffffffefffffc2fULL, 0xffffffffffffffffULL, 0xffffffffffffffffULL, 0xffffffffffffffffULL};
+static const uint64_t FIELD_C = 0x1000003d1ULL; // 2^256 - p
+
+static const uint64_t ORDER_N[4] = {0xbfd25e8cd0364141ULL, 0xbaaedce6af48a03bULL, 0xfffffffffffffffeULL, 0xffffffffffffffffULL};
+static const uint64_t ORDER_N_HALF[4] = {0xdfe92f46681b20a0ULL, 0x5d576e7357a4501dULL, 0xffffffffffffffffULL, 0x7fffffffffffffffULL};
+static const uint64_t ORDER_NC[3] = {0x402da1732fc9bebfULL, 0x4551231950b75fc4ULL, 0x1ULL}; // 2^256 - n
+static const uint64_t P_MINUS_N[4] = {0x402da1722fc9baeeULL, 0x4551231950b75fc4ULL, 0x1ULL, 0x0ULL};
+
+static const uint64_t G_X[4] = {0x59f2815b16f81798ULL, 0x029bfcdb2dce28d9ULL, 0x55a06295ce870b07ULL, 0x79be667ef9dcbbacULL};
+static const uint64_t G_Y[4] = {0x9c47d08ffb10d4b8ULL, 0xfd17b448a6855419ULL, 0x5da4fbfc0e1108a8ULL, 0x483ada7726a3c465ULL};
+
+// Endomorphism: lambda * (x, y) = (beta * x, y)
+static const uint64_t BETA[4] = {0xc1396c28719501eeULL, 0x9cf0497512f58995ULL, 0x6e64479eac3434e9ULL, 0x7ae96a2b657c0710ULL};
+static const uint64_t MINUS_LAMBDA[4] = {0xe0cfc810b51283cfULL, 0xa880b9fc8ec739c2ULL, 0x5ad9e3fd77ed9ba4ULL, 0xac9c52b33fa3cf1fULL};
+
+// Scalar splitting constants: g1, g2 are round(2^384 * b2 / n) and
+// round(2^384 * -b1 / n) for the reduced lattice basis (a1, b1), (a2, b2)
+static const uint64_t GLV_G1[4] = {0xe893209a45dbb031ULL, 0x3daa8a1471e8ca7fULL, 0xe86c90e49284eb15ULL, 0x3086d221a7d46bcdULL};
+static const uint64_t GLV_G2[4] = {0x1571b4ae8ac47f71ULL, 0x221208ac9df506c6ULL, 0x6f547fa90abfe4c4ULL, 0xe4437ed6010e8828ULL};
+static const uint64_t GLV_MINUS_B1[4] = {0x6f547fa90abfe4c3ULL, 0xe4437ed6010e8828ULL, 0x0ULL, 0x0ULL};
+static const uint64_t GLV_MINUS_B2[4] = {0xd765cda83db1562cULL, 0x8a280ac50774346dULL, 0xfffffffffffffffeULL, 0xffffffffffffffffULL};
+
+// Window sizes for the wNAF of the public key and generator scalars. The
+// generator's tables are built once, so it can afford a wider window.
+static const int WINDOW_A = 5;
+static const int WINDOW_G = 10;
+static const int TABLE_SIZE_A = 1 << (WINDOW_A - 2);
+static const int TABLE_SIZE_G = 1 << (WINDOW_G - 2);
+static const int WNAF_MAX = 132;
+
+//
+// 64 bit limb helpers
+//
+
+static inline uint64_t MulWide(uint64_t a, uint64_t b, uint64_t& hi)
+{
+#if defined(__SIZEOF_INT128__)
+    unsigned __int128 r = (unsigned __int128)a * b;
+    hi = (uint64_t)(r >> 64);
+    return (uint64_t)r;
+#else
+    uint64_t a0 = (uint32_t)a, a1 = a >> 32, b0 = (uint32_t)b, b1 = b >> 32;
+    uint64_t p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+    uint64_t mid = (p00 >> 32) + (uint32_t)p01 + (uint32_t)p10;
+    hi = p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+    return (mid << 32) | (uint32_t)p00;
+#endif
+}
+
+// a * b + c + d, which always fits in 128 bits
+static inline uint64_t MulAdd(uint64_t a, uint64_t b, uint64_t c, uint64_t d, uint64_t& hi)
+{
+    uint64_t h;
+    uint64_t l = MulWide(a, b, h);
+    l += c;
+    h += (l < c);
+    l += d;
+    h += (l < d);
+    hi = h;
+    return l;
+}
+
+static inline uint64_t AddCarry(uint64_t a, uint64_t b, uint64_t& carry)
+{
+    uint64_t r = a + carry;
+    uint64_t c = (r < carry);
+    r += b;
+    c += (r < b);
+    carry = c;
+    return r;
+}
+
+static inline uint64_t SubBorrow(uint64_t a, uint64_t b, uint64_t& borrow)
+{
+    uint64_t r = a - b;
+    uint64_t c = (a < b);
+    uint64_t r2 = r - borrow;
+    c += (r < borrow);
+    borrow = c;
+    return r2;
+}
+
+static void ReadBE256(uint64_t d[4], const unsigned char* p)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        uint64_t n = 0;
+        for (int j = 0; j < 8; j++)
+            n = (n << 8) | p[8 * i + j];
+        d[3 - i] = n;
+    }
+}
+
+static int Compare256(const uint64_t a[4], const uint64_t b[4])
+{
+    for (int i = 3; i >= 0; i--)
+    {
+        if (a[i] < b[i])
+            return -1;
+        if (a[i] > b[i])
+            return 1;
+    }
+    return 0;
+}
+
+static inline bool IsZero256(const uint64_t a[4])
+{
+    return (a[0] | a[1] | a[2] | a[3]) == 0;
+}
+
+//
+// Field elements, always fully reduced
+//
+
+struct FieldElem
+{
+    uint64_t d[4];
+};
+
+static inline void FieldSet(FieldElem& r, const uint64_t d[4])
+{
+    memcpy(r.d, d, sizeof(r.d));
+}
+
+static inline void FieldSetInt(FieldElem& r, uint64_t n)
+{
+    r.d[0] = n;
+    r.d[1] = r.d[2] = r.d[3] = 0;
+}
+
+static inline bool FieldIsZero(const FieldElem& a)
+{
+    return IsZero256(a.d);
+}
+
+static inline bool FieldEqual(const FieldElem& a, const FieldElem& b)
+{
+    return ((a.d[0] ^ b.d[0]) | (a.d[1] ^ b.d[1]) | (a.d[2] ^ b.d[2]) | (a.d[3] ^ b.d[3])) == 0;
+}
+
+static inline bool FieldIsOdd(const FieldElem& a)
+{
+    return a.d[0] & 1;
+}
+
+// Returns false for encodings of values >= p
+static inline bool FieldSetBytes(FieldElem& r, const unsigned char* p)
+{
+    ReadBE256(r.d, p);
+    return Compare256(r.d, FIELD_P) < 0;
+}
+
+// Reduce r + nCarry * 2^256, known to be below 2p, by subtracting p if
+// needed. Subtracting p is adding 2^256 - p and dropping the carry.
+static inline void FieldReduceOnce(FieldElem& r, uint64_t nCarry)
+{
+    uint64_t t[4];
+    uint64_t c = 0;
+    t[0] = AddCarry(r.d[0], FIELD_C, c);
+    t[1] = AddCarry(r.d[1], 0, c);
+    t[2] = AddCarry(r.d[2], 0, c);
+    t[3] = AddCarry(r.d[3], 0, c);
+    uint64_t mask = 0 - (c | nCarry);
+    for (int i = 0; i < 4; i++)
+        r.d[i] = (t[i] & mask) | (r.d[i] & ~mask);
+}
+
+static inline void FieldAdd(FieldElem& r, const FieldElem& a, const FieldElem& b)
+{
+    uint64_t c = 0;
+    for (int i = 0; i < 4; i++)
+        r.d[i] = AddCarry(a.d[i], b.d[i], c);
+    FieldReduceOnce(r, c);
+}
+
+static inline void FieldSub(FieldElem& r, const FieldElem& a, const FieldElem& b)
+{
+    uint64_t borrow = 0;
+    for (int i = 0; i < 4; i++)
+        r.d[i] = SubBorrow(a.d[i], b.d[i], borrow);
+    // On underflow add p, which is subtracting 2^256 - p
+    uint64_t mask = 0 - borrow;
+    borrow = 0;
+    r.d[0] = SubBorrow(r.d[0], FIELD_C & mask, borrow);
+    for (int i = 1; i < 4; i++)
+        r.d[i] = SubBorrow(r.d[i], 0, borrow);
+}
+
+static inline void FieldNegate(FieldElem& r, const FieldElem& a)
+{
+    FieldElem zero;
+    FieldSetInt(zero, 0);
+    FieldSub(r, zero, a);
+}
+
+// 512 bit product to field element, using 2^256 = 2^32 + 977 (mod p)
+static inline void FieldReduce512(FieldElem& r, const uint64_t t[8])
+{
+    uint64_t c = 0;
+    for (int i = 0; i < 4; i++)
+        r.d[i] = MulAdd(t[4 + i], FIELD_C, t[i], c, c);
+
+    uint64_t hi;
+    uint64_t lo = MulWide(c, FIELD_C, hi);
+    uint64_t carry = 0;
+    r.d[0] = AddCarry(r.d[0], lo, carry);
+    r.d[1] = AddCarry(r.d[1], hi, carry);
+    r.d[2] = AddCarry(r.d[2], 0, carry);
+    r.d[3] = AddCarry(r.d[3], 0, carry);
+    FieldReduceOnce(r, carry);
+}
+
+// Add a * b to the 192 bit column accumulator (c0, c1, c2)
+static inline void MulAcc(uint64_t& c0, uint64_t& c1, uint64_t& c2, uint64_t a, uint64_t b)
+{
+    uint64_t hi;
+    uint64_t lo = MulWide(a, b, hi);
+    c0 += lo;
+    hi += (c0 < lo);
+    c1 += hi;
+    c2 += (c1 < hi);
+}
+
+static inline void MulAccShift(uint64_t& t, uint64_t& c0, uint64_t& c1, uint64_t& c2)
+{
+    t = c0;
+    c0 = c1;
+    c1 = c2;
+    c2 = 0;
+}
+
+static inline void FieldMul(FieldElem& r, const FieldElem& a, const FieldElem& b)
+{
+    uint64_t t[8];
+    uint64_t c0 = 0, c1 = 0, c2 = 0;
+    for (int k = 0; k < 7; k++)
+    {
+        for (int i = max(0, k - 3); i <= min(k, 3); i++)
+            MulAcc(c0, c1, c2, a.d[i], b.d[k - i]);
+        MulAccShift(t[k], c0, c1, c2);
+    }
+    t[7] = c0;
+    FieldReduce512(r, t);
+}
+
+static inline void FieldSqr(FieldElem& r, const FieldElem& a)
+{
+    // Each cross product appears twice in a column, the squares once
+    uint64_t t[8];
+    uint64_t c0 = 0, c1 = 0, c2 = 0;
+    for (int k = 0; k < 7; k++)
+    {
+        for (int i = max(0, k - 3); i < k - i; i++)
+        {
+            MulAcc(c0, c1, c2, a.d[i], a.d[k - i]);
+            MulAcc(c0, c1, c2, a.d[i], a.d[k - i]);
+        }
+        if (k % 2 == 0)
+            MulAcc(c0, c1, c2, a.d[k / 2], a.d[k / 2]);
+        MulAccShift(t[k], c0, c1, c2);
+    }
+    t[7] = c0;
+    FieldReduce512(r, t);
+}
+
+static inline void FieldSqrN(FieldElem& r, const FieldElem& a, int n)
+{
+    FieldSqr(r, a);
+    for (int i = 1; i < n; i++)
+        FieldSqr(r, r);
+}
+
+// a^(2^223 - 1) and the smaller powers of the same form the inverse and
+// square root addition chains are built from
+static void FieldPowChain(const FieldElem& a, FieldElem& x2, FieldElem& x22, FieldElem& x223)
+{
+    FieldElem x3, x6, x9, x11, x44, x88, x176, x220;
+    FieldSqr(x2, a);
+    FieldMul(x2, x2, a);
+    FieldSqr(x3, x2);
+    FieldMul(x3, x3, a);
+    FieldSqrN(x6, x3, 3);
+    FieldMul(x6, x6, x3);
+    FieldSqrN(x9, x6, 3);
+    FieldMul(x9, x9, x3);
+    FieldSqrN(x11, x9, 2);
+    FieldMul(x11, x11, x2);
+    FieldSqrN(x22, x11, 11);
+    FieldMul(x22, x22, x11);
+    FieldSqrN(x44, x22, 22);
+    FieldMul(x44, x44, x22);
+    FieldSqrN(x88, x44, 44);
+    FieldMul(x88, x88, x44);
+    FieldSqrN(x176, x88, 88);
+    FieldMul(x176, x176, x88);
+    FieldSqrN(x220, x176, 44);
+    FieldMul(x220, x220, x44);
+    FieldSqrN(x223, x220, 3);
+    FieldMul(x223, x223, x3);
+}
+
+// a^(p - 2)
+static void FieldInv(FieldElem& r, const FieldElem& a)
+{
+    FieldElem x2, x22, x223, t;
+    FieldPowChain(a, x2, x22, x223);
+    FieldSqrN(t, x223, 23);
+    FieldMul(t, t, x22);
+    FieldSqrN(t, t, 5);
+    FieldMul(t, t, a);
+    FieldSqrN(t, t, 3);
+    FieldMul(t, t, x2);
+    FieldSqrN(t, t, 2);
+    FieldMul(r, t, a);
+}
+
+// a^((p + 1) / 4), which is a square root of a if one exists
+static bool FieldSqrt(FieldElem& r, const FieldElem& a)
+{
+    FieldElem x2, x22, x223, t, check;
+    FieldPowChain(a, x2, x22, x223);
+    FieldSqrN(t, x223, 23);
+    FieldMul(t, t, x22);
+    FieldSqrN(t, t, 6);
+    FieldMul(t, t, x2);
+    FieldSqrN(r, t, 2);
+    FieldSqr(check, r);
+    return FieldEqual(check, a);
+}
+
+//
+// Scalars modulo the group order
+//
+
+struct Scalar
+{
+    uint64_t d[4];
+};
+
+static inline void ScalarSet(Scalar& r, const uint64_t d[4])
+{
+    memcpy(r.d, d, sizeof(r.d));
+}
+
+static inline bool ScalarIsZero(const Scalar& a)
+{
+    return IsZero256(a.d);
+}
+
+static inline bool ScalarIsHigh(const Scalar& a)
+{
+    return Compare256(a.d, ORDER_N_HALF) > 0;
+}
+
+static inline void ScalarSubN(uint64_t d[4])
+{
+    uint64_t borrow = 0;
+    for (int i = 0; i < 4; i++)
+        d[i] = SubBorrow(d[i], ORDER_N[i], borrow);
+}
+
+// Reduces the encoded value mod n; fOverflow tells whether it was >= n
+static inline void ScalarSetBytes(Scalar& r, const unsigned char* p, bool& fOverflow)
+{
+    ReadBE256(r.d, p);
+    fOverflow = Compare256(r.d, ORDER_N) >= 0;
+    if (fOverflow)
+        ScalarSubN(r.d);
+}
+
+static void ScalarNegate(Scalar& r, const Scalar& a)
+{
+    if (ScalarIsZero(a))
+    {
+        r = a;
+        return;
+    }
+    uint64_t borrow = 0;
+    for (int i = 0; i < 4; i++)
+        r.d[i] = SubBorrow(ORDER_N[i], a.d[i], borrow);
+}
+
+static void ScalarAdd(Scalar& r, const Scalar& a, const Scalar& b)
+{
+    uint64_t c = 0;
+    for (int i = 0; i < 4; i++)
+        r.d[i] = AddCarry(a.d[i], b.d[i], c);
+    if (c || Compare256(r.d, ORDER_N) >= 0)
+        ScalarSubN(r.d);
+}
+
+static void ScalarMul512(uint64_t t[8], const Scalar& a, const Scalar& b)
+{
+    memset(t, 0, 8 * sizeof(uint64_t));
+    for (int i = 0; i < 4; i++)
+    {
+        uint64_t c = 0;
+        for (int j = 0; j < 4; j++)
+            t[i + j] = MulAdd(a.d[i], b.d[j], t[i + j], c, c);
+        t[i + 4] = c;
+    }
+}
+
+// Fold the limbs above 256 bits back in as multiples of 2^256 - n until
+// the value fits, then subtract n
+static void ScalarReduce512(Scalar& r, const uint64_t t[8])
+{
+    uint64_t a[8];
+    memcpy(a, t, sizeof(a));
+    int nLimbs = 8;
+    while (nLimbs > 0 && a[nLimbs - 1] == 0)
+        nLimbs--;
+    while (nLimbs > 4)
+    {
+        uint64_t b[8] = {a[0], a[1], a[2], a[3], 0, 0, 0, 0};
+        for (int i = 0; i < nLimbs - 4; i++)
+        {
+            uint64_t c = 0;
+            for (int j = 0; j < 3; j++)
+                b[i + j] = MulAdd(a[4 + i], ORDER_NC[j], b[i + j], c, c);
+            for (int k = i + 3; c && k < 8; k++)
+            {
+                b[k] += c;
+                c = (b[k] < c);
+            }
+        }
+        memcpy(a, b, sizeof(a));
+        nLimbs = 8;
+        while (nLimbs > 0 && a[nLimbs - 1] == 0)
+            nLimbs--;
+    }
+    memcpy(r.d, a, sizeof(r.d));
+    while (Compare256(r.d, ORDER_N) >= 0)
+        ScalarSubN(r.d);
+}
+
+static void ScalarMul(Scalar& r, const Scalar& a, const Scalar& b)
+{
+    uint64_t t[8];
+    ScalarMul512(t, a, b);
+    ScalarReduce512(r, t);
+}
+
+// round(a * b / 2^384)
+static void ScalarMulShift384(Scalar& r, const Scalar& a, const Scalar& b)
+{
+    uint64_t t[8];
+    ScalarMul512(t, a, b);
+    uint64_t c = t[5] >> 63;
+    r.d[0] = AddCarry(t[6], 0, c);
+    r.d[1] = AddCarry(t[7], 0, c);
+    r.d[2] = r.d[3] = 0;
+}
+
+// a^(n - 2), four bits at a time
+static void ScalarInv(Scalar& r, const Scalar& a)
+{
+    static const uint64_t ORDER_N_MINUS_2[4] = {0xbfd25e8cd036413fULL, 0xbaaedce6af48a03bULL, 0xfffffffffffffffeULL, 0xffffffffffffffffULL};
+    Scalar vPow[16];
+    vPow[1] = a;
+    for (int i = 2; i < 16; i++)
+        ScalarMul(vPow[i], vPow[i - 1], a);
+
+    bool fStarted = false;
+    Scalar x;
+    for (int i = 63; i >= 0; i--)
+    {
+        int nNibble = (ORDER_N_MINUS_2[i / 16] >> (4 * (i % 16))) & 15;
+        if (fStarted)
+            for (int j = 0; j < 4; j++)
+                ScalarMul(x, x, x);
+        if (nNibble)
+        {
+            if (fStarted)
+                ScalarMul(x, x, vPow[nNibble]);
+            else
+                x = vPow[nNibble];
+            fStarted = true;
+        }
+    }
+    r = x;
+}
+
+// Split k into k1 + k2 * lambda with k1, k2 about 128 bits each (as
+// signed values; the negative ones come back as n - |k|)
+static void ScalarSplitLambda(Scalar& k1, Scalar& k2, const Scalar& k)
+{
+    Scalar g1, g2, mb1, mb2, ml, c1, c2;
+    ScalarSet(g1, GLV_G1);
+    ScalarSet(g2, GLV_G2);
+    ScalarSet(mb1, GLV_MINUS_B1);
+    ScalarSet(mb2, GLV_MINUS_B2);
+    ScalarSet(ml, MINUS_LAMBDA);
+
+    ScalarMulShift384(c1, k, g1);
+    ScalarMulShift384(c2, k, g2);
+    ScalarMul(c1, c1, mb1);
+    ScalarMul(c2, c2, mb2);
+    ScalarAdd(k2, c1, c2);
+    ScalarMul(k1, k2, ml);
+    ScalarAdd(k1, k1, k);
+}
+
+// Width-w NAF of a scalar below 2^130: digits are zero or odd, below
+// 2^(w-1) in magnitude, and any two non-zero digits are at least w apart
+static int ComputeWnaf(int* wnaf, const Scalar& a, int w, bool fNegate)
+{
+    uint64_t s[3] = {a.d[0], a.d[1], a.d[2]};
+    int nLen = 0;
+    while (s[0] | s[1] | s[2])
+    {
+        int nDigit = 0;
+        if (s[0] & 1)
+        {
+            nDigit = (int)(s[0] & ((1U << w) - 1));
+            if (nDigit >= (1 << (w - 1)))
+                nDigit -= (1 << w);
+            uint64_t c = 0;
+            if (nDigit > 0)
+            {
+                s[0] = SubBorrow(s[0], nDigit, c);
+                s[1] = SubBorrow(s[1], 0, c);
+                s[2] = SubBorrow(s[2], 0, c);
+            }
+            else
+            {
+                s[0] = AddCarry(s[0], -nDigit, c);
+                s[1] = AddCarry(s[1], 0, c);
+                s[2] = AddCarry(s[2], 0, c);
+            }
+        }
+        wnaf[nLen++] = fNegate ? -nDigit : nDigit;
+        s[0] = (s[0] >> 1) | (s[1] << 63);
+        s[1] = (s[1] >> 1) | (s[2] << 63);
+        s[2] >>= 1;
+    }
+    return nLen;
+}
+
+//
+// Points in affine and Jacobian coordinates
+//
+
+struct GroupElem
+{
+    FieldElem x, y;
+    bool fInfinity;
+};
+
+struct GroupElemJ
+{
+    FieldElem x, y, z;   // affine x = X / Z^2, y = Y / Z^3
+    bool fInfinity;
+};
+
+static inline void GejSetInfinity(GroupElemJ& r)
+{
+    r.fInfinity = true;
+}
+
+static inline void GejSetGe(GroupElemJ& r, const GroupElem& a)
+{
+    r.x = a.x;
+    r.y = a.y;
+    FieldSetInt(r.z, 1);
+    r.fInfinity = a.fInfinity;
+}
+
+static inline bool GeIsOnCurve(const GroupElem& a)
+{
+    FieldElem y2, x3, seven;
+    FieldSqr(y2, a.y);
+    FieldSqr(x3, a.x);
+    FieldMul(x3, x3, a.x);
+    FieldSetInt(seven, 7);
+    FieldAdd(x3, x3, seven);
+    return FieldEqual(y2, x3);
+}
+
+// Point with the given x and y parity, if x is on the curve
+static bool GeSetXOdd(GroupElem& r, const FieldElem& x, bool fOdd)
+{
+    FieldElem x3, seven;
+    FieldSqr(x3, x);
+    FieldMul(x3, x3, x);
+    FieldSetInt(seven, 7);
+    FieldAdd(x3, x3, seven);
+    r.x = x;
+    r.fInfinity = false;
+    if (!FieldSqrt(r.y, x3))
+        return false;
+    if (FieldIsOdd(r.y) != fOdd)
+        FieldNegate(r.y, r.y);
+    return true;
+}
+
+// Doubling for a = 0 (dbl-2009-l)
+static void GejDouble(GroupElemJ& r, const GroupElemJ& a)
+{
+    if (a.fInfinity)
+    {
+        GejSetInfinity(r);
+        return;
+    }
+    FieldElem A, B, C, D, E, F, t;
+    FieldSqr(A, a.x);
+    FieldSqr(B, a.y);
+    FieldSqr(C, B);
+    FieldAdd(D, a.x, B);
+    FieldSqr(D, D);
+    FieldSub(D, D, A);
+    FieldSub(D, D, C);
+    FieldAdd(D, D, D);
+    FieldAdd(E, A, A);
+    FieldAdd(E, E, A);
+    FieldSqr(F, E);
+
+    FieldMul(r.z, a.y, a.z);
+    FieldAdd(r.z, r.z, r.z);
+    FieldSub(r.x, F, D);
+    FieldSub(r.x, r.x, D);
+    FieldSub(t, D, r.x);
+    FieldMul(t, E, t);
+    FieldAdd(C, C, C);
+    FieldAdd(C, C, C);
+    FieldAdd(C, C, C);
+    FieldSub(r.y, t, C);
+    r.fInfinity = false;
+}
+
+// r = a + b with b affine
+static void GejAddGe(GroupElemJ& r, const GroupElemJ& a, const GroupElem& b)
+{
+    if (b.fInfinity)
+    {
+        r = a;
+        return;
+    }
+    if (a.fInfinity)
+    {
+        GejSetGe(r, b);
+        return;
+    }
+    FieldElem z1z1, u2, s2, h, rr, hh, hhh, v, t;
+    FieldSqr(z1z1, a.z);
+    FieldMul(u2, b.x, z1z1);
+    FieldMul(s2, b.y, a.z);
+    FieldMul(s2, s2, z1z1);
+    FieldSub(h, u2, a.x);
+    FieldSub(rr, s2, a.y);
+    if (FieldIsZero(h))
+    {
+        if (FieldIsZero(rr))
+            GejDouble(r, a);
+        else
+            GejSetInfinity(r);
+        return;
+    }
+    FieldSqr(hh, h);
+    FieldMul(hhh, h, hh);
+    FieldMul(v, a.x, hh);
+
+    FieldMul(r.z, a.z, h);
+    FieldMul(t, a.y, hhh);
+    FieldSqr(r.x, rr);
+    FieldSub(r.x, r.x, hhh);
+    FieldSub(r.x, r.x, v);
+    FieldSub(r.x, r.x, v);
+    FieldSub(v, v, r.x);
+    FieldMul(v, v, rr);
+    FieldSub(r.y, v, t);
+    r.fInfinity = false;
+}
+
+// r = a + b
+static void GejAdd(GroupElemJ& r, const GroupElemJ& a, const GroupElemJ& b)
+{
+    if (b.fInfinity)
+    {
+        r = a;
+        return;
+    }
+    if (a.fInfinity)
+    {
+        r = b;
+        return;
+    }
+    FieldElem z1z1, z2z2, u1, u2, s1, s2, h, rr, hh, hhh, v, t;
+    FieldSqr(z1z1, a.z);
+    FieldSqr(z2z2, b.z);
+    FieldMul(u1, a.x, z2z2);
+    FieldMul(u2, b.x, z1z1);
+    FieldMul(s1, a.y, b.z);
+    FieldMul(s1, s1, z2z2);
+    FieldMul(s2, b.y, a.z);
+    FieldMul(s2, s2, z1z1);
+    FieldSub(h, u2, u1);
+    FieldSub(rr, s2, s1);
+    if (FieldIsZero(h))
+    {
+        if (FieldIsZero(rr))
+            GejDouble(r, a);
+        else
+            GejSetInfinity(r);
+        return;
+    }
+    FieldSqr(hh, h);
+    FieldMul(hhh, h, hh);
+    FieldMul(v, u1, hh);
+
+    FieldMul(r.z, a.z, b.z);
+    FieldMul(r.z, r.z, h);
+    FieldMul(t, s1, hhh);
+    FieldSqr(r.x, rr);
+    FieldSub(r.x, r.x, hhh);
+    FieldSub(r.x, r.x, v);
+    FieldSub(r.x, r.x, v);
+    FieldSub(v, v, r.x);
+    FieldMul(v, v, rr);
+    FieldSub(r.y, v, t);
+    r.fInfinity = false;
+}
+
+// Affine versions of a set of points, sharing one field inversion
+static void GeSetAllGej(GroupElem* r, const GroupElemJ* a, int n)
+{
+    vector<FieldElem> vProd(n);
+    FieldElem acc;
+    FieldSetInt(acc, 1);
+    for (int i = 0; i < n; i++)
+    {
+        if (!a[i].fInfinity)
+            FieldMul(acc, acc, a[i].z);
+        vProd[i] = acc;
+    }
+    FieldElem inv;
+    FieldInv(inv, acc);
+    for (int i = n - 1; i >= 0; i--)
+    {
+        r[i].fInfinity = a[i].fInfinity;
+        if (a[i].fInfinity)
+            continue;
+        FieldElem zinv, zinv2, zinv3;
+        if (i > 0)
+            FieldMul(zinv, inv, vProd[i - 1]);
+        else
+            zinv = inv;
+        FieldMul(inv, inv, a[i].z);
+        FieldSqr(zinv2, zinv);
+        FieldMul(zinv3, zinv2, zinv);
+        FieldMul(r[i].x, a[i].x, zinv2);
+        FieldMul(r[i].y, a[i].y, zinv3);
+    }
+}
+
+// Odd multiples G, 3G, ..., (2^(WINDOW_G-1) - 1)G and their images
+// under the endomorphism, computed on first use
+struct CGeneratorTables
+{
+    GroupElem vG[TABLE_SIZE_G];
+    GroupElem vLambdaG[TABLE_SIZE_G];
+
+    CGeneratorTables()
+    {
+        GroupElem g;
+        FieldSet(g.x, G_X);
+        FieldSet(g.y, G_Y);
+        g.fInfinity = false;
+
+        vector<GroupElemJ> vJ(TABLE_SIZE_G);
+        GroupElemJ g2;
+        GejSetGe(vJ[0], g);
+        GejDouble(g2, vJ[0]);
+        for (int i = 1; i < TABLE_SIZE_G; i++)
+            GejAdd(vJ[i], vJ[i - 1], g2);
+        GeSetAllGej(vG, &vJ[0], TABLE_SIZE_G);
+
+        FieldElem beta;
+        FieldSet(beta, BETA);
+        for (int i = 0; i < TABLE_SIZE_G; i++)
+        {
+            vLambdaG[i] = vG[i];
+            FieldMul(vLambdaG[i].x, vG[i].x, beta);
+        }
+    }
+};
+
+static const CGeneratorTables& GetGeneratorTables()
+{
+    static CGeneratorTables tables;
+    return tables;
+}
+
+static inline void TableGetGe(GroupElem& r, const GroupElem* pTable, int nDigit)
+{
+    if (nDigit > 0)
+        r = pTable[(nDigit - 1) / 2];
+    else
+    {
+        r = pTable[(-nDigit - 1) / 2];
+        FieldNegate(r.y, r.y);
+    }
+}
+
+static inline void TableGetGej(GroupElemJ& r, const GroupElemJ* pTable, int nDigit)
+{
+    if (nDigit > 0)
+        r = pTable[(nDigit - 1) / 2];
+    else
+    {
+        r = pTable[(-nDigit - 1) / 2];
+        FieldNegate(r.y, r.y);
+    }
+}
+
+// wNAF of one half of a split scalar, negated back if the split returned
+// it as n - |k|
+static int SplitWnaf(int* wnaf, const Scalar& k, int w)
+{
+    if (ScalarIsHigh(k))
+    {
+        Scalar neg;
+        ScalarNegate(neg, k);
+        return ComputeWnaf(wnaf, neg, w, true);
+    }
+    return ComputeWnaf(wnaf, k, w, false);
+}
+
+// r = na * a + ng * G
+static void EcMult(GroupElemJ& r, const GroupElem& a, const Scalar& na, const Scalar& ng)
+{
+    const CGeneratorTables& tables = GetGeneratorTables();
+
+    Scalar na1, na2, ng1, ng2;
+    ScalarSplitLambda(na1, na2, na);
+    ScalarSplitLambda(ng1, ng2, ng);
+
+    int wnafA1[WNAF_MAX], wnafA2[WNAF_MAX], wnafG1[WNAF_MAX], wnafG2[WNAF_MAX];
+    int nLenA1 = SplitWnaf(wnafA1, na1, WINDOW_A);
+    int nLenA2 = SplitWnaf(wnafA2, na2, WINDOW_A);
+    int nLenG1 = SplitWnaf(wnafG1, ng1, WINDOW_G);
+    int nLenG2 = SplitWnaf(wnafG2, ng2, WINDOW_G);
+
+    // Odd multiples of a, and of lambda * a
+    GroupElemJ vA[TABLE_SIZE_A], vLambdaA[TABLE_SIZE_A], a2;
+    GejSetGe(vA[0], a);
+    GejDouble(a2, vA[0]);
+    for (int i = 1; i < TABLE_SIZE_A; i++)
+        GejAdd(vA[i], vA[i - 1], a2);
+    FieldElem beta;
+    FieldSet(beta, BETA);
+    for (int i = 0; i < TABLE_SIZE_A; i++)
+    {
+        vLambdaA[i] = vA[i];
+        FieldMul(vLambdaA[i].x, vA[i].x, beta);
+    }
+
+    int nBits = max(max(nLenA1, nLenA2), max(nLenG1, nLenG2));
+    GejSetInfinity(r);
+    for (int i = nBits - 1; i >= 0; i--)
+    {
+        GejDouble(r, r);
+        GroupElemJ tj;
+        GroupElem t;
+        if (i < nLenA1 && wnafA1[i])
+        {
+            TableGetGej(tj, vA, wnafA1[i]);
+            GejAdd(r, r, tj);
+        }
+        if (i < nLenA2 && wnafA2[i])
+        {
+            TableGetGej(tj, vLambdaA, wnafA2[i]);
+            GejAdd(r, r, tj);
+        }
+        if (i < nLenG1 && wnafG1[i])
+        {
+            TableGetGe(t, tables.vG, wnafG1[i]);
+            GejAddGe(r, r, t);
+        }
+        if (i < nLenG2 && wnafG2[i])
+        {
+            TableGetGe(t, tables.vLambdaG, wnafG2[i]);
+            GejAddGe(r, r, t);
+        }
+    }
+}
+
+//
+// ECDSA
+//
+
+static bool ParsePubKey(GroupElem& r, const unsigned char* pch, size_t nSize)
+{
+    if (nSize == 33 && (pch[0] == 0x02 || pch[0] == 0x03))
+    {
+        FieldElem x;
+        if (!FieldSetBytes(x, pch + 1))
+            return false;
+        return GeSetXOdd(r, x, pch[0] == 0x03);
+    }
+    if (nSize == 65 && (pch[0] == 0x04 || pch[0] == 0x06 || pch[0] == 0x07))
+    {
+        if (!FieldSetBytes(r.x, pch + 1) || !FieldSetBytes(r.y, pch + 33))
+            return false;
+        r.fInfinity = false;
+        // Hybrid keys carry the y parity in the header too; it must match
+        if (pch[0] != 0x04 && FieldIsOdd(r.y) != (pch[0] == 0x07))
+            return false;
+        return GeIsOnCurve(r);
+    }
+    return false;
+}
+
+// Read one DER length, tolerating long forms; false if it runs past the end
+static bool ParseDERLength(const unsigned char* pch, size_t nSize, size_t& nPos, size_t& nLen)
+{
+    if (nPos == nSize)
+        return false;
+    size_t nLenByte = pch[nPos++];
+    if (!(nLenByte & 0x80))
+    {
+        nLen = nLenByte;
+        return true;
+    }
+    nLenByte -= 0x80;
+    if (nLenByte > nSize - nPos)
+        return false;
+    while (nLenByte > 0 && pch[nPos] == 0)
+    {
+        nPos++;
+        nLenByte--;
+    }
+    if (nLenByte >= 4)
+        return false;
+    nLen = 0;
+    while (nLenByte > 0)
+    {
+        nLen = (nLen << 8) + pch[nPos++];
+        nLenByte--;
+    }
+    return true;
+}
+
+// Parse a DER signature as leniently as OpenSSL did before it required
+// strict DER: the sequence length is not checked, integers may carry extra
+// zero padding, and trailing garbage is ignored. Values that do not fit
+// below n leave r and s zero, which never verifies.
+static bool ParseSignatureLax(Scalar& r, Scalar& s, const unsigned char* pch, size_t nSize)
+{
+    memset(r.d, 0, sizeof(r.d));
+    memset(s.d, 0, sizeof(s.d));
+    size_t nPos = 0, nLen;
+
+    // Sequence tag and length; the length is skipped over, not checked
+    if (nPos == nSize || pch[nPos] != 0x30)
+        return false;
+    nPos++;
+    if (nPos == nSize)
+        return false;
+    size_t nLenByte = pch[nPos++];
+    if (nLenByte & 0x80)
+    {
+        nLenByte -= 0x80;
+        if (nLenByte > nSize - nPos)
+            return false;
+        nPos += nLenByte;
+    }
+
+    // Integers R and S
+    size_t vPos[2], vLen[2];
+    for (int i = 0; i < 2; i++)
+    {
+        if (nPos == nSize || pch[nPos] != 0x02)
+            return false;
+        nPos++;
+        if (!ParseDERLength(pch, nSize, nPos, nLen) || nLen > nSize - nPos)
+            return false;
+        vPos[i] = nPos;
+        vLen[i] = nLen;
+        nPos += nLen;
+    }
+
+    unsigned char vch[2][32];
+    memset(vch, 0, sizeof(vch));
+    for (int i = 0; i < 2; i++)
+    {
+        while (vLen[i] > 0 && pch[vPos[i]] == 0)
+        {
+            vPos[i]++;
+            vLen[i]--;
+        }
+        if (vLen[i] > 32)
+            return true;
+        memcpy(vch[i] + 32 - vLen[i], pch + vPos[i], vLen[i]);
+    }
+
+    bool fOverflowR, fOverflowS;
+    Scalar rr, ss;
+    ScalarSetBytes(rr, vch[0], fOverflowR);
+    ScalarSetBytes(ss, vch[1], fOverflowS);
+    if (!fOverflowR && !fOverflowS)
+    {
+        r = rr;
+        s = ss;
+    }
+    return true;
+}
+
+// Check R.x == r (mod n) for R = (u1 * G + u2 * Q), given s^-1
+static bool VerifyWithInverse(const Scalar& r, const Scalar& sinv, const GroupElem& pubkey, const unsigned char* pchHash)
+{
+    Scalar e, u1, u2;
+    bool fOverflow;
+    ScalarSetBytes(e, pchHash, fOverflow);
+    ScalarMul(u1, e, sinv);
+    ScalarMul(u2, r, sinv);
+
+    GroupElemJ R;
+    EcMult(R, pubkey, u2, u1);
+    if (R.fInfinity)
+        return false;
+
+    // Compare in projective form to avoid an inversion. R.x is below p, so
+    // it reduces to r mod n either as r or, if that is still below p, r + n.
+    FieldElem xr, zz, t;
+    FieldSet(xr, r.d);
+    FieldSqr(zz, R.z);
+    FieldMul(t, xr, zz);
+    if (FieldEqual(t, R.x))
+        return true;
+    if (Compare256(r.d, P_MINUS_N) >= 0)
+        return false;
+    FieldElem n;
+    FieldSet(n, ORDER_N);
+    FieldAdd(xr, xr, n);
+    FieldMul(t, xr, zz);
+    return FieldEqual(t, R.x);
+}
+
+} // namespace
+
+bool Secp256k1PubKeyIsValid(const unsigned char* pchPubKey, size_t nPubKeySize)
+{
+    GroupElem pubkey;
+    return ParsePubKey(pubkey, pchPubKey, nPubKeySize);
+}
+
+bool Secp256k1Verify(const unsigned char* pchHash, const unsigned char* pchSig, size_t nSigSize,
+                     const unsigned char* pchPubKey, size_t nPubKeySize)
+{
+    GroupElem pubkey;
+    Scalar r, s, sinv;
+    if (!ParsePubKey(pubkey, pchPubKey, nPubKeySize))
+        return false;
+    if (!ParseSignatureLax(r, s, pchSig, nSigSize))
+        return false;
+    if (ScalarIsZero(r) || ScalarIsZero(s))
+        return false;
+    ScalarInv(sinv, s);
+    return VerifyWithInverse(r, sinv, pubkey, pchHash);
+}
+
+bool Secp256k1VerifyBatch(const vector<CSecp256k1Check>& vChecks, vector<bool>& vfValid)
+{
+    size_t nChecks = vChecks.size();
+    vfValid.assign(nChecks, false);
+
+    vector<GroupElem> vPubKey(nChecks);
+    vector<Scalar> vR(nChecks), vS(nChecks);
+    vector<size_t> vParsed;
+    vParsed.reserve(nChecks);
+    for (size_t i = 0; i < nChecks; i++)
+    {
+        const CSecp256k1Check& check = vChecks[i];
+        if (!ParsePubKey(vPubKey[i], check.pchPubKey, check.nPubKeySize))
+            continue;
+        if (!ParseSignatureLax(vR[i], vS[i], check.pchSig, check.nSigSize))
+            continue;
+        if (ScalarIsZero(vR[i]) || ScalarIsZero(vS[i]))
+            continue;
+        vParsed.push_back(i);
+    }
+
+    // Invert every s with a single inversion: invert the product of all of
+    // them, then peel the individual inverses off from the back
+    if (!vParsed.empty())
+    {
+        vector<Scalar> vProd(vParsed.size());
+        vProd[0] = vS[vParsed[0]];
+        for (size_t j = 1; j < vParsed.size(); j++)
+            ScalarMul(vProd[j], vProd[j - 1], vS[vParsed[j]]);
+        Scalar inv;
+        ScalarInv(inv, vProd.back());
+        for (size_t j = vParsed.size() - 1; j > 0; j--)
+        {
+            Scalar sinv;
+            ScalarMul(sinv, inv, vProd[j - 1]);
+            ScalarMul(inv, inv, vS[vParsed[j]]);
+            vS[vParsed[j]] = sinv;
+        }
+        vS[vParsed[0]] = inv;
+    }
+
+    bool fAllValid = true;
+    for (size_t j = 0; j < vParsed.size(); j++)
+    {
+        size_t i = vParsed[j];
+        vfValid[i] = VerifyWithInverse(vR[i], vS[i], vPubKey[i], vChecks[i].pchHash);
+    }
+    for (size_t i = 0; i < nChecks; i++)
+        fAllValid &= vfValid[i];
+    return fAllValid;
+}
+
+bool Secp256k1SelfTest()
+{
+    static const unsigned char vchHash[32] = {
+        0x48, 0x31, 0x1e, 0x3d, 0x3a, 0xbe, 0x11, 0x53, 0x19, 0xee, 0x22, 0xaa, 0x48, 0x21, 0xd4, 0x59,
+        0x7e, 0xd0, 0x3b, 0xf1, 0x8b, 0xe5, 0x73, 0x97, 0xe7, 0xa7, 0xb3, 0xd5, 0x84, 0x32, 0xe6, 0xde};
+    static const unsigned char vchSig[70] = {
+        0x30, 0x44, 0x02, 0x20, 0x17, 0xf5, 0x32, 0x89, 0xea, 0xc9, 0x61, 0xe5, 0xad, 0xc8, 0x58, 0xd3,
+        0xca, 0x50, 0xda, 0xb0, 0x56, 0xdd, 0xca, 0x7a, 0x1a, 0x90, 0x6c, 0x08, 0x15, 0xa0, 0x36, 0x93,
+        0x12, 0xd1, 0xaa, 0x49, 0x02, 0x20, 0x52, 0x20, 0xf2, 0x04, 0x7f, 0x32, 0x06, 0xfb, 0x67, 0xba,
+        0x63, 0xe7, 0xa4, 0xfc, 0xcd, 0x61, 0x61, 0x66, 0x21, 0x45, 0x77, 0xec, 0xa0, 0x60, 0xd8, 0xd7,
+        0x68, 0x21, 0x65, 0xe9, 0x91, 0x60};
+    static const unsigned char vchPubKey[33] = {
+        0x03, 0x44, 0x18, 0xd8, 0x98, 0x45, 0x78, 0x15, 0x20, 0x9b, 0xba, 0x06, 0xff, 0x62, 0x64, 0xdf,
+        0x26, 0x18, 0x1c, 0xd5, 0x48, 0x19, 0xbf, 0x09, 0x61, 0x39, 0x8c, 0x43, 0x7f, 0xcb, 0x58, 0x8f,
+        0xaf};
+
+    if (!Secp256k1Verify(vchHash, vchSig, sizeof(vchSig), vchPubKey, sizeof(vchPubKey)))
+        return false;
+
+    unsigned char vchHashBad[32];
+    memcpy(vchHashBad, vchHash, sizeof(vchHashBad));
+    vchHashBad[31] ^= 1;
+    if (Secp256k1Verify(vchHashBad, vchSig, sizeof(vchSig), vchPubKey, sizeof(vchPubKey)))
+        return false;
+
+    // The generator tables must agree with the endomorphism: lambda * G
+    // computed by scalar multiplication is (beta * Gx, Gy)
+    const CGeneratorTables& tables = GetGeneratorTables();
+    Scalar lambda, zero;
+    ScalarSet(lambda, MINUS_LAMBDA);
+    ScalarNegate(lambda, lambda);
+    memset(zero.d, 0, sizeof(zero.d));
+    GroupElemJ lg;
+    EcMult(lg, tables.vG[0], lambda, zero);
+    GroupElem lgAffine;
+    GeSetAllGej(&lgAffine, &lg, 1);
+    if (lgAffine.fInfinity || !FieldEqual(lgAffine.x, tables.vLambdaG[0].x) || !FieldEqual(lgAffine.y, tables.vLambdaG[0].y))
+        return false;
+    return true;
+}
@@ -0,0 +1,52 @@
+// Copyright (c) 2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef DIMINUTIVEVAULT_SECP256K1_H
+#define DIMINUTIVEVAULT_SECP256K1_H
+
+#include <stddef.h>
+#include <vector>
+
+// Verification-only secp256k1 implementation, used instead of OpenSSL's
+// generic curve code for ECDSA_verify. Signing and key recovery stay with
+// OpenSSL in key.cpp.
+//
+// Public keys may be compressed (0x02/0x03), uncompressed (0x04) or hybrid
+// (0x06/0x07), exactly as OpenSSL's o2i_ECPublicKey accepts them.
+// Signatures are parsed with the same lax DER rules as OpenSSL before it
+// started enforcing strict encoding, and both low and high S values verify.
+// The hash is read as a 32 byte big-endian number, like ECDSA_verify does
+// with (unsigned char*)&hash.
+
+/** One signature check for Secp256k1VerifyBatch */
+struct CSecp256k1Check
+{
+    const unsigned char* pchHash;   // 32 bytes
+    const unsigned char* pchSig;
+    size_t nSigSize;
+    const unsigned char* pchPubKey;
+    size_t nPubKeySize;
+
+    CSecp256k1Check() : pchHash(NULL), pchSig(NULL), nSigSize(0), pchPubKey(NULL), nPubKeySize(0) { }
+    CSecp256k1Check(const unsigned char* pchHashIn, const unsigned char* pchSigIn, size_t nSigSizeIn,
+                    const unsigned char* pchPubKeyIn, size_t nPubKeySizeIn) :
+        pchHash(pchHashIn), pchSig(pchSigIn), nSigSize(nSigSizeIn), pchPubKey(pchPubKeyIn), nPubKeySize(nPubKeySizeIn) { }
+};
+
+/** Whether a serialized public key is a valid point on the curve */
+bool Secp256k1PubKeyIsValid(const unsigned char* pchPubKey, size_t nPubKeySize);
+
+/** Verify a DER signature of a 32 byte hash */
+bool Secp256k1Verify(const unsigned char* pchHash, const unsigned char* pchSig, size_t nSigSize,
+                     const unsigned char* pchPubKey, size_t nPubKeySize);
+
+/** Verify many signatures at once. vfValid receives each result; returns
+ *  whether all of them verified. Cheaper per signature than
+ *  Secp256k1Verify as the batch shares one modular inversion. Safe to call
+ *  from several threads, e.g. script check workers. */
+bool Secp256k1VerifyBatch(const std::vector<CSecp256k1Check>& vChecks, std::vector<bool>& vfValid);
+
+/** Check the implementation against a known signature */
+bool Secp256k1SelfTest();
+
+#endif
@@ -929,6 +929,15 @@ public:
     const_reference operator[](size_type pos) const  { return vch[pos + nReadPos]; }
     reference operator[](size_type pos)              { return vch[pos + nReadPos]; }
     void clear()                                     { vch.clear(); nReadPos = 0; }
+    void swap(CDataStream& b)
+    {
+        vch.swap(b.vch);
+        std::swap(nReadPos, b.nReadPos);
+        std::swap(state, b.state);
+        std::swap(exceptmask, b.exceptmask);
+        std::swap(nType, b.nType);
+        std::swap(nVersion, b.nVersion);
+    }
     iterator insert(iterator it, const char& x=char()) { return vch.insert(it, x); }
     void insert(iterator it, size_type n, const char& x) { vch.insert(it, n, x); }
 
@@ -0,0 +1,341 @@
+// Copyright (c) 2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "sha256d.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#include <immintrin.h>
+#define SHA256D64_X86_DISPATCH
+// The 256-bit vector helpers are always inlined into AVX2 code, so the
+// ABI of passing them around without AVX never matters
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+namespace {
+
+const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+const uint32_t IV[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+inline uint32_t ReadBE32(const unsigned char* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+inline void WriteBE32(unsigned char* p, uint32_t x)
+{
+    p[0] = x >> 24;
+    p[1] = x >> 16;
+    p[2] = x >> 8;
+    p[3] = x;
+}
+
+// The compression function is written once over a word type V, which is
+// either uint32_t or a GCC vector of uint32_t holding one word of several
+// independent messages. The vector instantiations are only ever inlined
+// into functions compiled for the matching instruction set.
+
+#define SHA256D_INLINE inline __attribute__((always_inline))
+
+template<typename V> SHA256D_INLINE V Splat(uint32_t x) { return V() + x; }
+template<> SHA256D_INLINE uint32_t Splat<uint32_t>(uint32_t x) { return x; }
+
+template<typename V> SHA256D_INLINE V Ror(const V& x, int n) { return (x >> n) | (x << (32 - n)); }
+template<typename V> SHA256D_INLINE V Ch(const V& x, const V& y, const V& z) { return z ^ (x & (y ^ z)); }
+template<typename V> SHA256D_INLINE V Maj(const V& x, const V& y, const V& z) { return (x & y) | (z & (x | y)); }
+template<typename V> SHA256D_INLINE V Sigma0(const V& x) { return Ror(x, 2) ^ Ror(x, 13) ^ Ror(x, 22); }
+template<typename V> SHA256D_INLINE V Sigma1(const V& x) { return Ror(x, 6) ^ Ror(x, 11) ^ Ror(x, 25); }
+template<typename V> SHA256D_INLINE V sigma0(const V& x) { return Ror(x, 7) ^ Ror(x, 18) ^ (x >> 3); }
+template<typename V> SHA256D_INLINE V sigma1(const V& x) { return Ror(x, 17) ^ Ror(x, 19) ^ (x >> 10); }
+
+template<typename V>
+SHA256D_INLINE void Transform(V s[8], V w[16])
+{
+    V a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for (int i = 0; i < 64; i++)
+    {
+        if (i >= 16)
+            w[i & 15] += sigma1(w[(i + 14) & 15]) + w[(i + 9) & 15] + sigma0(w[(i + 1) & 15]);
+        V t1 = h + Sigma1(e) + Ch(e, f, g) + Splat<V>(K[i]) + w[i & 15];
+        V t2 = Sigma0(a) + Maj(a, b, c);
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    s[0] += a; s[1] += b; s[2] += c; s[3] += d;
+    s[4] += e; s[5] += f; s[6] += g; s[7] += h;
+}
+
+// Double SHA-256 of N 64 byte inputs held in N lanes of V. The padding
+// blocks of both passes are constant, which the compiler folds into the
+// message schedule.
+template<typename V, int N>
+SHA256D_INLINE void TransformD64(unsigned char* pchOut, const unsigned char* pchIn)
+{
+    V s[8], w[16];
+    for (int i = 0; i < 16; i++)
+    {
+        uint32_t lane[N];
+        for (int j = 0; j < N; j++)
+            lane[j] = ReadBE32(pchIn + 64 * j + 4 * i);
+        memcpy(&w[i], lane, sizeof(w[i]));
+    }
+    for (int i = 0; i < 8; i++)
+        s[i] = Splat<V>(IV[i]);
+    Transform(s, w);
+
+    // Padding of a 64 byte message
+    for (int i = 0; i < 16; i++)
+        w[i] = Splat<V>(i == 0 ? 0x80000000 : i == 15 ? 512 : 0);
+    V t[8];
+    for (int i = 0; i < 8; i++)
+        t[i] = s[i];
+    Transform(t, w);
+
+    // Second pass over the 32 byte digest
+    for (int i = 0; i < 8; i++)
+        w[i] = t[i];
+    for (int i = 8; i < 16; i++)
+        w[i] = Splat<V>(i == 8 ? 0x80000000 : i == 15 ? 256 : 0);
+    for (int i = 0; i < 8; i++)
+        s[i] = Splat<V>(IV[i]);
+    Transform(s, w);
+
+    for (int i = 0; i < 8; i++)
+    {
+        uint32_t lane[N];
+        memcpy(lane, &s[i], sizeof(s[i]));
+        for (int j = 0; j < N; j++)
+            WriteBE32(pchOut + 32 * j + 4 * i, lane[j]);
+    }
+}
+
+typedef void (*TransformD64Func)(unsigned char* pchOut, const unsigned char* pchIn);
+
+void TransformD64Generic(unsigned char* pchOut, const unsigned char* pchIn)
+{
+    TransformD64<uint32_t, 1>(pchOut, pchIn);
+}
+
+#ifdef SHA256D64_X86_DISPATCH
+typedef uint32_t v4u32 __attribute__((vector_size(16)));
+typedef uint32_t v8u32 __attribute__((vector_size(32)));
+
+__attribute__((target("sse4.1")))
+void TransformD64SSE41(unsigned char* pchOut, const unsigned char* pchIn)
+{
+    TransformD64<v4u32, 4>(pchOut, pchIn);
+}
+
+__attribute__((target("avx2")))
+void TransformD64AVX2(unsigned char* pchOut, const unsigned char* pchIn)
+{
+    TransformD64<v8u32, 8>(pchOut, pchIn);
+}
+
+// One block through the SHA extensions. state is in the usual a..h order.
+__attribute__((target("sha,sse4.1")))
+void TransformSHANI(uint32_t state[8], const unsigned char* pchBlock)
+{
+    static const uint32_t KNI[64] __attribute__((aligned(16))) = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+    };
+    const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    // The instructions want the state as ABEF and CDGH
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[0]), 0xB1);
+    __m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[4]), 0x1B);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+    __m128i abef = state0, cdgh = state1;
+
+    __m128i msg[4];
+    for (int i = 0; i < 4; i++)
+        msg[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(pchBlock + 16 * i)), MASK);
+
+    // Four rounds at a time; the message schedule runs alongside
+    for (int i = 0; i < 16; i++)
+    {
+        __m128i m = _mm_add_epi32(msg[i & 3], _mm_load_si128((const __m128i*)&KNI[4 * i]));
+        state1 = _mm_sha256rnds2_epu32(state1, state0, m);
+        if (i >= 3 && i < 15)
+        {
+            __m128i& next = msg[(i + 1) & 3];
+            next = _mm_add_epi32(next, _mm_alignr_epi8(msg[i & 3], msg[(i + 3) & 3], 4));
+            next = _mm_sha256msg2_epu32(next, msg[i & 3]);
+        }
+        state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(m, 0x0E));
+        if (i >= 1 && i < 13)
+            msg[(i + 3) & 3] = _mm_sha256msg1_epu32(msg[(i + 3) & 3], msg[i & 3]);
+    }
+
+    state0 = _mm_add_epi32(state0, abef);
+    state1 = _mm_add_epi32(state1, cdgh);
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    _mm_storeu_si128((__m128i*)&state[0], _mm_blend_epi16(tmp, state1, 0xF0));
+    _mm_storeu_si128((__m128i*)&state[4], _mm_alignr_epi8(state1, tmp, 8));
+}
+
+void TransformD64SHANI(unsigned char* pchOut, const unsigned char* pchIn)
+{
+    static const unsigned char pchPad64[64] = {0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                               0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                               0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                               0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0};
+    uint32_t state[8];
+    memcpy(state, IV, sizeof(state));
+    TransformSHANI(state, pchIn);
+    TransformSHANI(state, pchPad64);
+
+    unsigned char pchBlock[64] = {0};
+    for (int i = 0; i < 8; i++)
+        WriteBE32(pchBlock + 4 * i, state[i]);
+    pchBlock[32] = 0x80;
+    pchBlock[62] = 1;
+    memcpy(state, IV, sizeof(state));
+    TransformSHANI(state, pchBlock);
+    for (int i = 0; i < 8; i++)
+        WriteBE32(pchOut + 4 * i, state[i]);
+}
+#endif
+
+#ifdef SHA256D64_X86_DISPATCH
+bool HaveSHANI()
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid_max(0, NULL) < 7)
+        return false;
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return (ebx >> 29) & 1;
+}
+#endif // SHA256D64_X86_DISPATCH
+
+struct SHA256D64Dispatch
+{
+    TransformD64Func wide;      // NULL if there is no multi-lane kernel
+    int nWidth;                 // inputs per call of wide
+    TransformD64Func single;
+    const char* pszName;
+    bool fSelfTestPassed;
+
+    SHA256D64Dispatch()
+    {
+        Set(NULL, 1, TransformD64Generic, "generic");
+        fSelfTestPassed = true;
+#ifdef SHA256D64_X86_DISPATCH
+        // Best first; a kernel that disagrees with the generic code is
+        // skipped in favour of the next one
+        __builtin_cpu_init();
+        bool fSSE41 = __builtin_cpu_supports("sse4.1");
+        bool fAVX2 = __builtin_cpu_supports("avx2");
+        bool fSHANI = fSSE41 && HaveSHANI();
+        if (fAVX2 && fSHANI && Try(TransformD64AVX2, 8, TransformD64SHANI, "avx2(8-way),shani"))
+            return;
+        if (fAVX2 && Try(TransformD64AVX2, 8, TransformD64Generic, "avx2(8-way)"))
+            return;
+        if (fSHANI && Try(NULL, 1, TransformD64SHANI, "shani"))
+            return;
+        if (fSSE41 && Try(TransformD64SSE41, 4, TransformD64Generic, "sse4.1(4-way)"))
+            return;
+#endif
+    }
+
+    void Set(TransformD64Func wideIn, int nWidthIn, TransformD64Func singleIn, const char* pszNameIn)
+    {
+        wide = wideIn;
+        nWidth = nWidthIn;
+        single = singleIn;
+        pszName = pszNameIn;
+    }
+
+    bool Try(TransformD64Func wideIn, int nWidthIn, TransformD64Func singleIn, const char* pszNameIn)
+    {
+        SHA256D64Dispatch test(*this);
+        test.Set(wideIn, nWidthIn, singleIn, pszNameIn);
+        if (!test.SelfTest())
+        {
+            fSelfTestPassed = false;
+            return false;
+        }
+        Set(wideIn, nWidthIn, singleIn, pszNameIn);
+        return true;
+    }
+
+    void Run(unsigned char* pchOut, const unsigned char* pchIn, size_t nBlocks) const
+    {
+        if (wide)
+        {
+            for (; nBlocks >= (size_t)nWidth; nBlocks -= nWidth)
+            {
+                wide(pchOut, pchIn);
+                pchOut += 32 * nWidth;
+                pchIn += 64 * nWidth;
+            }
+        }
+        for (; nBlocks > 0; nBlocks--)
+        {
+            single(pchOut, pchIn);
+            pchOut += 32;
+            pchIn += 64;
+        }
+    }
+
+    /** Compare against the generic code on 11 inputs, so that every width
+     *  gets both full calls and a remainder */
+    bool SelfTest() const
+    {
+        unsigned char vchIn[64 * 11], vchTest[32 * 11], vchRef[32 * 11];
+        for (unsigned int i = 0; i < sizeof(vchIn); i++)
+            vchIn[i] = (unsigned char)(i * 131 + (i >> 6) * 7);
+        for (int i = 0; i < 11; i++)
+            TransformD64Generic(vchRef + 32 * i, vchIn + 64 * i);
+        Run(vchTest, vchIn, 11);
+        return memcmp(vchTest, vchRef, sizeof(vchRef)) == 0;
+    }
+};
+
+const SHA256D64Dispatch& GetDispatch()
+{
+    static const SHA256D64Dispatch dispatch;
+    return dispatch;
+}
+
+}
+
+void SHA256D64(unsigned char* pchOut, const unsigned char* pchIn, size_t nBlocks)
+{
+    GetDispatch().Run(pchOut, pchIn, nBlocks);
+}
+
+const char* SHA256D64Implementation()
+{
+    return GetDispatch().pszName;
+}
+
+bool SHA256D64SelfTest()
+{
+    return GetDispatch().fSelfTestPassed;
+}
@@ -0,0 +1,30 @@
+// Copyright (c) 2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef DIMINUTIVEVAULT_SHA256D_H
+#define DIMINUTIVEVAULT_SHA256D_H
+
+#include <stddef.h>
+
+// Double SHA-256 of many 64 byte inputs at once, which is what every inner
+// node of a merkle tree is: Hash() of two concatenated 32 byte hashes.
+//
+// On x86 the inputs are hashed several at a time in SIMD lanes (4 with
+// SSE4.1, 8 with AVX2), or with the SHA extensions where the CPU has them.
+// The implementation is picked at first use from what the CPU supports,
+// after checking it against the portable one; everything else falls back to
+// plain C++.
+
+/** Hash nBlocks 64 byte inputs from pchIn, writing nBlocks 32 byte hashes
+ *  to pchOut. Each output equals Hash(pchIn + 64 * i, pchIn + 64 * (i + 1)).
+ *  pchOut may equal pchIn. */
+void SHA256D64(unsigned char* pchOut, const unsigned char* pchIn, size_t nBlocks);
+
+/** Name of the kernels selected for this CPU ("generic" if none) */
+const char* SHA256D64Implementation();
+
+/** False if a kernel this CPU supports disagreed with the portable code and
+ *  was passed over */
+bool SHA256D64SelfTest();
+
+#endif
@@ -0,0 +1,220 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2012 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "sigcache.h"
+
+#include "util.h"
+
+#include <openssl/sha.h>
+
+using namespace std;
+
+CSignatureCache::CSignatureCache(size_t nBytes)
+{
+    nonce = GetRandHash();
+
+    // Up to 16 shards, each with at least one bucket; zero bytes gives an
+    // empty cache that never stores anything
+    size_t nSlots = nBytes / sizeof(Slot);
+    size_t nBucketsTotal = nSlots / SLOTS_PER_BUCKET;
+    nShards = 16;
+    while (nShards > 1 && nBucketsTotal < nShards)
+        nShards /= 2;
+    nBuckets = nBucketsTotal / nShards;
+
+    vector<Shard> vShardsNew(nShards);
+    vShards.swap(vShardsNew);
+    for (unsigned int i = 0; i < nShards; i++)
+    {
+        Shard& shard = vShards[i];
+        vector<Slot> vSlots(nBuckets * SLOTS_PER_BUCKET);
+        for (unsigned int j = 0; j < vSlots.size(); j++)
+            Store(vSlots[j], Entry());
+        shard.vSlots.swap(vSlots);
+        shard.nSeq = 0;
+        shard.nHits = shard.nMisses = shard.nInserts = shard.nEvictions = shard.nEntries = 0;
+    }
+}
+
+CSignatureCache::Entry CSignatureCache::ComputeEntry(const uint256& sighash, const vector<unsigned char>& vchSig, const CPubKey& pubkey) const
+{
+    // The nonce keeps digests, and so bucket positions, unpredictable
+    unsigned int nSigSize = vchSig.size();
+    SHA256_CTX ctx;
+    SHA256_Init(&ctx);
+    SHA256_Update(&ctx, nonce.begin(), nonce.size());
+    SHA256_Update(&ctx, sighash.begin(), sighash.size());
+    SHA256_Update(&ctx, &nSigSize, sizeof(nSigSize));
+    if (!vchSig.empty())
+        SHA256_Update(&ctx, &vchSig[0], vchSig.size());
+    SHA256_Update(&ctx, pubkey.begin(), pubkey.size());
+
+    Entry entry;
+    SHA256_Final((unsigned char*)entry.n, &ctx);
+    return entry;
+}
+
+void CSignatureCache::GetBuckets(const Entry& entry, unsigned int& nBucket1, unsigned int& nBucket2) const
+{
+    nBucket1 = entry.n[1] % nBuckets;
+    nBucket2 = entry.n[2] % nBuckets;
+    if (nBucket2 == nBucket1 && nBuckets > 1)
+        nBucket2 = (nBucket1 + 1) % nBuckets;
+}
+
+CSignatureCache::Entry CSignatureCache::Load(const Slot& slot)
+{
+    Entry entry;
+    for (int i = 0; i < 4; i++)
+        entry.n[i] = slot.n[i].load(memory_order_relaxed);
+    return entry;
+}
+
+void CSignatureCache::Store(Slot& slot, const Entry& entry)
+{
+    for (int i = 0; i < 4; i++)
+        slot.n[i].store(entry.n[i], memory_order_relaxed);
+}
+
+bool CSignatureCache::Contains(const Shard& shard, unsigned int nBucket, const Entry& entry) const
+{
+    const Slot* pslot = &shard.vSlots[nBucket * SLOTS_PER_BUCKET];
+    for (int i = 0; i < SLOTS_PER_BUCKET; i++)
+        if (Load(pslot[i]) == entry)
+            return true;
+    return false;
+}
+
+bool CSignatureCache::StoreIfFree(Shard& shard, unsigned int nBucket, const Entry& entry)
+{
+    Slot* pslot = &shard.vSlots[nBucket * SLOTS_PER_BUCKET];
+    for (int i = 0; i < SLOTS_PER_BUCKET; i++)
+    {
+        if (Load(pslot[i]).IsNull())
+        {
+            Store(pslot[i], entry);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CSignatureCache::Get(const uint256& sighash, const vector<unsigned char>& vchSig, const CPubKey& pubkey)
+{
+    if (nBuckets == 0)
+        return false;
+
+    Entry entry = ComputeEntry(sighash, vchSig, pubkey);
+    Shard& shard = GetShard(entry);
+    unsigned int nBucket1, nBucket2;
+    GetBuckets(entry, nBucket1, nBucket2);
+
+    // Seqlock read: a result only counts if no writer touched the shard
+    // while we looked. Give up after a few tries rather than wait; a miss
+    // only costs a signature check.
+    bool fFound = false;
+    for (int nTry = 0; nTry < MAX_READ_RETRIES; nTry++)
+    {
+        uint32_t nSeq = shard.nSeq.load(memory_order_acquire);
+        if (nSeq & 1)
+            continue;
+        bool fFoundNow = Contains(shard, nBucket1, entry) || Contains(shard, nBucket2, entry);
+        atomic_thread_fence(memory_order_acquire);
+        if (shard.nSeq.load(memory_order_relaxed) == nSeq)
+        {
+            fFound = fFoundNow;
+            break;
+        }
+    }
+
+    if (fFound)
+        shard.nHits.fetch_add(1, memory_order_relaxed);
+    else
+        shard.nMisses.fetch_add(1, memory_order_relaxed);
+    return fFound;
+}
+
+void CSignatureCache::Set(const uint256& sighash, const vector<unsigned char>& vchSig, const CPubKey& pubkey)
+{
+    if (nBuckets == 0)
+        return;
+
+    Entry entry = ComputeEntry(sighash, vchSig, pubkey);
+    if (entry.IsNull())
+        return; // reserved for empty slots
+    Shard& shard = GetShard(entry);
+    unsigned int nBucket1, nBucket2;
+    GetBuckets(entry, nBucket1, nBucket2);
+
+    boost::mutex::scoped_lock lock(shard.cs);
+    if (Contains(shard, nBucket1, entry) || Contains(shard, nBucket2, entry))
+        return;
+
+    uint32_t nSeq = shard.nSeq.load(memory_order_relaxed);
+    shard.nSeq.store(nSeq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    // Take a free slot in either bucket, else displace entries to their
+    // other bucket. Victims are picked by digest bits, which are salted,
+    // so an attacker cannot choose what gets evicted.
+    bool fStored = StoreIfFree(shard, nBucket1, entry) || StoreIfFree(shard, nBucket2, entry);
+    unsigned int nBucket = nBucket1;
+    for (int nKick = 0; nKick < MAX_KICKS && !fStored; nKick++)
+    {
+        Slot& slot = shard.vSlots[nBucket * SLOTS_PER_BUCKET + (entry.n[3] + nKick) % SLOTS_PER_BUCKET];
+        Entry victim = Load(slot);
+        Store(slot, entry);
+        entry = victim;
+
+        unsigned int nVictim1, nVictim2;
+        GetBuckets(entry, nVictim1, nVictim2);
+        nBucket = (nVictim1 == nBucket) ? nVictim2 : nVictim1;
+        fStored = StoreIfFree(shard, nBucket, entry);
+    }
+
+    shard.nSeq.store(nSeq + 2, memory_order_release);
+
+    shard.nInserts.fetch_add(1, memory_order_relaxed);
+    if (fStored)
+        shard.nEntries.fetch_add(1, memory_order_relaxed);
+    else
+        shard.nEvictions.fetch_add(1, memory_order_relaxed);
+}
+
+void CSignatureCache::GetStats(CSignatureCacheStats& stats) const
+{
+    stats.nHits = stats.nMisses = stats.nInserts = stats.nEvictions = stats.nEntries = 0;
+    for (unsigned int i = 0; i < nShards; i++)
+    {
+        const Shard& shard = vShards[i];
+        stats.nHits += shard.nHits;
+        stats.nMisses += shard.nMisses;
+        stats.nInserts += shard.nInserts;
+        stats.nEvictions += shard.nEvictions;
+        stats.nEntries += shard.nEntries;
+    }
+    stats.nCapacity = (uint64_t)nShards * nBuckets * SLOTS_PER_BUCKET;
+    stats.nBytes = stats.nCapacity * sizeof(Slot);
+}
+
+static size_t GetSignatureCacheBytes()
+{
+    int64_t nSize = max((int64_t)0, GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE));
+    if (nSize > MAX_MAX_SIG_CACHE_SIZE)
+    {
+        // An old config counting entries (default 50000): keep about as many,
+        // at 32 bytes, so 32768 to the megabyte
+        int64_t nSizeMB = min((int64_t)MAX_MAX_SIG_CACHE_SIZE, nSize / 32768 + (nSize % 32768 != 0));
+        LogPrintf("Warning: -maxsigcachesize=%d is now in megabytes, reading it as an entry count (%d MB)\n", nSize, nSizeMB);
+        nSize = nSizeMB;
+    }
+    return (size_t)nSize << 20;
+}
+
+CSignatureCache& GetSignatureCache()
+{
+    static CSignatureCache signatureCache(GetSignatureCacheBytes());
+    return signatureCache;
+}
@@ -0,0 +1,107 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2012 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef DIMINUTIVEVAULT_SIGCACHE_H
+#define DIMINUTIVEVAULT_SIGCACHE_H
+
+#include "key.h"
+#include "uint256.h"
+
+#include <atomic>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+
+/** -maxsigcachesize default, in megabytes */
+static const unsigned int DEFAULT_MAX_SIG_CACHE_SIZE = 16;
+/** Largest -maxsigcachesize accepted, in megabytes. Bigger values are taken
+ *  as entry counts, which is what the option counted before. */
+static const unsigned int MAX_MAX_SIG_CACHE_SIZE = 1024;
+
+struct CSignatureCacheStats
+{
+    uint64_t nHits;
+    uint64_t nMisses;
+    uint64_t nInserts;
+    uint64_t nEvictions;
+    uint64_t nEntries;
+    uint64_t nCapacity;
+    uint64_t nBytes;
+};
+
+/** Valid signature cache, to avoid doing expensive ECDSA signature checking
+ *  twice for every transaction (once when accepted into memory pool, and
+ *  again when accepted into the block chain).
+ *
+ *  Entries are 256-bit digests of (salt, sighash, signature, public key) in
+ *  a fixed-size table, so the cache never allocates after construction and
+ *  an attacker cannot predict where an entry lands. The table is split into
+ *  shards, each a bucketized cuckoo hash: an entry lives in one of two
+ *  buckets of SLOTS_PER_BUCKET slots, and inserting into two full buckets
+ *  moves older entries to their other bucket, dropping one after
+ *  MAX_KICKS moves. Lookups take no lock: each shard has a sequence
+ *  counter that writers make odd while they modify it, and readers retry
+ *  if it changed under them.
+ */
+class CSignatureCache
+{
+public:
+    explicit CSignatureCache(size_t nBytes);
+
+    bool Get(const uint256& sighash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey);
+    void Set(const uint256& sighash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey);
+
+    void GetStats(CSignatureCacheStats& stats) const;
+
+private:
+    enum
+    {
+        SLOTS_PER_BUCKET = 4,
+        MAX_KICKS = 8,
+        MAX_READ_RETRIES = 16,
+    };
+
+    struct Entry
+    {
+        uint64_t n[4];
+        bool IsNull() const { return (n[0] | n[1] | n[2] | n[3]) == 0; }
+        bool operator==(const Entry& b) const { return n[0] == b.n[0] && n[1] == b.n[1] && n[2] == b.n[2] && n[3] == b.n[3]; }
+    };
+
+    struct Slot
+    {
+        std::atomic<uint64_t> n[4];
+    };
+
+    struct Shard
+    {
+        boost::mutex cs;                // serializes writers
+        std::atomic<uint32_t> nSeq;     // odd while a writer is active
+        std::vector<Slot> vSlots;
+        std::atomic<uint64_t> nHits;
+        std::atomic<uint64_t> nMisses;
+        std::atomic<uint64_t> nInserts;
+        std::atomic<uint64_t> nEvictions;
+        std::atomic<uint64_t> nEntries;
+    };
+
+    uint256 nonce;
+    unsigned int nShards;
+    unsigned int nBuckets;              // per shard
+    std::vector<Shard> vShards;
+
+    Entry ComputeEntry(const uint256& sighash, const std::vector<unsigned char>& vchSig, const CPubKey& pubkey) const;
+    Shard& GetShard(const Entry& entry) { return vShards[entry.n[0] % nShards]; }
+    void GetBuckets(const Entry& entry, unsigned int& nBucket1, unsigned int& nBucket2) const;
+
+    static Entry Load(const Slot& slot);
+    static void Store(Slot& slot, const Entry& entry);
+    bool Contains(const Shard& shard, unsigned int nBucket, const Entry& entry) const;
+    static bool StoreIfFree(Shard& shard, unsigned int nBucket, const Entry& entry);
+};
+
+/** The process-wide cache, sized by -maxsigcachesize on first use */
+CSignatureCache& GetSignatureCache();
+
+#endif
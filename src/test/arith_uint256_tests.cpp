@@ -0,0 +1,151 @@
+#include <boost/test/unit_test.hpp>
+
+#include "arith_uint256.h"
+#include "bignum.h"
+#include "kernel.h"
+#include "main.h"
+#include "util.h"
+
+// Differential tests: the fixed width arithmetic that replaced CBigNum in
+// consensus code must give exactly the results CBigNum did.
+
+BOOST_AUTO_TEST_SUITE(arith_uint256_tests)
+
+static uint256 RandUint256(unsigned int nBits)
+{
+    uint256 n;
+    for (unsigned char* p = n.begin(); p != n.end(); p++)
+        *p = insecure_rand();
+    return nBits < 256 ? (n >> (256 - nBits)) : n;
+}
+
+// Random compact values, biased towards the interesting exponents: around
+// the 256 and 512 bit boundaries, tiny sizes, and the sign bit
+static unsigned int RandCompact()
+{
+    static const unsigned int vSizes[] = { 0, 1, 2, 3, 4, 29, 30, 31, 32, 33, 34, 35, 36, 64, 65, 66, 67, 255 };
+    unsigned int nSize = (insecure_rand() % 4) ? vSizes[insecure_rand() % (sizeof(vSizes) / sizeof(vSizes[0]))] : insecure_rand() % 256;
+    unsigned int nWord = insecure_rand() & 0x00ffffff;
+    switch (insecure_rand() % 4)
+    {
+        case 0: nWord &= 0xff; break;
+        case 1: nWord &= 0xffff; break;
+    }
+    return (nSize << 24) | nWord;
+}
+
+BOOST_AUTO_TEST_CASE(compact_matches_bignum)
+{
+    seed_insecure_rand(true);
+    for (int i = 0; i < 20000; i++)
+    {
+        unsigned int nCompact = RandCompact();
+        CBigNum bn;
+        bn.SetCompact(nCompact);
+
+        bool fNegative, fOverflow;
+        arith_uint256 n;
+        n.SetCompact(nCompact, &fNegative, &fOverflow);
+        BOOST_CHECK_EQUAL(fNegative, bn < 0);
+        BOOST_CHECK_EQUAL(fOverflow, bn.bitSize() > 256);
+        if (!fOverflow)
+        {
+            BOOST_CHECK(ArithToUint256(n) == bn.getuint256());
+            if (!fNegative)
+                BOOST_CHECK_EQUAL(n.GetCompact(), bn.GetCompact());
+        }
+
+        arith_uint512 n512;
+        n512.SetCompact(nCompact, &fNegative, &fOverflow);
+        BOOST_CHECK_EQUAL(fOverflow, bn.bitSize() > 512);
+        if (!fOverflow && !fNegative)
+            BOOST_CHECK_EQUAL(n512.GetCompact(), bn.GetCompact());
+    }
+
+    // Round trips through values of every width
+    for (unsigned int nBits = 0; nBits <= 256; nBits++)
+    {
+        uint256 v = RandUint256(nBits);
+        BOOST_CHECK_EQUAL(UintToArith256(v).GetCompact(), CBigNum(v).GetCompact());
+    }
+
+    BOOST_CHECK_EQUAL(UintToArith256(~uint256(0) >> 20).GetCompact(), 0x1e0fffffU);
+}
+
+BOOST_AUTO_TEST_CASE(mul_div_match_bignum)
+{
+    seed_insecure_rand(true);
+    for (int i = 0; i < 5000; i++)
+    {
+        uint256 a = RandUint256(insecure_rand() % 257);
+        uint256 b = RandUint256(insecure_rand() % 129);
+        uint256 c = RandUint256(1 + insecure_rand() % 256);
+        if (c == 0)
+            c = 1;
+
+        // Products that fit, and products wrapped to 256 bits
+        arith_uint256 nProduct = UintToArith256(a >> 128) * UintToArith256(b);
+        BOOST_CHECK(ArithToUint256(nProduct) == (CBigNum(a >> 128) * CBigNum(b)).getuint256());
+        arith_uint512 nWide = arith_uint512(a) * arith_uint512(b);
+        BOOST_CHECK(nWide.trim256() == (CBigNum(a) * CBigNum(b)).getuint256());
+        BOOST_CHECK(ArithToUint256(UintToArith256(a) * UintToArith256(b)) == (CBigNum(a) * CBigNum(b)).getuint256());
+
+        BOOST_CHECK(ArithToUint256(UintToArith256(a) / UintToArith256(c)) == (CBigNum(a) / CBigNum(c)).getuint256());
+        uint32_t n32 = insecure_rand();
+        arith_uint256 nSmall = UintToArith256(a);
+        nSmall *= n32;
+        BOOST_CHECK(ArithToUint256(nSmall) == (CBigNum(a) * CBigNum((int64_t)n32)).getuint256());
+    }
+
+    BOOST_CHECK_THROW(UintToArith256(uint256(1)) / arith_uint256(0), uint_error);
+}
+
+BOOST_AUTO_TEST_CASE(block_trust_matches_bignum)
+{
+    seed_insecure_rand(true);
+    for (int i = 0; i < 5000; i++)
+    {
+        CBlockIndex index;
+        index.nBits = RandCompact();
+
+        CBigNum bnTarget;
+        bnTarget.SetCompact(index.nBits);
+        uint256 nExpected = 0;
+        if (bnTarget > 0)
+            nExpected = ((CBigNum(1) << 256) / (bnTarget + 1)).getuint256();
+        BOOST_CHECK(index.GetBlockTrust() == nExpected);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(kernel_target_matches_bignum)
+{
+    seed_insecure_rand(true);
+    for (int i = 0; i < 20000; i++)
+    {
+        unsigned int nBits = RandCompact();
+        int64_t nValueIn;
+        switch (insecure_rand() % 4)
+        {
+            case 0: nValueIn = 0; break;
+            case 1: nValueIn = insecure_rand(); break;
+            case 2: nValueIn = ((int64_t)insecure_rand() << 31) | insecure_rand(); break;
+            default: nValueIn = -(int64_t)insecure_rand(); break;
+        }
+
+        CBigNum bnTarget;
+        bnTarget.SetCompact(nBits);
+        bnTarget *= CBigNum(nValueIn);
+
+        // Hashes on either side of the target where it is in range
+        uint256 hash = RandUint256(insecure_rand() % 257);
+        if (insecure_rand() % 2 && bnTarget > 0 && bnTarget.bitSize() <= 256)
+            hash = bnTarget.getuint256() + (insecure_rand() % 3) - 1;
+
+        uint256 targetProofOfStake;
+        bool fPass = CheckStakeKernelTarget(nBits, nValueIn, hash, targetProofOfStake);
+        BOOST_CHECK_EQUAL(fPass, !(CBigNum(hash) > bnTarget));
+        BOOST_CHECK(targetProofOfStake == bnTarget.getuint256());
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,109 @@
+#include <boost/test/unit_test.hpp>
+
+#include "blockencodings.h"
+#include "hash.h"
+#include "txmempool.h"
+#include "util.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(blockencodings_tests)
+
+static CTransaction MakeTx(bool fCoinBase)
+{
+    CTransaction tx;
+    tx.vin.resize(1);
+    if (!fCoinBase)
+        tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 1 * COIN;
+    tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    return tx;
+}
+
+static CBlock MakeBlock(unsigned int nTx)
+{
+    CBlock block;
+    block.nBits = 0x1e0fffff;
+    block.nTime = 1400000000;
+    block.vtx.push_back(MakeTx(true));
+    for (unsigned int i = 1; i < nTx; i++)
+        block.vtx.push_back(MakeTx(false));
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    return block;
+}
+
+BOOST_AUTO_TEST_CASE(siphash)
+{
+    uint256 val;
+    for (int i = 0; i < 32; i++)
+        val.begin()[i] = i;
+    BOOST_CHECK(SipHashUint256(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL, val) == 0x7127512f72f27cceULL);
+}
+
+BOOST_AUTO_TEST_CASE(compactblock_reconstruct)
+{
+    CBlock block = MakeBlock(5);
+    CTxMemPool pool;
+    for (unsigned int i = 1; i < block.vtx.size(); i++)
+        if (i != 3)
+            pool.addUnchecked(block.vtx[i].GetHash(), block.vtx[i]);
+    CTransaction txOther = MakeTx(false);
+    pool.addUnchecked(txOther.GetHash(), txOther);
+
+    // Through the wire and back
+    CBlockHeaderAndShortTxIDs cmpctblockSent(block);
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << cmpctblockSent;
+    BOOST_CHECK(ss.size() < ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION));
+    CBlockHeaderAndShortTxIDs cmpctblock;
+    ss >> cmpctblock;
+    BOOST_CHECK(cmpctblock.BlockTxCount() == 5 && cmpctblock.prefilledtxn.size() == 1);
+    BOOST_CHECK(cmpctblock.header.GetHash() == block.GetHash());
+    BOOST_CHECK(cmpctblock.GetShortID(block.vtx[2].GetHash()) == cmpctblockSent.GetShortID(block.vtx[2].GetHash()));
+
+    CPartialBlock partial;
+    BOOST_CHECK(partial.InitData(cmpctblock, pool) == READ_STATUS_OK);
+    vector<unsigned short> vMissing = partial.GetMissing();
+    BOOST_CHECK(vMissing.size() == 1 && vMissing[0] == 3);
+    BOOST_CHECK(partial.IsTxAvailable(0) && partial.IsTxAvailable(4) && !partial.IsTxAvailable(3));
+
+    // Too few, too many and wrong transactions
+    CBlock blockRebuilt;
+    BOOST_CHECK(partial.FillBlock(blockRebuilt, vector<CTransaction>()) == READ_STATUS_INVALID);
+    BOOST_CHECK(partial.FillBlock(blockRebuilt, vector<CTransaction>(2, block.vtx[3])) == READ_STATUS_INVALID);
+    BOOST_CHECK(partial.FillBlock(blockRebuilt, vector<CTransaction>(1, txOther)) == READ_STATUS_FAILED);
+
+    BOOST_CHECK(partial.FillBlock(blockRebuilt, vector<CTransaction>(1, block.vtx[3])) == READ_STATUS_OK);
+    BOOST_CHECK(blockRebuilt.GetHash() == block.GetHash());
+    BOOST_CHECK(blockRebuilt.vtx.size() == block.vtx.size());
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
+        BOOST_CHECK(blockRebuilt.vtx[i].GetHash() == block.vtx[i].GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(compactblock_invalid)
+{
+    CBlock block = MakeBlock(3);
+    CTxMemPool pool;
+    CBlockHeaderAndShortTxIDs cmpctblock(block);
+    CPartialBlock partial;
+
+    // Prefilled indexes have to increase and stay inside the block
+    CBlockHeaderAndShortTxIDs cmpctblockBad = cmpctblock;
+    cmpctblockBad.prefilledtxn[0].index = 3;
+    BOOST_CHECK(partial.InitData(cmpctblockBad, pool) == READ_STATUS_INVALID);
+    cmpctblockBad = cmpctblock;
+    cmpctblockBad.prefilledtxn.push_back(cmpctblock.prefilledtxn[0]);
+    BOOST_CHECK(partial.InitData(cmpctblockBad, pool) == READ_STATUS_INVALID);
+
+    // Two transactions with the same short id can't be told apart
+    cmpctblockBad = cmpctblock;
+    cmpctblockBad.shorttxids[1] = cmpctblockBad.shorttxids[0];
+    BOOST_CHECK(partial.InitData(cmpctblockBad, pool) == READ_STATUS_FAILED);
+
+    // Nothing from the pool: everything but the coinbase is asked for
+    BOOST_CHECK(partial.InitData(cmpctblock, pool) == READ_STATUS_OK);
+    BOOST_CHECK(partial.GetMissing().size() == 2);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,70 @@
+#include <boost/test/unit_test.hpp>
+
+#include "blockindexmap.h"
+#include "main.h"
+#include "util.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(blockindexmap_tests)
+
+BOOST_AUTO_TEST_CASE(blockindexmap_basics)
+{
+    CBlockIndexMap mapIndex;
+    map<uint256, CBlockIndex*> mapExpected;
+    vector<const uint256*> vKeys;
+    BOOST_CHECK(mapIndex.empty() && mapIndex.begin() == mapIndex.end());
+    BOOST_CHECK(mapIndex.find(1) == mapIndex.end());
+
+    for (int i = 0; i < 5000; i++)
+    {
+        uint256 hash = GetRandHash();
+        CBlockIndex* pindex = new (mapIndex.AllocateIndex()) CBlockIndex();
+        pair<CBlockIndexMap::iterator, bool> ret = mapIndex.insert(make_pair(hash, pindex));
+        BOOST_CHECK(ret.second && ret.first->first == hash && ret.first->second == pindex);
+        pindex->phashBlock = &ret.first->first;
+        vKeys.push_back(pindex->phashBlock);
+        mapExpected[hash] = pindex;
+
+        // Inserting again leaves the first entry
+        ret = mapIndex.insert(make_pair(hash, (CBlockIndex*)NULL));
+        BOOST_CHECK(!ret.second && ret.first->second == pindex);
+    }
+    BOOST_CHECK(mapIndex.size() == mapExpected.size());
+
+    // Keys stay where they were through rehashing
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapExpected)
+    {
+        CBlockIndexMap::const_iterator it = mapIndex.find(item.first);
+        BOOST_CHECK(it != mapIndex.end() && it->second == item.second);
+        BOOST_CHECK(item.second->phashBlock == &it->first);
+        BOOST_CHECK(mapIndex.count(item.first) == 1);
+        BOOST_CHECK(mapIndex[item.first] == item.second);
+    }
+    for (unsigned int i = 0; i < vKeys.size(); i++)
+        BOOST_CHECK(mapExpected.count(*vKeys[i]));
+
+    // Iteration visits every entry once
+    size_t nVisited = 0;
+    for (CBlockIndexMap::iterator it = mapIndex.begin(); it != mapIndex.end(); ++it)
+    {
+        BOOST_CHECK(mapExpected[it->first] == it->second);
+        nVisited++;
+    }
+    BOOST_CHECK(nVisited == mapExpected.size());
+
+    // operator[] adds a null entry for an unknown hash
+    uint256 hashMissing = GetRandHash();
+    BOOST_CHECK(mapIndex.count(hashMissing) == 0);
+    BOOST_CHECK(mapIndex[hashMissing] == NULL);
+    BOOST_CHECK(mapIndex.count(hashMissing) == 1);
+
+    BOOST_CHECK(mapIndex.DynamicUsage() > mapIndex.size() * sizeof(CBlockIndex));
+
+    // Entries and index objects are both freed
+    mapIndex.clear();
+    BOOST_CHECK(mapIndex.empty() && mapIndex.find(hashMissing) == mapIndex.end());
+    BOOST_CHECK(mapIndex.DynamicUsage() == 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,65 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+#include "checkqueue.h"
+
+#include <atomic>
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(checkqueue_tests)
+
+static atomic<int> nChecksRun(0);
+
+struct CTestCheck
+{
+    bool fOk;
+
+    CTestCheck(bool fOkIn = true) : fOk(fOkIn) {}
+
+    bool operator()() const
+    {
+        nChecksRun++;
+        return fOk;
+    }
+
+    void swap(CTestCheck& check) { std::swap(fOk, check.fOk); }
+};
+
+BOOST_AUTO_TEST_CASE(checkqueue_results)
+{
+    CCheckQueue<CTestCheck> queue(16);
+    boost::thread_group workers;
+    for (int i = 0; i < 3; i++)
+        workers.create_thread(boost::bind(&CCheckQueue<CTestCheck>::Thread, &queue));
+
+    for (int nRound = 0; nRound < 50; nRound++)
+    {
+        // Any single failing check fails the whole batch; the queue resets
+        // after every Wait()
+        bool fFail = nRound % 3 == 1;
+        nChecksRun = 0;
+        {
+            CCheckQueueControl<CTestCheck> control(&queue);
+            for (int nTx = 0; nTx < 20; nTx++)
+            {
+                vector<CTestCheck> vChecks(nRound + 1);
+                if (fFail && nTx == 7)
+                    vChecks.back() = CTestCheck(false);
+                control.Add(vChecks);
+            }
+            BOOST_CHECK_EQUAL(control.Wait(), !fFail);
+        }
+        if (!fFail)
+            BOOST_CHECK_EQUAL(nChecksRun, 20 * (nRound + 1));
+    }
+
+    // Without a queue the control is a no-op
+    CCheckQueueControl<CTestCheck> control(NULL);
+    BOOST_CHECK(control.Wait());
+
+    workers.interrupt_all();
+    workers.join_all();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
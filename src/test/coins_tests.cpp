@@ -0,0 +1,103 @@
+#include <boost/test/unit_test.hpp>
+
+#include "coins.h"
+#include "main.h"
+#include "util.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(coins_tests)
+
+static CTransaction RandomTransaction(bool fCoinBase, bool fCoinStake)
+{
+    CTransaction tx;
+    tx.nTime = insecure_rand();
+    tx.vin.resize(1);
+    if (!fCoinBase)
+        tx.vin[0].prevout = COutPoint(GetRandHash(), insecure_rand() % 4);
+    if (fCoinStake)
+        tx.vout.push_back(CTxOut(0, CScript()));
+    int nOutputs = 2 + insecure_rand() % 20;
+    for (int i = 0; i < nOutputs; i++)
+    {
+        CTxOut txout;
+        txout.nValue = (insecure_rand() % 2) ? insecure_rand() * COIN : insecure_rand();
+        switch (insecure_rand() % 3)
+        {
+        case 0:
+            txout.scriptPubKey << OP_DUP << OP_HASH160 << vector<unsigned char>(20, insecure_rand()) << OP_EQUALVERIFY << OP_CHECKSIG;
+            break;
+        case 1:
+            txout.scriptPubKey << OP_RETURN << vector<unsigned char>(insecure_rand() % 60, 0x42);
+            break;
+        default:
+            break;
+        }
+        tx.vout.push_back(txout);
+    }
+    return tx;
+}
+
+BOOST_AUTO_TEST_CASE(coins_serialization)
+{
+    seed_insecure_rand(false);
+    for (int i = 0; i < 200; i++)
+    {
+        CTransaction tx = RandomTransaction(i % 3 == 0, i % 3 == 1);
+        CCoins coins(tx);
+        vector<CDiskTxPos> vSpent(tx.vout.size());
+        for (unsigned int j = 0; j < vSpent.size(); j++)
+            if (insecure_rand() % 2)
+                vSpent[j] = CDiskTxPos(1, 2, 3);
+        coins.Spend(vSpent);
+
+        CDataStream ss(SER_DISK, CLIENT_VERSION);
+        ss << coins;
+        BOOST_CHECK(ss.size() == ::GetSerializeSize(coins, SER_DISK, CLIENT_VERSION));
+        CCoins coins2;
+        ss >> coins2;
+        BOOST_CHECK(ss.empty());
+        BOOST_CHECK(coins2.fCoinBase == coins.fCoinBase);
+        BOOST_CHECK(coins2.fCoinStake == coins.fCoinStake);
+        BOOST_CHECK(coins2.nTime == tx.nTime);
+        BOOST_CHECK(coins2.vout.size() == tx.vout.size());
+        for (unsigned int j = 0; j < tx.vout.size(); j++)
+        {
+            BOOST_CHECK(coins2.IsAvailable(j) == vSpent[j].IsNull());
+            if (vSpent[j].IsNull())
+                BOOST_CHECK(coins2.vout[j] == tx.vout[j]);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(coins_transaction)
+{
+    seed_insecure_rand(false);
+    for (int i = 0; i < 30; i++)
+    {
+        CTransaction tx = RandomTransaction(i % 3 == 0, i % 3 == 1);
+        uint256 hash = tx.GetHash();
+        CCoins coins(tx);
+        vector<CDiskTxPos> vSpent(tx.vout.size());
+        vSpent[tx.vout.size() - 1] = CDiskTxPos(1, 2, 3);
+        coins.Spend(vSpent);
+        BOOST_CHECK(!coins.IsPruned());
+
+        CTransaction txPrev;
+        coins.GetTransaction(hash, txPrev);
+        BOOST_CHECK(txPrev.GetHash() == hash);
+        BOOST_CHECK(txPrev.IsCoinBase() == tx.IsCoinBase());
+        BOOST_CHECK(txPrev.IsCoinStake() == tx.IsCoinStake());
+        BOOST_CHECK(txPrev.nTime == tx.nTime);
+        BOOST_CHECK(txPrev.vout.size() == tx.vout.size());
+        BOOST_CHECK(txPrev.vout[0] == tx.vout[0]);
+        BOOST_CHECK(txPrev.vout.back().IsNull());
+
+        for (unsigned int j = 0; j < vSpent.size(); j++)
+            vSpent[j] = CDiskTxPos(1, 2, 3);
+        coins.Spend(vSpent);
+        BOOST_CHECK(coins.IsPruned());
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,146 @@
+#include <boost/foreach.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include "hashblock.h"
+#include "util.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(hashblock_tests)
+
+// Header of the main network genesis block
+static void GenesisHeader(vector<unsigned char>& vch)
+{
+    int nVersion = 1;
+    uint256 hashPrevBlock = 0;
+    uint256 hashMerkleRoot("0x84346f5d939fa8c9d3548f3c3f31ef29f1b7972a43878453d3a5a4c176836459");
+    unsigned int nTime = 1517516135, nBits = 0x1e0fffff, nNonce = 5070141;
+
+    vch.clear();
+    vch.insert(vch.end(), BEGIN(nVersion), END(nVersion));
+    vch.insert(vch.end(), hashPrevBlock.begin(), hashPrevBlock.end());
+    vch.insert(vch.end(), hashMerkleRoot.begin(), hashMerkleRoot.end());
+    vch.insert(vch.end(), BEGIN(nTime), END(nTime));
+    vch.insert(vch.end(), BEGIN(nBits), END(nBits));
+    vch.insert(vch.end(), BEGIN(nNonce), END(nNonce));
+}
+
+BOOST_AUTO_TEST_CASE(hmq1725_genesis)
+{
+    vector<unsigned char> vch;
+    GenesisHeader(vch);
+    BOOST_CHECK_EQUAL(vch.size(), 80U);
+    BOOST_CHECK(HMQ1725(vch.begin(), vch.end()) ==
+                uint256("0x2ce9a9e271caa8fc164d29ea497f60f0a0f6a05998db2430bc5003da148b6699"));
+}
+
+BOOST_AUTO_TEST_CASE(hmq1725_incremental)
+{
+    vector<unsigned char> vch;
+    GenesisHeader(vch);
+    uint256 hashExpected = HMQ1725(vch.begin(), vch.end());
+
+    // Any split of the message gives the same hash, and Reset() starts over
+    CHMQ1725 hasher;
+    for (unsigned int nSplit = 0; nSplit <= vch.size(); nSplit += 7)
+    {
+        uint256 hash;
+        hasher.Reset().Write(&vch[0], nSplit).Write(&vch[nSplit], vch.size() - nSplit).Finalize(hash.begin());
+        BOOST_CHECK(hash == hashExpected);
+    }
+
+    uint256 hash;
+    CHMQ1725().Finalize(hash.begin());
+    BOOST_CHECK(hash == HMQ1725(vch.begin(), vch.begin()));
+}
+
+BOOST_AUTO_TEST_CASE(hmq1725_batch_matches_scalar)
+{
+    // Enough inputs to exercise both branches of every stage, full lane
+    // groups and the scalar remainder, plus an empty and a short message
+    vector<vector<unsigned char> > vData(67);
+    GenesisHeader(vData[0]);
+    vData[2].resize(3, 'a');
+    seed_insecure_rand(true);
+    for (unsigned int i = 3; i < vData.size(); i++)
+    {
+        vData[i].resize(80);
+        for (unsigned int j = 0; j < vData[i].size(); j++)
+            vData[i][j] = insecure_rand();
+    }
+
+    vector<HMQ1725Input> vInputs;
+    BOOST_FOREACH(const vector<unsigned char>& vch, vData)
+        vInputs.push_back(HMQ1725Input(vch.empty() ? NULL : &vch[0], vch.size()));
+
+    vector<uint256> vHash;
+    HMQ1725Batch(vInputs, vHash);
+    BOOST_CHECK_EQUAL(vHash.size(), vData.size());
+    for (unsigned int i = 0; i < vData.size(); i++)
+        BOOST_CHECK(vHash[i] == HMQ1725(vData[i].begin(), vData[i].end()));
+
+    vInputs.clear();
+    HMQ1725Batch(vInputs, vHash);
+    BOOST_CHECK(vHash.empty());
+}
+
+BOOST_AUTO_TEST_CASE(hmq1725_lane_kernels_match_sph)
+{
+    BOOST_CHECK(HMQ1725BatchSelfTest());
+
+    // Two full groups of the widest kernel plus a remainder, for every
+    // primitive, against the one-input-at-a-time sph path
+    const unsigned int nCount = 19;
+    vector<unsigned char> vIn(64 * nCount), vOut(64 * nCount);
+    seed_insecure_rand(true);
+    for (unsigned int i = 0; i < vIn.size(); i++)
+        vIn[i] = insecure_rand();
+
+    for (int n = 0; n < HMQ1725PrimitiveCount(); n++)
+    {
+        BOOST_CHECK(HMQ1725PrimitiveLanes(n) >= 1);
+        HMQ1725PrimitiveBatch(n, &vIn[0], &vOut[0], nCount);
+        for (unsigned int i = 0; i < nCount; i++)
+        {
+            unsigned char vchRef[64];
+            HMQ1725Primitive(n, &vIn[64 * i], vchRef);
+            BOOST_CHECK_MESSAGE(memcmp(&vOut[64 * i], vchRef, 64) == 0, HMQ1725PrimitiveName(n));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(hmq1725_aes_stages_match_sph)
+{
+    BOOST_CHECK(HMQ1725AESSelfTest());
+
+    unsigned char vch[64], vchOut[64], vchRef[64];
+    seed_insecure_rand(true);
+    for (int n = 0; n < 100; n++)
+    {
+        for (int i = 0; i < 64; i++)
+            vch[i] = insecure_rand();
+
+        sph_groestl512_context ctx_groestl;
+        sph_groestl512_init(&ctx_groestl);
+        sph_groestl512(&ctx_groestl, vch, 64);
+        sph_groestl512_close(&ctx_groestl, vchRef);
+        HMQ1725Groestl512(vch, vchOut);
+        BOOST_CHECK(memcmp(vchOut, vchRef, 64) == 0);
+
+        sph_echo512_context ctx_echo;
+        sph_echo512_init(&ctx_echo);
+        sph_echo512(&ctx_echo, vch, 64);
+        sph_echo512_close(&ctx_echo, vchRef);
+        HMQ1725Echo512(vch, vchOut);
+        BOOST_CHECK(memcmp(vchOut, vchRef, 64) == 0);
+
+        sph_shavite512_context ctx_shavite;
+        sph_shavite512_init(&ctx_shavite);
+        sph_shavite512(&ctx_shavite, vch, 64);
+        sph_shavite512_close(&ctx_shavite, vchRef);
+        HMQ1725Shavite512(vch, vchOut);
+        BOOST_CHECK(memcmp(vchOut, vchRef, 64) == 0);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,67 @@
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include "mappedfile.h"
+#include "util.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(mappedfile_tests)
+
+static void AppendFile(const boost::filesystem::path& path, const string& str)
+{
+    boost::filesystem::ofstream file(path, ios::app | ios::binary);
+    file << str;
+}
+
+BOOST_AUTO_TEST_CASE(mappedfile_cache)
+{
+    boost::filesystem::path dir = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    boost::filesystem::create_directories(dir);
+    boost::filesystem::path pathA = dir / "a", pathB = dir / "b";
+    AppendFile(pathA, "abcdef");
+    AppendFile(pathB, "xyz");
+
+#ifndef WIN32
+    CMappedFileCache cache(1);
+    boost::shared_ptr<const CMappedFile> pmapA = cache.Get(1, pathA, 6);
+    BOOST_CHECK(pmapA && pmapA->size() == 6 && memcmp(pmapA->data(), "abcdef", 6) == 0);
+    BOOST_CHECK(cache.Get(1, pathA, 1) == pmapA);
+
+    // Too short until the file is appended to
+    BOOST_CHECK(!cache.Get(1, pathA, 8));
+    AppendFile(pathA, "gh");
+    boost::shared_ptr<const CMappedFile> pmapA2 = cache.Get(1, pathA, 8);
+    BOOST_CHECK(pmapA2 && pmapA2 != pmapA && memcmp(pmapA2->data(), "abcdefgh", 8) == 0);
+
+    // Only one mapping is kept, but the dropped one stays readable
+    boost::shared_ptr<const CMappedFile> pmapB = cache.Get(2, pathB, 3);
+    BOOST_CHECK(pmapB && memcmp(pmapB->data(), "xyz", 3) == 0);
+    BOOST_CHECK(cache.Get(1, pathA, 1) != pmapA2);
+    BOOST_CHECK(memcmp(pmapA2->data(), "abcdefgh", 8) == 0);
+
+    BOOST_CHECK(!cache.Get(3, dir / "missing", 0));
+    cache.Clear();
+#endif
+
+    boost::filesystem::remove_all(dir);
+}
+
+BOOST_AUTO_TEST_CASE(spanreader)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << 12345 << string("block") << (unsigned char)7;
+    vector<char> vch(ss.begin(), ss.end());
+
+    CSpanReader reader(&vch[0], &vch[0] + vch.size(), SER_DISK, CLIENT_VERSION);
+    int n;
+    string str;
+    unsigned char ch;
+    reader >> n >> str >> ch;
+    BOOST_CHECK(n == 12345 && str == "block" && ch == 7);
+    BOOST_CHECK(reader.empty());
+    BOOST_CHECK_THROW(reader >> ch, std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
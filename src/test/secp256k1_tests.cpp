@@ -0,0 +1,159 @@
+#include <boost/foreach.hpp>
+#include <boost/test/unit_test.hpp>
+
+#include <openssl/ecdsa.h>
+#include <openssl/obj_mac.h>
+
+#include "key.h"
+#include "secp256k1.h"
+#include "util.h"
+
+using namespace std;
+
+// The in-tree verifier must accept exactly what OpenSSL's ECDSA_verify does
+
+BOOST_AUTO_TEST_SUITE(secp256k1_tests)
+
+static bool OpenSSLVerify(const uint256& hash, const vector<unsigned char>& vchSig, const CPubKey& pubkey)
+{
+    EC_KEY* pkey = EC_KEY_new_by_curve_name(NID_secp256k1);
+    const unsigned char* pbegin = pubkey.begin();
+    bool fOk = o2i_ECPublicKey(&pkey, &pbegin, pubkey.size()) &&
+               ECDSA_verify(0, (unsigned char*)&hash, sizeof(hash), &vchSig[0], vchSig.size(), pkey) == 1;
+    EC_KEY_free(pkey);
+    return fOk;
+}
+
+static uint256 RandHash()
+{
+    uint256 hash;
+    for (unsigned char* p = hash.begin(); p != hash.end(); p++)
+        *p = insecure_rand();
+    return hash;
+}
+
+// Same signature with s replaced by n - s
+static vector<unsigned char> HighS(const vector<unsigned char>& vchSig)
+{
+    const unsigned char* pbegin = &vchSig[0];
+    ECDSA_SIG* sig = d2i_ECDSA_SIG(NULL, &pbegin, vchSig.size());
+    EC_GROUP* group = EC_GROUP_new_by_curve_name(NID_secp256k1);
+    BIGNUM* order = BN_new();
+    EC_GROUP_get_order(group, order, NULL);
+    BN_sub(sig->s, order, sig->s);
+    vector<unsigned char> vchRet(i2d_ECDSA_SIG(sig, NULL));
+    unsigned char* pos = &vchRet[0];
+    i2d_ECDSA_SIG(sig, &pos);
+    BN_free(order);
+    EC_GROUP_free(group);
+    ECDSA_SIG_free(sig);
+    return vchRet;
+}
+
+BOOST_AUTO_TEST_CASE(secp256k1_selftest)
+{
+    BOOST_CHECK(Secp256k1SelfTest());
+}
+
+BOOST_AUTO_TEST_CASE(secp256k1_matches_openssl)
+{
+    seed_insecure_rand(true);
+    for (int i = 0; i < 200; i++)
+    {
+        CKey key;
+        key.MakeNewKey(i % 2 == 0);
+        CPubKey pubkey = key.GetPubKey();
+        uint256 hash = RandHash();
+        vector<unsigned char> vchSig;
+        BOOST_CHECK(key.Sign(hash, vchSig));
+
+        // All public key encodings
+        vector<CPubKey> vPubKeys;
+        vPubKeys.push_back(pubkey);
+        CPubKey pubkeyFull = pubkey;
+        BOOST_CHECK(pubkeyFull.Decompress());
+        vPubKeys.push_back(pubkeyFull);
+        vector<unsigned char> vchHybrid(pubkeyFull.begin(), pubkeyFull.end());
+        vchHybrid[0] = 0x06 | (vchHybrid[64] & 1);
+        vPubKeys.push_back(CPubKey(vchHybrid));
+        vchHybrid[0] ^= 1;
+        vPubKeys.push_back(CPubKey(vchHybrid));
+
+        // Good, high S, wrong hash and corrupted signatures
+        vector<unsigned char> vchSigBad = vchSig;
+        vchSigBad[4 + insecure_rand() % vchSig[3]] ^= 1 << (insecure_rand() % 8);
+        uint256 hashBad = hash;
+        *(hashBad.begin() + insecure_rand() % 32) ^= 1 << (insecure_rand() % 8);
+
+        BOOST_FOREACH(const CPubKey& pk, vPubKeys)
+        {
+            BOOST_CHECK_EQUAL(pk.IsFullyValid(), Secp256k1PubKeyIsValid(pk.begin(), pk.size()));
+            BOOST_CHECK_EQUAL(pk.Verify(hash, vchSig), OpenSSLVerify(hash, vchSig, pk));
+            BOOST_CHECK_EQUAL(pk.Verify(hash, HighS(vchSig)), OpenSSLVerify(hash, HighS(vchSig), pk));
+            BOOST_CHECK_EQUAL(pk.Verify(hashBad, vchSig), OpenSSLVerify(hashBad, vchSig, pk));
+            BOOST_CHECK_EQUAL(pk.Verify(hash, vchSigBad), OpenSSLVerify(hash, vchSigBad, pk));
+        }
+        BOOST_CHECK(pubkey.Verify(hash, vchSig));
+        BOOST_CHECK(pubkeyFull.Verify(hash, HighS(vchSig)));
+        BOOST_CHECK(!vPubKeys[3].IsFullyValid());
+        BOOST_CHECK(!pubkey.Verify(hashBad, vchSig));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(secp256k1_lax_der)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    uint256 hash = 1;
+    vector<unsigned char> vchSig;
+    BOOST_CHECK(key.Sign(hash, vchSig));
+
+    // Extra zero padding in R is tolerated, as older OpenSSL did
+    vector<unsigned char> vchPadded(vchSig.begin(), vchSig.begin() + 4);
+    vchPadded.push_back(0);
+    vchPadded.insert(vchPadded.end(), vchSig.begin() + 4, vchSig.end());
+    vchPadded[1]++;
+    vchPadded[3]++;
+    BOOST_CHECK(pubkey.Verify(hash, vchPadded));
+
+    // Truncated and empty signatures are not
+    vector<unsigned char> vchShort(vchSig.begin(), vchSig.end() - 1);
+    BOOST_CHECK(!pubkey.Verify(hash, vchShort));
+    BOOST_CHECK(!pubkey.Verify(hash, vector<unsigned char>()));
+}
+
+BOOST_AUTO_TEST_CASE(secp256k1_batch)
+{
+    seed_insecure_rand(true);
+    vector<uint256> vHash;
+    vector<vector<unsigned char> > vSig;
+    vector<CPubKey> vPubKey;
+    for (int i = 0; i < 50; i++)
+    {
+        CKey key;
+        key.MakeNewKey(i % 2 == 0);
+        vHash.push_back(RandHash());
+        vSig.push_back(vector<unsigned char>());
+        BOOST_CHECK(key.Sign(vHash.back(), vSig.back()));
+        vPubKey.push_back(key.GetPubKey());
+    }
+    vSig[10][vSig[10].size() - 1] ^= 1;
+    vSig[20].clear();
+
+    vector<CSecp256k1Check> vChecks;
+    for (unsigned int i = 0; i < vHash.size(); i++)
+        vChecks.push_back(CSecp256k1Check(vHash[i].begin(), vSig[i].empty() ? NULL : &vSig[i][0], vSig[i].size(),
+                                          vPubKey[i].begin(), vPubKey[i].size()));
+    vector<bool> vfValid;
+    BOOST_CHECK(!Secp256k1VerifyBatch(vChecks, vfValid));
+    BOOST_CHECK_EQUAL(vfValid.size(), vChecks.size());
+    for (unsigned int i = 0; i < vHash.size(); i++)
+        BOOST_CHECK_EQUAL(vfValid[i], i != 10 && i != 20);
+
+    vChecks.erase(vChecks.begin() + 20);
+    vChecks.erase(vChecks.begin() + 10);
+    BOOST_CHECK(Secp256k1VerifyBatch(vChecks, vfValid));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
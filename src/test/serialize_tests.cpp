@@ -42,4 +42,22 @@ BOOST_AUTO_TEST_CASE(varints)
 
 }
 
+BOOST_AUTO_TEST_CASE(datastream_swap)
+{
+    CDataStream a(SER_NETWORK, 1);
+    CDataStream b(SER_DISK, 2);
+    a << 1 << 2;
+    int n;
+    a >> n;
+    b << 3;
+
+    a.swap(b);
+    BOOST_CHECK(a.nType == SER_DISK && a.nVersion == 2 && a.size() == 4);
+    BOOST_CHECK(b.nType == SER_NETWORK && b.nVersion == 1 && b.size() == 4);
+    a >> n;
+    BOOST_CHECK(n == 3 && a.empty());
+    b >> n;
+    BOOST_CHECK(n == 2 && b.empty());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
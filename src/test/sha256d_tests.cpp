@@ -0,0 +1,98 @@
+#include <boost/test/unit_test.hpp>
+
+#include "hash.h"
+#include "main.h"
+#include "sha256d.h"
+#include "util.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(sha256d_tests)
+
+BOOST_AUTO_TEST_CASE(sha256d64_matches_hash)
+{
+    BOOST_CHECK(SHA256D64SelfTest());
+    seed_insecure_rand(false);
+    for (int nBlocks = 0; nBlocks < 40; nBlocks++)
+    {
+        vector<unsigned char> vchIn(64 * nBlocks + 1);
+        for (unsigned int i = 0; i < vchIn.size(); i++)
+            vchIn[i] = insecure_rand();
+        vector<unsigned char> vchOut(32 * nBlocks + 1);
+        SHA256D64(&vchOut[0], &vchIn[0], nBlocks);
+        for (int i = 0; i < nBlocks; i++)
+        {
+            uint256 hash = Hash(vchIn.begin() + 64 * i, vchIn.begin() + 64 * (i + 1));
+            BOOST_CHECK(memcmp(&vchOut[32 * i], hash.begin(), 32) == 0);
+        }
+
+        // In place
+        SHA256D64(&vchIn[0], &vchIn[0], nBlocks);
+        BOOST_CHECK(memcmp(&vchIn[0], &vchOut[0], 32 * nBlocks) == 0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(merkle_tree_levels)
+{
+    seed_insecure_rand(false);
+    for (int nTx = 1; nTx < 40; nTx++)
+    {
+        CBlock block;
+        for (int i = 0; i < nTx; i++)
+        {
+            CTransaction tx;
+            tx.vin.resize(1);
+            tx.vin[0].prevout.n = insecure_rand();
+            tx.vout.resize(1);
+            tx.vout[0].nValue = insecure_rand();
+            block.vtx.push_back(tx);
+        }
+        uint256 hashRoot = block.BuildMerkleTree();
+
+        // Same tree built pair by pair
+        vector<uint256> vTree;
+        for (int i = 0; i < nTx; i++)
+            vTree.push_back(block.vtx[i].GetHash());
+        int j = 0;
+        for (int nSize = nTx; nSize > 1; nSize = (nSize + 1) / 2)
+        {
+            for (int i = 0; i < nSize; i += 2)
+            {
+                int i2 = std::min(i+1, nSize-1);
+                vTree.push_back(Hash(BEGIN(vTree[j+i]), END(vTree[j+i]), BEGIN(vTree[j+i2]), END(vTree[j+i2])));
+            }
+            j += nSize;
+        }
+        BOOST_CHECK(hashRoot == vTree.back());
+
+        for (int i = 0; i < nTx; i++)
+            BOOST_CHECK(CBlock::CheckMerkleBranch(block.vtx[i].GetHash(), block.GetMerkleBranch(i), i) == hashRoot);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(txid_cache)
+{
+    CTransaction tx;
+    tx.vin.resize(1);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 1;
+    uint256 hash = tx.GetHash();
+
+    // Not cached until asked for
+    tx.vout[0].nValue = 2;
+    BOOST_CHECK(tx.GetHash() != hash);
+    tx.CacheHash();
+    BOOST_CHECK(tx.GetHash() == SerializeHash(tx));
+
+    // Copies keep it, deserialization and SetNull drop it
+    CTransaction txCopy(tx);
+    BOOST_CHECK(txCopy.fHashCached && txCopy.GetHash() == tx.GetHash());
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << tx;
+    ss >> txCopy;
+    BOOST_CHECK(!txCopy.fHashCached);
+    tx.SetNull();
+    BOOST_CHECK(!tx.fHashCached);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,174 @@
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+#include "sigcache.h"
+#include "util.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(sigcache_tests)
+
+static uint256 RandHash()
+{
+    uint256 hash;
+    for (unsigned char* p = hash.begin(); p != hash.end(); p++)
+        *p = insecure_rand();
+    return hash;
+}
+
+// Only the encoding matters to the cache, so any 33 bytes starting with
+// 0x02 will do as a public key
+static CPubKey RandPubKey()
+{
+    vector<unsigned char> vch(33);
+    vch[0] = 0x02;
+    for (unsigned int i = 1; i < vch.size(); i++)
+        vch[i] = insecure_rand();
+    return CPubKey(vch);
+}
+
+static vector<unsigned char> RandSig()
+{
+    vector<unsigned char> vch(70 + insecure_rand() % 3);
+    for (unsigned int i = 0; i < vch.size(); i++)
+        vch[i] = insecure_rand();
+    return vch;
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_get_set)
+{
+    seed_insecure_rand(true);
+    CSignatureCache cache(1 << 20);
+    uint256 sighash = RandHash();
+    vector<unsigned char> vchSig = RandSig();
+    CPubKey pubkey = RandPubKey();
+
+    BOOST_CHECK(!cache.Get(sighash, vchSig, pubkey));
+    cache.Set(sighash, vchSig, pubkey);
+    BOOST_CHECK(cache.Get(sighash, vchSig, pubkey));
+
+    // Every part of the triple counts
+    vector<unsigned char> vchSigOther = vchSig;
+    vchSigOther.back() ^= 1;
+    BOOST_CHECK(!cache.Get(RandHash(), vchSig, pubkey));
+    BOOST_CHECK(!cache.Get(sighash, vchSigOther, pubkey));
+    BOOST_CHECK(!cache.Get(sighash, vchSig, RandPubKey()));
+
+    // Setting an entry twice stores it once
+    cache.Set(sighash, vchSig, pubkey);
+    CSignatureCacheStats stats;
+    cache.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nHits, 1U);
+    BOOST_CHECK_EQUAL(stats.nMisses, 4U);
+    BOOST_CHECK_EQUAL(stats.nInserts, 1U);
+    BOOST_CHECK_EQUAL(stats.nEntries, 1U);
+    BOOST_CHECK_EQUAL(stats.nBytes, 1U << 20);
+
+    // A zero-sized cache stores nothing
+    CSignatureCache cacheEmpty(0);
+    cacheEmpty.Set(sighash, vchSig, pubkey);
+    BOOST_CHECK(!cacheEmpty.Get(sighash, vchSig, pubkey));
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_bounded)
+{
+    seed_insecure_rand(true);
+    CSignatureCache cache(4096);
+    CSignatureCacheStats stats;
+    cache.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nCapacity, 128U);
+
+    // Overfill it: the table stays within its capacity, dropping exactly one
+    // entry per insert once full
+    vector<uint256> vHashes;
+    vector<unsigned char> vchSig = RandSig();
+    CPubKey pubkey = RandPubKey();
+    for (int i = 0; i < 1000; i++)
+    {
+        vHashes.push_back(RandHash());
+        cache.Set(vHashes.back(), vchSig, pubkey);
+    }
+    cache.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nInserts, 1000U);
+    BOOST_CHECK(stats.nEntries <= stats.nCapacity);
+    BOOST_CHECK(stats.nEntries > stats.nCapacity / 2);
+    BOOST_CHECK_EQUAL(stats.nEntries + stats.nEvictions, stats.nInserts);
+
+    unsigned int nFound = 0;
+    for (unsigned int i = 0; i < vHashes.size(); i++)
+        if (cache.Get(vHashes[i], vchSig, pubkey))
+            nFound++;
+    BOOST_CHECK_EQUAL(nFound, stats.nEntries);
+
+    // Victims are picked by digest, not age, but old entries have been
+    // exposed to more evictions, so recent entries are the ones that survive.
+    // This takes a table with more than two buckets per shard.
+    CSignatureCache cacheLarge(65536);
+    cacheLarge.GetStats(stats);
+    unsigned int nCapacity = stats.nCapacity;
+    vHashes.clear();
+    for (unsigned int i = 0; i < nCapacity * 4; i++)
+    {
+        vHashes.push_back(RandHash());
+        cacheLarge.Set(vHashes.back(), vchSig, pubkey);
+    }
+    unsigned int nFoundOld = 0, nFoundRecent = 0;
+    for (unsigned int i = 0; i < nCapacity / 8; i++)
+    {
+        if (cacheLarge.Get(vHashes[i], vchSig, pubkey))
+            nFoundOld++;
+        if (cacheLarge.Get(vHashes[vHashes.size() - 1 - i], vchSig, pubkey))
+            nFoundRecent++;
+    }
+    BOOST_CHECK(nFoundRecent > nCapacity / 8 * 3 / 4);
+    BOOST_CHECK(nFoundOld < nCapacity / 8 / 8);
+}
+
+static void SetAndCheck(CSignatureCache* pcache, const vector<uint256>* pvHashes, const CPubKey* ppubkey, bool* pfOk)
+{
+    vector<unsigned char> vchSig(71, 0x30);
+    for (unsigned int i = 0; i < pvHashes->size(); i++)
+    {
+        pcache->Set((*pvHashes)[i], vchSig, *ppubkey);
+        if (!pcache->Get((*pvHashes)[i], vchSig, *ppubkey))
+            *pfOk = false;
+    }
+    for (unsigned int i = 0; i < pvHashes->size(); i++)
+        if (!pcache->Get((*pvHashes)[i], vchSig, *ppubkey))
+            *pfOk = false;
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_concurrent)
+{
+    seed_insecure_rand(true);
+    CSignatureCache cache(1 << 20);
+
+    // Readers and writers on the same shards; with the table lightly
+    // loaded nothing is evicted, so every entry must be found again
+    const int nThreads = 4;
+    vector<vector<uint256> > vvHashes(nThreads);
+    vector<CPubKey> vPubKeys;
+    for (int t = 0; t < nThreads; t++)
+    {
+        for (int i = 0; i < 1000; i++)
+            vvHashes[t].push_back(RandHash());
+        vPubKeys.push_back(RandPubKey());
+    }
+    bool vfOk[nThreads];
+    boost::thread_group threads;
+    for (int t = 0; t < nThreads; t++)
+    {
+        vfOk[t] = true;
+        threads.create_thread(boost::bind(&SetAndCheck, &cache, &vvHashes[t], &vPubKeys[t], &vfOk[t]));
+    }
+    threads.join_all();
+
+    CSignatureCacheStats stats;
+    cache.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nEvictions, 0U);
+    for (int t = 0; t < nThreads; t++)
+        BOOST_CHECK(vfOk[t]);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,72 @@
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+#include "script.h"
+#include "util.h"
+
+using namespace std;
+
+// CSignatureHasher must produce exactly the hashes SignatureHash() does
+
+BOOST_AUTO_TEST_SUITE(sighash_tests)
+
+static CScript RandomScript()
+{
+    static const opcodetype oplist[] = {OP_FALSE, OP_1, OP_2, OP_3, OP_CHECKSIG, OP_IF, OP_VERIF, OP_RETURN, OP_CODESEPARATOR};
+    CScript script;
+    int nOps = insecure_rand() % 10;
+    for (int i = 0; i < nOps; i++)
+        script << oplist[insecure_rand() % (sizeof(oplist) / sizeof(oplist[0]))];
+    if (insecure_rand() % 2)
+        script << vector<unsigned char>(insecure_rand() % 80, insecure_rand());
+    return script;
+}
+
+static void RandomTransaction(CTransaction& tx, int nInputs)
+{
+    tx.nVersion = insecure_rand();
+    tx.nTime = insecure_rand();
+    tx.nLockTime = (insecure_rand() % 2) ? insecure_rand() : 0;
+    tx.vin.clear();
+    tx.vout.clear();
+    int nOutputs = insecure_rand() % 4;
+    for (int i = 0; i < nInputs; i++)
+    {
+        CTxIn txin;
+        txin.prevout.hash = GetRandHash();
+        txin.prevout.n = insecure_rand() % 4;
+        txin.scriptSig = RandomScript();
+        txin.nSequence = (insecure_rand() % 2) ? insecure_rand() : (unsigned int)-1;
+        tx.vin.push_back(txin);
+    }
+    for (int i = 0; i < nOutputs; i++)
+    {
+        CTxOut txout;
+        txout.nValue = insecure_rand();
+        txout.scriptPubKey = RandomScript();
+        tx.vout.push_back(txout);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sighash_precomputed_matches)
+{
+    seed_insecure_rand(false);
+    for (int i = 0; i < 2000; i++)
+    {
+        CTransaction tx;
+        RandomTransaction(tx, 1 + insecure_rand() % ((i % 100 == 0) ? 200 : 6));
+        CSignatureHasher hasher(tx);
+        for (int j = 0; j < 8; j++)
+        {
+            // Every hash type, including out of range inputs and outputs
+            int nHashType = insecure_rand();
+            if (j < 4)
+                nHashType = (j + 1) | ((insecure_rand() % 2) ? SIGHASH_ANYONECANPAY : 0);
+            unsigned int nIn = insecure_rand() % (tx.vin.size() + 1);
+            CScript scriptCode = RandomScript();
+            BOOST_CHECK(hasher.GetHash(scriptCode, nIn, nHashType) == SignatureHash(scriptCode, tx, nIn, nHashType));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -14,6 +14,7 @@
 #include <leveldb/filter_policy.h>
 #include <memenv/memenv.h>
 
+#include "hashblock.h"
 #include "kernel.h"
 #include "txdb.h"
 #include "util.h"
@@ -127,6 +128,12 @@ CTxDB::CTxDB(const char* pszMode)
 
 void CTxDB::Close()
 {
+    Flush();
+    {
+        LOCK(cs_coinsCache);
+        mapCoinsCache.clear();
+        nCoinsCacheUsage = 0;
+    }
     delete txdb;
     txdb = pdb = NULL;
     delete options.filter_policy;
@@ -137,19 +144,33 @@ void CTxDB::Close()
     activeBatch = NULL;
 }
 
+CTxDB::PendingBatch CTxDB::coalescedBatch;
+size_t CTxDB::nCoalescedBytes = 0;
+CCriticalSection CTxDB::cs_coalesced;
+
+// Rough heap cost of one entry of a PendingBatch
+static size_t PendingWriteSize(const string& key, const string& value)
+{
+    return key.size() + value.size() + 96;
+}
+
 bool CTxDB::TxnBegin()
 {
     assert(!activeBatch);
-    activeBatch = new leveldb::WriteBatch();
+    activeBatch = new PendingBatch();
     return true;
 }
 
-bool CTxDB::TxnCommit()
+bool CTxDB::WriteBatchToDisk(leveldb::DB *pdbIn, const PendingBatch& batchIn)
 {
-    assert(activeBatch);
-    leveldb::Status status = pdb->Write(leveldb::WriteOptions(), activeBatch);
-    delete activeBatch;
-    activeBatch = NULL;
+    leveldb::WriteBatch batch;
+    for (PendingBatch::const_iterator it = batchIn.begin(); it != batchIn.end(); ++it) {
+        if (it->second.fDeleted)
+            batch.Delete(it->first);
+        else
+            batch.Put(it->first, it->second.strValue);
+    }
+    leveldb::Status status = pdbIn->Write(leveldb::WriteOptions(), &batch);
     if (!status.ok()) {
         LogPrintf("LevelDB batch commit failure: %s\n", status.ToString());
         return false;
@@ -157,48 +178,121 @@ bool CTxDB::TxnCommit()
     return true;
 }
 
-class CBatchScanner : public leveldb::WriteBatch::Handler {
-public:
-    std::string needle;
-    bool *deleted;
-    std::string *foundValue;
-    bool foundEntry;
+// Initial block download and imports connect blocks far faster than a disk
+// can take a separate write for each of them, so during those their commits
+// are merged into coalescedBatch and written out together. Each commit that
+// moves the best chain also writes hashBestChain, and the merged batch goes
+// to disk atomically, so after a crash the database holds a consistent
+// state as of some earlier block and sync resumes from there.
+bool CTxDB::TxnCommit()
+{
+    assert(activeBatch);
+    bool fCoalesce = fImporting || fReindex || IsInitialBlockDownload();
+
+    LOCK(cs_coalesced);
+    if (!fCoalesce && coalescedBatch.empty()) {
+        bool fOk = WriteBatchToDisk(pdb, *activeBatch);
+        UncacheCoins(*activeBatch);
+        delete activeBatch;
+        activeBatch = NULL;
+        return fOk;
+    }
+
+    UncacheCoins(*activeBatch);
+    for (PendingBatch::iterator it = activeBatch->begin(); it != activeBatch->end(); ++it) {
+        pair<PendingBatch::iterator, bool> ret = coalescedBatch.insert(make_pair(it->first, CPendingWrite()));
+        CPendingWrite& pending = ret.first->second;
+        if (!ret.second)
+            nCoalescedBytes -= min(nCoalescedBytes, PendingWriteSize(it->first, pending.strValue));
+        pending.fDeleted = it->second.fDeleted;
+        pending.strValue.swap(it->second.strValue);
+        nCoalescedBytes += PendingWriteSize(it->first, pending.strValue);
+    }
+    delete activeBatch;
+    activeBatch = NULL;
+
+    static const size_t nMaxCoalescedBytes = (size_t)max((int64_t)1, GetArg("-dbcache", 25)) << 20;
+    if (fCoalesce && nCoalescedBytes < nMaxCoalescedBytes)
+        return true;
+    return FlushCoalesced();
+}
+
+bool CTxDB::FlushCoalesced()
+{
+    AssertLockHeld(cs_coalesced);
+    if (coalescedBatch.empty() || !txdb)
+        return true;
+    LogPrint("db", "CTxDB : writing %u coalesced updates (%u kB)\n", coalescedBatch.size(), nCoalescedBytes / 1024);
+    bool fOk = WriteBatchToDisk(txdb, coalescedBatch);
+    coalescedBatch.clear();
+    nCoalescedBytes = 0;
+    return fOk;
+}
 
-    CBatchScanner() : foundEntry(false) {}
+bool CTxDB::Flush()
+{
+    LOCK(cs_coalesced);
+    return FlushCoalesced();
+}
 
-    virtual void Put(const leveldb::Slice& key, const leveldb::Slice& value) {
-        if (key.ToString() == needle) {
-            foundEntry = true;
-            *deleted = false;
-            *foundValue = value.ToString();
+// Outside a transaction writes go straight to disk, unless commits are
+// being held back: then they join those, so that they are not overwritten
+// by an older value when the held back commits are written.
+bool CTxDB::WriteNow(const string &key, const string *value)
+{
+    {
+        LOCK(cs_coalesced);
+        if (!coalescedBatch.empty()) {
+            pair<PendingBatch::iterator, bool> ret = coalescedBatch.insert(make_pair(key, CPendingWrite()));
+            CPendingWrite& pending = ret.first->second;
+            if (!ret.second)
+                nCoalescedBytes -= min(nCoalescedBytes, PendingWriteSize(key, pending.strValue));
+            pending.fDeleted = (value == NULL);
+            pending.strValue = value ? *value : string();
+            nCoalescedBytes += PendingWriteSize(key, pending.strValue);
+            return true;
         }
     }
 
-    virtual void Delete(const leveldb::Slice& key) {
-        if (key.ToString() == needle) {
-            foundEntry = true;
-            *deleted = true;
+    if (value) {
+        leveldb::Status status = pdb->Put(leveldb::WriteOptions(), key, *value);
+        if (!status.ok()) {
+            LogPrintf("LevelDB write failure: %s\n", status.ToString());
+            return false;
         }
+        return true;
     }
-};
+    leveldb::Status status = pdb->Delete(leveldb::WriteOptions(), key);
+    return (status.ok() || status.IsNotFound());
+}
 
 // When performing a read, if we have an active batch we need to check it first
 // before reading from the database, as the rest of the code assumes that once
-// a database transaction begins reads are consistent with it. It would be good
-// to change that assumption in future and avoid the performance hit, though in
-// practice it does not appear to be large.
-bool CTxDB::ScanBatch(const CDataStream &key, string *value, bool *deleted) const {
-    assert(activeBatch);
+// a database transaction begins reads are consistent with it. The same goes
+// for commits that are held back. Both are indexed by key, so this is a
+// single lookup however many writes are pending.
+bool CTxDB::ScanBatch(const string &key, string *value, bool *deleted) const {
     *deleted = false;
-    CBatchScanner scanner;
-    scanner.needle = key.str();
-    scanner.deleted = deleted;
-    scanner.foundValue = value;
-    leveldb::Status status = activeBatch->Iterate(&scanner);
-    if (!status.ok()) {
-        throw runtime_error(status.ToString());
+    const CPendingWrite* pfound = NULL;
+    if (activeBatch) {
+        PendingBatch::const_iterator it = activeBatch->find(key);
+        if (it != activeBatch->end())
+            pfound = &it->second;
+    }
+
+    LOCK(cs_coalesced);
+    if (!pfound && !coalescedBatch.empty()) {
+        PendingBatch::const_iterator it = coalescedBatch.find(key);
+        if (it != coalescedBatch.end())
+            pfound = &it->second;
     }
-    return scanner.foundEntry;
+    if (!pfound)
+        return false;
+    if (pfound->fDeleted)
+        *deleted = true;
+    else
+        *value = pfound->strValue;
+    return true;
 }
 
 bool CTxDB::ReadTxIndex(uint256 hash, CTxIndex& txindex)
@@ -224,9 +318,109 @@ bool CTxDB::EraseTxIndex(const CTransaction& tx)
 {
     uint256 hash = tx.GetHash();
 
+    EraseCoins(hash);
     return Erase(make_pair(string("tx"), hash));
 }
 
+map<uint256, CCoins> CTxDB::mapCoinsCache;
+size_t CTxDB::nCoinsCacheUsage = 0;
+CCriticalSection CTxDB::cs_coinsCache;
+
+void CTxDB::UncacheCoins(const uint256& hash)
+{
+    LOCK(cs_coinsCache);
+    map<uint256, CCoins>::iterator it = mapCoinsCache.find(hash);
+    if (it != mapCoinsCache.end()) {
+        nCoinsCacheUsage -= min(nCoinsCacheUsage, it->second.DynamicUsage());
+        mapCoinsCache.erase(it);
+    }
+}
+
+void CTxDB::UncacheCoins(const PendingBatch& batch)
+{
+    // Keys of coins records are the serialized pair ("coins", txid)
+    static const char pchPrefix[] = "\x05" "coins";
+    static const size_t nPrefix = sizeof(pchPrefix) - 1;
+    {
+        LOCK(cs_coinsCache);
+        if (mapCoinsCache.empty())
+            return;
+    }
+    for (PendingBatch::const_iterator it = batch.begin(); it != batch.end(); ++it) {
+        const string& key = it->first;
+        if (key.size() != nPrefix + 32 || key.compare(0, nPrefix, pchPrefix, nPrefix) != 0)
+            continue;
+        uint256 hash;
+        memcpy(hash.begin(), key.data() + nPrefix, 32);
+        UncacheCoins(hash);
+    }
+}
+
+bool CTxDB::ReadCoins(uint256 hash, CCoins& coins)
+{
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << make_pair(string("coins"), hash);
+    string strKey = ssKey.str();
+    string strValue;
+
+    // Uncommitted changes first, then the cache, then disk
+    bool deleted = false;
+    bool fFromDisk = !ScanBatch(strKey, &strValue, &deleted);
+    if (deleted)
+        return false;
+    if (fFromDisk) {
+        {
+            LOCK(cs_coinsCache);
+            map<uint256, CCoins>::const_iterator it = mapCoinsCache.find(hash);
+            if (it != mapCoinsCache.end()) {
+                coins = it->second;
+                return true;
+            }
+        }
+        leveldb::Status status = pdb->Get(leveldb::ReadOptions(), strKey, &strValue);
+        if (!status.ok()) {
+            if (!status.IsNotFound())
+                LogPrintf("LevelDB read failure: %s\n", status.ToString());
+            return false;
+        }
+    }
+
+    try {
+        CDataStream ssValue(strValue.data(), strValue.data() + strValue.size(), SER_DISK, CLIENT_VERSION);
+        ssValue >> coins;
+    }
+    catch (std::exception &e) {
+        return false;
+    }
+    if (fFromDisk) {
+        static const size_t nMaxCoinsCacheUsage = (size_t)max((int64_t)1, GetArg("-dbcache", 25)) << 18;
+        LOCK(cs_coinsCache);
+        pair<map<uint256, CCoins>::iterator, bool> ret = mapCoinsCache.insert(make_pair(hash, coins));
+        if (ret.second)
+            nCoinsCacheUsage += coins.DynamicUsage();
+        while (nCoinsCacheUsage > nMaxCoinsCacheUsage && mapCoinsCache.size() > 1) {
+            map<uint256, CCoins>::iterator it = mapCoinsCache.begin();
+            if (it == ret.first)
+                ++it;
+            nCoinsCacheUsage -= min(nCoinsCacheUsage, it->second.DynamicUsage());
+            mapCoinsCache.erase(it);
+        }
+    }
+    return true;
+}
+
+bool CTxDB::WriteCoins(uint256 hash, const CCoins& coins)
+{
+    UncacheCoins(hash);
+    return Write(make_pair(string("coins"), hash), coins);
+}
+
+bool CTxDB::EraseCoins(uint256 hash)
+{
+    UncacheCoins(hash);
+    return Erase(make_pair(string("coins"), hash));
+}
+
 bool CTxDB::ContainsTx(uint256 hash)
 {
     return Exists(make_pair(string("tx"), hash));
@@ -282,26 +476,74 @@ bool CTxDB::WriteBestInvalidTrust(CBigNum bnBestInvalidTrust)
     return Write(string("bnBestInvalidTrust"), bnBestInvalidTrust);
 }
 
+static CBlockIndex *AllocBlockIndex()
+{
+    return new (mapBlockIndex.AllocateIndex()) CBlockIndex();
+}
+
 static CBlockIndex *InsertBlockIndex(uint256 hash)
 {
     if (hash == 0)
         return NULL;
 
     // Return existing
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+    CBlockIndexMap::iterator mi = mapBlockIndex.find(hash);
     if (mi != mapBlockIndex.end())
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
-    if (!pindexNew)
-        throw runtime_error("LoadBlockIndex() : new CBlockIndex failed");
+    CBlockIndex* pindexNew = AllocBlockIndex();
     mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
 
     return pindexNew;
 }
 
+// One blockindex record while the index is being loaded
+struct CBlockIndexRecord
+{
+    CBlockIndex* pindex;
+    uint256 hashBlock;
+    uint256 hashPrev;
+    uint256 hashNext;
+    bool fHashHeader; // hashBlock is computed from the header, not read
+};
+
+// Hash the headers of the records that need it and compute the trust of
+// every block, for records [nBegin, nEnd). The block trust is left in
+// nChainTrust; the chain trust is summed up afterwards, in height order.
+static void ProcessBlockIndexRecords(vector<CBlockIndexRecord>& vRecords, size_t nBegin, size_t nEnd)
+{
+    vector<CBlockIndexRecord*> vToHash;
+    vector<unsigned char> vchHeaders;
+    for (size_t i = nBegin; i < nEnd; i++) {
+        CBlockIndexRecord& rec = vRecords[i];
+        rec.pindex->nChainTrust = rec.pindex->GetBlockTrust();
+        if (!rec.fHashHeader)
+            continue;
+        CBlock block;
+        block.nVersion       = rec.pindex->nVersion;
+        block.hashPrevBlock  = rec.hashPrev;
+        block.hashMerkleRoot = rec.pindex->hashMerkleRoot;
+        block.nTime          = rec.pindex->nTime;
+        block.nBits          = rec.pindex->nBits;
+        block.nNonce         = rec.pindex->nNonce;
+        vchHeaders.insert(vchHeaders.end(), (unsigned char*)BEGIN(block.nVersion), (unsigned char*)END(block.nNonce));
+        vToHash.push_back(&rec);
+    }
+    if (vToHash.empty())
+        return;
+
+    vector<HMQ1725Input> vInputs;
+    vInputs.reserve(vToHash.size());
+    for (size_t i = 0; i < vToHash.size(); i++)
+        vInputs.push_back(HMQ1725Input(&vchHeaders[i * CBlock::HEADER_SIZE], CBlock::HEADER_SIZE));
+    vector<uint256> vHashes;
+    HMQ1725Batch(vInputs, vHashes);
+    for (size_t i = 0; i < vToHash.size(); i++)
+        vToHash[i]->hashBlock = vHashes[i];
+}
+
 bool CTxDB::LoadBlockIndex()
 {
     if (mapBlockIndex.size() > 0) {
@@ -309,6 +551,8 @@ bool CTxDB::LoadBlockIndex()
         // from BDB.
         return true;
     }
+    int64_t nStart = GetTimeMillis();
+
     // The block index is an in-memory structure that maps hashes to on-disk
     // locations where the contents of the block can be found. Here, we scan it
     // out of the DB and into mapBlockIndex.
@@ -317,29 +561,30 @@ bool CTxDB::LoadBlockIndex()
     CDataStream ssStartKey(SER_DISK, CLIENT_VERSION);
     ssStartKey << make_pair(string("blockindex"), uint256(0));
     iterator->Seek(ssStartKey.str());
-    // Now read each entry.
+    // Keys are the serialized pair ("blockindex", hash); the first part is
+    // compared in place rather than deserialized
+    const size_t nPrefixSize = ssStartKey.size() - sizeof(uint256);
+    const string strPrefix = ssStartKey.str().substr(0, nPrefixSize);
+
+    // Now read each entry. The stream and index object are reused, so this
+    // loop allocates nothing but the records themselves.
+    vector<CBlockIndexRecord> vRecords;
+    CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+    CDiskBlockIndex diskindex;
     while (iterator->Valid())
     {
         boost::this_thread::interruption_point();
-        // Unpack keys and values.
-        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
-        ssKey.write(iterator->key().data(), iterator->key().size());
-        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
-        ssValue.write(iterator->value().data(), iterator->value().size());
-        string strType;
-        ssKey >> strType;
         // Did we reach the end of the data to read?
-        if (strType != "blockindex")
+        leveldb::Slice key = iterator->key();
+        if (key.size() < nPrefixSize || memcmp(key.data(), strPrefix.data(), nPrefixSize) != 0)
             break;
-        CDiskBlockIndex diskindex;
+        leveldb::Slice value = iterator->value();
+        ssValue.clear();
+        ssValue.write(value.data(), value.size());
         ssValue >> diskindex;
 
-        uint256 blockHash = diskindex.GetBlockHash();
-
         // Construct block index object
-        CBlockIndex* pindexNew    = InsertBlockIndex(blockHash);
-        pindexNew->pprev          = InsertBlockIndex(diskindex.hashPrev);
-        pindexNew->pnext          = InsertBlockIndex(diskindex.hashNext);
+        CBlockIndex* pindexNew    = AllocBlockIndex();
         pindexNew->nFile          = diskindex.nFile;
         pindexNew->nBlockPos      = diskindex.nBlockPos;
         pindexNew->nHeight        = diskindex.nHeight;
@@ -357,22 +602,69 @@ bool CTxDB::LoadBlockIndex()
         pindexNew->nBits          = diskindex.nBits;
         pindexNew->nNonce         = diskindex.nNonce;
 
+        vRecords.push_back(CBlockIndexRecord());
+        CBlockIndexRecord& rec = vRecords.back();
+        rec.pindex = pindexNew;
+        rec.hashPrev = diskindex.hashPrev;
+        rec.hashNext = diskindex.hashNext;
+        rec.fHashHeader = !diskindex.GetStoredBlockHash(rec.hashBlock);
+
+        iterator->Next();
+    }
+    delete iterator;
+    int64_t nReadDone = GetTimeMillis();
+
+    boost::this_thread::interruption_point();
+
+    // Header hashes that weren't stored or can't be trusted yet, and the
+    // trust of each block, are independent per record: spread them over
+    // all cores
+    unsigned int nThreads = max(1u, min(boost::thread::hardware_concurrency(), (unsigned int)(vRecords.size() / 1024 + 1)));
+    {
+        boost::thread_group workers;
+        for (unsigned int i = 1; i < nThreads; i++)
+            workers.create_thread(boost::bind(&ProcessBlockIndexRecords, boost::ref(vRecords),
+                                              vRecords.size() * i / nThreads, vRecords.size() * (i + 1) / nThreads));
+        ProcessBlockIndexRecords(vRecords, 0, vRecords.size() / nThreads);
+        workers.join_all();
+    }
+    int64_t nHashDone = GetTimeMillis();
+
+    boost::this_thread::interruption_point();
+
+    // Index all records before linking them, so only blocks missing from
+    // the database get an empty placeholder entry
+    mapBlockIndex.reserve(vRecords.size());
+    size_t nHashed = 0;
+    BOOST_FOREACH(CBlockIndexRecord& rec, vRecords)
+    {
+        if (rec.fHashHeader)
+            nHashed++;
+        pair<CBlockIndexMap::iterator, bool> ret = mapBlockIndex.insert(make_pair(rec.hashBlock, rec.pindex));
+        if (!ret.second) {
+            // Two records for the same block: the later one wins
+            *ret.first->second = *rec.pindex;
+            rec.pindex = ret.first->second;
+        }
+        rec.pindex->phashBlock = &ret.first->first;
+    }
+    BOOST_FOREACH(const CBlockIndexRecord& rec, vRecords)
+    {
+        CBlockIndex* pindexNew = rec.pindex;
+        pindexNew->pprev = InsertBlockIndex(rec.hashPrev);
+        pindexNew->pnext = InsertBlockIndex(rec.hashNext);
+
         // Watch for genesis block
-        if (pindexGenesisBlock == NULL && blockHash == Params().HashGenesisBlock())
+        if (pindexGenesisBlock == NULL && rec.hashBlock == Params().HashGenesisBlock())
             pindexGenesisBlock = pindexNew;
 
-        if (!pindexNew->CheckIndex()) {
-            delete iterator;
+        if (!pindexNew->CheckIndex())
             return error("LoadBlockIndex() : CheckIndex failed at %d", pindexNew->nHeight);
-        }
 
         // NovaCoin: build setStakeSeen
         if (pindexNew->IsProofOfStake())
             setStakeSeen.insert(make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
-
-        iterator->Next();
     }
-    delete iterator;
 
     boost::this_thread::interruption_point();
 
@@ -388,9 +680,13 @@ bool CTxDB::LoadBlockIndex()
     BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
     {
         CBlockIndex* pindex = item.second;
-        pindex->nChainTrust = (pindex->pprev ? pindex->pprev->nChainTrust : 0) + pindex->GetBlockTrust();
+        pindex->nChainTrust += (pindex->pprev ? pindex->pprev->nChainTrust : 0);
     }
 
+    LogPrintf("LoadBlockIndex(): %u entries in %dms (read %dms, %u headers hashed on %u threads %dms, link %dms)\n",
+      vRecords.size(), GetTimeMillis() - nStart, nReadDone - nStart, nHashed, nThreads,
+      nHashDone - nReadDone, GetTimeMillis() - nHashDone);
+
     // Load hashBestChain pointer to end of best chain
     if (!ReadHashBestChain(hashBestChain))
     {
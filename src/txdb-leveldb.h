@@ -6,6 +6,7 @@
 #ifndef DIMINUTIVEVAULT_LEVELDB_H
 #define DIMINUTIVEVAULT_LEVELDB_H
 
+#include "coins.h"
 #include "main.h"
 
 #include <map>
@@ -40,21 +41,58 @@ public:
     // Destroys the underlying shared global state accessed by this TxDB.
     void Close();
 
+    // Writes out the commits held back during initial block download or an
+    // import (see TxnCommit()). Called on shutdown.
+    static bool Flush();
+
 private:
     leveldb::DB *pdb;  // Points to the global instance.
 
     // A batch stores up writes and deletes for atomic application. When this
     // field is non-NULL, writes/deletes go there instead of directly to disk.
-    leveldb::WriteBatch *activeBatch;
+    // It is kept as a map from serialized key to the last pending change, so
+    // reads during a transaction can look keys up directly; TxnCommit() turns
+    // it into a leveldb::WriteBatch.
+    struct CPendingWrite
+    {
+        bool fDeleted;
+        std::string strValue;
+    };
+    typedef std::map<std::string, CPendingWrite> PendingBatch;
+    PendingBatch *activeBatch;
+
+    // While blocks are being downloaded or imported in bulk, committed
+    // batches are merged here instead of being written one by one. This is
+    // shared by all instances and written out as a single leveldb batch
+    // once it holds -dbcache megabytes, when bulk sync ends, or on Flush().
+    static PendingBatch coalescedBatch;
+    static size_t nCoalescedBytes;
+    static CCriticalSection cs_coalesced;
+
+    static bool WriteBatchToDisk(leveldb::DB *pdbIn, const PendingBatch& batch);
+    static bool FlushCoalesced();
+    bool WriteNow(const std::string &key, const std::string *value);
+
+    // Decoded coins records recently read from disk, so that spending from
+    // the same transactions again does not go back to LevelDB. Entries are
+    // dropped when their record is written or erased and again when that is
+    // committed; the whole cache is bounded by a quarter of -dbcache.
+    static std::map<uint256, CCoins> mapCoinsCache;
+    static size_t nCoinsCacheUsage;
+    static CCriticalSection cs_coinsCache;
+
+    static void UncacheCoins(const uint256& hash);
+    static void UncacheCoins(const PendingBatch& batch);
+
     leveldb::Options options;
     bool fReadOnly;
     int nVersion;
 
 protected:
-    // Returns true and sets (value,false) if activeBatch contains the given key
-    // or leaves value alone and sets deleted = true if activeBatch contains a
-    // delete for it.
-    bool ScanBatch(const CDataStream &key, std::string *value, bool *deleted) const;
+    // Returns true and sets (value,false) if activeBatch or the coalesced
+    // batch contains the given key or leaves value alone and sets deleted =
+    // true if they contain a delete for it. activeBatch takes precedence.
+    bool ScanBatch(const std::string &key, std::string *value, bool *deleted) const;
 
     template<typename K, typename T>
     bool Read(const K& key, T& value)
@@ -62,21 +100,19 @@ protected:
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
+        std::string strKey = ssKey.str();
         std::string strValue;
 
-        bool readFromDb = true;
-        if (activeBatch) {
-            // First we must search for it in the currently pending set of
-            // changes to the db. If not found in the batch, go on to read disk.
-            bool deleted = false;
-            readFromDb = ScanBatch(ssKey, &strValue, &deleted) == false;
-            if (deleted) {
-                return false;
-            }
+        // First we must search for it in the currently pending set of
+        // changes to the db. If not found in the batch, go on to read disk.
+        bool deleted = false;
+        bool readFromDb = ScanBatch(strKey, &strValue, &deleted) == false;
+        if (deleted) {
+            return false;
         }
         if (readFromDb) {
             leveldb::Status status = pdb->Get(leveldb::ReadOptions(),
-                                              ssKey.str(), &strValue);
+                                              strKey, &strValue);
             if (!status.ok()) {
                 if (status.IsNotFound())
                     return false;
@@ -111,15 +147,13 @@ protected:
         ssValue << value;
 
         if (activeBatch) {
-            activeBatch->Put(ssKey.str(), ssValue.str());
+            CPendingWrite& pending = (*activeBatch)[ssKey.str()];
+            pending.fDeleted = false;
+            pending.strValue = ssValue.str();
             return true;
         }
-        leveldb::Status status = pdb->Put(leveldb::WriteOptions(), ssKey.str(), ssValue.str());
-        if (!status.ok()) {
-            LogPrintf("LevelDB write failure: %s\n", status.ToString());
-            return false;
-        }
-        return true;
+        std::string strValue = ssValue.str();
+        return WriteNow(ssKey.str(), &strValue);
     }
 
     template<typename K>
@@ -134,11 +168,12 @@ protected:
         ssKey.reserve(1000);
         ssKey << key;
         if (activeBatch) {
-            activeBatch->Delete(ssKey.str());
+            CPendingWrite& pending = (*activeBatch)[ssKey.str()];
+            pending.fDeleted = true;
+            pending.strValue.clear();
             return true;
         }
-        leveldb::Status status = pdb->Delete(leveldb::WriteOptions(), ssKey.str());
-        return (status.ok() || status.IsNotFound());
+        return WriteNow(ssKey.str(), NULL);
     }
 
     template<typename K>
@@ -147,17 +182,15 @@ protected:
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(1000);
         ssKey << key;
+        std::string strKey = ssKey.str();
         std::string unused;
 
-        if (activeBatch) {
-            bool deleted;
-            if (ScanBatch(ssKey, &unused, &deleted) && !deleted) {
-                return true;
-            }
+        bool deleted;
+        if (ScanBatch(strKey, &unused, &deleted)) {
+            return !deleted;
         }
 
-
-        leveldb::Status status = pdb->Get(leveldb::ReadOptions(), ssKey.str(), &unused);
+        leveldb::Status status = pdb->Get(leveldb::ReadOptions(), strKey, &unused);
         return status.IsNotFound() == false;
     }
 
@@ -187,6 +220,9 @@ public:
     bool UpdateTxIndex(uint256 hash, const CTxIndex& txindex);
     bool AddTxIndex(const CTransaction& tx, const CDiskTxPos& pos, int nHeight);
     bool EraseTxIndex(const CTransaction& tx);
+    bool ReadCoins(uint256 hash, CCoins& coins);
+    bool WriteCoins(uint256 hash, const CCoins& coins);
+    bool EraseCoins(uint256 hash);
     bool ContainsTx(uint256 hash);
     bool ReadDiskTx(uint256 hash, CTransaction& tx, CTxIndex& txindex);
     bool ReadDiskTx(uint256 hash, CTransaction& tx);
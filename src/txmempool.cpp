@@ -33,6 +33,7 @@ bool CTxMemPool::addUnchecked(const uint256& hash, CTransaction &tx)
     LOCK(cs);
     {
         mapTx[hash] = tx;
+        mapTx[hash].SetCachedHash(hash);
         for (unsigned int i = 0; i < tx.vin.size(); i++)
             mapNextTx[tx.vin[i].prevout] = CInPoint(&mapTx[hash], i);
         nTransactionsUpdated++;
@@ -30,7 +30,7 @@ static const int DATABASE_VERSION = 70001;
 // network protocol versioning
 //
 
-static const int PROTOCOL_VERSION = 60007;
+static const int PROTOCOL_VERSION = 60008;
 
 // intial proto version, to be increased after version/verack negotiation
 static const int INIT_PROTO_VERSION = 100;
@@ -56,4 +56,10 @@ static const int MEMPOOL_GD_VERSION = 60000;
 static const int CANONICAL_BLOCK_SIG_VERSION = 60000;
 static const int CANONICAL_BLOCK_SIG_LOW_S_VERSION = 60000;
 
+// "cmpctblock", "getblocktxn" and "blocktxn" messages starting with this version
+static const int COMPACT_BLOCKS_VERSION = 60008;
+
+// getdata for an unknown block is answered with "notfound" starting with this version
+static const int BLOCK_NOTFOUND_VERSION = 60008;
+
 #endif
@@ -22,6 +22,7 @@ using namespace std;
 int64_t nTransactionFee = MIN_TX_FEE;
 int64_t nReserveBalance = 0;
 int64_t nMinimumInputValue = 0;
+int nStakeThreads = 1;
 
 static int64_t GetStakeCombineThreshold() { return 5000 * COIN; }
 static int64_t GetStakeSplitThreshold() { return 2 * GetStakeCombineThreshold(); }
@@ -210,6 +211,17 @@ void CWallet::SetBestChain(const CBlockLocator& loc)
 {
     CWalletDB walletdb(strWalletFile);
     walletdb.WriteBestBlock(loc);
+
+    // Drop stake candidates whose block has left the main chain
+    LOCK(cs_stakecache);
+    for (map<COutPoint, CStakeCandidate>::iterator it = mapStakeCandidates.begin(); it != mapStakeCandidates.end(); )
+    {
+        CBlockIndexMap::iterator mi = mapBlockIndex.find(it->second.hashBlock);
+        if (mi == mapBlockIndex.end() || !mi->second->IsInMainChain())
+            mapStakeCandidates.erase(it++);
+        else
+            ++it;
+    }
 }
 
 bool CWallet::SetMinVersion(enum WalletFeature nVersion, CWalletDB* pwalletdbIn, bool fExplicit)
@@ -579,6 +591,33 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pbl
 }
 
 void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock, bool fConnect) {
+    {
+        LOCK(cs_stakecache);
+        // Spent outputs can no longer stake
+        BOOST_FOREACH(const CTxIn& txin, tx.vin)
+            mapStakeCandidates.erase(txin.prevout);
+
+        uint256 hashTx = tx.GetHash();
+        CBlockIndexMap::iterator mi = mapBlockIndex.end();
+        if (fConnect && pblock)
+            mi = mapBlockIndex.find(pblock->GetHash());
+        for (unsigned int i = 0; i < tx.vout.size(); i++)
+        {
+            COutPoint prevout(hashTx, i);
+            if (!fConnect)
+                mapStakeCandidates.erase(prevout);
+            else if (mi != mapBlockIndex.end() && IsMine(tx.vout[i]))
+            {
+                CStakeCandidate& candidate = mapStakeCandidates[prevout];
+                candidate.hashBlock = mi->first;
+                candidate.nHeight = mi->second->nHeight;
+                candidate.nBlockTime = pblock->GetBlockTime();
+                candidate.nTxPrevTime = tx.nTime;
+                candidate.nValue = tx.vout[i].nValue;
+            }
+        }
+    }
+
     if (!fConnect)
     {
         // wallets need to refund inputs when disconnecting coinstake
@@ -1344,6 +1383,29 @@ bool CWallet::SelectCoins(int64_t nTargetValue, unsigned int nSpendTime, set<pai
             f(this, nTargetValue, nSpendTime, 0, 1, vCoins, setCoinsRet, nValueRet));
 }
 
+bool CWallet::GetStakeCandidate(CTxDB& txdb, const COutPoint& prevout, CStakeCandidate& candidate)
+{
+    {
+        LOCK(cs_stakecache);
+        map<COutPoint, CStakeCandidate>::const_iterator it = mapStakeCandidates.find(prevout);
+        if (it != mapStakeCandidates.end())
+        {
+            candidate = it->second;
+            return true;
+        }
+    }
+
+    {
+        LOCK(cs_main);
+        if (!ReadStakeCandidate(txdb, prevout, candidate))
+            return false;
+    }
+
+    LOCK(cs_stakecache);
+    mapStakeCandidates[prevout] = candidate;
+    return true;
+}
+
 // Select some coins without random shuffle or best subset approximation
 bool CWallet::SelectCoinsForStaking(int64_t nTargetValue, set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64_t& nValueRet) const
 {
@@ -1563,9 +1625,13 @@ uint64_t CWallet::GetStakeWeight() const
 
 bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int64_t nSearchInterval, int64_t nFees, CTransaction& txNew, CKey& key)
 {
-    CBlockIndex* pindexPrev = pindexBest;
-    CBigNum bnTargetPerCoinDay;
-    bnTargetPerCoinDay.SetCompact(nBits);
+    CBlockIndex* pindexPrev;
+    unsigned int nChainUpdates;
+    {
+        LOCK(cs_main);
+        pindexPrev = pindexBest;
+        nChainUpdates = nBestChainUpdates;
+    }
 
     txNew.vin.clear();
     txNew.vout.clear();
@@ -1596,78 +1662,90 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
     int64_t nCredit = 0;
     CScript scriptPubKeyKernel;
     CTxDB txdb("r");
+
+    // Look each coin up once; the kernel search itself runs in memory
+    vector<pair<const CWalletTx*,unsigned int> > vCoins;
+    vector<COutPoint> vPrevouts;
+    vector<CStakeCandidate> vCandidates;
     BOOST_FOREACH(PAIRTYPE(const CWalletTx*, unsigned int) pcoin, setCoins)
     {
-        static int nMaxStakeSearchInterval = 60;
-        bool fKernelFound = false;
-        for (unsigned int n=0; n<min(nSearchInterval,(int64_t)nMaxStakeSearchInterval) && !fKernelFound && pindexPrev == pindexBest; n++)
-        {
-            boost::this_thread::interruption_point();
-            // Search backward in time from the given txNew timestamp 
-            // Search nSearchInterval seconds back up to nMaxStakeSearchInterval
-            COutPoint prevoutStake = COutPoint(pcoin.first->GetHash(), pcoin.second);
-            int64_t nBlockTime;
-            if (CheckKernel(pindexPrev, nBits, txNew.nTime - n, prevoutStake, &nBlockTime))
-            {
-                // Found a kernel
-                LogPrint("coinstake", "CreateCoinStake : kernel found\n");
-                vector<valtype> vSolutions;
-                txnouttype whichType;
-                CScript scriptPubKeyOut;
-                scriptPubKeyKernel = pcoin.first->vout[pcoin.second].scriptPubKey;
-                if (!Solver(scriptPubKeyKernel, whichType, vSolutions))
-                {
-                    LogPrint("coinstake", "CreateCoinStake : failed to parse kernel\n");
-                    break;
-                }
-                LogPrint("coinstake", "CreateCoinStake : parsed kernel type=%d\n", whichType);
-                if (whichType != TX_PUBKEY && whichType != TX_PUBKEYHASH)
-                {
-                    LogPrint("coinstake", "CreateCoinStake : no support for kernel type=%d\n", whichType);
-                    break;  // only support pay to public key and pay to address
-                }
-                if (whichType == TX_PUBKEYHASH) // pay to address type
-                {
-                    // convert to pay to public key type
-                    if (!keystore.GetKey(uint160(vSolutions[0]), key))
-                    {
-                        LogPrint("coinstake", "CreateCoinStake : failed to get key for kernel type=%d\n", whichType);
-                        break;  // unable to find corresponding public key
-                    }
-                    scriptPubKeyOut << key.GetPubKey() << OP_CHECKSIG;
-                }
-                if (whichType == TX_PUBKEY)
-                {
-                    valtype& vchPubKey = vSolutions[0];
-                    if (!keystore.GetKey(Hash160(vchPubKey), key))
-                    {
-                        LogPrint("coinstake", "CreateCoinStake : failed to get key for kernel type=%d\n", whichType);
-                        break;  // unable to find corresponding public key
-                    }
+        COutPoint prevoutStake = COutPoint(pcoin.first->GetHash(), pcoin.second);
+        CStakeCandidate candidate;
+        if (!GetStakeCandidate(txdb, prevoutStake, candidate))
+            continue;
+        vCoins.push_back(pcoin);
+        vPrevouts.push_back(prevoutStake);
+        vCandidates.push_back(candidate);
+    }
 
-                    if (key.GetPubKey() != vchPubKey)
-                    {
-                        LogPrint("coinstake", "CreateCoinStake : invalid key for kernel type=%d\n", whichType);
-                        break; // keys mismatch
-                    }
+    // Search backward in time from the given txNew timestamp
+    // Search nSearchInterval seconds back up to nMaxStakeSearchInterval
+    static int nMaxStakeSearchInterval = 60;
+    unsigned int nSearchSpan = max((int64_t)0, min(nSearchInterval, (int64_t)nMaxStakeSearchInterval));
+    vector<bool> vExcluded(vCoins.size(), false);
+    while (true)
+    {
+        unsigned int nCoin, nOffset;
+        CStakeKernelSearch search(pindexPrev, nChainUpdates, nBits, txNew.nTime, nSearchSpan, vPrevouts, vCandidates, vExcluded);
+        if (!FindStakeKernel(search, nStakeThreads, nCoin, nOffset))
+            break;
 
-                    scriptPubKeyOut = scriptPubKeyKernel;
-                }
+        // A kernel we cannot use is skipped and the search repeated without it
+        vExcluded[nCoin] = true;
 
-                txNew.nTime -= n;
-                txNew.vin.push_back(CTxIn(pcoin.first->GetHash(), pcoin.second));
-                nCredit += pcoin.first->vout[pcoin.second].nValue;
-                vwtxPrev.push_back(pcoin.first);
-                txNew.vout.push_back(CTxOut(0, scriptPubKeyOut));
+        // Found a kernel
+        LogPrint("coinstake", "CreateCoinStake : kernel found\n");
+        vector<valtype> vSolutions;
+        txnouttype whichType;
+        CScript scriptPubKeyOut;
+        scriptPubKeyKernel = vCoins[nCoin].first->vout[vCoins[nCoin].second].scriptPubKey;
+        if (!Solver(scriptPubKeyKernel, whichType, vSolutions))
+        {
+            LogPrint("coinstake", "CreateCoinStake : failed to parse kernel\n");
+            continue;
+        }
+        LogPrint("coinstake", "CreateCoinStake : parsed kernel type=%d\n", whichType);
+        if (whichType != TX_PUBKEY && whichType != TX_PUBKEYHASH)
+        {
+            LogPrint("coinstake", "CreateCoinStake : no support for kernel type=%d\n", whichType);
+            continue;  // only support pay to public key and pay to address
+        }
+        if (whichType == TX_PUBKEYHASH) // pay to address type
+        {
+            // convert to pay to public key type
+            if (!keystore.GetKey(uint160(vSolutions[0]), key))
+            {
+                LogPrint("coinstake", "CreateCoinStake : failed to get key for kernel type=%d\n", whichType);
+                continue;  // unable to find corresponding public key
+            }
+            scriptPubKeyOut << key.GetPubKey() << OP_CHECKSIG;
+        }
+        if (whichType == TX_PUBKEY)
+        {
+            valtype& vchPubKey = vSolutions[0];
+            if (!keystore.GetKey(Hash160(vchPubKey), key))
+            {
+                LogPrint("coinstake", "CreateCoinStake : failed to get key for kernel type=%d\n", whichType);
+                continue;  // unable to find corresponding public key
+            }
 
-                LogPrint("coinstake", "CreateCoinStake : added kernel type=%d\n", whichType);
-                fKernelFound = true;
-                break;
+            if (key.GetPubKey() != vchPubKey)
+            {
+                LogPrint("coinstake", "CreateCoinStake : invalid key for kernel type=%d\n", whichType);
+                continue; // keys mismatch
             }
+
+            scriptPubKeyOut = scriptPubKeyKernel;
         }
 
-        if (fKernelFound)
-            break; // if kernel is found stop searching
+        txNew.nTime -= nOffset;
+        txNew.vin.push_back(CTxIn(vCoins[nCoin].first->GetHash(), vCoins[nCoin].second));
+        nCredit += vCoins[nCoin].first->vout[vCoins[nCoin].second].nValue;
+        vwtxPrev.push_back(vCoins[nCoin].first);
+        txNew.vout.push_back(CTxOut(0, scriptPubKeyOut));
+
+        LogPrint("coinstake", "CreateCoinStake : added kernel type=%d\n", whichType);
+        break; // if kernel is found stop searching
     }
 
     if (nCredit == 0 || nCredit > nBalance - nReserveBalance)
@@ -2357,7 +2435,7 @@ void CWallet::GetKeyBirthTimes(std::map<CKeyID, int64_t> &mapKeyBirth) const {
     for (std::map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); it++) {
         // iterate over all wallet transactions...
         const CWalletTx &wtx = (*it).second;
-        std::map<uint256, CBlockIndex*>::const_iterator blit = mapBlockIndex.find(wtx.hashBlock);
+        CBlockIndexMap::const_iterator blit = mapBlockIndex.find(wtx.hashBlock);
         if (blit != mapBlockIndex.end() && blit->second->IsInMainChain()) {
             // ... which are already in a block
             int nHeight = blit->second->nHeight;
@@ -13,6 +13,7 @@
 #include <stdlib.h>
 
 #include "crypter.h"
+#include "kernel.h"
 #include "main.h"
 #include "key.h"
 #include "keystore.h"
@@ -24,6 +25,10 @@
 extern int64_t nTransactionFee;
 extern int64_t nReserveBalance;
 extern int64_t nMinimumInputValue;
+extern int nStakeThreads;
+
+/** Maximum number of threads searching for stake kernels */
+static const int MAX_STAKE_THREADS = 16;
 extern bool fWalletUnlockStakingOnly;
 extern bool fConfChange;
 
@@ -83,6 +88,13 @@ private:
 
     CWalletDB *pwalletdbEncryption;
 
+    // Stake inputs already looked up in the transaction database, so the
+    // kernel search in CreateCoinStake() does not read them again on every
+    // pass. Kept up to date by SyncTransaction() and SetBestChain().
+    CCriticalSection cs_stakecache;
+    std::map<COutPoint, CStakeCandidate> mapStakeCandidates;
+    bool GetStakeCandidate(CTxDB& txdb, const COutPoint& prevout, CStakeCandidate& candidate);
+
     // the current wallet version: clients below this version are not able to load the wallet
     int nWalletVersion;
 